@@ -0,0 +1,483 @@
+#ifndef FLUX_ANIMATION_HH
+#define FLUX_ANIMATION_HH
+
+#include "Flux/ECS.hh"
+#include "Flux/Renderer.hh"
+#include "Flux/Resources.hh"
+
+// STL
+#include <string>
+#include <vector>
+
+// GLM
+#include <glm/glm.hpp>
+#include "glm/gtc/quaternion.hpp"
+
+/** How many clips can be blended together on one character */
+#ifndef FLUX_MAX_ANIMATION_LAYERS
+#define FLUX_MAX_ANIMATION_LAYERS 4
+#endif
+
+/** How far (in model space) compressed translations and scales are allowed to drift from the real ones */
+#ifndef FLUX_ANIMATION_TRANSLATION_TOLERANCE
+#define FLUX_ANIMATION_TRANSLATION_TOLERANCE 0.001f
+#endif
+
+/** How far compressed rotations are allowed to drift from the real ones, in radians */
+#ifndef FLUX_ANIMATION_ROTATION_TOLERANCE
+#define FLUX_ANIMATION_ROTATION_TOLERANCE 0.002f
+#endif
+
+/** With at least this many animators, the poses are worked out on the worker threads */
+#ifndef FLUX_ANIMATION_THREADING_THRESHOLD
+#define FLUX_ANIMATION_THREADING_THRESHOLD 16
+#endif
+
+/** How many worker threads help with the animators, on top of the main thread. 0 does everything on the main thread */
+#ifndef FLUX_ANIMATION_THREADS
+#ifdef __EMSCRIPTEN__
+#define FLUX_ANIMATION_THREADS 0
+#else
+#define FLUX_ANIMATION_THREADS 3
+#endif
+#endif
+
+/**
+Skeletal animation.
+A SkeletonRes is the bones, and an AnimationRes is a clip that moves them. An AnimatorCom plays clips on an entity's mesh,
+which needs a MeshRes::skin saying which bones move each vertex.
+
+Skinning can happen on the gpu or the cpu. On the gpu, the mesh is shared by every character, and each draw gets its own
+bone matrices. The material's vertex shader has to do the skinning itself when vertex_format has VertexFormatFlags::Skinned:
+
+    layout (location = 5) in uvec4 bone_indices;
+    layout (location = 6) in vec4 bone_weights;
+
+    layout (std140) uniform FluxBones
+    {
+        mat4 bones[64]; // FLUX_MAX_BONES
+    };
+
+    mat4 skin = bones[bone_indices.x] * bone_weights.x + bones[bone_indices.y] * bone_weights.y
+              + bones[bone_indices.z] * bone_weights.z + bones[bone_indices.w] * bone_weights.w;
+
+On the cpu, each character gets its own dynamic copy of the mesh, which is skinned with SSE, and streamed to the gpu every frame.
+That works with any shader, but costs a lot more bandwidth.
+*/
+namespace Flux { namespace Animation {
+
+    /**
+    Where a bone is, relative to its parent
+    */
+    struct BoneTransform
+    {
+        glm::vec3 translation = glm::vec3(0);
+        glm::quat rotation = glm::quat(1, 0, 0, 0);
+        glm::vec3 scale = glm::vec3(1);
+
+        /** Translation * rotation * scale */
+        glm::mat4 toMatrix() const;
+    };
+
+    /**
+    Blends from a to b. Rotations are nlerped the short way round, which is close enough to slerp for blending
+    */
+    BoneTransform blend(const BoneTransform& a, const BoneTransform& b, float t);
+
+    struct Bone
+    {
+        std::string name;
+
+        /** Index of the parent bone, or -1. Parents have to come before their children, bones that don't are animated as roots */
+        int parent = -1;
+
+        /** Takes a vertex from model space into the bone's space, in the pose the mesh was modelled in */
+        glm::mat4 inverse_bind;
+
+        /** Where the bone is when nothing is playing */
+        BoneTransform rest;
+    };
+
+    // Helpers for serializing the bits of glm that animations use
+    inline void setVec3(FluxArc::BinaryFile* output, const glm::vec3& v)
+    {
+        output->set(v.x);
+        output->set(v.y);
+        output->set(v.z);
+    }
+
+    inline void getVec3(FluxArc::BinaryFile* file, glm::vec3& v)
+    {
+        file->get(&v.x);
+        file->get(&v.y);
+        file->get(&v.z);
+    }
+
+    /**
+    The bones of a character. Bone i moves the vertices with i in their VertexSkin
+    */
+    struct SkeletonRes: public Resources::Resource
+    {
+        FLUX_RESOURCE(SkeletonRes, skeleton);
+
+        /** No more than FLUX_MAX_BONES */
+        std::vector<Bone> bones;
+
+        /** Returns the index of the bone with that name, or -1 */
+        int findBone(const std::string& name) const;
+
+        bool serialize(Resources::Serializer* serializer, FluxArc::BinaryFile* output) override
+        {
+            output->set((uint32_t)bones.size());
+            for (auto& bone : bones)
+            {
+                output->set(bone.name);
+                output->set((int32_t)bone.parent);
+
+                for (int i = 0; i < 4; i++)
+                {
+                    for (int j = 0; j < 4; j++)
+                    {
+                        output->set(bone.inverse_bind[i][j]);
+                    }
+                }
+
+                setVec3(output, bone.rest.translation);
+                output->set(bone.rest.rotation.w);
+                output->set(bone.rest.rotation.x);
+                output->set(bone.rest.rotation.y);
+                output->set(bone.rest.rotation.z);
+                setVec3(output, bone.rest.scale);
+            }
+
+            return true;
+        };
+
+        void deserialize(Resources::Deserializer* deserializer, FluxArc::BinaryFile* file) override
+        {
+            uint32_t bone_count;
+            file->get(&bone_count);
+
+            bones.resize(bone_count);
+            for (auto& bone : bones)
+            {
+                bone.name = file->get();
+
+                int32_t parent;
+                file->get(&parent);
+                bone.parent = parent;
+
+                for (int i = 0; i < 4; i++)
+                {
+                    for (int j = 0; j < 4; j++)
+                    {
+                        file->get(&bone.inverse_bind[i][j]);
+                    }
+                }
+
+                getVec3(file, bone.rest.translation);
+                file->get(&bone.rest.rotation.w);
+                file->get(&bone.rest.rotation.x);
+                file->get(&bone.rest.rotation.y);
+                file->get(&bone.rest.rotation.z);
+                getVec3(file, bone.rest.scale);
+            }
+        };
+    };
+
+    /**
+    One channel of a bone in a compressed clip. Only the frames that can't be interpolated from their neighbours are kept,
+    and every value is quantized to 16 bits.
+    Translations and scales are 3 values between min and min + extent.
+    Rotations are stored as their smallest three components, with the index of the one that was dropped
+    in the lowest bit of the first two values
+    */
+    struct AnimationTrack
+    {
+        /** The frame of each key. Compressed tracks always have at least one, tracks with none are left out when sampling */
+        std::vector<uint16_t> times;
+
+        /** 3 per key */
+        std::vector<uint16_t> values;
+
+        /** Only for translations and scales */
+        glm::vec3 min = glm::vec3(0);
+        glm::vec3 extent = glm::vec3(0);
+
+        /** These give back min and the identity rotation if there aren't any keys */
+        glm::vec3 sampleVector(float frame) const;
+        glm::quat sampleRotation(float frame) const;
+
+        void serialize(FluxArc::BinaryFile* output) const
+        {
+            output->set((uint32_t)times.size());
+            output->set((char*)times.data(), times.size() * sizeof(uint16_t));
+            output->set((char*)values.data(), values.size() * sizeof(uint16_t));
+            setVec3(output, min);
+            setVec3(output, extent);
+        }
+
+        void deserialize(FluxArc::BinaryFile* file)
+        {
+            uint32_t key_count;
+            file->get(&key_count);
+
+            times.resize(key_count);
+            values.resize(key_count * 3);
+            file->get((char*)times.data(), times.size() * sizeof(uint16_t));
+            file->get((char*)values.data(), values.size() * sizeof(uint16_t));
+            getVec3(file, min);
+            getVec3(file, extent);
+        }
+    };
+
+    struct BoneTrack
+    {
+        AnimationTrack translation;
+        AnimationTrack rotation;
+        AnimationTrack scale;
+    };
+
+    /**
+    A compressed animation clip, made by compressAnimation. There's one track for each bone of the skeleton it was made for
+    */
+    struct AnimationRes: public Resources::Resource
+    {
+        FLUX_RESOURCE(AnimationRes, animation);
+
+        /** In seconds */
+        float duration = 0;
+
+        /** Frames per second the clip was made at */
+        float sample_rate = 30;
+
+        std::vector<BoneTrack> tracks;
+
+        /**
+        Gets where each bone is at a time in the clip, in seconds. Only the first `count` bones are done.
+        Safe to call from multiple threads at once
+        */
+        void sample(float time, BoneTransform* pose, size_t count) const;
+
+        bool serialize(Resources::Serializer* serializer, FluxArc::BinaryFile* output) override
+        {
+            output->set(duration);
+            output->set(sample_rate);
+
+            output->set((uint32_t)tracks.size());
+            for (auto& track : tracks)
+            {
+                track.translation.serialize(output);
+                track.rotation.serialize(output);
+                track.scale.serialize(output);
+            }
+
+            return true;
+        };
+
+        void deserialize(Resources::Deserializer* deserializer, FluxArc::BinaryFile* file) override
+        {
+            file->get(&duration);
+            file->get(&sample_rate);
+
+            uint32_t track_count;
+            file->get(&track_count);
+
+            tracks.resize(track_count);
+            for (auto& track : tracks)
+            {
+                track.translation.deserialize(file);
+                track.rotation.deserialize(file);
+                track.scale.deserialize(file);
+            }
+        };
+    };
+
+    /**
+    Makes a clip out of every frame of an animation, as frames[frame][bone], sampled at sample_rate frames per second.
+    Keys are only kept where interpolating from the ones around them would be further off than the tolerances.
+    Like optimizeMesh, this is slow, so do it before serializing. Clips can't be longer than 65536 frames
+    */
+    Resources::ResourceRef<AnimationRes> compressAnimation(const std::vector<std::vector<BoneTransform>>& frames, float sample_rate,
+        float translation_tolerance = FLUX_ANIMATION_TRANSLATION_TOLERANCE, float rotation_tolerance = FLUX_ANIMATION_ROTATION_TOLERANCE);
+
+    /**
+    Moves the vertices of a skinned mesh by the bones' skinning matrices, blended by each vertex's weights.
+    The normals, tangents and bitangents are turned too. The source mesh must be unpacked, and output must have room for all its vertices.
+    Uses SSE where it can. Safe to call from multiple threads at once
+    */
+    void skinVertices(const Renderer::MeshRes* source, const glm::mat4* matrices, Renderer::Vertex* output);
+
+    enum class SkinningMode
+    {
+        /** The bones are sent to the shader, which skins the shared mesh. Needs a shader that knows about FluxBones */
+        GPU,
+        /** Each character gets its own copy of the mesh, which is skinned by AnimationSystem and streamed to the gpu */
+        CPU
+    };
+
+    /**
+    A clip playing on an animator
+    */
+    struct AnimationLayer
+    {
+        /** Empty if the layer isn't being used */
+        Resources::ResourceRef<AnimationRes> clip;
+
+        /** In seconds */
+        float time = 0;
+        float speed = 1;
+
+        /** How much of the layers below it this covers up. 1 replaces them completely */
+        float weight = 1;
+
+        bool loop = true;
+    };
+
+    /**
+    Plays animations on an entity's mesh. The layers are blended from the bottom up, on top of the skeleton's rest pose
+    */
+    struct AnimatorCom: public Component
+    {
+        FLUX_COMPONENT(AnimatorCom, AnimatorCom);
+
+        Resources::ResourceRef<SkeletonRes> skeleton;
+
+        AnimationLayer layers[FLUX_MAX_ANIMATION_LAYERS];
+
+        SkinningMode mode = SkinningMode::GPU;
+
+        /**
+        The copy of the mesh that's drawn instead of the MeshCom's, for cpu skinning. It's made by AnimationSetupSystem,
+        and isn't serialized
+        */
+        Resources::ResourceRef<Renderer::MeshRes> skinned_mesh;
+
+        /**
+        The parent of each bone, or -1. The skeleton's parents, except bones whose parent doesn't come before them are roots.
+        Worked out by AnimationSetupSystem, since the skeleton is shared
+        */
+        std::vector<int> parents;
+
+        /** False if the mesh's skin uses bones the skeleton doesn't have, which leaves it in its rest pose. Checked by AnimationSetupSystem */
+        bool skin_valid = true;
+
+        /** Where each bone is, relative to its parent. Worked out by AnimationSystem every frame */
+        std::vector<BoneTransform> pose;
+
+        /** Model space bone matrices, multiplied by the inverse bind matrices. This is what skins the vertices */
+        std::vector<glm::mat4> skin_matrices;
+
+        /** Scratch space for blending the layers, so it doesn't have to be allocated every frame */
+        std::vector<BoneTransform> layer_pose;
+
+        bool serialize(Resources::Serializer *serializer, FluxArc::BinaryFile *output) override
+        {
+            output->set(serializer->addResource(Resources::ResourceRef<Resources::Resource>(skeleton.getBaseEntity())));
+            output->set((int)mode);
+
+            for (auto& layer : layers)
+            {
+                bool has_clip = layer.clip.getBaseEntity().getEntityID() != -1;
+                output->set(has_clip);
+                if (!has_clip)
+                {
+                    continue;
+                }
+
+                output->set(serializer->addResource(Resources::ResourceRef<Resources::Resource>(layer.clip.getBaseEntity())));
+                output->set(layer.time);
+                output->set(layer.speed);
+                output->set(layer.weight);
+                output->set(layer.loop);
+            }
+
+            return true;
+        }
+
+        void deserialize(Resources::Deserializer *deserializer, FluxArc::BinaryFile *file) override
+        {
+            uint32_t skeleton_res;
+            file->get(&skeleton_res);
+            skeleton = deserializer->getResource(skeleton_res);
+
+            int mode_value;
+            file->get(&mode_value);
+            mode = (SkinningMode)mode_value;
+
+            for (auto& layer : layers)
+            {
+                bool has_clip;
+                file->get(&has_clip);
+                if (!has_clip)
+                {
+                    continue;
+                }
+
+                uint32_t clip_res;
+                file->get(&clip_res);
+                layer.clip = deserializer->getResource(clip_res);
+                file->get(&layer.time);
+                file->get(&layer.speed);
+                file->get(&layer.weight);
+                file->get(&layer.loop);
+            }
+        }
+    };
+
+    /**
+    Makes an entity with a skinned mesh animatable. The entity needs a MeshCom, and its mesh needs a skin
+    */
+    void addAnimator(EntityRef entity, Resources::ResourceRef<SkeletonRes> skeleton, SkinningMode mode = SkinningMode::GPU);
+
+    /**
+    Starts a clip playing on one of the animator's layers, from the start.
+    For a crossfade, play the new clip on the layer above, and raise its weight from 0 to 1 over time
+    */
+    void playAnimation(EntityRef entity, Resources::ResourceRef<AnimationRes> clip, int layer = 0, float weight = 1, bool loop = true, float speed = 1);
+
+    /**
+    Makes the cpu skinned copies of meshes. Creating resources isn't thread safe, so this isn't threaded
+    */
+    class AnimationSetupSystem: public System
+    {
+        void runSystem(EntityRef entity, float delta) override;
+    };
+
+    /**
+    Moves each animator's clips forward, samples them, blends them, and works out the skinning matrices.
+    Cpu skinned characters are skinned here too.
+    Every animator only touches its own data, so once there are FLUX_ANIMATION_THREADING_THRESHOLD of them,
+    they're split between worker threads. runSystem only collects them, and they're all done in onSystemEnd
+    */
+    class AnimationSystem: public System
+    {
+        void onSystemStart() override;
+        void runSystem(EntityRef entity, float delta) override;
+        void onSystemEnd() override;
+
+        struct Animated
+        {
+            AnimatorCom* animator;
+            Renderer::MeshCom* mesh;
+            Transform::TransformCom* transform;
+        };
+
+        std::vector<Animated> animated;
+        float delta = 0;
+    };
+
+    /**
+    Does one animator's frame. This is what AnimationSystem runs for each of them.
+    mesh and transform can be nullptr. It only changes the animator and its cpu skinned mesh, so different animators can be done on different threads at once
+    */
+    void animate(AnimatorCom* animator, Renderer::MeshCom* mesh, Transform::TransformCom* transform, float delta);
+
+    /**
+    Adds the animation systems to the given ECS. They have to run before the renderer
+    */
+    void addAnimationSystems(ECSCtx* ctx);
+
+}}
+
+#endif
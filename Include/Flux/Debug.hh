@@ -17,7 +17,11 @@ namespace Flux { namespace Debug
         Red, Green, Blue, Orange, Pink, Purple, Black, White, Brown
     };
 
-    void drawMesh(std::vector<Renderer::Vertex> vertices, std::vector<uint32_t> indices, Colors color, bool wireframe=false);
+    /**
+    Draws a mesh for this frame only.
+    Everything of the same color is batched into one draw call, which is streamed to the gpu once per frame
+    */
+    void drawMesh(const std::vector<Renderer::Vertex>& vertices, const std::vector<uint32_t>& indices, Colors color, bool wireframe=false);
 
     void drawLine(glm::vec3 start, glm::vec3 end, Colors color);
 
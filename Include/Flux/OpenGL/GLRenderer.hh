@@ -3,6 +3,7 @@
 
 // Flux includes
 #include "Flux/ECS.hh"
+#include "Flux/Particles.hh"
 #include "Flux/Renderer.hh"
 #include "Flux/Resources.hh"
 #include "glm/fwd.hpp"
@@ -12,7 +13,120 @@
 #include <glm/glm.hpp>
 
 // STL includes
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/** The first texture unit used for the light textures. Material textures use the ones below it */
+#ifndef FLUX_LIGHT_TEXTURE_UNIT
+#define FLUX_LIGHT_TEXTURE_UNIT 9
+#endif
+
+// What shaders have to call things to get lights
+// Each light is one row of 4 texels in light_data: (position, radius), (direction, type), (color, cos(cutoff)), unused.
+// A fragment's cluster is found with cluster_params and cluster_size, and its lights are
+// light_clusters' (offset, count) into light_cluster_indices. See Renderer::LightSystem::buildClusters
+// Directional lights light every fragment, so they're the first directional_light_count indices instead of being in the clusters
+
+#define FLUX_LIGHT_DATA_UNIFORM "light_data"
+#define FLUX_LIGHT_CLUSTERS_UNIFORM "light_clusters"
+#define FLUX_LIGHT_CLUSTER_INDICES_UNIFORM "light_cluster_indices"
+#define FLUX_LIGHT_DATA_UNIT FLUX_LIGHT_TEXTURE_UNIT
+#define FLUX_LIGHT_CLUSTERS_UNIT (FLUX_LIGHT_TEXTURE_UNIT + 1)
+#define FLUX_LIGHT_CLUSTER_INDICES_UNIT (FLUX_LIGHT_TEXTURE_UNIT + 2)
+
+/** Number of lights, int */
+#define FLUX_LIGHT_COUNT_UNIFORM "light_count"
+/** Number of directional lights at the start of light_cluster_indices, int */
+#define FLUX_DIRECTIONAL_LIGHT_COUNT_UNIFORM "directional_light_count"
+/** (width, height, depth scale, depth bias) of what's being drawn, vec4 */
+#define FLUX_CLUSTER_PARAMS_UNIFORM "cluster_params"
+/** FLUX_CLUSTERS_X, Y and Z, ivec3 */
+#define FLUX_CLUSTER_SIZE_UNIFORM "cluster_size"
+/** The closest FLUX_MAX_OBJECT_LIGHTS lights to the object, int[], -1 for none. Works with both ways of getting lights */
+#define FLUX_LIGHT_INDEXES_UNIFORM "light_indexes"
+
+/**
+The old way of getting lights, which shaders written before clustering still use.
+It's a std140 block of 4 vec4 arrays, each FLUX_LEGACY_MAX_LIGHTS long: positions, directions, colors, and (type, radius, cos(cutoff)).
+Lights past the end of the arrays are left out
+*/
+#define FLUX_LIGHTS_BLOCK "Lights"
+#define FLUX_LIGHTS_BINDING 2
+#define FLUX_LEGACY_MAX_LIGHTS 128
+
+/** Width of the texture storing the light indices of each cluster */
+#ifndef FLUX_LIGHT_INDEX_TEXTURE_WIDTH
+#define FLUX_LIGHT_INDEX_TEXTURE_WIDTH 1024
+#endif
+
+#ifndef FLUX_NEAR_PLANE
+#define FLUX_NEAR_PLANE 0.01f
+#endif
+
+#ifndef FLUX_FAR_PLANE
+#define FLUX_FAR_PLANE 100.0f
+#endif
+
+/** How many bytes of mesh and texture data can be sent to the gpu each frame */
+#ifndef FLUX_UPLOAD_BYTES_PER_FRAME
+#define FLUX_UPLOAD_BYTES_PER_FRAME (4 * 1024 * 1024)
+#endif
+
+/** How long uploading can take each frame, in milliseconds */
+#ifndef FLUX_UPLOAD_MS_PER_FRAME
+#define FLUX_UPLOAD_MS_PER_FRAME 2.0f
+#endif
+
+/** How many texture units the state cache keeps track of */
+#ifndef FLUX_MAX_TEXTURE_UNITS
+#define FLUX_MAX_TEXTURE_UNITS 16
+#endif
+
+/** Textures that are being changed are bound here, so they don't kick out anything that's used for drawing */
+#define FLUX_EDIT_TEXTURE_UNIT (FLUX_MAX_TEXTURE_UNITS - 1)
+
+/** Where linked shader programs are saved, so they don't have to be compiled again next time */
+#ifndef FLUX_SHADER_CACHE_DIR
+#define FLUX_SHADER_CACHE_DIR ".flux_shader_cache"
+#endif
+
+/** The biggest piece of data that gets uploaded in one go */
+#ifndef FLUX_UPLOAD_CHUNK_SIZE
+#define FLUX_UPLOAD_CHUNK_SIZE (256 * 1024)
+#endif
+
+/**
+How much mesh and texture data can be on the gpu before the least recently drawn things are evicted, in bytes.
+Things that were drawn last frame are never evicted, so this can still be gone over
+*/
+#ifndef FLUX_GPU_MEMORY_BUDGET
+#define FLUX_GPU_MEMORY_BUDGET (256 * 1024 * 1024)
+#endif
+
+/** Where skinned meshes find their bone matrices. Materials use binding 0, and the Lights block uses 2 */
+#define FLUX_BONES_BINDING 1
+
+/**
+Each character's bone matrices start on a multiple of this, in bytes.
+It's the biggest GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT anything has, so it doesn't have to be asked for
+*/
+#ifndef FLUX_BONE_PALETTE_ALIGNMENT
+#define FLUX_BONE_PALETTE_ALIGNMENT 256
+#endif
+
+/** How many frames of gpu timer queries are kept, since results take a few frames to come back */
+#ifndef FLUX_GPU_TIMER_QUERIES
+#define FLUX_GPU_TIMER_QUERIES 4
+#endif
 
 namespace Flux { namespace GLRenderer {
 
@@ -35,6 +149,90 @@ namespace Flux { namespace GLRenderer {
 
     extern GLCtx* current_window;
 
+    /** Stats for the frame that's being drawn. They're moved to Renderer::getRenderStats() by endFrame */
+    extern Renderer::RenderStats render_stats;
+
+    /**
+    Remembers what's bound, so calls that wouldn't change anything never reach the driver.
+    Everything in the renderer should change state through here, or the cache will get confused.
+    If something else touches GL, call invalidate() afterwards
+    */
+    class GLStateCache
+    {
+    public:
+        GLStateCache();
+
+        void useProgram(uint32_t program);
+        void bindVertexArray(uint32_t vao);
+
+        /** GL_ELEMENT_ARRAY_BUFFER belongs to the VAO, so it always goes through */
+        void bindBuffer(GLenum target, uint32_t buffer);
+        void bindBufferBase(GLenum target, uint32_t index, uint32_t buffer);
+        /** Always goes through, but makes sure the next bindBufferBase at that index does too */
+        void bindBufferRange(GLenum target, uint32_t index, uint32_t buffer, uintptr_t offset, uintptr_t size);
+
+        /**
+        Binds a texture to a unit for drawing, only switching the active unit if it has to.
+        The active unit might be anything afterwards, so use editTexture for changing textures
+        */
+        void bindTexture(uint32_t unit, uint32_t texture, GLenum target = GL_TEXTURE_2D);
+
+        /** Binds a texture to its own unit, and makes it active, so glTex* calls will go to it */
+        void editTexture(uint32_t texture, GLenum target = GL_TEXTURE_2D);
+
+        /** Sets a sampler uniform of the current program */
+        void setSampler(int location, int unit);
+
+        void enable(GLenum cap);
+        void disable(GLenum cap);
+        void cullFace(GLenum mode);
+
+        void depthFunc(GLenum func);
+        void depthMask(bool write);
+        /** All four channels at once */
+        void colorMask(bool write);
+        /** Doesn't turn blending on, that's still enable(GL_BLEND) */
+        void blendFunc(GLenum source, GLenum dest);
+
+        /** GL reuses the names of deleted objects, so the cache has to be told when they're deleted */
+        void forgetBuffer(uint32_t buffer);
+        void forgetTexture(uint32_t texture);
+        void forgetProgram(uint32_t program);
+        void forgetVertexArray(uint32_t vao);
+
+        /** Forgets everything, so the next call of each kind always goes through */
+        void invalidate();
+
+    private:
+        void activeTexture(uint32_t unit);
+
+        uint32_t program;
+        uint32_t vao;
+
+        std::map<GLenum, uint32_t> buffers;
+        /** Binding point -> buffer */
+        std::map<uint32_t, uint32_t> uniform_buffers;
+
+        uint32_t active_unit;
+        /** Each unit has a binding for every target, so they're remembered separately */
+        std::map<GLenum, uint32_t> textures[FLUX_MAX_TEXTURE_UNITS];
+
+        std::map<GLenum, bool> caps;
+        GLenum cull_mode;
+        GLenum depth_func;
+        /** These can also be FLUX_UNKNOWN_STATE, so they aren't bools */
+        uint32_t depth_mask;
+        uint32_t color_mask;
+        uint32_t blend_source;
+        uint32_t blend_dest;
+
+        /** (program << 32 | location) -> unit */
+        std::unordered_map<uint64_t, int> samplers;
+    };
+
+    /** The renderer's state cache */
+    extern GLStateCache gl_state;
+
     /**
     Component where GLRenderer stores all GL-related data
     */
@@ -43,14 +241,51 @@ namespace Flux { namespace GLRenderer {
         FLUX_COMPONENT(GLMeshCom, glmesh);
         ~GLMeshCom();
 
-        uint32_t VBO;
-        uint32_t IBO;
-        uint32_t VAO;
+        /** The GL objects are made on the render thread, so these are 0 until the mesh is resident */
+        uint32_t VBO = 0;
+        uint32_t IBO = 0;
+        uint32_t VAO = 0;
+
+        /**
+        VAO with only the position stream, which is after the vertices in the VBO.
+        0 if the mesh doesn't have one. See MeshRes::position_stream
+        */
+        uint32_t position_VAO = 0;
 
         uint32_t num_vertices;
         uint32_t num_indices;
 
         uint32_t draw_type;
+
+        /** GL_UNSIGNED_SHORT or GL_UNSIGNED_INT */
+        uint32_t index_type;
+        uint32_t index_size;
+
+        /** Where each level of detail is in the index buffer, in indices */
+        std::vector<uint32_t> lod_offsets;
+        std::vector<uint32_t> lod_counts;
+
+        /** VertexFormatFlags of the mesh, for the shader */
+        int vertex_format_flags;
+
+        /** Turns quantized positions back into model space */
+        bool has_position_transform;
+        glm::mat4 position_transform;
+
+        /**
+        False until all the data has been uploaded. The mesh isn't drawn until then.
+        Only set on the simulation thread, see GLUploadQueue::finishJobs
+        */
+        bool resident = false;
+
+        /** How much gpu memory the buffers take up */
+        uint32_t gpu_bytes = 0;
+
+        /** The upload queue's job for it. See GLUploadQueue::cancel */
+        uint32_t upload_job = 0;
+
+        /** The last frame it was drawn on. See GLResidency */
+        uint32_t last_used = 0;
     };
 
     /**
@@ -72,6 +307,19 @@ namespace Flux { namespace GLRenderer {
         uint32_t has_texture_location;
 
         uint32_t light_indexes_location;
+        uint32_t light_count_location;
+        uint32_t directional_light_count_location;
+        uint32_t cluster_params_location;
+        uint32_t vertex_format_location;
+
+        /** The shader has a Lights block instead of the light textures */
+        bool legacy_lights = false;
+
+        /** Size of the Material uniform block */
+        int material_block_size;
+
+        /** Where each uniform in the Material block is. Looked up once per shader */
+        std::map<std::string, uint32_t> material_offsets;
     };
     
     /** Little struct for storing info on textures */
@@ -82,19 +330,16 @@ namespace Flux { namespace GLRenderer {
     };
 
     /**
-    Component that keeps track of uniform positions.
+    Component that keeps track of a material's uniform buffer
     */
     struct GLUniformCom: Component
     {
         // More info: Open GL 4 Shading Language Cookbook, page 57
         FLUX_COMPONENT(GLUniformCom, gluniform);
+        ~GLUniformCom();
 
         int block_size;
 
-        std::vector<uint32_t> indices;
-
-        std::vector<int> offset;
-
         /** OpenGL handle for the uniform buffer */
         uint32_t handle;
 
@@ -108,16 +353,705 @@ namespace Flux { namespace GLRenderer {
     struct GLTextureCom: public Component
     {
         FLUX_COMPONENT(GLTextureCom, gltexture);
+        ~GLTextureCom();
 
-        uint32_t handle;
+        /** Made on the render thread, like GLMeshCom's objects, so it's 0 until the texture is resident */
+        uint32_t handle = 0;
+
+        /** GL_TEXTURE_2D, or GL_TEXTURE_2D_ARRAY for texture arrays */
+        uint32_t target = GL_TEXTURE_2D;
+
+        /** False until every mip has been uploaded. Only set on the simulation thread, like GLMeshCom's */
+        bool resident = false;
+
+        /** How much gpu memory the texture takes up, including mips */
+        uint32_t gpu_bytes = 0;
+
+        /** The upload queue's job for it. See GLUploadQueue::cancel */
+        uint32_t upload_job = 0;
+
+        /** The last frame it was drawn with. See GLResidency */
+        uint32_t last_used = 0;
     };
 
+    /**
+    Spreads uploading meshes and textures over multiple frames, so loading a big scene doesn't freeze everything.
+    The simulation adds things without waiting for the render thread. The GL objects are made at the start of the next frame it draws,
+    then the data is trickled in according to the budget, and finishJobs hands the finished objects back to the simulation.
+    addMesh, addTexture, streamMesh, cancel and finishJobs are called by the simulation. The rest is for the render thread
+    */
+    class GLUploadQueue
+    {
+    public:
+        GLUploadQueue();
+
+        /** Makes the component for a mesh, and queues up its data. It's resident once finishJobs has given it its GL objects */
+        GLMeshCom* addMesh(Renderer::MeshRes* mesh);
+
+        /** Makes the component for a texture, and queues up its mips */
+        GLTextureCom* addTexture(Renderer::TextureRes* texture);
+
+        /**
+        Re-uploads a dynamic mesh before anything else in the frame is drawn, orphaning the old buffers so the gpu doesn't have to finish with them first.
+        Not counted against the budget, since it happens every frame anyway. Does nothing until the mesh is resident
+        */
+        void streamMesh(Renderer::MeshRes* mesh, GLMeshCom* mesh_com);
+
+        /**
+        Stops uploading a job. Called when a component is destroyed before it's resident.
+        Its GL objects are deleted once the render thread hands them back, so this doesn't have to wait for it
+        */
+        void cancel(uint32_t job);
+
+        /** Resets the budget. Should be called at the start of every frame */
+        void startFrame();
+
+        /**
+        Uploads as much as it can without going over the budget.
+        At least one piece is always uploaded each frame, so everything gets there eventually
+        */
+        void process();
+
+        /**
+        Gives everything that finished uploading its GL objects and marks it as resident, and frees the cpu copy of finished textures.
+        The render thread can't do this itself, since the simulation is using them while it draws
+        */
+        void finishJobs();
+
+        void setBudget(uint32_t bytes_per_frame, float ms_per_frame);
+
+        /** How many meshes and textures aren't resident yet */
+        size_t getQueueLength() const { return queued; }
+        uint32_t getBytesThisFrame() const { return bytes_this_frame; }
+
+    private:
+        struct Job
+        {
+            /** Never 0, so components can use 0 for no job */
+            uint32_t id = 0;
+
+            GLMeshCom* mesh_com = nullptr;
+
+            /** Only used to free the texture once it's finished. The render thread uses the copy below */
+            Renderer::TextureRes* texture = nullptr;
+            GLTextureCom* texture_com = nullptr;
+
+            /** The GL objects, made by the render thread. They're copied into the component by finishJobs */
+            uint32_t vbo = 0;
+            uint32_t ibo = 0;
+            uint32_t vao = 0;
+            uint32_t position_vao = 0;
+            uint32_t handle = 0;
+
+            /** Dynamic meshes only need their GL objects, streamMesh does the rest */
+            bool dynamic = false;
+
+            /** What the VAO is set up for */
+            Renderer::VertexFormat vertex_format;
+
+            /** GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY */
+            uint32_t target = GL_TEXTURE_2D;
+
+            /** The texture's mips, copied for the same reason as the vertices */
+            std::vector<unsigned char> texture_data;
+            std::vector<uint32_t> mip_sizes;
+            uint32_t width = 0;
+            uint32_t height = 0;
+            uint32_t layers = 1;
+            Renderer::TextureFormat format = Renderer::TextureFormat::RGBA8;
+            std::string filename;
+
+            /** How much gpu memory it ends up taking, which changes if it has to be decompressed */
+            uint32_t gpu_bytes = 0;
+
+            /**
+            The vertices, packed or not. They're copied too, since the mesh can be destroyed
+            on the main thread while the render thread is still uploading them
+            */
+            std::vector<char> vertex_data;
+
+            /** Index data, with all the levels of detail and already in the right size */
+            std::vector<char> index_data;
+
+            /** Goes in the VBO straight after the vertices */
+            std::vector<char> position_data;
+
+            /** Bone indices and weights, after the position stream */
+            std::vector<char> skin_data;
+
+            /** Bytes done for meshes. For textures, the mip and row we're up to */
+            uint32_t progress = 0;
+            uint32_t level = 0;
+        };
+
+        /** Make the GL objects for a job, on the render thread, and start uploading it */
+        void createMesh(Job& job);
+        void createTexture(Job& job);
+
+        /** Hands a job back to the simulation. See finishJobs */
+        void finishJob(Job& job);
+
+        /** Takes a job off the render thread's queue, so it's finished as it is */
+        void dropJob(uint32_t id);
+
+        /** Both return true when the job is finished */
+        bool processMesh(Job& job, uint32_t max_bytes);
+        bool processTexture(Job& job, uint32_t max_bytes);
+
+        std::deque<Job> jobs;
+
+        /** Jobs the render thread has finished, waiting for finishJobs */
+        std::vector<Job> finished;
+        std::mutex finished_mutex;
+
+        // Only used by the simulation
+        uint32_t next_id;
+        size_t queued;
+        /** Jobs whose component is gone, so their GL objects are deleted when they're handed back */
+        std::unordered_set<uint32_t> cancelled;
+
+        /** Pixel unpack buffer that texture data goes through */
+        uint32_t pbo;
+        bool has_pbo;
+
+        uint32_t byte_budget;
+        float ms_budget;
+
+        uint32_t bytes_this_frame;
+        float ms_this_frame;
+    };
+
+    /** The renderer's upload queue */
+    extern GLUploadQueue upload_queue;
+
+    /**
+    Keeps track of how much gpu memory meshes and textures are using.
+    When it's over budget, the ones that haven't been drawn for the longest are removed from the gpu.
+    They come back through the upload queue the next time they're drawn.
+    Meshes always keep their data, but textures free theirs, so they're only evicted if they can be loaded again,
+    either from the archive they came from, from their image file, or because FLUX_NO_CPU_FREE is on
+    */
+    class GLResidency
+    {
+    public:
+        GLResidency();
+
+        /** Starts keeping track of a mesh. resource is the entity it's attached to, which it gets removed from when evicted */
+        void track(EntityRef resource, GLMeshCom* mesh);
+        void track(EntityRef resource, GLTextureCom* texture);
+
+        /** Stops keeping track of a component. Called when it's destroyed */
+        void forget(Component* com);
+
+        /** Marks it as being drawn this frame */
+        void touch(GLMeshCom* mesh) { mesh->last_used = frame; }
+        void touch(GLTextureCom* texture) { texture->last_used = frame; }
+
+        /** Evicts things until it's under budget. Should be called at the start of every frame */
+        void startFrame();
+
+        /**
+        Gets an evicted texture's data back, so it can be uploaded again.
+        Returns false if it can't, which only happens for textures that were never evicted
+        */
+        bool restoreTexture(EntityRef texture);
+
+        void setBudget(uint64_t bytes);
+
+        uint64_t getBudget() const { return budget; }
+        uint64_t getBytesUsed() const { return bytes_used; }
+
+    private:
+        struct Entry
+        {
+            EntityRef resource;
+            GLMeshCom* mesh = nullptr;
+            GLTextureCom* texture = nullptr;
+        };
+
+        /** Whether a texture's data can be brought back after it's evicted */
+        bool canRestore(EntityRef texture);
+
+        std::vector<Entry> entries;
+
+        uint64_t budget;
+        uint64_t bytes_used;
+
+        uint32_t frame;
+    };
+
+    /** The renderer's residency manager */
+    extern GLResidency residency;
+
+    /**
+    Keeps one linked program for each unique pair of shader sources.
+    Programs are also saved to disk with glGetProgramBinary, so later runs can skip compiling them
+    */
+    class GLShaderCache
+    {
+    public:
+        /** Gets a linked program for the shader, compiling it only if it has to. Give it back with release */
+        uint32_t acquire(Renderer::ShaderRes* shader);
+
+        /** Deletes the program once nothing is using it */
+        void release(uint32_t program);
+
+        /** Changes where program binaries are saved. An empty string turns the disk cache off */
+        void setDirectory(const std::string& dir);
+
+        size_t getProgramCount() const { return programs.size(); }
+
+    private:
+        struct Program
+        {
+            uint32_t handle;
+            int references;
+        };
+
+        uint32_t compile(Renderer::ShaderRes* shader);
+        /** Returns a program made from the saved binary, or 0 if there isn't a usable one */
+        uint32_t loadBinary(uint64_t hash);
+        void saveBinary(uint64_t hash, uint32_t program);
+        std::string getBinaryPath(uint64_t hash);
+
+        std::map<uint64_t, Program> programs;
+        std::string directory = FLUX_SHADER_CACHE_DIR;
+
+        /** Hash of the driver, since binaries from other drivers won't work */
+        uint64_t driver_hash = 0;
+    };
+
+    /** The renderer's shader cache */
+    extern GLShaderCache shader_cache;
+
+    /**
+    One draw call, with everything it needs copied out of the ECS.
+    Only GL names and values are stored, so it doesn't matter if the components are gone by the time it's drawn
+    */
+    struct GLDrawCommand
+    {
+        uint32_t program;
+        uint32_t vao;
+        uint32_t uniform_buffer;
+
+        uint32_t draw_type;
+        uint32_t index_type;
+        uint32_t count;
+        /** In bytes */
+        uintptr_t offset;
+
+        /**
+        If range_count isn't 0, only these of the list's meshlet_ranges are drawn, instead of count and offset.
+        That's what's left of a mesh's meshlets after culling
+        */
+        uint32_t range_start = 0;
+        uint32_t range_count = 0;
+
+        glm::mat4 model_view_projection;
+        glm::mat4 model_view;
+        glm::mat4 model;
+        int vertex_format_flags;
+
+        // Where those go in the shader
+        int mvp_location;
+        int mv_location;
+        int m_location;
+        int cam_pos_location;
+        int vertex_format_location;
+        int light_indexes_location;
+        int light_count_location;
+        int directional_light_count_location;
+        int cluster_params_location;
+
+        bool has_lights = false;
+        int light_indexes[FLUX_MAX_OBJECT_LIGHTS];
+
+        /** The depth was already drawn by the pre-pass, so only the pixels with exactly that depth are shaded */
+        bool depth_prepass = false;
+        /** What the pre-pass draws with. Either the position-only VAO, or the normal one */
+        uint32_t depth_vao;
+
+        /** Where the bone matrices start in the list's bone_matrices, or -1 if the mesh isn't skinned on the gpu */
+        int bone_offset = -1;
+
+        /** The material's textures. Texture i goes on unit i */
+        int texture_count = 0;
+        uint32_t textures[FLUX_LIGHT_TEXTURE_UNIT];
+        uint32_t texture_targets[FLUX_LIGHT_TEXTURE_UNIT];
+        int texture_locations[FLUX_LIGHT_TEXTURE_UNIT];
+    };
+
+    /**
+    One emitter's particles in GLCommandList::particles. Batches that look the same are drawn together
+    */
+    struct GLParticleBatch
+    {
+        /** 0 for untextured particles */
+        uint32_t texture;
+        bool additive;
+
+        uint32_t first;
+        uint32_t count;
+    };
+
+    /**
+    One impostor to draw. They're all drawn together, with one instanced draw per atlas
+    */
+    struct GLImpostorInstance
+    {
+        uint32_t atlas;
+        uint32_t views;
+
+        /** World space middle of the quad */
+        glm::vec3 position;
+
+        /** Which way the object is turned around the up axis, in radians */
+        float rotation;
+
+        /** Half the world space size of the quad */
+        float radius;
+        float half_height;
+    };
+
+    /**
+    Everything the render thread needs to draw a frame. Once it's submitted, the simulation doesn't touch it again
+    */
+    struct GLCommandList
+    {
+        /** GL work that has to happen before drawing, like uploads. Run in order */
+        std::vector<std::function<void()>> commands;
+
+        std::vector<GLDrawCommand> draws;
+
+        /** (offset, count) in indices. See GLDrawCommand::range_start */
+        std::vector<glm::uvec2> meshlet_ranges;
+
+        /** Every skinned draw's bone matrices, each starting on FLUX_BONE_PALETTE_ALIGNMENT. See GLDrawCommand::bone_offset */
+        std::vector<glm::mat4> bone_matrices;
+
+        /** Drawn after the draws */
+        std::vector<GLImpostorInstance> impostors;
+
+        /** Every emitter's particles, drawn after the impostors. The batches say which are whose */
+        std::vector<Particles::ParticleInstance> particles;
+        std::vector<GLParticleBatch> particle_batches;
+
+        /** Run after the draws, so anything drawn this frame can be deleted */
+        std::vector<std::function<void()>> deletions;
+
+        /** Size of the window when the frame was recorded */
+        int width = 0;
+        int height = 0;
+
+        /** How long the simulation took to record this, in seconds */
+        float simulation_time = 0;
+
+        // Uniforms that are the same for every draw
+        glm::vec3 camera_position;
+        glm::mat4 view_projection;
+        /** World space directions of the screen's x and y, for facing things towards the camera */
+        glm::vec3 camera_right;
+        glm::vec3 camera_up;
+        glm::vec4 cluster_params;
+        int light_count = 0;
+        int directional_light_count = 0;
+
+        /** Stats counted while recording. They're added to the frame's stats when it's drawn */
+        Renderer::RenderStats stats;
+
+        /** Does the glDrawElements for a draw, once for each of its meshlet ranges if it has any. Returns how many indices were drawn */
+        uint32_t drawElements(const GLDrawCommand& command) const;
+
+        void clear();
+    };
+
+    /**
+    Owns the GL context, and draws the frames the simulation records.
+    Each frame is recorded into a GLCommandList, which is handed over by endFrame. The render thread draws it
+    while the simulation carries on with the next frame, so there's always one frame being recorded and one being drawn.
+    With FLUX_RENDER_THREAD off (always the case on Emscripten), the lists are drawn straight away on the main thread instead
+    */
+    class GLRenderThread
+    {
+    public:
+        GLRenderThread();
+        ~GLRenderThread();
+
+        /** Hands the context over to the render thread. Called once the window is ready */
+        void start();
+
+        /** Waits for the last frame, then gives the context back to the main thread */
+        void stop();
+
+        /** The list being recorded this frame */
+        GLCommandList& getList() { return *recording; }
+
+        /** Adds some GL work to the frame being recorded */
+        void record(std::function<void()> command);
+
+        /**
+        Runs some GL work once the frame being drawn is finished, or straight away if nothing is being drawn.
+        For deleting GL objects, since the frame being recorded might still use them
+        */
+        void deleteLater(std::function<void()> command);
+
+        /**
+        Runs something on the render thread, and waits for it.
+        This is for creating GL objects, since the simulation needs their names. It has to wait for the frame being drawn, so it's slow
+        */
+        void call(const std::function<void()>& function);
+
+        /** Hands the recorded list to the render thread, after waiting for the one before it */
+        void submit();
+
+        /** Waits until everything submitted has been drawn */
+        void finish();
+
+        bool isThreaded() const { return threaded; }
+
+        /** Stats of the last frame that was drawn. With a render thread, this lags a frame behind */
+        Renderer::RenderStats getFinishedStats();
+
+    private:
+        void threadMain();
+        void execute(GLCommandList* list);
+
+        GLCommandList lists[2];
+        GLCommandList* recording;
+
+        bool started;
+        bool threaded;
+
+        Renderer::RenderStats finished_stats;
+        double last_frame_end;
+
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable condition;
+
+        /** Set by the simulation, and cleared by the render thread once it's done */
+        GLCommandList* pending;
+        const std::function<void()>* pending_call;
+        bool running;
+    };
+
+    /** The renderer's render thread */
+    extern GLRenderThread render_thread;
+
+    /**
+    Draws the scene into an offscreen framebuffer at a fraction of the window's size, then stretches it over the window.
+    The fraction is picked each frame by a ResolutionGovernor, from gpu timer queries. Without them, it stays at full resolution.
+    At full resolution, the framebuffer is skipped, and everything is drawn straight to the window
+    */
+    class GLDynamicResolution
+    {
+    public:
+        GLDynamicResolution();
+
+        /**
+        Finds out if the gpu can be timed, and loads the query functions glad doesn't.
+        Desktop GL has them built in, ES and WebGL need EXT_disjoint_timer_query.
+        Called once the context is made, with the loader glad was given
+        */
+        void loadTimerQueries(GLADloadproc load);
+
+        // These are only for the render thread
+
+        /** Binds the framebuffer at the current scale, and starts timing the gpu */
+        void beginFrame(int window_width, int window_height);
+
+        /** Stops timing, and stretches what was drawn over the window */
+        void endFrame();
+
+        /** Picks the scale for the next frame. Returns the gpu time, or 0 if it isn't known */
+        float update(float cpu_time);
+
+        /** The size that's actually being drawn at */
+        int getWidth() const { return width; }
+        int getHeight() const { return height; }
+
+        // These can be used from anywhere. The changes are recorded, so they happen in order with the frames
+
+        void setEnabled(bool enabled);
+        void setTarget(float seconds);
+        void setLimits(float min_scale, float max_scale);
+
+        /** The scale of the last frame that was drawn */
+        float getScale() const { return scale; }
+
+    private:
+        void resize(int new_width, int new_height);
+
+        Renderer::ResolutionGovernor governor;
+        bool enabled;
+        std::atomic<float> scale;
+
+        uint32_t framebuffer;
+        uint32_t color_buffer;
+        uint32_t depth_buffer;
+        int buffer_width;
+        int buffer_height;
+
+        /** Whether this frame is going through the framebuffer */
+        bool offscreen;
+        int width;
+        int height;
+        int window_width;
+        int window_height;
+
+        bool timer_supported;
+        /** The extension's timers can be thrown off by things like the gpu changing speed, and it says when */
+        bool check_disjoint;
+        bool has_queries;
+        uint32_t queries[FLUX_GPU_TIMER_QUERIES];
+        /** Queries that are waiting for their result */
+        bool query_busy[FLUX_GPU_TIMER_QUERIES];
+        /** The query being used this frame, or -1 */
+        int current_query;
+        uint32_t frame;
+        float gpu_time;
+    };
+
+    /** The renderer's dynamic resolution */
+    extern GLDynamicResolution dynamic_resolution;
+
+    /**
+    Draws the impostors in a command list as camera-facing quads.
+    The instances are sorted by atlas, and each atlas is one instanced draw.
+    The shader is built in, and is made the first time there's something to draw. Only used on the render thread
+    */
+    class GLImpostorRenderer
+    {
+    public:
+        GLImpostorRenderer();
+
+        /** Draws all of the list's impostors. The depth buffer should already have everything else in it */
+        void draw(GLCommandList* list);
+
+    private:
+        void init();
+
+        bool initialized;
+
+        uint32_t program;
+        uint32_t vao;
+        uint32_t instance_buffer;
+
+        int view_projection_location;
+        int camera_position_location;
+        int views_location;
+        int atlas_location;
+    };
+
+    /** The renderer's impostor renderer */
+    extern GLImpostorRenderer impostor_renderer;
+
+    /**
+    Draws the particles in a command list as camera-facing quads, blended over everything else without writing depth.
+    The batches are sorted by texture and blending, so all the emitters that look the same are one instanced draw.
+    The shader is built in, and is made the first time there's something to draw. Only used on the render thread
+    */
+    class GLParticleRenderer
+    {
+    public:
+        GLParticleRenderer();
+
+        /** Draws all of the list's particles. Everything else should already be drawn */
+        void draw(GLCommandList* list);
+
+    private:
+        void init();
+
+        bool initialized;
+
+        uint32_t program;
+        uint32_t vao;
+        uint32_t instance_buffer;
+
+        int view_projection_location;
+        int camera_right_location;
+        int camera_up_location;
+        int textured_location;
+        int texture_location;
+
+        /** Sorted instances, kept around so they don't have to be allocated every frame */
+        std::vector<Particles::ParticleInstance> data;
+    };
+
+    /** The renderer's particle renderer */
+    extern GLParticleRenderer particle_renderer;
+
+    /**
+    Draws the depth of every draw with a depth_prepass material before anything else, with colour writes off.
+    Those draws then go again with their real shader, testing for equal depth without writing it, so each pixel is only shaded once.
+    Meshes with a position stream are read through it, so the pre-pass doesn't have to fetch whole vertices.
+    The shader is built in, and is made the first time there's something to draw
+    */
+    class GLDepthPrepass
+    {
+    public:
+        GLDepthPrepass();
+
+        /** Draws the depth of the list's pre-pass draws. Only for the render thread */
+        void draw(GLCommandList* list);
+
+        /** Turns the pre-pass on or off for every material. It's on to start with */
+        void setEnabled(bool enabled);
+        bool isEnabled() const { return enabled; }
+
+    private:
+        void init();
+
+        std::atomic<bool> enabled;
+        bool initialized;
+
+        uint32_t program;
+        int mvp_location;
+    };
+
+    /** The renderer's depth pre-pass */
+    extern GLDepthPrepass depth_prepass;
+
+    /**
+    Sends the bone matrices of every skinned draw to the gpu in one uniform buffer each frame.
+    Each draw then gets its part of the buffer bound to the FluxBones block, at FLUX_BONES_BINDING.
+    Only used on the render thread
+    */
+    class GLSkinning
+    {
+    public:
+        GLSkinning();
+
+        /** Uploads all of the list's bone matrices. Called before anything is drawn */
+        void upload(GLCommandList* list);
+
+        /** Binds a draw's bone matrices, if it has any */
+        void bind(const GLDrawCommand& command);
+
+        /**
+        Adds a palette to the list, and returns its bone_offset.
+        The matrices are multiplied by position_transform, so quantized positions are turned back before they're skinned
+        */
+        static int addPalette(GLCommandList& list, const std::vector<glm::mat4>& matrices, const glm::mat4& position_transform);
+
+    private:
+        uint32_t buffer;
+        /** In bytes */
+        uint32_t capacity;
+    };
+
+    /** The renderer's skinning */
+    extern GLSkinning skinning;
+
     /**
     Little component that tells the renderer that GL has already been setup
     */
     struct GLEntityCom: Component
     {
         FLUX_COMPONENT(GLEntityCom, glentity);
+
+        /** The level of detail drawn last frame */
+        int current_lod = 0;
     };
 
     /**
@@ -127,9 +1061,9 @@ namespace Flux { namespace GLRenderer {
     void createWindow(const int& width, const int& height, const std::string& title);
 
     /**
-    Sets up the OpenGL context
+    Sets up the OpenGL context. load is what the window gave glad, for anything glad didn't load
     */
-    void _startGL();
+    void _startGL(GLADloadproc load);
 
     /**
     Close the current window, and free all it's resources
@@ -149,9 +1083,15 @@ namespace Flux { namespace GLRenderer {
     bool _windowStartFrame();
 
     /**
-    The windowing system's part of ending a frame
+    The windowing system's part of ending a frame. Called on the render thread, after everything has been drawn
     */
     void _windowEndFrame();
+
+    /**
+    Makes the context current on the calling thread, or releases it, so the render thread can take it
+    */
+    void _windowAcquireContext();
+    void _windowReleaseContext();
     
     /**
     Tells the renderer that the frame is over
@@ -169,14 +1109,28 @@ namespace Flux { namespace GLRenderer {
     {
     private:
         void initGLMaterial(Flux::Renderer::MeshCom* mesh);
-        void dealWithUniforms(Flux::Renderer::MeshCom* mesh, Flux::Renderer::MaterialRes* mat_res, GLShaderCom* shader_res);
+        GLUniformCom* dealWithUniforms(Flux::Renderer::MeshCom* mesh, Flux::Renderer::MaterialRes* mat_res, GLShaderCom* shader_res);
         void dealWithLights();
+        /** Adds the entity's impostor to the frame if it's far enough away. Returns false if the mesh should be drawn instead */
+        bool drawImpostor(EntityRef entity, Transform::TransformCom* trans_com);
+        /** Copies the entity's particles into the frame */
+        void drawParticles(EntityRef entity);
         bool setup_lighting = false;
 
         glm::mat4 projection;
 
         Renderer::LightSystem* lights;
-        uint32_t light_buffer;
+        Renderer::OcclusionSystem* occlusion;
+
+        // Light data textures
+        uint32_t light_data_texture;
+        uint32_t light_cluster_texture;
+        uint32_t light_index_texture;
+        int light_capacity;
+        int light_index_capacity;
+
+        /** Whether any shader has used the Lights block. It's only kept up to date once one has */
+        bool legacy_lights = false;
 
     public:
         GLRendererSystem();
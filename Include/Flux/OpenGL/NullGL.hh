@@ -0,0 +1,73 @@
+#ifndef FLUX_NULL_GL_HH
+#define FLUX_NULL_GL_HH
+
+// STL includes
+#include <cstdint>
+#include <vector>
+
+/**
+The null backend replaces GLFW and the real OpenGL driver with one that draws nothing.
+The GLRenderer runs exactly like normal on top of it, but every GL call is just counted (and optionally traced),
+so the cpu side of the renderer can be benchmarked and tested on machines without a gpu.
+Build with FLUX_NULL_RENDERER to use it.
+*/
+namespace Flux { namespace GLRenderer { namespace Null {
+
+    /**
+    What the renderer would have asked the gpu to do
+    */
+    struct NullStats
+    {
+        /** Every GL call */
+        uint32_t commands = 0;
+
+        uint32_t draw_calls = 0;
+        uint64_t indices_drawn = 0;
+
+        /** Binds, enables, and anything else that changes GL state */
+        uint32_t state_changes = 0;
+        uint32_t uniform_updates = 0;
+
+        /** Bytes sent to buffers, including pixel unpack buffers */
+        uint64_t buffer_bytes = 0;
+
+        /** Bytes sent straight to textures, not through a buffer */
+        uint64_t texture_bytes = 0;
+
+        /** Buffers, textures, vertex arrays, shaders and programs */
+        uint32_t objects_created = 0;
+        uint32_t objects_deleted = 0;
+    };
+
+    /**
+    A single GL call in the trace.
+    The arguments are whatever is most useful for that call, like the count for draw calls, or the size for buffers
+    */
+    struct NullCommand
+    {
+        const char* name;
+        uint64_t args[3];
+    };
+
+    /** Stats for the last full frame. With FLUX_RENDER_THREAD on, these are written by the render thread, so call GLRenderThread::finish first */
+    const NullStats& getLastFrameStats();
+
+    /** Stats since the window was created */
+    const NullStats& getTotalStats();
+
+    /** Turns the trace on or off. It's off by default, since it grows forever */
+    void setTraceEnabled(bool enabled);
+
+    const std::vector<NullCommand>& getTrace();
+
+    void clearTrace();
+
+    /** Makes runMainloop stop after this many frames. 0 means never */
+    void setFrameLimit(uint32_t frames);
+
+    /** Makes startFrame return false, like closing a real window */
+    void closeWindow();
+
+}}}
+
+#endif
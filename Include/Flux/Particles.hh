@@ -0,0 +1,256 @@
+#ifndef FLUX_PARTICLES_HH
+#define FLUX_PARTICLES_HH
+
+#include "Flux/ECS.hh"
+#include "Flux/Renderer.hh"
+#include "Flux/Resources.hh"
+
+// STL
+#include <vector>
+
+// GLM
+#include <glm/glm.hpp>
+
+/** Emitters with at least this many live particles are simulated on the worker threads */
+#ifndef FLUX_PARTICLE_THREADING_THRESHOLD
+#define FLUX_PARTICLE_THREADING_THRESHOLD 16384
+#endif
+
+/** How many worker threads help with big emitters, on top of the main thread. 0 simulates everything on the main thread */
+#ifndef FLUX_PARTICLE_THREADS
+#ifdef __EMSCRIPTEN__
+#define FLUX_PARTICLE_THREADS 0
+#else
+#define FLUX_PARTICLE_THREADS 3
+#endif
+#endif
+
+/**
+Particles.
+A ParticleEmitterCom holds all of its particles itself, so a thousand sparks are one entity instead of a thousand.
+The particles are stored as structure-of-arrays, so the simulation can do 4 of them at a time with SSE.
+Each frame the renderer copies them out as ParticleInstances, and draws all the emitters that look the same
+(same texture and blending) with one instanced draw.
+
+Particles live in world space, so moving the emitter leaves its old particles behind.
+Alpha blended particles aren't sorted, so additive blending looks best when lots of them overlap
+*/
+namespace Flux { namespace Particles {
+
+    /**
+    The particles of an emitter, with each attribute in its own array.
+    The arrays are always a multiple of 4 long, so the simulation never has to deal with a partial group at the end.
+    Only the first `count` are alive
+    */
+    struct ParticlePool
+    {
+        std::vector<float> position_x;
+        std::vector<float> position_y;
+        std::vector<float> position_z;
+
+        std::vector<float> velocity_x;
+        std::vector<float> velocity_y;
+        std::vector<float> velocity_z;
+
+        /** How far through its life each particle is, from 0 to 1. It dies at 1 */
+        std::vector<float> life;
+
+        /** 1 / lifetime, so ageing is a multiply */
+        std::vector<float> life_rate;
+
+        uint32_t count = 0;
+
+        uint32_t capacity() const { return life.size(); }
+
+        /** Makes room for max_particles, rounded up to a multiple of 4. If it's smaller, the newest particles are dropped */
+        void resize(uint32_t max_particles);
+
+        /** Moves the last live particle into i's place */
+        void kill(uint32_t i);
+    };
+
+    /**
+    What the renderer gets for each particle. 20 bytes, which is the layout of the instance buffer
+    */
+    struct ParticleInstance
+    {
+        /** World space middle of the quad */
+        float x, y, z;
+
+        /** Width of the quad */
+        float size;
+
+        /** RGBA, out of 255 */
+        uint8_t color[4];
+    };
+
+    /**
+    Spawns particles at the entity's position, and moves them around.
+    All the settings can be changed at any time
+    */
+    struct ParticleEmitterCom: public Component
+    {
+        FLUX_COMPONENT(ParticleEmitterCom, ParticleEmitterCom);
+
+        /** The most particles that can be alive at once. New ones aren't spawned while it's full */
+        uint32_t max_particles = 1024;
+
+        /** Particles spawned per second */
+        float rate = 100;
+
+        /** When this is false, no new particles are spawned, but the live ones carry on */
+        bool emitting = true;
+
+        /** In seconds. Each particle gets a random one in between */
+        float min_lifetime = 1;
+        float max_lifetime = 2;
+
+        /** Particles spawn up to this far from the emitter on each axis */
+        glm::vec3 position_spread = glm::vec3(0);
+
+        /** Starting velocity. Each particle gets up to velocity_spread added or taken away on each axis */
+        glm::vec3 velocity = glm::vec3(0, 1, 0);
+        glm::vec3 velocity_spread = glm::vec3(0.5);
+
+        /** Added to the velocity every second, like gravity or wind */
+        glm::vec3 acceleration = glm::vec3(0, -9.81, 0);
+
+        /** How quickly the particles slow down. The velocity is multiplied by e^(-drag) every second */
+        float drag = 0;
+
+        /** The size and colour go from start to end over the particle's life */
+        float start_size = 0.1;
+        float end_size = 0.1;
+        glm::vec4 start_color = glm::vec4(1);
+        glm::vec4 end_color = glm::vec4(1, 1, 1, 0);
+
+        /** Multiplied by the colour. If there isn't one, particles are soft round dots */
+        Resources::ResourceRef<Renderer::TextureRes> texture;
+
+        /** Adds the particles onto what's behind them, instead of alpha blending */
+        bool additive = false;
+
+        /** The live particles. Not serialized */
+        ParticlePool particles;
+
+        /** Part of a particle that was due to be spawned, carried over to the next frame */
+        float spawn_accumulator = 0;
+
+        /** For the random numbers. Each emitter has its own, so they don't depend on each other */
+        uint32_t random_state = 0x9E3779B9;
+
+        bool serialize(Resources::Serializer *serializer, FluxArc::BinaryFile *output) override
+        {
+            output->set(max_particles);
+            output->set(rate);
+            output->set(emitting);
+            output->set(min_lifetime);
+            output->set(max_lifetime);
+
+            const glm::vec3* vectors[] = {&position_spread, &velocity, &velocity_spread, &acceleration};
+            for (auto v : vectors)
+            {
+                output->set(v->x);
+                output->set(v->y);
+                output->set(v->z);
+            }
+
+            output->set(drag);
+            output->set(start_size);
+            output->set(end_size);
+
+            for (int i = 0; i < 4; i++)
+            {
+                output->set(start_color[i]);
+                output->set(end_color[i]);
+            }
+
+            bool has_texture = texture.getBaseEntity().getEntityID() != -1;
+            output->set(has_texture);
+            if (has_texture)
+            {
+                output->set(serializer->addResource(Resources::ResourceRef<Resources::Resource>(texture.getBaseEntity())));
+            }
+
+            output->set(additive);
+
+            return true;
+        }
+
+        void deserialize(Resources::Deserializer *deserializer, FluxArc::BinaryFile *file) override
+        {
+            file->get(&max_particles);
+            file->get(&rate);
+            file->get(&emitting);
+            file->get(&min_lifetime);
+            file->get(&max_lifetime);
+
+            glm::vec3* vectors[] = {&position_spread, &velocity, &velocity_spread, &acceleration};
+            for (auto v : vectors)
+            {
+                file->get(&v->x);
+                file->get(&v->y);
+                file->get(&v->z);
+            }
+
+            file->get(&drag);
+            file->get(&start_size);
+            file->get(&end_size);
+
+            for (int i = 0; i < 4; i++)
+            {
+                file->get(&start_color[i]);
+                file->get(&end_color[i]);
+            }
+
+            bool has_texture;
+            file->get(&has_texture);
+            if (has_texture)
+            {
+                uint32_t texture_res;
+                file->get(&texture_res);
+                texture = deserializer->getResource(texture_res);
+            }
+
+            file->get(&additive);
+        }
+    };
+
+    /**
+    Moves particles start to end of a pool along by delta seconds. Both have to be multiples of 4.
+    Dead particles aren't removed, that's removeDeadParticles' job.
+    Uses SSE where it can. Different ranges of the same pool can be done on different threads at once
+    */
+    void simulateParticles(ParticlePool& pool, uint32_t start, uint32_t end, glm::vec3 acceleration, float drag, float delta);
+
+    /** Removes the particles that have reached the end of their life */
+    void removeDeadParticles(ParticlePool& pool);
+
+    /** Spawns `count` new particles around origin, as long as there's room */
+    void spawnParticles(ParticleEmitterCom* emitter, glm::vec3 origin, uint32_t count);
+
+    /** Writes out the emitter's live particles for drawing. out needs room for particles.count */
+    void packParticles(const ParticleEmitterCom* emitter, ParticleInstance* out);
+
+    /**
+    Adds an emitter to an entity, and returns it so it can be set up
+    */
+    ParticleEmitterCom* addParticleEmitter(EntityRef entity, uint32_t max_particles = 1024);
+
+    /**
+    Spawns and moves the particles of every emitter. Emitters with more than FLUX_PARTICLE_THREADING_THRESHOLD
+    particles are split up between the worker threads
+    */
+    class ParticleSystem: public System
+    {
+        void runSystem(EntityRef entity, float delta) override;
+    };
+
+    /**
+    Adds the particle system to the front of the ECS, so the particles are moved before the renderer copies them
+    */
+    void addParticleSystems(ECSCtx* ctx);
+
+}}
+
+#endif
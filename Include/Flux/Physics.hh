@@ -11,6 +11,7 @@
 #include <array>
 #include <forward_list>
 #include <initializer_list>
+#include <unordered_map>
 #include <unordered_set>
 
 #define FLUX_SIL_CHUNK_SIZE 8
@@ -27,6 +28,14 @@ namespace Flux { namespace Physics {
 
     class BoundingBox;
 
+    struct CollisionData
+    {
+        glm::vec3 normal;
+        glm::vec3 offset;
+        float depth;
+        bool colliding;
+    };
+
 /** Namespace for specialized data structures */
 namespace DS
 {
@@ -182,10 +191,69 @@ namespace DS
         std::vector<Chunk*> array;
     };
 
+    /**
+    Two bounding boxes that overlap. a is always the one at the lower address, so each pair only has one way of being written
+    */
+    struct BoxPair
+    {
+        BoundingBox* a;
+        BoundingBox* b;
+
+        /** What the narrow phase found. Only worked out again when one of them moves */
+        CollisionData contact;
+        bool tested;
+    };
+
+    /**
+    Every pair of bounding boxes that overlap.
+    It's never built from scratch: the sorted extrema lists tell it when a pair starts or stops overlapping,
+    as their insertion sort swaps the pair's extrema past each other.
+    The pairs that were added and removed are kept until clearEvents, so other things can react to them.
+    The narrow phase clears them once it's gone through them
+    */
+    class PairCache
+    {
+    public:
+        /** Returns false if the pair was already there */
+        bool add(BoundingBox* a, BoundingBox* b);
+
+        /** Returns false if the pair wasn't there */
+        bool remove(BoundingBox* a, BoundingBox* b);
+
+        /**
+        Removes every pair the box is in. The box is about to be deleted, so it's nullptr in the removed events,
+        and any added events it's in are dropped
+        */
+        void removeBox(BoundingBox* box);
+
+        void clearEvents();
+
+        std::vector<BoxPair> pairs;
+
+        /** Pairs that started overlapping since clearEvents */
+        std::vector<BoxPair> added;
+
+        /** Pairs that stopped overlapping since clearEvents, with the last contact they had. See removeBox */
+        std::vector<BoxPair> removed;
+
+    private:
+        struct PairHash
+        {
+            size_t operator()(const std::pair<BoundingBox*, BoundingBox*>& pair) const
+            {
+                return std::hash<BoundingBox*>()(pair.first) * 31 + std::hash<BoundingBox*>()(pair.second);
+            }
+        };
+
+        /** Pair -> index in pairs */
+        std::unordered_map<std::pair<BoundingBox*, BoundingBox*>, uint32_t, PairHash> indices;
+    };
+
     class SortedExtremaList
     {
     public:
-        SortedExtremaList(const int index);
+        /** If pairs is given, it's kept up to date as the list is sorted */
+        SortedExtremaList(const int index, PairCache* pairs = nullptr);
         ~SortedExtremaList();
 
         /** Adds a bounding box. Simple as that */
@@ -208,8 +276,12 @@ namespace DS
     private:
         void addItemToCollisionList(BoundingBox* box, int i, std::vector<BoundingBox*>& collisions);
 
+        /** Called when the extrema moving down the list passes another one */
+        void swapped(const Extrema& moving, const Extrema& passed);
+
         const int index;
         std::vector<Extrema> extrema;
+        PairCache* pairs;
     };
 }
 
@@ -248,6 +320,9 @@ namespace DS
         uint64_t pass;
         bool collisions[3];
 
+        /** Every box this one overlaps. The world's pair cache keeps it up to date */
+        std::vector<BoundingBox*> overlapping;
+
         EntityRef entity;
 
     private:
@@ -288,11 +363,20 @@ namespace DS
         // bool isColliding(BoundingBox* boxa, BoundingBox* boxb);
 
         /**
-        Returns all boxes coliding with the given box
+        Returns all boxes coliding with the given box.
+        This searches the lists, so box->overlapping is much quicker
         */
         std::vector<BoundingBox*> getColliding(BoundingBox* box);
 
+        /** Every pair of boxes that overlap, with the pairs that were added and removed since the narrow phase last went through them */
+        DS::PairCache& getPairs() { return pairs; }
+
+        /** The frame the narrow phase last went through the pairs */
+        uint64_t narrow_phase_frame;
+
     private:
+        // Has to be made before the lists
+        DS::PairCache pairs;
 
         // DS::SegmentedIntervalList x_axis;
         // DS::SegmentedIntervalList y_axis;
@@ -310,11 +394,13 @@ namespace DS
         ~BoundingCom()
         {
             // Remove bounding boxes from bounding world
-            if (world && box)
+            // Its pairs go with it, so nothing is left pointing at it
+            if (world && box && setup)
             {
-                // TODO: IMPORTANT: Fix
-                // world->removeBoundingBox(box);
+                world->removeBoundingBox(box);
             }
+
+            delete box;
         }
 
         bool serialize(Resources::Serializer *serializer, FluxArc::BinaryFile *output) override
@@ -351,16 +437,14 @@ namespace DS
             box->min_pos = box->og_min_pos;
 
             setup = false;
-            collisions = std::vector<BoundingBox* >();
         }
 
-        BoundingBox* box;
-        BoundingWorld* world;
+        BoundingBox* box = nullptr;
 
-        uint64_t frame;
-        std::vector<BoundingBox*> collisions;
+        /** Set once the broad phase has added the box */
+        BoundingWorld* world = nullptr;
 
-        bool setup;
+        bool setup = false;
     };
 
     /**
@@ -371,6 +455,7 @@ namespace DS
     void giveBoundingBox(EntityRef entity);
     void giveBoundingBox(EntityRef entity, glm::vec3 min_pos, glm::vec3 max_pos);
 
+    /** Returns every bounding box overlapping the entity's, as of the last time the broad phase ran */
     std::vector<BoundingBox*> getBoundingBoxCollisions(EntityRef entity);
 
     class BroadPhaseSystem: public Flux::System
@@ -417,14 +502,6 @@ namespace DS
         void updateTransform(const glm::mat4& global_transform) override;
     };
 
-    struct CollisionData
-    {
-        glm::vec3 normal;
-        glm::vec3 offset;
-        float depth;
-        bool colliding;
-    };
-
     struct Collision
     {
         glm::vec3 normal;
@@ -536,7 +613,11 @@ namespace GJK
         void onSystemEnd() override {};
     };
 
-    /** Returns collision data about each collision involving this entity */
+    /**
+    Returns collision data about each collision involving this entity.
+    The narrow phase goes through every overlapping pair once a frame, the first time this (or NarrowPhaseSystem) needs it,
+    and gives each collision to both entities. Pairs where neither entity has moved keep last frame's result
+    */
     std::vector<Collision> getCollisions(EntityRef entity);
 
     /**
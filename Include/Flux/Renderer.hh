@@ -7,11 +7,13 @@
 
 // STL
 // #include <bits/stdint-uintn.h>
+#include <algorithm>
 #include <map>
 
 // GLM
 #include <glm/glm.hpp>
 #include <set>
+#include <unordered_map>
 #include <vector>
 #include "glm/fwd.hpp"
 
@@ -20,6 +22,131 @@
 #define FLUX_MAX_CHILDREN 32
 #endif
 
+/** How many pixels of error a level of detail is allowed to have */
+#ifndef FLUX_LOD_PIXEL_ERROR
+#define FLUX_LOD_PIXEL_ERROR 1.0f
+#endif
+
+/** How far under FLUX_LOD_PIXEL_ERROR a level has to be before switching to it */
+#ifndef FLUX_LOD_HYSTERESIS
+#define FLUX_LOD_HYSTERESIS 0.25f
+#endif
+
+/** Most triangles in a meshlet */
+#ifndef FLUX_MESHLET_TRIANGLES
+#define FLUX_MESHLET_TRIANGLES 124
+#endif
+
+/** optimizeMesh only splits meshes into meshlets if they have at least this many triangles */
+#ifndef FLUX_MESHLET_MIN_TRIANGLES
+#define FLUX_MESHLET_MIN_TRIANGLES 4096
+#endif
+
+/** Most bones a skeleton can have. Skinned shaders need a FluxBones block with this many matrices */
+#ifndef FLUX_MAX_BONES
+#define FLUX_MAX_BONES 64
+#endif
+
+#ifndef FLUX_MAX_OBJECT_LIGHTS
+#define FLUX_MAX_OBJECT_LIGHTS 8
+#endif
+
+// Froxel grid used for clustered lighting
+#ifndef FLUX_CLUSTERS_X
+#define FLUX_CLUSTERS_X 16
+#endif
+
+#ifndef FLUX_CLUSTERS_Y
+#define FLUX_CLUSTERS_Y 9
+#endif
+
+#ifndef FLUX_CLUSTERS_Z
+#define FLUX_CLUSTERS_Z 24
+#endif
+
+#ifndef FLUX_MAX_CLUSTER_LIGHTS
+#define FLUX_MAX_CLUSTER_LIGHTS 64
+#endif
+
+/** Size of a cell in the world space light grid */
+#ifndef FLUX_LIGHT_GRID_CELL_SIZE
+#define FLUX_LIGHT_GRID_CELL_SIZE 8.0f
+#endif
+
+/** Resolution of the cpu depth buffer used for occlusion culling. Both are rounded up to a multiple of 8 */
+#ifndef FLUX_OCCLUSION_WIDTH
+#define FLUX_OCCLUSION_WIDTH 256
+#endif
+
+#ifndef FLUX_OCCLUSION_HEIGHT
+#define FLUX_OCCLUSION_HEIGHT 128
+#endif
+
+/** Size of a cell in a potentially visible set. Smaller cells cull more, but take much longer to build */
+#ifndef FLUX_PVS_CELL_SIZE
+#define FLUX_PVS_CELL_SIZE 4.0f
+#endif
+
+/** Building gives up on levels that would need more cells than this, since it takes cells squared time */
+#ifndef FLUX_PVS_MAX_CELLS
+#define FLUX_PVS_MAX_CELLS 4096
+#endif
+
+/** Resolution of each of the 6 views rendered from a point when building a potentially visible set */
+#ifndef FLUX_PVS_VIEW_SIZE
+#define FLUX_PVS_VIEW_SIZE 64
+#endif
+
+/** Static meshes are only batched with others in the same cell, so batches can still be culled */
+#ifndef FLUX_STATIC_BATCH_CELL_SIZE
+#define FLUX_STATIC_BATCH_CELL_SIZE 32.0f
+#endif
+
+/** Batches are split before they get this big, so they can keep 16 bit indices */
+#ifndef FLUX_STATIC_BATCH_MAX_VERTICES
+#define FLUX_STATIC_BATCH_MAX_VERTICES 65535
+#endif
+
+/** Textures bigger than this (in either direction) are left alone by buildTextureArrays */
+#ifndef FLUX_TEXTURE_ARRAY_MAX_SIZE
+#define FLUX_TEXTURE_ARRAY_MAX_SIZE 512
+#endif
+
+/** GL only has to support 256 layers */
+#ifndef FLUX_MAX_TEXTURE_ARRAY_LAYERS
+#define FLUX_MAX_TEXTURE_ARRAY_LAYERS 256
+#endif
+
+/** How long a frame should take, in seconds. The resolution is lowered when frames take longer than this */
+#ifndef FLUX_TARGET_FRAME_TIME
+#define FLUX_TARGET_FRAME_TIME (1.0f / 60.0f)
+#endif
+
+/** The resolution is never scaled down further than this */
+#ifndef FLUX_MIN_RESOLUTION_SCALE
+#define FLUX_MIN_RESOLUTION_SCALE 0.5f
+#endif
+
+/** How many frames in a row have to be well under the target before the resolution goes back up */
+#ifndef FLUX_RESOLUTION_RAISE_FRAMES
+#define FLUX_RESOLUTION_RAISE_FRAMES 30
+#endif
+
+/** How many angles impostors are rendered from. They're spread evenly around the up axis */
+#ifndef FLUX_IMPOSTOR_VIEWS
+#define FLUX_IMPOSTOR_VIEWS 8
+#endif
+
+/** Size of each view in an impostor's atlas, in pixels */
+#ifndef FLUX_IMPOSTOR_VIEW_SIZE
+#define FLUX_IMPOSTOR_VIEW_SIZE 64
+#endif
+
+/** Impostors are drawn instead of the least detailed level once the object is shorter than this on screen, in pixels */
+#ifndef FLUX_IMPOSTOR_PIXELS
+#define FLUX_IMPOSTOR_PIXELS 48.0f
+#endif
+
 
 namespace Flux { namespace Renderer {
 
@@ -49,11 +176,170 @@ namespace Flux { namespace Renderer {
         float btanz;
     };
 
+    /**
+    Which bones move a vertex, and by how much. The weights add up to 255.
+    Kept seperate from Vertex, since most meshes don't have it. See Flux/Animation.hh
+    */
+    struct VertexSkin
+    {
+        uint8_t bones[4];
+        uint8_t weights[4];
+    };
+
     enum DrawMode
     {
         Triangles, Lines
     };
 
+    /** How positions are stored on the gpu */
+    enum class PositionFormat: uint8_t
+    {
+        /** 3 floats */
+        Float,
+        /** 3 half floats */
+        Half,
+        /** 3 signed normalized shorts, relative to the mesh's bounds */
+        SNorm16
+    };
+
+    /** How normals and tangents are stored on the gpu */
+    enum class DirectionFormat: uint8_t
+    {
+        None,
+        /** 3 floats */
+        Float,
+        /** 2 signed normalized shorts, octahedral encoded */
+        Octahedral
+    };
+
+    /** How bitangents are stored on the gpu */
+    enum class BitangentFormat: uint8_t
+    {
+        None,
+        /** 3 floats */
+        Float,
+        /** Only the sign is stored (in the tangent's w), the rest is reconstructed from the normal and tangent */
+        Sign
+    };
+
+    /** How texture coordinates are stored on the gpu */
+    enum class UVFormat: uint8_t
+    {
+        None,
+        /** 2 floats */
+        Float,
+        /** 2 half floats */
+        Half
+    };
+
+    /**
+    Flags passed to shaders in the `vertex_format` uniform, so they know what they have to decode
+    */
+    enum VertexFormatFlags
+    {
+        OctahedralNormals = 1,
+        OctahedralTangents = 2,
+        BitangentSign = 4,
+        /** Has bone indices and weights in attributes 5 and 6, and the FluxBones block is bound */
+        Skinned = 8
+    };
+
+    /**
+    Describes the layout of a mesh's vertices on the gpu.
+    The default is the same as Vertex, which is 56 bytes.
+    All attributes are 4 byte aligned
+    */
+    struct VertexFormat
+    {
+        PositionFormat position = PositionFormat::Float;
+        DirectionFormat normal = DirectionFormat::Float;
+        UVFormat uv = UVFormat::Float;
+        DirectionFormat tangent = DirectionFormat::Float;
+        BitangentFormat bitangent = BitangentFormat::Float;
+
+        bool operator==(const VertexFormat& other) const;
+        bool operator!=(const VertexFormat& other) const;
+
+        /** Returns true if the format is the same as Vertex */
+        bool isDefault() const;
+
+        /** Size of one vertex, in bytes */
+        uint32_t getStride() const;
+
+        /**
+        Offsets of each attribute, in bytes.
+        In order: position, normal, uv, tangent, bitangent
+        */
+        uint32_t getOffset(int attribute) const;
+
+        /** Returns the VertexFormatFlags for this format */
+        int getShaderFlags() const;
+    };
+
+    /**
+    A format that works for most meshes, at 24 bytes a vertex
+    */
+    const VertexFormat compact_vertex_format = {PositionFormat::SNorm16, DirectionFormat::Octahedral, UVFormat::Half, DirectionFormat::Octahedral, BitangentFormat::Sign};
+
+    /**
+    Same as compact_vertex_format, but for meshes without normal maps. 16 bytes a vertex
+    */
+    const VertexFormat compact_untangented_vertex_format = {PositionFormat::SNorm16, DirectionFormat::Octahedral, UVFormat::Half, DirectionFormat::None, BitangentFormat::None};
+
+    /**
+    Serialized meshes that start with this instead of a vertex count are packed,
+    and store the size of their indices
+    */
+    #define FLUX_PACKED_MESH_MARKER 0xFFFFFFFF
+
+    /**
+    Same as FLUX_PACKED_MESH_MARKER, but there's a MeshExtras bitfield after the levels of detail,
+    followed by each of the extras in order
+    */
+    #define FLUX_EXTENDED_MESH_MARKER 0xFFFFFFFE
+
+    enum MeshExtras
+    {
+        HasMeshlets = 1,
+        HasSkin = 2
+    };
+
+    /**
+    A simplified version of a mesh. It uses the same vertices as the full mesh
+    */
+    struct MeshLOD
+    {
+        /** How far (in model space) this LOD is from the full mesh, at worst */
+        float error;
+
+        /** Empty while the mesh is packed. See MeshRes::packed_indices */
+        std::vector<uint32_t> indices;
+
+        /** How many indices it has, which is still known while the mesh is packed */
+        uint32_t indices_length;
+    };
+
+    /**
+    A small piece of a mesh's full level of detail, which can be culled by itself. See buildMeshlets()
+    */
+    struct Meshlet
+    {
+        /** Where its triangles are in the mesh's indices, in indices */
+        uint32_t offset;
+        uint32_t count;
+
+        /** Bounding sphere, in model space */
+        glm::vec3 center;
+        float radius;
+
+        /**
+        Every triangle faces within the cone around the axis, so it can be skipped when the camera is behind all of them.
+        cutoff is the sine of the cone's half angle, or 1 if the cone is too wide to ever cull anything
+        */
+        glm::vec3 cone_axis;
+        float cone_cutoff;
+    };
+
     /**
     Renderer-independant mesh component which stores all the data nessesary to render the defined mesh
     TODO: Make it deallocate memory after the mesh is on the gpu
@@ -64,62 +350,215 @@ namespace Flux { namespace Renderer {
 
         uint32_t vertices_length;
         /**
-        Array of vertices in the mesh. See vertices_len for length
+        Array of vertices in the mesh. See vertices_len for length.
+        This can be nullptr if the mesh was loaded packed. Use unpack() to get them back
         */
         Vertex* vertices;
 
         uint32_t indices_length;
         /**
-        Array of indices in the mesh. See vertices_len for length
+        Array of indices in the mesh. See vertices_len for length.
+        This is nullptr if the mesh was loaded packed, like the vertices. Use unpack() to get them back
         */
         uint32_t* indices;
 
+        /**
+        The indices of a mesh that was loaded packed, in index_size, followed by each level of detail's.
+        They stay the size they were saved in, and go to the gpu as-is. Empty once the mesh is unpacked
+        */
+        std::vector<char> packed_indices;
+
+        /** Size of each index in packed_indices, in bytes. See getIndexSize() */
+        uint8_t index_size = sizeof(uint32_t);
+
         /** How to draw the mesh */
         DrawMode draw_mode;
 
+        /**
+        Extra levels of detail, from most to least detailed.
+        LOD 0 is always the full mesh, so lods[0] is LOD 1.
+        See generateLODs()
+        */
+        std::vector<MeshLOD> lods;
+
+        /**
+        The full mesh split into pieces that can be culled seperately, in the same order as indices.
+        Empty for most meshes. Levels of detail aren't split, and are always drawn whole
+        */
+        std::vector<Meshlet> meshlets;
+
+        /** One for each vertex if the mesh can be animated, otherwise empty. See Flux/Animation.hh */
+        std::vector<VertexSkin> skin;
+
+        /** The layout of packed_vertices */
+        VertexFormat vertex_format;
+
+        /**
+        Vertices in the format described by vertex_format, which get sent to the gpu as-is.
+        nullptr if the mesh hasn't been packed
+        */
+        char* packed_vertices = nullptr;
+        uint32_t packed_size = 0;
+
+        /**
+        SNorm16 positions are stored relative to the mesh's bounds.
+        real position = packed position * position_scale + position_offset
+        */
+        glm::vec3 position_offset = glm::vec3(0);
+        float position_scale = 1;
+
+        /**
+        Dynamic meshes are streamed to the gpu again every time `changed` is set, instead of just once.
+        They don't get packed or use levels of detail
+        */
+        bool dynamic = false;
+        bool changed = false;
+
+        /**
+        Also upload the positions on their own, tightly packed, for the depth pre-pass.
+        That's 12 bytes a vertex for Float positions, and 8 for the 16 bit ones, instead of the whole vertex.
+        The renderer sets this for meshes with a depth_prepass material, but it has to happen before the mesh is uploaded
+        */
+        bool position_stream = false;
+
+        /**
+        Packs the vertices into the given format. The vertices stay where they are
+        */
+        void pack(const VertexFormat& format);
+
+        /**
+        Same as pack, but gives back the packed vertices instead of changing the mesh, along with the position_offset and position_scale they use.
+        The mesh has to have its vertices
+        */
+        std::vector<char> getPackedVertices(const VertexFormat& format, glm::vec3& position_offset, float& position_scale) const;
+
+        /**
+        All the indices in getIndexSize(), followed by each level of detail's, which is how they're saved and sent to the gpu.
+        size is set to the size of each index
+        */
+        std::vector<char> getPackedIndices(uint8_t& size) const;
+
+        /**
+        Copies just the positions out, in vertex_format's position format, one after the other.
+        SNorm16 positions still need position_offset and position_scale
+        */
+        std::vector<char> getPositionStream() const;
+
+        /**
+        If the mesh only has packed vertices, decode them back into `vertices`.
+        Packed indices are widened back into `indices` and the levels of detail too.
+        Quantized attributes don't come back perfectly
+        */
+        void unpack();
+
+        /** Same as unpack, but gives back a copy of the vertices, and leaves the mesh how it is */
+        std::vector<Vertex> getUnpackedVertices() const;
+
+        /** A copy of the full mesh's indices, widened if they're packed */
+        std::vector<uint32_t> getUnpackedIndices() const;
+
+        /**
+        Returns the size of each index on the gpu, in bytes.
+        Meshes with less than 65536 vertices use 16 bit indices, and packed meshes keep the size they were saved with
+        */
+        uint8_t getIndexSize() const
+        {
+            if (indices == nullptr)
+            {
+                return index_size;
+            }
+
+            return vertices_length < 65536 ? sizeof(uint16_t) : sizeof(uint32_t);
+        }
+
         // Functions
         ~MeshRes()
         {
             delete[] vertices;
             delete[] indices;
+            delete[] packed_vertices;
         }
 
         bool serialize(Resources::Serializer* serializer, FluxArc::BinaryFile* output) override
         {
-            output->set(vertices_length);
-
-            // Resize the binary file to limit copies
-            output->allocate(sizeof(float) * 14 * vertices_length);
-            for (int i = 0; i < vertices_length; i++)
+            // Meshes that haven't been packed are packed into a copy, so saving doesn't change them
+            const char* vertex_data = packed_vertices;
+            uint32_t vertex_size = packed_size;
+            glm::vec3 offset = position_offset;
+            float scale = position_scale;
+
+            std::vector<char> local_vertices;
+            if (packed_vertices == nullptr)
             {
-                output->set(vertices[i].x);
-                output->set(vertices[i].y);
-                output->set(vertices[i].z);
+                local_vertices = getPackedVertices(vertex_format, offset, scale);
+                vertex_data = local_vertices.data();
+                vertex_size = local_vertices.size();
+            }
 
-                output->set(vertices[i].nx);
-                output->set(vertices[i].ny);
-                output->set(vertices[i].nz);
+            uint32_t extras = (meshlets.empty() ? 0 : HasMeshlets) | (skin.empty() ? 0 : HasSkin);
+            output->set((uint32_t)(extras == 0 ? FLUX_PACKED_MESH_MARKER : FLUX_EXTENDED_MESH_MARKER));
+            output->set((uint8_t)vertex_format.position);
+            output->set((uint8_t)vertex_format.normal);
+            output->set((uint8_t)vertex_format.uv);
+            output->set((uint8_t)vertex_format.tangent);
+            output->set((uint8_t)vertex_format.bitangent);
 
-                output->set(vertices[i].tx);
-                output->set(vertices[i].ty);
+            output->set(vertices_length);
+            output->set(offset.x);
+            output->set(offset.y);
+            output->set(offset.z);
+            output->set(scale);
+
+            output->set(vertex_size);
+            output->set((char*)vertex_data, vertex_size);
+
+            // Small meshes get 16 bit indices
+            uint8_t size;
+            auto index_data = getPackedIndices(size);
+            output->set(size);
+            output->set(indices_length);
+            output->set(index_data.data(), indices_length * size);
 
-                output->set(vertices[i].tanx);
-                output->set(vertices[i].tany);
-                output->set(vertices[i].tanz);
+            output->set((int)draw_mode);
 
-                output->set(vertices[i].btanx);
-                output->set(vertices[i].btany);
-                output->set(vertices[i].btanz);
+            // Levels of detail
+            uint32_t index_offset = indices_length * size;
+            output->set((uint32_t)lods.size());
+            for (auto& lod : lods)
+            {
+                output->set(lod.error);
+                output->set(lod.indices_length);
+                output->set(index_data.data() + index_offset, lod.indices_length * size);
+                index_offset += lod.indices_length * size;
             }
 
-            output->set(indices_length);
-            output->allocate(sizeof(uint32_t) * indices_length);
-            for (int i = 0; i < indices_length; i++)
+            if (extras != 0)
             {
-                output->set(indices[i]);
+                output->set(extras);
             }
 
-            output->set((int)draw_mode);
+            if (!meshlets.empty())
+            {
+                output->set((uint32_t)meshlets.size());
+                for (auto& meshlet : meshlets)
+                {
+                    output->set(meshlet.offset);
+                    output->set(meshlet.count);
+                    output->set(meshlet.center.x);
+                    output->set(meshlet.center.y);
+                    output->set(meshlet.center.z);
+                    output->set(meshlet.radius);
+                    output->set(meshlet.cone_axis.x);
+                    output->set(meshlet.cone_axis.y);
+                    output->set(meshlet.cone_axis.z);
+                    output->set(meshlet.cone_cutoff);
+                }
+            }
+
+            if (!skin.empty())
+            {
+                output->set((char*)skin.data(), skin.size() * sizeof(VertexSkin));
+            }
 
             return true;
         };
@@ -127,54 +566,239 @@ namespace Flux { namespace Renderer {
         virtual void deserialize(Resources::Deserializer* deserializer, FluxArc::BinaryFile* file) override
         {
             file->get(&vertices_length);
-            vertices = new Vertex[vertices_length];
 
-            for (int i = 0; i < vertices_length; i++)
+            // Only packed meshes store the size of their indices
+            index_size = sizeof(uint32_t);
+
+            bool extended = vertices_length == FLUX_EXTENDED_MESH_MARKER;
+            if (vertices_length == FLUX_PACKED_MESH_MARKER || extended)
             {
-                file->get(&vertices[i].x);
-                file->get(&vertices[i].y);
-                file->get(&vertices[i].z);
+                // Packed vertices can go straight to the gpu
+                uint8_t format[5];
+                for (int i = 0; i < 5; i++)
+                {
+                    file->get(&format[i]);
+                }
+
+                vertex_format.position = (PositionFormat)format[0];
+                vertex_format.normal = (DirectionFormat)format[1];
+                vertex_format.uv = (UVFormat)format[2];
+                vertex_format.tangent = (DirectionFormat)format[3];
+                vertex_format.bitangent = (BitangentFormat)format[4];
 
-                file->get(&vertices[i].nx);
-                file->get(&vertices[i].ny);
-                file->get(&vertices[i].nz);
+                file->get(&vertices_length);
+                file->get(&position_offset.x);
+                file->get(&position_offset.y);
+                file->get(&position_offset.z);
+                file->get(&position_scale);
 
-                file->get(&vertices[i].tx);
-                file->get(&vertices[i].ty);
+                file->get(&packed_size);
+                packed_vertices = new char[packed_size];
+                file->get(packed_vertices, packed_size);
 
-                file->get(&vertices[i].tanx);
-                file->get(&vertices[i].tany);
-                file->get(&vertices[i].tanz);
+                vertices = nullptr;
 
-                file->get(&vertices[i].btanx);
-                file->get(&vertices[i].btany);
-                file->get(&vertices[i].btanz);
+                file->get(&index_size);
             }
+            else
+            {
+                // Old, unpacked format
+                vertices = new Vertex[vertices_length];
 
-            file->get(&indices_length);
-            indices = new uint32_t[indices_length];
+                for (int i = 0; i < vertices_length; i++)
+                {
+                    file->get(&vertices[i].x);
+                    file->get(&vertices[i].y);
+                    file->get(&vertices[i].z);
+
+                    file->get(&vertices[i].nx);
+                    file->get(&vertices[i].ny);
+                    file->get(&vertices[i].nz);
 
-            for (int i = 0; i < indices_length; i++)
+                    file->get(&vertices[i].tx);
+                    file->get(&vertices[i].ty);
+
+                    file->get(&vertices[i].tanx);
+                    file->get(&vertices[i].tany);
+                    file->get(&vertices[i].tanz);
+
+                    file->get(&vertices[i].btanx);
+                    file->get(&vertices[i].btany);
+                    file->get(&vertices[i].btanz);
+                }
+            }
+
+            file->get(&indices_length);
+            if (vertices == nullptr)
             {
-                file->get(&indices[i]);
+                // Packed indices are kept the size they are, the levels of detail get added after them
+                indices = nullptr;
+                packed_indices.resize(indices_length * index_size);
+                file->get(packed_indices.data(), packed_indices.size());
+            }
+            else
+            {
+                indices = new uint32_t[indices_length];
+                for (int i = 0; i < indices_length; i++)
+                {
+                    file->get(&indices[i]);
+                }
             }
 
             int i;
             file->get(&i);
             draw_mode = (DrawMode)i;
+
+            if (vertices == nullptr)
+            {
+                // Packed meshes can have levels of detail
+                uint32_t lod_count;
+                file->get(&lod_count);
+                lods.resize(lod_count);
+
+                for (auto& lod : lods)
+                {
+                    file->get(&lod.error);
+                    file->get(&lod.indices_length);
+
+                    auto offset = packed_indices.size();
+                    packed_indices.resize(offset + lod.indices_length * index_size);
+                    file->get(packed_indices.data() + offset, lod.indices_length * index_size);
+                }
+            }
+
+            uint32_t extras = 0;
+            if (extended)
+            {
+                file->get(&extras);
+            }
+
+            if (extras & HasMeshlets)
+            {
+                uint32_t meshlet_count;
+                file->get(&meshlet_count);
+                meshlets.resize(meshlet_count);
+
+                for (auto& meshlet : meshlets)
+                {
+                    file->get(&meshlet.offset);
+                    file->get(&meshlet.count);
+                    file->get(&meshlet.center.x);
+                    file->get(&meshlet.center.y);
+                    file->get(&meshlet.center.z);
+                    file->get(&meshlet.radius);
+                    file->get(&meshlet.cone_axis.x);
+                    file->get(&meshlet.cone_axis.y);
+                    file->get(&meshlet.cone_axis.z);
+                    file->get(&meshlet.cone_cutoff);
+                }
+            }
+
+            if (extras & HasSkin)
+            {
+                skin.resize(vertices_length);
+                file->get((char*)skin.data(), skin.size() * sizeof(VertexSkin));
+            }
         };
     };
 
+    /**
+    Merges vertices that are the same (or within epsilon of each other).
+    Returns the number of vertices that were removed
+    */
+    uint32_t weldVertices(Resources::ResourceRef<MeshRes> mesh, float epsilon = 0);
+
+    /**
+    Reorders the triangles so the gpu's post-transform vertex cache gets used as much as possible.
+    This uses Tom Forsyth's Linear-Speed Vertex Cache Optimisation
+    */
+    void optimizeVertexCache(Resources::ResourceRef<MeshRes> mesh);
+
+    /**
+    Same as above, but for any list of indices
+    */
+    void optimizeVertexCache(uint32_t* indices, uint32_t indices_length, uint32_t vertices_length);
+
+    /**
+    Reorders clusters of triangles so the ones on the outside get drawn first, which reduces overdraw.
+    Must be run after optimizeVertexCache.
+    threshold is how much worse the vertex cache is allowed to get (1.05 = 5% worse)
+    */
+    void optimizeOverdraw(Resources::ResourceRef<MeshRes> mesh, float threshold = 1.05f);
+
+    /**
+    Reorders the vertices in the order they are used, so fetching them is more cache friendly
+    */
+    void optimizeVertexFetch(Resources::ResourceRef<MeshRes> mesh);
+
+    /**
+    Generates levels of detail for the mesh, using edge collapses with quadric error metrics.
+    Each level has about `reduction` times as many triangles as the one before it.
+    max_error is the most error allowed per level, relative to the size of the mesh.
+    Like optimizeMesh, this is slow, so do it before serializing
+    */
+    void generateLODs(Resources::ResourceRef<MeshRes> mesh, int max_levels = 4, float reduction = 0.5f, float max_error = 0.02f);
+
+    /**
+    Picks the level of detail to draw a mesh with, using how big its error would be on the screen.
+    distance is the distance from the camera, scale is the biggest scale of the mesh,
+    projection_scale is projection[1][1] and screen_height is in pixels.
+    To avoid popping, it only goes to a less detailed level once it's well under the error threshold
+    */
+    int selectLOD(MeshRes* mesh, int current_lod, float distance, float scale, float projection_scale, float screen_height);
+
+    /**
+    Splits the full mesh into meshlets of up to max_triangles triangles, which the renderer can cull against the frustum,
+    and by which way they face. Triangles are grown out from their neighbours, preferring ones that face the same way.
+    This reorders the indices, so it has to be run after anything else that does. optimizeMesh does it for big meshes
+    */
+    void buildMeshlets(Resources::ResourceRef<MeshRes> mesh, uint32_t max_triangles = FLUX_MESHLET_TRIANGLES);
+
+    /**
+    Gets the 6 planes of the frustum of a matrix, as (normal, distance), with the normals pointing in.
+    With a model_view_projection matrix, they're in model space
+    */
+    void getFrustumPlanes(const glm::mat4& matrix, glm::vec4 planes[6]);
+
+    /**
+    Returns false if the meshlet is definitely outside the planes, or facing away from the camera.
+    The planes and camera position have to be in model space
+    */
+    bool isMeshletVisible(const Meshlet& meshlet, const glm::vec4 planes[6], const glm::vec3& camera_position);
+
+    /**
+    Adds the ranges of indices that need to be drawn to the end of ranges, as (offset, count) in indices.
+    Visible meshlets next to each other are merged into one range. Returns how many meshlets were culled
+    */
+    uint32_t cullMeshlets(const MeshRes* mesh, const glm::mat4& model_view_projection, const glm::vec3& camera_position, std::vector<glm::uvec2>& ranges);
+
+    /**
+    Runs all of the mesh optimizations, in the right order.
+    This is slow, so it should be done before the mesh gets serialized, not at runtime
+    */
+    void optimizeMesh(Resources::ResourceRef<MeshRes> mesh);
+
     enum UniformType
     {
         Int, Float, Vector2, Vector3, Vector4, Mat4, Bool, Texture
     };
 
-    struct Uniform
+    /** Size of a uniform type in a std140 block */
+    uint32_t getStd140Size(UniformType type);
+
+    /** Alignment of a uniform type in a std140 block */
+    uint32_t getStd140Alignment(UniformType type);
+
+    /**
+    A uniform in a material's uniform block
+    */
+    struct MaterialParam
     {
-        int location;
+        std::string name;
         UniformType type;
-        void* value;
+
+        /** Where the value is in the block */
+        uint32_t offset;
     };
 
     struct ShaderRes;
@@ -185,6 +809,9 @@ namespace Flux { namespace Renderer {
     */
     Resources::ResourceRef<ShaderRes> createShaderResource(const std::string& vert, const std::string& frag);
 
+    /** FNV-1a hash of some bytes. Pass the last result in as hash to keep going */
+    uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull);
+
     struct ShaderRes: public Resources::Resource
     {
         FLUX_RESOURCE(ShaderRes, shader);
@@ -196,6 +823,12 @@ namespace Flux { namespace Renderer {
         std::string vert_fname;
         std::string frag_fname;
 
+        /** Hash of both sources. Shaders with the same hash share a program */
+        uint64_t source_hash = 0;
+
+        /** Reads the sources from vert_fname and frag_fname, and updates the hash */
+        void load();
+
         bool serialize(Resources::Serializer* serializer, FluxArc::BinaryFile* output) override
         {
             output->set(vert_fname);
@@ -209,16 +842,38 @@ namespace Flux { namespace Renderer {
             vert_fname = file->get();
             frag_fname = file->get();
 
-            // Yes, this is basically the worst way possible to do this
-            // _but I don't care_
-            auto res = createShaderResource(vert_fname, frag_fname);
-            vert_src = res->vert_src;
-            frag_src = res->frag_src;
-
-            // Resources::removeResource(res);
+            load();
         };
     };
 
+    /**
+    Format of a texture's data
+    */
+    enum class TextureFormat: uint8_t
+    {
+        /** Uncompressed, 4 bytes a pixel */
+        RGBA8,
+        /** ETC2 RGB, 8 bytes per 4x4 block */
+        ETC2_RGB8,
+        /** ETC2 RGB with EAC alpha, 16 bytes per 4x4 block */
+        ETC2_RGBA8
+    };
+
+    /**
+    How a texture is stored in an archive
+    */
+    enum TextureStorage
+    {
+        /** Reference to an image file */
+        External = 0,
+        /** Raw RGBA8 data */
+        Internal = 1,
+        /** Pre-generated mips, possibly compressed. See TextureRes::cook */
+        Cooked = 2,
+        /** Several layers of the same size. See buildTextureArrays */
+        Array = 3
+    };
+
     /**
     Texture Resource. Can either reference an internal file, or an external one
     */
@@ -238,6 +893,21 @@ namespace Flux { namespace Renderer {
         /** Once the renderer has processed the texture, the data will be freed */
         bool processed = false;
 
+        /** The format of image_data */
+        TextureFormat format = TextureFormat::RGBA8;
+
+        /**
+        Size of each mip level in image_data, in bytes. They are stored one after the other.
+        This is empty unless the texture has been cooked
+        */
+        std::vector<uint32_t> mip_sizes;
+
+        /**
+        Texture arrays have more than one layer. Each mip level holds every layer, one after the other,
+        and the sizes in mip_sizes are for all the layers together
+        */
+        uint32_t layers = 1;
+
         bool serialize(Resources::Serializer* serializer, FluxArc::BinaryFile* output) override
         {
             if (processed && internal && image_data == nullptr)
@@ -260,6 +930,48 @@ namespace Flux { namespace Renderer {
                 return false;
             }
 
+            if (layers > 1)
+            {
+                // Arrays are always stored in the archive too
+                // Arrays that weren't cooked have no mip sizes
+                output->set((uint8_t)TextureStorage::Array);
+                output->set((uint8_t)format);
+                output->set(width);
+                output->set(height);
+                output->set(layers);
+
+                output->set((uint32_t)mip_sizes.size());
+                for (auto size : mip_sizes)
+                {
+                    output->set(size);
+                }
+
+                output->set(image_data_size);
+                output->set((char*)image_data, image_data_size);
+
+                return true;
+            }
+
+            if (!mip_sizes.empty())
+            {
+                // Cooked textures are always stored in the archive
+                output->set((uint8_t)TextureStorage::Cooked);
+                output->set((uint8_t)format);
+                output->set(width);
+                output->set(height);
+
+                output->set((uint32_t)mip_sizes.size());
+                for (auto size : mip_sizes)
+                {
+                    output->set(size);
+                }
+
+                output->set(image_data_size);
+                output->set((char*)image_data, image_data_size);
+
+                return true;
+            }
+
             output->set(internal);
 
             if (!internal)
@@ -280,7 +992,40 @@ namespace Flux { namespace Renderer {
 
         void deserialize(Resources::Deserializer* deserializer, FluxArc::BinaryFile* file) override
         {
-            file->get(&internal);
+            // This used to be a bool, so 0 and 1 still mean the same thing
+            uint8_t storage;
+            file->get(&storage);
+            internal = storage != TextureStorage::External;
+
+            if (storage == TextureStorage::Cooked || storage == TextureStorage::Array)
+            {
+                uint8_t f;
+                file->get(&f);
+                format = (TextureFormat)f;
+
+                file->get(&width);
+                file->get(&height);
+
+                layers = 1;
+                if (storage == TextureStorage::Array)
+                {
+                    file->get(&layers);
+                }
+
+                uint32_t mip_count;
+                file->get(&mip_count);
+                mip_sizes.resize(mip_count);
+                for (int i = 0; i < mip_count; i++)
+                {
+                    file->get(&mip_sizes[i]);
+                }
+
+                file->get(&image_data_size);
+                image_data = new unsigned char[image_data_size];
+                file->get((char*)image_data, image_data_size);
+
+                return;
+            }
 
             if (!internal)
             {
@@ -301,13 +1046,52 @@ namespace Flux { namespace Renderer {
 
         void loadImage(const std::string& filename);
 
-        void destroy();
+        /**
+        Generates mips and compresses the texture, so it can go straight to the gpu.
+        This is slow, so it should be done before serializing, not at runtime.
+        The cooked texture is always stored in the archive
+        */
+        void cook(TextureFormat format = TextureFormat::ETC2_RGBA8, bool generate_mips = true);
+
+        /**
+        Turns a compressed texture back into RGBA8, for when the gpu doesn't support the format
+        */
+        void decompress();
+
+        /** Width of a mip level */
+        uint32_t getMipWidth(int level) const { return std::max(width >> level, (uint32_t)1); }
+
+        /** Height of a mip level */
+        uint32_t getMipHeight(int level) const { return std::max(height >> level, (uint32_t)1); }
+
+        void destroy();
+
+        ~TextureRes()
+        {
+            destroy();
+        }
+    };
+
+    /**
+    Decodes compressed mips, laid out like TextureRes::image_data, into RGBA8. See TextureRes::decompress.
+    mip_sizes is changed to the size of each decoded level. Returns false if some blocks couldn't be decoded
+    */
+    bool decompressMips(const unsigned char* data, std::vector<uint32_t>& mip_sizes, uint32_t width, uint32_t height, uint32_t layers, TextureFormat format, std::vector<unsigned char>& decoded);
+
+    /**
+    A texture used by a material. Textures can't go in uniform blocks, so they're kept seperately
+    */
+    struct MaterialTexture
+    {
+        std::string name;
+        Resources::ResourceRef<TextureRes> texture;
+    };
+
+    /** Offset for uniforms that the shader doesn't use. See MaterialRes::relayout */
+    #define FLUX_UNUSED_UNIFORM 0xFFFFFFFF
 
-        ~TextureRes()
-        {
-            destroy();
-        }
-    };
+    /** Set in a serialized material's uniform count if it uses the depth pre-pass */
+    #define FLUX_MATERIAL_DEPTH_PREPASS_BIT 0x80000000u
 
     /**
     Material Resource
@@ -317,132 +1101,87 @@ namespace Flux { namespace Renderer {
         FLUX_RESOURCE(MaterialRes, material);
 
         Resources::ResourceRef<ShaderRes> shaders;
-        std::map<std::string, Uniform> uniforms;
+
+        /**
+        The values of all the uniforms, laid out with the std140 rules.
+        Once the renderer has seen the shader, the layout matches its uniform block exactly, so it can be uploaded in one go
+        */
+        std::vector<unsigned char> block;
+        std::vector<MaterialParam> params;
+        std::vector<MaterialTexture> textures;
+
+        /** Set when a value changes, so the renderer knows to upload the block again */
         bool changed;
 
+        /** Set when a uniform or texture is added, so the renderer knows to match it to the shader again */
+        bool layout_changed = true;
+
         bool has_texture = false;
         Resources::ResourceRef<TextureRes> diffuse_texture;
 
-        ~MaterialRes()
-        {
-            // Deallocate uniforms
-            for (auto i : uniforms)
-            {
-                switch (i.second.type)
-                {
-                    case (UniformType::Bool):
-                        delete (bool*)i.second.value;
-                        break;
-                    
-                    case (UniformType::Float):
-                        delete (float*)i.second.value;
-                        break;
-
-                    case (UniformType::Int):
-                        delete (int*)i.second.value;
-                        break;
-
-                    case (UniformType::Mat4):
-                        delete (glm::mat4*)i.second.value;
-                        break;
-                    
-                    case (UniformType::Vector2):
-                        delete (glm::vec2*)i.second.value;
-                        break;
-                    
-                    case (UniformType::Vector3):
-                        delete (glm::vec3*)i.second.value;
-                        break;
-
-                    case (UniformType::Vector4):
-                        delete (glm::vec4*)i.second.value;
-                        break;
-                    
-                    case (UniformType::Texture):
-                        // No need
-                        break;
-                }
-            }
-        }
+        /**
+        Lay down the depth of everything with this material first, with a depth-only shader, so the real shader only runs once per pixel.
+        Worth it for expensive shaders. The shader has to work out gl_Position as `model_view_projection * vec4(position, 1.0)`,
+        or the depths won't match exactly and pixels will go missing. gl_Position is made `invariant` when the shader is compiled
+        */
+        bool depth_prepass = false;
+
+        /** Index of the uniform in params, or -1 if there isn't one */
+        int findParam(const std::string& name) const;
+
+        /** Copies a value into the block, adding the uniform if it doesn't exist */
+        void setParam(const std::string& name, UniformType type, const void* value);
+
+        void setTexture(const std::string& name, Resources::ResourceRef<TextureRes> texture);
+
+        /**
+        Moves every uniform to a new offset, in the same order as params.
+        Uniforms with FLUX_UNUSED_UNIFORM are put after the end of the block.
+        */
+        void relayout(const std::vector<uint32_t>& offsets, uint32_t block_size);
 
         bool serialize(Resources::Serializer* serializer, FluxArc::BinaryFile* output) override
         {
             output->set(serializer->addResource(Resources::ResourceRef<Resources::Resource>(shaders.getBaseEntity())));
-            output->set((uint32_t)uniforms.size());
+            // The pre-pass flag goes in the top bit of the count, so older files still load
+            output->set((uint32_t)(params.size() + textures.size()) | (depth_prepass ? FLUX_MATERIAL_DEPTH_PREPASS_BIT : 0));
             changed = true;
 
-            for (auto i : uniforms)
+            for (auto& param : params)
             {
-                output->set(i.first);
-                output->set(i.second.type);
-                switch (i.second.type)
+                output->set(param.name);
+                output->set(param.type);
+
+                auto value = block.data() + param.offset;
+                switch (param.type)
                 {
                 case (Int):
-                    output->set(*((int32_t*)i.second.value));
-                    break;
-                
-                case (Float):
-                    output->set(*((float*)i.second.value));
+                    output->set(*((int32_t*)value));
                     break;
 
                 case (Bool):
-                    output->set(*((bool*)i.second.value));
-                    break;
-                
-                case (Vector2):
-                    output->set(((glm::vec2*)i.second.value)->x);
-                    output->set(((glm::vec2*)i.second.value)->y);
-                    break;
-                
-                case (Vector3):
-                    output->set(((glm::vec3*)i.second.value)->x);
-                    output->set(((glm::vec3*)i.second.value)->y);
-                    output->set(((glm::vec3*)i.second.value)->z);
+                    output->set(*((int32_t*)value) != 0);
                     break;
 
-                case (Vector4):
-                    output->set(((glm::vec4*)i.second.value)->x);
-                    output->set(((glm::vec4*)i.second.value)->y);
-                    output->set(((glm::vec4*)i.second.value)->z);
-                    output->set(((glm::vec4*)i.second.value)->w);
+                case (Texture):
                     break;
 
-                case (Mat4):
-                    // Oh Boy...
-                    output->set((*((glm::mat4*)i.second.value))[0][0]);
-                    output->set((*((glm::mat4*)i.second.value))[0][1]);
-                    output->set((*((glm::mat4*)i.second.value))[0][2]);
-                    output->set((*((glm::mat4*)i.second.value))[0][3]);
-
-                    output->set((*((glm::mat4*)i.second.value))[1][0]);
-                    output->set((*((glm::mat4*)i.second.value))[1][1]);
-                    output->set((*((glm::mat4*)i.second.value))[1][2]);
-                    output->set((*((glm::mat4*)i.second.value))[1][3]);
-
-                    output->set((*((glm::mat4*)i.second.value))[2][0]);
-                    output->set((*((glm::mat4*)i.second.value))[2][1]);
-                    output->set((*((glm::mat4*)i.second.value))[2][2]);
-                    output->set((*((glm::mat4*)i.second.value))[2][3]);
-
-                    output->set((*((glm::mat4*)i.second.value))[3][0]);
-                    output->set((*((glm::mat4*)i.second.value))[3][1]);
-                    output->set((*((glm::mat4*)i.second.value))[3][2]);
-                    output->set((*((glm::mat4*)i.second.value))[3][3]);
-                    break;
-                
-                case (Texture):
-                    output->set(serializer->addResource(((Resources::ResourceRef<TextureRes>*)i.second.value)->getBaseEntity()));
+                default:
+                    // Everything else is just floats
+                    for (int i = 0; i < getStd140Size(param.type) / sizeof(float); i++)
+                    {
+                        output->set(((float*)value)[i]);
+                    }
                     break;
                 }
             }
 
-            // Textures
-            // output->set(has_texture);
-
-            // if (has_texture)
-            // {
-            //     output->set(serializer->addResource(diffuse_texture.getBaseEntity()));
-            // }
+            for (auto& tex : textures)
+            {
+                output->set(tex.name);
+                output->set(Texture);
+                output->set(serializer->addResource(tex.texture.getBaseEntity()));
+            }
 
             return true;
         };
@@ -456,94 +1195,47 @@ namespace Flux { namespace Renderer {
             uint32_t size;
             file->get(&size);
 
+            depth_prepass = (size & FLUX_MATERIAL_DEPTH_PREPASS_BIT) != 0;
+            size &= ~FLUX_MATERIAL_DEPTH_PREPASS_BIT;
+
             for (int i = 0; i < size; i++)
             {
                 std::string name = file->get();
                 UniformType type;
                 file->get(&type);
 
-                // Variables
-                int32_t* ivalue;
-                float* fvalue;
-                bool* bvalue;
-                glm::vec2* v2value;
-                glm::vec3* v3value;
-                glm::vec4* v4value;
-                glm::mat4* mvalue;
+                // Big enough for a mat4
+                float value[16];
 
                 switch (type) {
                 case (Int):
-                    ivalue = new int32_t;
-                    file->get(ivalue);
-                    uniforms[name] = Uniform {0, type, ivalue};
-                    break;
-                
-                case (Float):
-                    fvalue = new float;
-                    file->get(fvalue);
-                    uniforms[name] = Uniform {0, type, fvalue};
+                    file->get((int32_t*)value);
+                    setParam(name, type, value);
                     break;
 
                 case (Bool):
-                    bvalue = new bool;
-                    file->get(bvalue);
-                    uniforms[name] = Uniform {0, type, bvalue};
-                    break;
-                
-                case (Vector2):
-                    v2value = new glm::vec2;
-                    file->get(&v2value->x);
-                    file->get(&v2value->y);
-                    uniforms[name] = Uniform {0, type, v2value};
-                    break;
-                
-                case (Vector3):
-                    v3value = new glm::vec3;
-                    file->get(&v3value->x);
-                    file->get(&v3value->y);
-                    file->get(&v3value->z);
-                    uniforms[name] = Uniform {0, type, v3value};
-                    break;
-
-                case (Vector4):
-                    v4value = new glm::vec4;
-                    file->get(&v4value->x);
-                    file->get(&v4value->y);
-                    file->get(&v4value->z);
-                    file->get(&v4value->w);
-                    uniforms[name] = Uniform {0, type, v4value};
-                    break;
-
-                case (Mat4):
-                    // Oh Boy...
-                    mvalue = new glm::mat4;
-                    file->get(&(*(mvalue))[0][0]);
-                    file->get(&(*(mvalue))[0][1]);
-                    file->get(&(*(mvalue))[0][2]);
-                    file->get(&(*(mvalue))[0][3]);
-
-                    file->get(&(*(mvalue))[1][0]);
-                    file->get(&(*(mvalue))[1][1]);
-                    file->get(&(*(mvalue))[1][2]);
-                    file->get(&(*(mvalue))[1][3]);
-
-                    file->get(&(*(mvalue))[2][0]);
-                    file->get(&(*(mvalue))[2][1]);
-                    file->get(&(*(mvalue))[2][2]);
-                    file->get(&(*(mvalue))[2][3]);
-
-                    file->get(&(*(mvalue))[3][0]);
-                    file->get(&(*(mvalue))[3][1]);
-                    file->get(&(*(mvalue))[3][2]);
-                    file->get(&(*(mvalue))[3][3]);
-                    uniforms[name] = Uniform {0, type, mvalue};
+                {
+                    bool bvalue;
+                    file->get(&bvalue);
+                    *((int32_t*)value) = bvalue ? 1 : 0;
+                    setParam(name, type, value);
                     break;
+                }
 
                 case (Texture):
+                {
                     uint32_t tvalue;
                     file->get(&tvalue);
-                    auto tres = new Resources::ResourceRef<TextureRes>(deserializer->getResource(tvalue));
-                    uniforms[name] = Uniform {0, type, (void*)tres};
+                    setTexture(name, deserializer->getResource(tvalue));
+                    break;
+                }
+
+                default:
+                    for (int j = 0; j < getStd140Size(type) / sizeof(float); j++)
+                    {
+                        file->get(&value[j]);
+                    }
+                    setParam(name, type, value);
                     break;
                 }
             }
@@ -616,6 +1308,15 @@ namespace Flux { namespace Renderer {
     void setUniform(Resources::ResourceRef<MaterialRes> res, const std::string& name, const bool& v);
     void setUniform(Resources::ResourceRef<MaterialRes> res, const std::string& name, Resources::ResourceRef<TextureRes> v);
 
+    /**
+    Packs the small textures used by a set of materials into texture arrays, so drawing them doesn't need as many texture binds.
+    Textures are grouped by size, format and number of mips, and each group becomes one array.
+    The materials are changed to use the array, and an int uniform called <texture name>_layer is set to the layer.
+    Only textures whose material's shader declares them as a sampler2DArray, and has the _layer uniform, are moved.
+    Like TextureRes::cook, this is slow, and should be done before serializing. Returns the new arrays
+    */
+    std::vector<Resources::ResourceRef<TextureRes>> buildTextureArrays(const std::vector<Resources::ResourceRef<MaterialRes>>& materials, uint32_t max_size = FLUX_TEXTURE_ARRAY_MAX_SIZE);
+
     /**
     Links a mesh to an entity. Takes a MeshRes, a ShaderRes, and a MaterialRes.
     Also adds a transformation component
@@ -637,6 +1338,111 @@ namespace Flux { namespace Renderer {
     */
     double getTime();
 
+    /**
+    Counters for everything the renderer did in a frame
+    */
+    struct RenderStats
+    {
+        uint32_t draw_calls = 0;
+        uint64_t triangles = 0;
+
+        /** How many times a different shader program had to be used */
+        uint32_t program_switches = 0;
+
+        /** Textures that actually had to be bound */
+        uint32_t texture_binds = 0;
+
+        /** GL calls that were skipped, because they wouldn't have changed anything */
+        uint32_t redundant_calls = 0;
+
+        /** Bytes of material data sent to uniform buffers */
+        uint64_t uniform_bytes = 0;
+
+        /** Vertex, index and uniform buffers created */
+        uint32_t buffer_creations = 0;
+
+        /** Objects with a mesh that weren't drawn, because they were hidden or culled */
+        uint32_t culled_objects = 0;
+
+        /** Objects that were drawn as impostors instead of their mesh */
+        uint32_t impostors = 0;
+
+        /** Particles drawn, from every emitter */
+        uint32_t particles = 0;
+
+        /** Meshlets that weren't drawn, because they were outside the frustum or facing away */
+        uint32_t culled_meshlets = 0;
+
+        /** Draws in the depth pre-pass. They're also counted in draw_calls */
+        uint32_t prepass_draws = 0;
+
+        /** Meshes and textures removed from the gpu to stay under the memory budget */
+        uint32_t evictions = 0;
+
+        /** Mesh and texture memory on the gpu, in bytes */
+        uint64_t gpu_memory = 0;
+
+        /** How long the whole frame took, in seconds */
+        float frame_time = 0;
+
+        /** How long the gpu took to draw the frame, in seconds. 0 if the gpu can't time itself */
+        float gpu_time = 0;
+
+        /** What the resolution was scaled by. See ResolutionGovernor */
+        float resolution_scale = 1;
+    };
+
+    /**
+    Picks how much to scale the resolution by, from how long frames are taking.
+    It doesn't touch GL, so it can be fed made up frame times to see what it does.
+    Drawing time goes up with the number of pixels, so the scale is dropped straight to the one that should fit the target.
+    It's raised a little at a time, once frames have been well under the target for FLUX_RESOLUTION_RAISE_FRAMES frames
+    */
+    class ResolutionGovernor
+    {
+    public:
+        ResolutionGovernor(float target = FLUX_TARGET_FRAME_TIME, float min_scale = FLUX_MIN_RESOLUTION_SCALE, float max_scale = 1.0f);
+
+        /**
+        Feeds in how long the last frame took, in seconds, and returns the scale for the next one.
+        Only the gpu time is scaled by. If it isn't known, pass 0, and the scale is left alone.
+        If the cpu is what's slow, a smaller resolution wouldn't help, so the scale isn't lowered
+        */
+        float update(float cpu_time, float gpu_time);
+
+        /** Goes back to full resolution, and forgets any frame times */
+        void reset();
+
+        void setTarget(float seconds) { target = seconds; }
+        void setLimits(float min, float max);
+
+        float getScale() const { return scale; }
+        float getTarget() const { return target; }
+
+        /** The frame time the governor is going by, after smoothing */
+        float getSmoothedTime() const { return smoothed_time; }
+
+    private:
+        /** Changes the scale, and guesses what the smoothed time will be at the new one */
+        void setScale(float new_scale);
+
+        float target;
+        float min_scale;
+        float max_scale;
+
+        float scale;
+        float smoothed_time;
+        bool has_time;
+
+        int frames_under;
+    };
+
+    /**
+    Returns the stats of the last full frame. With a render thread, that's the last frame it finished drawing.
+    Poll this once per frame to show it in an overlay, or to check if something made the renderer slower
+    */
+    const RenderStats& getRenderStats();
+
     enum LightType
     {
         Point = 0, Directional = 1, Spot = 2
@@ -696,29 +1502,110 @@ namespace Flux { namespace Renderer {
     };
 
     /**
-    Runtime component that tells each object which lights are interacting with it
+    Runtime component that tells each object which lights are interacting with it.
+    The lights are ranked, so the light that contributes the most to the object is first.
+    Unused slots are -1
     */
     struct LightInfoCom: public Component
     {
         FLUX_COMPONENT(LightInfoCom, LightInfoCom);
 
-        int effected_lights[8];
+        int effected_lights[FLUX_MAX_OBJECT_LIGHTS];
+    };
+
+    /**
+    World space copy of a light, refreshed once per frame by the LightSystem.
+    A light with a radius of 0 is an empty slot
+    */
+    struct LightData
+    {
+        glm::vec3 position;
+        float radius;
+
+        glm::vec3 direction;
+        LightType type;
+
+        glm::vec3 color;
+        float cutoff;
     };
 
-    // extern EntityRef lights[128];
-    // extern std::vector<int> lights_that_changed;
+    /**
+    Froxel (frustum voxel) light assignment.
+    The view frustum is split into FLUX_CLUSTERS_X * FLUX_CLUSTERS_Y screen tiles,
+    and FLUX_CLUSTERS_Z exponential depth slices.
+    Each cluster stores where its lights start in `light_indices`, and how many there are.
+    Lights in a cluster are ranked, most important first.
+    Directional lights reach every cluster, so they're kept at the start of `light_indices` instead of in each cluster's list
+    */
+    struct ClusterGrid
+    {
+        /** Pairs of (offset, count), one pair per cluster. Cluster index is x + y * FLUX_CLUSTERS_X + z * FLUX_CLUSTERS_X * FLUX_CLUSTERS_Y */
+        std::vector<uint32_t> clusters;
+
+        /** Compact list of light indices, referenced by `clusters` */
+        std::vector<uint32_t> light_indices;
+
+        /** The first directional_count entries of light_indices are the directional lights */
+        uint32_t directional_count = 0;
+
+        float near;
+        float far;
+
+        /** Slice = floor(log(view_depth) * depth_scale + depth_bias) */
+        float depth_scale;
+        float depth_bias;
+    };
 
     class LightSystem: public System
     {
     public:
-        EntityRef lights[128];
+        /** Every light known to the renderer. A light's index in this vector is also its index on the GPU */
+        std::vector<EntityRef> lights;
+
+        /** World space data of every light, indexed the same way as `lights` */
+        std::vector<LightData> light_data;
+
         std::vector<int> lights_that_changed;
         std::vector<EntityRef> new_lights;
 
+        /** Clusters built by the last call to buildClusters */
+        ClusterGrid clusters;
+
         LightSystem();
         void onSystemStart() override;
         void runSystem(EntityRef entity, float delta) override;
+
+        /**
+        Assigns every light to the clusters of the given view.
+        Should be called once per frame, after the light system has run
+        */
+        void buildClusters(const glm::mat4& view, const glm::mat4& projection, float near, float far);
+
+        /**
+        Estimates how much the given light contributes to a box in world space.
+        Used to rank lights, so it's relative, not physically accurate
+        */
+        float getContribution(int light, const glm::vec3& min_pos, const glm::vec3& max_pos) const;
+
     private:
+        /** Puts all the lights in the world space grid */
+        void buildGrid();
+
+        /** Finds the most important lights for a box */
+        void assignLights(const glm::vec3& min_pos, const glm::vec3& max_pos, LightInfoCom* lightinfo);
+
+        /** Uniform grid of light indices, keyed by packed cell coordinates */
+        std::unordered_map<uint64_t, std::vector<int>> grid;
+
+        /** Lights that are too big for the grid (and directional lights) */
+        std::vector<int> global_lights;
+
+        /** Used to avoid testing a light twice per query */
+        std::vector<uint32_t> light_stamps;
+        uint32_t current_stamp;
+
+        /** Lights have moved, so every object needs to be re-assigned */
+        bool grid_changed;
     };
 
     /** Turns the given entity into a point light. The entity must have a transformation */
@@ -730,6 +1617,292 @@ namespace Flux { namespace Renderer {
     /** Turns the given entity into a spot light. The entity must have a transformation */
     void addSpotLight(EntityRef entity, float cutoff_radians, float radius, glm::vec3 color);
 
+    // ===================================================
+    // Occlusion culling
+    // ===================================================
+
+    /**
+    Marks an entity's mesh as an occluder, so it gets drawn into the occlusion buffer.
+    Big, simple, solid things like walls and buildings make the best occluders.
+    If the mesh has levels of detail, the least detailed one is used
+    */
+    struct OccluderCom: public Component
+    {
+        FLUX_COMPONENT(OccluderCom, OccluderCom);
+
+        bool serialize(Resources::Serializer *serializer, FluxArc::BinaryFile *output) override
+        {
+            // There's nothing in it, it just has to be there
+            return true;
+        }
+
+        void deserialize(Resources::Deserializer *deserializer, FluxArc::BinaryFile *file) override {}
+    };
+
+    /**
+    A small depth buffer on the cpu, that occluders are rasterized into.
+    Boxes can then be tested against it, to find out if they're completely hidden.
+    8x8 tiles keep their furthest depth, so most tests don't have to look at every pixel.
+    Uses SSE when it's there, and does the same thing one pixel at a time when it isn't
+    */
+    class OcclusionBuffer
+    {
+    public:
+        OcclusionBuffer(int width = FLUX_OCCLUSION_WIDTH, int height = FLUX_OCCLUSION_HEIGHT);
+
+        /** Empties the buffer, and sets the camera for everything drawn or tested until the next clear */
+        void clear(const glm::mat4& view_projection);
+
+        /** Rasterizes a triangle list. Back faces, lines and triangles that cross the near plane are skipped */
+        void drawTriangles(const glm::mat4& model, const Vertex* vertices, const uint32_t* indices, uint32_t index_count);
+
+        /** Rasterizes a mesh, using its least detailed level */
+        void drawMesh(const glm::mat4& model, MeshRes* mesh);
+
+        /** Builds the tiles. Has to be called after drawing, and before testing */
+        void finish();
+
+        /**
+        Returns false if a world space box is completely behind the occluders, or completely off screen.
+        Boxes that cross the near plane are always visible
+        */
+        bool isVisible(const glm::vec3& min_pos, const glm::vec3& max_pos) const;
+
+        /** Depth of a pixel, from -1 (near plane) to 1 (far plane, or nothing) */
+        float getDepth(int x, int y) const { return depth[x + y * width]; }
+
+        int getWidth() const { return width; }
+        int getHeight() const { return height; }
+
+        /** Triangles actually rasterized since the last clear */
+        uint32_t getTrianglesDrawn() const { return triangles_drawn; }
+
+    private:
+        void drawTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c);
+
+        int width;
+        int height;
+        int tiles_x;
+        int tiles_y;
+
+        glm::mat4 view_projection;
+
+        std::vector<float> depth;
+
+        /** The furthest depth in each 8x8 tile */
+        std::vector<float> tile_depth;
+
+        uint32_t triangles_drawn;
+    };
+
+    // ===================================================
+    // Potentially visible sets
+    // ===================================================
+
+    /**
+    Precomputed visibility for indoor levels. The level's bounds are split into a grid of cells,
+    and each cell has a bitset of every cell that can be seen from somewhere inside it.
+    The bitsets are run-length compressed, since most of a corridor-heavy level can't be seen from any one place.
+    It's built offline with build(), and saved into the scene archive by Serializer::setPVS
+    */
+    class PVS
+    {
+    public:
+        /**
+        Builds the sets from the meshes in entities. Only entities with an OccluderCom block anything.
+        From the middle and corners of each cell, the occluders are drawn into an OcclusionBuffer in 6 directions,
+        and every cell that shows up in any of them can be seen. Cells that see each other both get marked, so it's a bit more forgiving.
+        The points are only samples, so very thin gaps can be missed. Returns false if there was nothing to build from, or too many cells
+        */
+        bool build(const std::vector<EntityRef>& entities, float cell_size = FLUX_PVS_CELL_SIZE);
+
+        /** Index of the cell a point is in, or -1 if it's outside the grid */
+        int findCell(const glm::vec3& position) const;
+
+        /** Returns true if cell `to` can be seen from cell `from` */
+        bool isCellVisible(int from, int to);
+
+        /**
+        Returns true if any of the cells a world space box touches can be seen from cell `from`.
+        Boxes that reach outside the grid are always visible, since nothing is known about them
+        */
+        bool isVisible(int from, const glm::vec3& min_pos, const glm::vec3& max_pos);
+
+        void save(FluxArc::BinaryFile* file) const;
+        bool load(FluxArc::BinaryFile* file);
+
+        int getCellCount() const { return size_x * size_y * size_z; }
+
+        /** Bytes used by the compressed sets */
+        size_t getCompressedSize() const;
+
+    private:
+        /** Decompresses a cell's set. The last one is kept, since the camera doesn't change cells often */
+        const std::vector<uint8_t>& getRow(int from);
+
+        glm::vec3 origin = glm::vec3(0);
+        float cell_size = FLUX_PVS_CELL_SIZE;
+        int size_x = 0;
+        int size_y = 0;
+        int size_z = 0;
+
+        /** Each cell's set, one bit per cell. Runs of zero bytes are stored as a 0, then how many there are */
+        std::vector<std::vector<uint8_t>> rows;
+
+        int cached_row = -1;
+        std::vector<uint8_t> row;
+    };
+
+    /** Sets the PVS the occlusion system uses. Loading a scene with one in it does this automatically. nullptr turns it off */
+    void setPVS(PVS* pvs);
+
+    /** The PVS being used, or nullptr */
+    PVS* getPVS();
+
+    /**
+    Finds the occluders each frame, so the renderer can draw them into the buffer before drawing anything else.
+    Entities need a Physics::BoundingCom (or to be a static batch) to be culled, since that's where their box comes from
+    */
+    class OcclusionSystem: public System
+    {
+    public:
+        OcclusionBuffer buffer;
+
+        /** Set to false to turn occlusion culling off */
+        bool enabled = true;
+
+        /** Set to false to ignore the PVS, even if there is one */
+        bool use_pvs = true;
+
+        void onSystemStart() override;
+        void runSystem(EntityRef entity, float delta) override;
+
+        /**
+        Draws all the occluders from the camera's point of view.
+        Should be called once per frame, after the occlusion system has run
+        */
+        void buildBuffer(const glm::mat4& view, const glm::mat4& projection);
+
+        /**
+        Returns false if the entity is definitely hidden.
+        The PVS is checked first, since it's much cheaper. Occluders are never hidden by the buffer, but can be by the PVS
+        */
+        bool isVisible(EntityRef entity);
+
+    private:
+        std::vector<EntityRef> occluders;
+        bool has_buffer = false;
+
+        /** The camera's cell in the PVS, or -1 */
+        int pvs_cell = -1;
+    };
+
+    // ===================================================
+    // Static batching
+    // ===================================================
+
+    /**
+    Marks an entity as never moving, so its mesh can be merged with others that use the same material.
+    Static entities shouldn't be moved, hidden or have their mesh changed once they're batched
+    */
+    struct StaticCom: public Component
+    {
+        FLUX_COMPONENT(StaticCom, StaticCom);
+
+        /** Set once the mesh is part of a batch. The entity isn't drawn by itself after that */
+        bool batched = false;
+
+        bool serialize(Resources::Serializer *serializer, FluxArc::BinaryFile *output) override
+        {
+            // Batches are made again when the scene is loaded
+            return true;
+        }
+
+        void deserialize(Resources::Deserializer *deserializer, FluxArc::BinaryFile *file) override {}
+    };
+
+    /**
+    Runtime component on the entities batchStatic creates.
+    Batches are rebuilt every time the scene is loaded, so this isn't serialized
+    */
+    struct StaticBatchCom: public Component
+    {
+        FLUX_COMPONENT(StaticBatchCom, StaticBatchCom);
+
+        /** World space bounds of everything in the batch, for culling */
+        glm::vec3 min_pos;
+        glm::vec3 max_pos;
+
+        /** The entities that were merged into this batch */
+        std::vector<EntityRef> sources;
+    };
+
+    /**
+    Merges the meshes of static entities that share a material into a few big meshes.
+    The vertices are moved into world space, and entities are grouped by FLUX_STATIC_BATCH_CELL_SIZE cells.
+    Only entities with a StaticCom are batched. Returns the new batch entities.
+    Scenes loaded with Deserializer::addToECS(ctx, true) call this once they're loaded
+    */
+    std::vector<EntityRef> batchStatic(const std::vector<EntityRef>& entities);
+
+    // ===================================================
+    // Impostors
+    // ===================================================
+
+    /**
+    Lets the renderer draw an entity as a camera-facing quad once it's far away, instead of its mesh.
+    The quad shows a picture of the mesh from whichever of the FLUX_IMPOSTOR_VIEWS angles is closest to the camera.
+    The pictures are made by buildImpostors when the scene is loaded, so only the marker itself is serialized.
+    Works best on static props that are only ever turned around the up axis, like trees and rocks
+    */
+    struct ImpostorCom: public Component
+    {
+        FLUX_COMPONENT(ImpostorCom, ImpostorCom);
+
+        /** Every view, side by side from left to right. Empty until the impostor has been baked */
+        Resources::ResourceRef<TextureRes> atlas;
+        uint32_t views = 0;
+
+        /** Middle of the mesh's bounds, in model space */
+        glm::vec3 center = glm::vec3(0);
+
+        /** Half the width and height of the quad, in model space */
+        float radius = 0;
+        float half_height = 0;
+
+        /** Whether the impostor was drawn last frame, so it doesn't flicker between the two */
+        bool showing = false;
+
+        bool serialize(Resources::Serializer *serializer, FluxArc::BinaryFile *output) override
+        {
+            // The atlas is baked again when the scene is loaded
+            return true;
+        }
+
+        void deserialize(Resources::Deserializer *deserializer, FluxArc::BinaryFile *file) override {}
+    };
+
+    /**
+    Renders a mesh from `views` angles around the up axis on the cpu, and puts the pictures in the impostor's atlas.
+    The colour comes from the material's diffuse texture (or its first texture), with some simple lighting from above.
+    Returns false if the mesh can't be baked, like if it isn't made of triangles
+    */
+    bool bakeImpostor(ImpostorCom* impostor, MeshRes* mesh, MaterialRes* material, uint32_t views = FLUX_IMPOSTOR_VIEWS, uint32_t view_size = FLUX_IMPOSTOR_VIEW_SIZE);
+
+    /**
+    Bakes the impostors of every entity with an ImpostorCom and a mesh.
+    Entities that share a mesh and material share an atlas.
+    Scenes loaded with Deserializer::addToECS(ctx, true) call this before static batching. Impostors are never batched
+    */
+    void buildImpostors(const std::vector<EntityRef>& entities);
+
+    /**
+    Decides if an impostor should be drawn instead of the mesh, and remembers it in impostor->showing.
+    That only happens once the mesh is at its least detailed level, and shorter than FLUX_IMPOSTOR_PIXELS on screen.
+    The arguments are the same as selectLOD's
+    */
+    bool selectImpostor(ImpostorCom* impostor, MeshRes* mesh, float distance, float scale, float projection_scale, float screen_height);
+
 }
 
 namespace Transform
@@ -1015,6 +2188,9 @@ namespace Transform
     /** Helper variable for the renderer that says the global position of the camera */
     extern glm::vec3 camera_position;
 
+    /** Helper variable for the renderer that holds the current camera's view matrix */
+    extern glm::mat4 camera_view;
+
     class CameraSystem: public System
     {
         void runSystem(EntityRef entity, float delta) override;
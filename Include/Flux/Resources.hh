@@ -28,6 +28,10 @@ std::string _flux_res_get_name() override { return #name;}\
 static inline bool _flux_res_registered = \
 Flux::Resources::registerResource(#name, (Flux::Resources::Resource*(*)())&type::_flux_res_create)
 
+namespace Flux { namespace Renderer {
+    class PVS;
+}}
+
 namespace Flux { namespace Resources {
 
     typedef int ResourceID;
@@ -138,7 +142,12 @@ namespace Flux { namespace Resources {
         /** Saves the Entities and Resources to a file */
         void save(FluxArc::Archive& arc, bool release);
 
+        /** Saves a potentially visible set with the scene. It's loaded again with the scene, and used straight away */
+        void setPVS(Renderer::PVS* pvs) { this->pvs = pvs; }
+
     private:
+        Renderer::PVS* pvs = nullptr;
+
         std::vector<EntityRef> entities;
         std::vector<ResourceRef<Resource>> resources;
         std::vector<uint32_t> resource_ihids;
@@ -161,8 +170,18 @@ namespace Flux { namespace Resources {
         Deserializer(const std::string& filename, bool unlinked_res);
         ~Deserializer();
 
-        /** Add all of the Entities from the file to an ECSCtx. Returns a vector if EntityRefs */
-        std::vector<EntityRef> addToECS(ECSCtx* ctx);
+        /**
+        Add all of the Entities from the file to an ECSCtx. Returns a vector if EntityRefs.
+        If prepare_static is true, impostors are built and static meshes are batched once everything
+        (including linked scenes) is loaded. See Renderer::buildImpostors and Renderer::batchStatic
+        */
+        std::vector<EntityRef> addToECS(ECSCtx* ctx, bool prepare_static = false);
+
+        /** Returns the entities linked scenes added during the last addToECS, including the scenes they linked */
+        const std::vector<EntityRef>& getLinkedEntities() const
+        {
+            return linked_entities;
+        }
 
         /** Get a resource from the deserializer */
         ResourceRef<Resource> getResource(uint32_t id);
@@ -182,6 +201,13 @@ namespace Flux { namespace Resources {
         /** Destroyes all the resources loaded in by this Deserializer */
         void destroyResources();
 
+        /**
+        Reads a resource's data back out of the archive, into the resource that's already there.
+        This is for resources that free their data once they're done with it, like textures on the gpu.
+        Returns false if the resource didn't come from this file
+        */
+        bool reloadResource(EntityRef resource);
+
         // Functions for ResourceRefs
         void addRef();
         void subRef();
@@ -195,6 +221,7 @@ namespace Flux { namespace Resources {
 
         std::vector<bool> entity_done;
         std::vector<EntityRef> entitys;
+        std::vector<EntityRef> linked_entities;
         ECSCtx* current_ctx;
 
         std::filesystem::path dir;
@@ -207,6 +234,9 @@ namespace Flux { namespace Resources {
 
         /** Bool to make sure it doesn't free itself before it's even fully loaded */
         bool created;
+
+        /** The scene's potentially visible set, if it has one */
+        Renderer::PVS* pvs = nullptr;
     };
 
     /**
@@ -217,9 +247,10 @@ namespace Flux { namespace Resources {
     void createSceneLink(EntityRef entity, const std::string& scene);
 
     /**
-    Instanciate a scene link
+    Instanciate a scene link.
+    Returns every entity it added, including the ones from scenes the linked scene links to
     */
-    void instanciateSceneLink(EntityRef entity);
+    std::vector<EntityRef> instanciateSceneLink(EntityRef entity);
 
     /**
     Component that instanciates another scene.
@@ -3,6 +3,13 @@
 
 #include "Flux/ECS.hh"
 
+// STL
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 namespace Flux { namespace Threads
 {
     /**
@@ -50,6 +57,44 @@ namespace Flux { namespace Threads
     /** Waits until the worker threads are done processing the given system */
     void waitForThreads(ThreadCtx* tctx);
 
+    /**
+    A few threads that split a loop between them, for systems with lots of things that don't depend on each other.
+    The ECS doesn't run threaded systems at the moment, so systems collect what they need in runSystem,
+    and hand it to one of these in onSystemEnd.
+    The threads are started the first time they're needed, and sleep in between
+    */
+    class WorkerPool
+    {
+    public:
+        /** thread_count is on top of the calling thread, which always does a part too. 0 does everything on the calling thread */
+        WorkerPool(int thread_count);
+        ~WorkerPool();
+
+        /**
+        Splits 0 to count into one part for each worker, and one for the calling thread, then waits for them all.
+        Each part starts on a multiple of grain, so if count is a multiple of grain, they all are
+        */
+        void run(uint32_t count, const std::function<void(uint32_t, uint32_t)>& function, uint32_t grain = 1);
+
+    private:
+        void start();
+        void doPart(int part, const std::function<void(uint32_t, uint32_t)>& function, uint32_t count, uint32_t grain);
+        void workerMain(int part);
+
+        int thread_count;
+        std::vector<std::thread> threads;
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::condition_variable finished;
+
+        const std::function<void(uint32_t, uint32_t)>* job = nullptr;
+        uint32_t job_count = 0;
+        uint32_t job_grain = 1;
+        uint64_t generation = 0;
+        size_t remaining = 0;
+        bool running = false;
+    };
+
 } }
 
 #endif
\ No newline at end of file
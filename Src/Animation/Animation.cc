@@ -0,0 +1,339 @@
+#include "Flux/Animation.hh"
+#include "Flux/ECS.hh"
+#include "Flux/Log.hh"
+#include "Flux/Renderer.hh"
+#include "Flux/Resources.hh"
+#include "Flux/Threads.hh"
+
+#include <glm/glm.hpp>
+
+// STL includes
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace Flux;
+
+// =========================================================
+// Bones
+// =========================================================
+
+glm::mat4 Animation::BoneTransform::toMatrix() const
+{
+    // Rotation matrix from the quaternion, with the scale on each column
+    float x = rotation.x, y = rotation.y, z = rotation.z, w = rotation.w;
+
+    glm::mat4 m;
+    m[0] = glm::vec4(1 - 2 * (y * y + z * z), 2 * (x * y + w * z), 2 * (x * z - w * y), 0) * scale.x;
+    m[1] = glm::vec4(2 * (x * y - w * z), 1 - 2 * (x * x + z * z), 2 * (y * z + w * x), 0) * scale.y;
+    m[2] = glm::vec4(2 * (x * z + w * y), 2 * (y * z - w * x), 1 - 2 * (x * x + y * y), 0) * scale.z;
+    m[3] = glm::vec4(translation, 1);
+
+    return m;
+}
+
+Animation::BoneTransform Animation::blend(const BoneTransform& a, const BoneTransform& b, float t)
+{
+    BoneTransform result;
+    result.translation = glm::mix(a.translation, b.translation, t);
+    result.scale = glm::mix(a.scale, b.scale, t);
+
+    float flip = glm::dot(a.rotation, b.rotation) < 0 ? -1.0f : 1.0f;
+    result.rotation = glm::normalize(a.rotation * (1 - t) + b.rotation * (t * flip));
+
+    return result;
+}
+
+int Animation::SkeletonRes::findBone(const std::string& name) const
+{
+    for (int i = 0; i < bones.size(); i++)
+    {
+        if (bones[i].name == name)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// =========================================================
+// Animators
+// =========================================================
+
+void Animation::addAnimator(EntityRef entity, Resources::ResourceRef<SkeletonRes> skeleton, SkinningMode mode)
+{
+    if (!entity.hasComponent<Renderer::MeshCom>())
+    {
+        LOG_ERROR("Animated entities need a mesh");
+        return;
+    }
+
+    auto mesh = entity.getComponent<Renderer::MeshCom>()->mesh_resource.getPtr();
+    if (mesh->skin.empty())
+    {
+        LOG_WARN("Mesh has no skin, so animating it won't do anything");
+    }
+
+    if (skeleton->bones.size() > FLUX_MAX_BONES)
+    {
+        LOG_WARN("Skeleton has more than " + std::to_string(FLUX_MAX_BONES) + " bones, the rest are ignored");
+    }
+
+    auto animator = new AnimatorCom;
+    animator->skeleton = skeleton;
+    animator->mode = mode;
+
+    entity.addComponent(animator);
+}
+
+void Animation::playAnimation(EntityRef entity, Resources::ResourceRef<AnimationRes> clip, int layer, float weight, bool loop, float speed)
+{
+    if (!entity.hasComponent<AnimatorCom>())
+    {
+        LOG_ERROR("Entity doesn't have an animator");
+        return;
+    }
+
+    if (layer < 0 || layer >= FLUX_MAX_ANIMATION_LAYERS)
+    {
+        LOG_ERROR("Animation layer " + std::to_string(layer) + " doesn't exist");
+        return;
+    }
+
+    auto& l = entity.getComponent<AnimatorCom>()->layers[layer];
+    l.clip = clip;
+    l.time = 0;
+    l.speed = speed;
+    l.weight = weight;
+    l.loop = loop;
+}
+
+// =========================================================
+// Systems
+// =========================================================
+
+void Animation::AnimationSetupSystem::runSystem(EntityRef entity, float delta)
+{
+    if (!entity.hasComponent<AnimatorCom>() || !entity.hasComponent<Renderer::MeshCom>())
+    {
+        return;
+    }
+
+    auto animator = entity.getComponent<AnimatorCom>();
+    auto skeleton = animator->skeleton.getPtr();
+    auto source = entity.getComponent<Renderer::MeshCom>()->mesh_resource.getPtr();
+    size_t bone_count = std::min(skeleton->bones.size(), (size_t)FLUX_MAX_BONES);
+
+    if (animator->parents.size() != bone_count)
+    {
+        // Poses are worked out in order, so a parent that comes after its bone wouldn't be ready yet
+        animator->parents.resize(bone_count);
+        for (size_t i = 0; i < bone_count; i++)
+        {
+            auto& bone = skeleton->bones[i];
+            animator->parents[i] = bone.parent;
+            if (bone.parent < -1 || bone.parent >= (int)i)
+            {
+                LOG_ERROR("Bone " + bone.name + " has parent " + std::to_string(bone.parent) + ", which doesn't come before it. It's animated as a root bone");
+                animator->parents[i] = -1;
+            }
+        }
+
+        // Skinning goes straight to the bone's matrix, on the gpu or the cpu, so it has to be there
+        animator->skin_valid = true;
+        for (auto& skin : source->skin)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                if (skin.weights[i] != 0 && skin.bones[i] >= bone_count)
+                {
+                    animator->skin_valid = false;
+                }
+            }
+        }
+
+        if (!animator->skin_valid)
+        {
+            LOG_ERROR("Mesh uses bones the skeleton doesn't have, so it can't be skinned");
+        }
+    }
+
+    if (animator->mode != SkinningMode::CPU || !animator->skin_valid || source->skin.empty()
+        || animator->skinned_mesh.getBaseEntity().getEntityID() != -1)
+    {
+        // Already has its copy, or doesn't need one
+        return;
+    }
+
+    // Skinning needs the real vertices
+    source->unpack();
+
+    // Only the vertices change, but dynamic meshes stream their indices too
+    auto mesh = new Renderer::MeshRes;
+    mesh->draw_mode = source->draw_mode;
+    mesh->vertices_length = source->vertices_length;
+    mesh->vertices = new Renderer::Vertex[source->vertices_length];
+    mesh->indices_length = source->indices_length;
+    mesh->indices = new uint32_t[source->indices_length];
+    std::memcpy(mesh->vertices, source->vertices, sizeof(Renderer::Vertex) * source->vertices_length);
+    std::memcpy(mesh->indices, source->indices, sizeof(uint32_t) * source->indices_length);
+
+    mesh->dynamic = true;
+    mesh->changed = true;
+
+    animator->skinned_mesh = Resources::createResource(mesh);
+}
+
+void Animation::animate(AnimatorCom* animator, Renderer::MeshCom* mesh, Transform::TransformCom* transform, float delta)
+{
+    auto skeleton = animator->skeleton.getPtr();
+    size_t bone_count = std::min(skeleton->bones.size(), (size_t)FLUX_MAX_BONES);
+    if (animator->parents.size() != bone_count)
+    {
+        // AnimationSetupSystem hasn't seen it yet
+        return;
+    }
+
+    animator->pose.resize(bone_count);
+    animator->layer_pose.resize(bone_count);
+    animator->skin_matrices.resize(bone_count);
+
+    // Everything starts at rest, and the layers go on top
+    for (size_t i = 0; i < bone_count; i++)
+    {
+        animator->pose[i] = skeleton->bones[i].rest;
+    }
+
+    for (auto& layer : animator->layers)
+    {
+        if (layer.clip.getBaseEntity().getEntityID() == -1)
+        {
+            continue;
+        }
+
+        auto clip = layer.clip.getPtr();
+
+        layer.time += delta * layer.speed;
+        if (layer.loop && clip->duration > 0)
+        {
+            layer.time = std::fmod(layer.time, clip->duration);
+            if (layer.time < 0)
+            {
+                layer.time += clip->duration;
+            }
+        }
+        else
+        {
+            layer.time = glm::clamp(layer.time, 0.0f, clip->duration);
+        }
+
+        if (layer.weight <= 0)
+        {
+            continue;
+        }
+
+        // Bones the clip doesn't have stay where they are
+        std::copy(animator->pose.begin(), animator->pose.end(), animator->layer_pose.begin());
+        clip->sample(layer.time, animator->layer_pose.data(), bone_count);
+
+        if (layer.weight >= 1)
+        {
+            std::swap(animator->pose, animator->layer_pose);
+            continue;
+        }
+
+        for (size_t i = 0; i < bone_count; i++)
+        {
+            animator->pose[i] = blend(animator->pose[i], animator->layer_pose[i], layer.weight);
+        }
+    }
+
+    // Parents come first, so their model space matrix is always ready
+    glm::mat4 model_pose[FLUX_MAX_BONES];
+    for (size_t i = 0; i < bone_count; i++)
+    {
+        int parent = animator->parents[i];
+        model_pose[i] = animator->pose[i].toMatrix();
+        if (parent >= 0)
+        {
+            model_pose[i] = model_pose[parent] * model_pose[i];
+        }
+
+        animator->skin_matrices[i] = model_pose[i] * skeleton->bones[i].inverse_bind;
+    }
+
+    if (animator->mode != SkinningMode::CPU || animator->skinned_mesh.getBaseEntity().getEntityID() == -1 || mesh == nullptr)
+    {
+        return;
+    }
+
+    // Nobody's going to see it, so it doesn't need skinning
+    if (transform != nullptr && !transform->global_visibility)
+    {
+        return;
+    }
+
+    auto source = mesh->mesh_resource.getPtr();
+    auto skinned = animator->skinned_mesh.getPtr();
+    if (source->vertices == nullptr || source->vertices_length != skinned->vertices_length)
+    {
+        return;
+    }
+
+    skinVertices(source, animator->skin_matrices.data(), skinned->vertices);
+    skinned->changed = true;
+}
+
+// Lots of characters are split between these
+static Threads::WorkerPool workers(FLUX_ANIMATION_THREADS);
+
+void Animation::AnimationSystem::onSystemStart()
+{
+    animated.clear();
+}
+
+void Animation::AnimationSystem::runSystem(EntityRef entity, float new_delta)
+{
+    if (!entity.hasComponent<AnimatorCom>())
+    {
+        return;
+    }
+
+    // The components are found here, so the worker threads never have to touch the ECS
+    Animated a;
+    a.animator = entity.getComponent<AnimatorCom>();
+    a.mesh = entity.hasComponent<Renderer::MeshCom>() ? entity.getComponent<Renderer::MeshCom>() : nullptr;
+    a.transform = entity.hasComponent<Transform::TransformCom>() ? entity.getComponent<Transform::TransformCom>() : nullptr;
+
+    animated.push_back(a);
+    delta = new_delta;
+}
+
+void Animation::AnimationSystem::onSystemEnd()
+{
+    if (FLUX_ANIMATION_THREADS > 0 && animated.size() >= FLUX_ANIMATION_THREADING_THRESHOLD)
+    {
+        workers.run(animated.size(), [this](uint32_t start, uint32_t end) {
+            for (uint32_t i = start; i < end; i++)
+            {
+                animate(animated[i].animator, animated[i].mesh, animated[i].transform, delta);
+            }
+        });
+    }
+    else
+    {
+        for (auto& a : animated)
+        {
+            animate(a.animator, a.mesh, a.transform, delta);
+        }
+    }
+}
+
+void Animation::addAnimationSystems(ECSCtx* ctx)
+{
+    // Added to the front, so the setup runs first
+    // The ECS's threading is off, so the animation system splits the work up itself
+    ctx->addSystemFront(new AnimationSystem, false);
+    ctx->addSystemFront(new AnimationSetupSystem, false);
+}
@@ -0,0 +1,394 @@
+#include "Flux/Animation.hh"
+#include "Flux/Log.hh"
+#include "Flux/Resources.hh"
+
+#include <glm/glm.hpp>
+
+// STL includes
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <vector>
+
+using namespace Flux;
+
+// The smallest three components of a unit quaternion are never bigger than this
+#define FLUX_SMALLEST_THREE_RANGE 0.70710678f
+
+// Values of the smallest three are 15 bits, so the lowest bit is free for the index
+#define FLUX_ROTATION_STEPS 32767
+
+// =========================================================
+// Quantization
+// =========================================================
+
+static uint16_t quantize(float value, float min, float extent)
+{
+    if (extent <= 0)
+    {
+        return 0;
+    }
+
+    return (uint16_t)std::round(glm::clamp((value - min) / extent, 0.0f, 1.0f) * 65535.0f);
+}
+
+static glm::vec3 decodeVector(const Animation::AnimationTrack& track, size_t key)
+{
+    auto v = &track.values[key * 3];
+    return track.min + track.extent * glm::vec3(v[0], v[1], v[2]) / 65535.0f;
+}
+
+static void encodeRotation(const glm::quat& q, uint16_t* out)
+{
+    float c[4] = {q.x, q.y, q.z, q.w};
+
+    int largest = 0;
+    for (int i = 1; i < 4; i++)
+    {
+        if (std::abs(c[i]) > std::abs(c[largest]))
+        {
+            largest = i;
+        }
+    }
+
+    // q and -q are the same rotation, so the dropped one can always be positive
+    float sign = c[largest] < 0 ? -1.0f : 1.0f;
+
+    int n = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        if (i == largest)
+        {
+            continue;
+        }
+
+        float v = glm::clamp((c[i] * sign / FLUX_SMALLEST_THREE_RANGE + 1) * 0.5f, 0.0f, 1.0f);
+        out[n] = (uint16_t)std::round(v * FLUX_ROTATION_STEPS) << 1;
+        n++;
+    }
+
+    out[0] |= largest & 1;
+    out[1] |= largest >> 1;
+}
+
+static glm::quat decodeRotation(const uint16_t* in)
+{
+    int largest = (in[0] & 1) | ((in[1] & 1) << 1);
+
+    float c[4];
+    float sum = 0;
+    int n = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        if (i == largest)
+        {
+            continue;
+        }
+
+        c[i] = ((in[n] >> 1) / (float)FLUX_ROTATION_STEPS * 2 - 1) * FLUX_SMALLEST_THREE_RANGE;
+        sum += c[i] * c[i];
+        n++;
+    }
+
+    c[largest] = std::sqrt(std::max(0.0f, 1 - sum));
+    return glm::quat(c[3], c[0], c[1], c[2]);
+}
+
+// =========================================================
+// Sampling
+// =========================================================
+
+// Finds the keys on either side of a frame, and how far it is between them. Returns false if there aren't any keys
+static bool findKeys(const std::vector<uint16_t>& times, float frame, size_t& a, size_t& b, float& t)
+{
+    if (times.empty())
+    {
+        return false;
+    }
+
+    auto it = std::upper_bound(times.begin(), times.end(), frame, [](float f, uint16_t time) { return f < time; });
+    b = it - times.begin();
+
+    if (b == 0 || b == times.size())
+    {
+        // Before the first key, or after the last
+        a = b = b == 0 ? 0 : times.size() - 1;
+        t = 0;
+        return true;
+    }
+
+    a = b - 1;
+    t = (frame - times[a]) / (float)(times[b] - times[a]);
+    return true;
+}
+
+// Normalized lerp, the short way round
+static glm::quat nlerp(const glm::quat& a, const glm::quat& b, float t)
+{
+    float flip = glm::dot(a, b) < 0 ? -1.0f : 1.0f;
+    return glm::normalize(a * (1 - t) + b * (t * flip));
+}
+
+glm::vec3 Animation::AnimationTrack::sampleVector(float frame) const
+{
+    size_t a, b;
+    float t;
+    if (!findKeys(times, frame, a, b, t))
+    {
+        return min;
+    }
+
+    return glm::mix(decodeVector(*this, a), decodeVector(*this, b), t);
+}
+
+glm::quat Animation::AnimationTrack::sampleRotation(float frame) const
+{
+    size_t a, b;
+    float t;
+    if (!findKeys(times, frame, a, b, t))
+    {
+        return glm::quat(1, 0, 0, 0);
+    }
+
+    auto qa = decodeRotation(&values[a * 3]);
+    if (a == b)
+    {
+        return qa;
+    }
+
+    return nlerp(qa, decodeRotation(&values[b * 3]), t);
+}
+
+void Animation::AnimationRes::sample(float time, BoneTransform* pose, size_t count) const
+{
+    float frame = glm::clamp(time * sample_rate, 0.0f, duration * sample_rate);
+    count = std::min(count, tracks.size());
+
+    // Channels without any keys stay where they are
+    for (size_t i = 0; i < count; i++)
+    {
+        auto& track = tracks[i];
+        if (!track.translation.times.empty())
+        {
+            pose[i].translation = track.translation.sampleVector(frame);
+        }
+
+        if (!track.rotation.times.empty())
+        {
+            pose[i].rotation = track.rotation.sampleRotation(frame);
+        }
+
+        if (!track.scale.times.empty())
+        {
+            pose[i].scale = track.scale.sampleVector(frame);
+        }
+    }
+}
+
+// =========================================================
+// Compression
+// =========================================================
+
+/**
+Picks which frames to keep. fits(a, b) says whether every frame between a and b can be interpolated from them.
+Greedy, so it isn't the fewest keys possible, but it's close and it's simple
+*/
+static std::vector<uint32_t> pickKeys(uint32_t frame_count, bool constant, const std::function<bool(uint32_t, uint32_t)>& fits)
+{
+    if (frame_count == 0)
+    {
+        return {};
+    }
+
+    std::vector<uint32_t> keys = {0};
+
+    // Channels that never move only need one key
+    if (frame_count < 2 || constant)
+    {
+        return keys;
+    }
+
+    uint32_t last = 0;
+    for (uint32_t frame = 2; frame < frame_count; frame++)
+    {
+        if (!fits(last, frame))
+        {
+            last = frame - 1;
+            keys.push_back(last);
+        }
+    }
+
+    keys.push_back(frame_count - 1);
+    return keys;
+}
+
+static Animation::AnimationTrack compressVectors(const std::vector<glm::vec3>& values, float tolerance)
+{
+    uint32_t frame_count = values.size();
+    if (frame_count == 0)
+    {
+        return Animation::AnimationTrack();
+    }
+
+    bool constant = true;
+    for (auto& value : values)
+    {
+        constant = constant && glm::length(value - values[0]) <= tolerance;
+    }
+
+    auto keys = pickKeys(frame_count, constant, [&](uint32_t a, uint32_t b) {
+        for (uint32_t f = a + 1; f < b; f++)
+        {
+            auto expected = glm::mix(values[a], values[b], (f - a) / (float)(b - a));
+            if (glm::length(expected - values[f]) > tolerance)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    });
+
+    Animation::AnimationTrack track;
+    track.min = values[keys[0]];
+    glm::vec3 max_value = track.min;
+    for (auto key : keys)
+    {
+        track.min = glm::min(track.min, values[key]);
+        max_value = glm::max(max_value, values[key]);
+    }
+    track.extent = max_value - track.min;
+
+    for (auto key : keys)
+    {
+        track.times.push_back(key);
+        for (int i = 0; i < 3; i++)
+        {
+            track.values.push_back(quantize(values[key][i], track.min[i], track.extent[i]));
+        }
+    }
+
+    return track;
+}
+
+// Angle between two rotations, in radians
+static float rotationError(const glm::quat& a, const glm::quat& b)
+{
+    return 2 * std::acos(std::min(std::abs(glm::dot(a, b)), 1.0f));
+}
+
+static Animation::AnimationTrack compressRotations(std::vector<glm::quat> values, float tolerance)
+{
+    uint32_t frame_count = values.size();
+    if (frame_count == 0)
+    {
+        return Animation::AnimationTrack();
+    }
+
+    // Keep each one on the same side as the last, so interpolating between keys doesn't go the long way round
+    for (uint32_t f = 1; f < frame_count; f++)
+    {
+        if (glm::dot(values[f - 1], values[f]) < 0)
+        {
+            values[f] = values[f] * -1.0f;
+        }
+    }
+
+    bool constant = true;
+    for (auto& value : values)
+    {
+        constant = constant && rotationError(value, values[0]) <= tolerance;
+    }
+
+    auto keys = pickKeys(frame_count, constant, [&](uint32_t a, uint32_t b) {
+        for (uint32_t f = a + 1; f < b; f++)
+        {
+            auto expected = nlerp(values[a], values[b], (f - a) / (float)(b - a));
+            if (rotationError(expected, values[f]) > tolerance)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    });
+
+    Animation::AnimationTrack track;
+    for (auto key : keys)
+    {
+        track.times.push_back(key);
+
+        uint16_t encoded[3];
+        encodeRotation(glm::normalize(values[key]), encoded);
+        track.values.insert(track.values.end(), encoded, encoded + 3);
+    }
+
+    return track;
+}
+
+Resources::ResourceRef<Animation::AnimationRes> Animation::compressAnimation(const std::vector<std::vector<BoneTransform>>& frames, float sample_rate,
+    float translation_tolerance, float rotation_tolerance)
+{
+    auto clip = new AnimationRes;
+    clip->sample_rate = sample_rate;
+
+    if (frames.empty())
+    {
+        LOG_WARN("Can't compress an animation with no frames");
+        return Resources::createResource(clip);
+    }
+
+    uint32_t frame_count = std::min(frames.size(), (size_t)65536);
+    if (frame_count < frames.size())
+    {
+        LOG_WARN("Animation is too long, only the first 65536 frames are kept");
+    }
+
+    clip->duration = (frame_count - 1) / sample_rate;
+
+    // Every frame needs every bone, so bones some frames are missing are left out
+    size_t bone_count = frames[0].size();
+    for (uint32_t f = 0; f < frame_count; f++)
+    {
+        if (frames[f].size() < bone_count)
+        {
+            LOG_WARN("Frame " + std::to_string(f) + " only has " + std::to_string(frames[f].size()) + " bones, the rest aren't animated");
+            bone_count = frames[f].size();
+        }
+    }
+
+    clip->tracks.resize(bone_count);
+
+    uint32_t keys = 0;
+    std::vector<glm::vec3> vectors(frame_count);
+    std::vector<glm::quat> rotations(frame_count);
+
+    for (size_t bone = 0; bone < bone_count; bone++)
+    {
+        auto& track = clip->tracks[bone];
+
+        for (uint32_t f = 0; f < frame_count; f++)
+        {
+            vectors[f] = frames[f][bone].translation;
+        }
+        track.translation = compressVectors(vectors, translation_tolerance);
+
+        for (uint32_t f = 0; f < frame_count; f++)
+        {
+            rotations[f] = frames[f][bone].rotation;
+        }
+        track.rotation = compressRotations(rotations, rotation_tolerance);
+
+        // Scales are usually 1, so this is nearly always one key
+        for (uint32_t f = 0; f < frame_count; f++)
+        {
+            vectors[f] = frames[f][bone].scale;
+        }
+        track.scale = compressVectors(vectors, translation_tolerance);
+
+        keys += track.translation.times.size() + track.rotation.times.size() + track.scale.times.size();
+    }
+
+    LOG_INFO("Compressed animation: " + std::to_string(frame_count * bone_count * 3) + " -> " + std::to_string(keys) + " keys");
+    return Resources::createResource(clip);
+}
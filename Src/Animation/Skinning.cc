@@ -0,0 +1,130 @@
+#include "Flux/Animation.hh"
+#include "Flux/Renderer.hh"
+
+#include <glm/glm.hpp>
+#include "glm/gtc/type_ptr.hpp"
+
+// STL includes
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace Flux;
+
+// Weights are stored out of 255
+#define FLUX_WEIGHT_SCALE (1.0f / 255.0f)
+
+static void normalizeInto(float x, float y, float z, float& out_x, float& out_y, float& out_z)
+{
+    // Blending matrices shrinks directions a bit, and they might have been scaled too
+    float length = std::sqrt(x * x + y * y + z * z);
+    float scale = length > 0 ? 1 / length : 0;
+
+    out_x = x * scale;
+    out_y = y * scale;
+    out_z = z * scale;
+}
+
+#ifdef __SSE2__
+
+// Columns of a matrix times a vector, with w being 1 for points and 0 for directions
+static inline __m128 transform(const __m128 columns[4], float x, float y, float z, bool point)
+{
+    __m128 result = _mm_add_ps(_mm_add_ps(
+        _mm_mul_ps(columns[0], _mm_set1_ps(x)),
+        _mm_mul_ps(columns[1], _mm_set1_ps(y))),
+        _mm_mul_ps(columns[2], _mm_set1_ps(z)));
+
+    return point ? _mm_add_ps(result, columns[3]) : result;
+}
+
+void Animation::skinVertices(const Renderer::MeshRes* source, const glm::mat4* matrices, Renderer::Vertex* output)
+{
+    alignas(16) float out[4];
+
+    for (uint32_t v = 0; v < source->vertices_length; v++)
+    {
+        auto& in = source->vertices[v];
+        auto& skin = source->skin[v];
+
+        // Blend the bones' matrices together first, so each attribute only needs one matrix multiply
+        __m128 columns[4] = {_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps()};
+        for (int i = 0; i < 4; i++)
+        {
+            if (skin.weights[i] == 0)
+            {
+                continue;
+            }
+
+            const float* m = glm::value_ptr(matrices[skin.bones[i]]);
+            __m128 weight = _mm_set1_ps(skin.weights[i] * FLUX_WEIGHT_SCALE);
+
+            columns[0] = _mm_add_ps(columns[0], _mm_mul_ps(_mm_loadu_ps(m), weight));
+            columns[1] = _mm_add_ps(columns[1], _mm_mul_ps(_mm_loadu_ps(m + 4), weight));
+            columns[2] = _mm_add_ps(columns[2], _mm_mul_ps(_mm_loadu_ps(m + 8), weight));
+            columns[3] = _mm_add_ps(columns[3], _mm_mul_ps(_mm_loadu_ps(m + 12), weight));
+        }
+
+        auto& dest = output[v];
+
+        _mm_store_ps(out, transform(columns, in.x, in.y, in.z, true));
+        dest.x = out[0];
+        dest.y = out[1];
+        dest.z = out[2];
+
+        _mm_store_ps(out, transform(columns, in.nx, in.ny, in.nz, false));
+        normalizeInto(out[0], out[1], out[2], dest.nx, dest.ny, dest.nz);
+
+        _mm_store_ps(out, transform(columns, in.tanx, in.tany, in.tanz, false));
+        normalizeInto(out[0], out[1], out[2], dest.tanx, dest.tany, dest.tanz);
+
+        _mm_store_ps(out, transform(columns, in.btanx, in.btany, in.btanz, false));
+        normalizeInto(out[0], out[1], out[2], dest.btanx, dest.btany, dest.btanz);
+
+        dest.tx = in.tx;
+        dest.ty = in.ty;
+    }
+}
+
+#else
+
+void Animation::skinVertices(const Renderer::MeshRes* source, const glm::mat4* matrices, Renderer::Vertex* output)
+{
+    for (uint32_t v = 0; v < source->vertices_length; v++)
+    {
+        auto& in = source->vertices[v];
+        auto& skin = source->skin[v];
+
+        glm::mat4 m(0);
+        for (int i = 0; i < 4; i++)
+        {
+            if (skin.weights[i] != 0)
+            {
+                m += matrices[skin.bones[i]] * (skin.weights[i] * FLUX_WEIGHT_SCALE);
+            }
+        }
+
+        auto& dest = output[v];
+
+        glm::vec4 position = m * glm::vec4(in.x, in.y, in.z, 1);
+        dest.x = position.x;
+        dest.y = position.y;
+        dest.z = position.z;
+
+        glm::vec4 normal = m * glm::vec4(in.nx, in.ny, in.nz, 0);
+        normalizeInto(normal.x, normal.y, normal.z, dest.nx, dest.ny, dest.nz);
+
+        glm::vec4 tangent = m * glm::vec4(in.tanx, in.tany, in.tanz, 0);
+        normalizeInto(tangent.x, tangent.y, tangent.z, dest.tanx, dest.tany, dest.tanz);
+
+        glm::vec4 bitangent = m * glm::vec4(in.btanx, in.btany, in.btanz, 0);
+        normalizeInto(bitangent.x, bitangent.y, bitangent.z, dest.btanx, dest.btany, dest.btanz);
+
+        dest.tx = in.tx;
+        dest.ty = in.ty;
+    }
+}
+
+#endif
@@ -8,12 +8,76 @@
 #include <cstring>
 #include <math.h>
 
+#include <algorithm>
+
 static bool enabled = false;
 static Flux::ECSCtx* ctx = nullptr;
-static Flux::EntityRef solids[9];
-static bool solids_changed[9];
-static Flux::EntityRef wireframes[9];
-static bool wireframes_changed[9];
+
+/**
+All the debug geometry of one color and draw mode.
+The mesh's arrays are reused every frame, and only grow when they run out of room
+*/
+struct DebugBatch
+{
+    Flux::EntityRef entity;
+    Flux::Renderer::MeshRes* mesh_res = nullptr;
+
+    uint32_t vertex_capacity = 0;
+    uint32_t index_capacity = 0;
+};
+
+static DebugBatch solids[9];
+static DebugBatch wireframes[9];
+
+// Makes an array bigger, keeping what's already in it
+template<typename T>
+static void growArray(T*& array, uint32_t length, uint32_t& capacity, uint32_t needed)
+{
+    if (needed <= capacity)
+    {
+        return;
+    }
+
+    uint32_t new_capacity = std::max(needed, std::max(capacity * 2, (uint32_t)64));
+    auto new_array = new T[new_capacity];
+    if (array != nullptr)
+    {
+        std::memcpy(new_array, array, sizeof(T) * length);
+    }
+
+    delete[] array;
+    array = new_array;
+    capacity = new_capacity;
+}
+
+// Makes room for some more geometry in a batch. Returns the index of the first new vertex
+static uint32_t reserveBatch(DebugBatch& batch, uint32_t vertex_count, uint32_t index_count)
+{
+    auto mesh_res = batch.mesh_res;
+    growArray(mesh_res->vertices, mesh_res->vertices_length, batch.vertex_capacity, mesh_res->vertices_length + vertex_count);
+    growArray(mesh_res->indices, mesh_res->indices_length, batch.index_capacity, mesh_res->indices_length + index_count);
+
+    // The renderer streams it again next time it's drawn
+    mesh_res->changed = true;
+
+    return mesh_res->vertices_length;
+}
+
+static void createBatch(DebugBatch& batch, Flux::Resources::ResourceRef<Flux::Renderer::MaterialRes> mat, Flux::Renderer::DrawMode mode)
+{
+    batch.entity = ctx->createEntity();
+
+    auto meshres = Flux::Resources::createResource(new Flux::Renderer::MeshRes);
+    meshres->draw_mode = mode;
+    meshres->indices = nullptr;
+    meshres->vertices = nullptr;
+    meshres->indices_length = 0;
+    meshres->vertices_length = 0;
+    meshres->dynamic = true;
+
+    Flux::Renderer::addMesh(batch.entity, meshres, mat);
+    batch.mesh_res = meshres.getPtr();
+}
 
 void Flux::Debug::enableDebugDraw(ECSCtx* ct)
 {
@@ -36,33 +100,8 @@ void Flux::Debug::enableDebugDraw(ECSCtx* ct)
         auto mat = Flux::Renderer::createMaterialResource(shaders);
         Renderer::setUniform(mat, "color", colors[i]);
 
-        // Create solid entity
-        auto solid = ctx->createEntity();
-        auto wireframe = ctx->createEntity();
-
-        auto solid_meshres = Flux::Resources::createResource(new Renderer::MeshRes);
-        solid_meshres->draw_mode = Renderer::DrawMode::Triangles;
-        solid_meshres->indices = nullptr;
-        solid_meshres->vertices = nullptr;
-        solid_meshres->indices_length = 0;
-        solid_meshres->vertices_length = 0;
-        
-        Flux::Renderer::addMesh(solid, solid_meshres, mat);
-
-        auto wireframe_meshres = Flux::Resources::createResource(new Renderer::MeshRes);
-        wireframe_meshres->draw_mode = Renderer::DrawMode::Lines;
-        wireframe_meshres->indices = nullptr;
-        wireframe_meshres->vertices = nullptr;
-        wireframe_meshres->indices_length = 0;
-        wireframe_meshres->vertices_length = 0;
-
-        Flux::Renderer::addMesh(wireframe, wireframe_meshres, mat);
-
-        solids[i] = solid;
-        wireframes[i] = wireframe;
-
-        solids_changed[i] = true;
-        wireframes_changed[i] = true;
+        createBatch(solids[i], mat, Renderer::DrawMode::Triangles);
+        createBatch(wireframes[i], mat, Renderer::DrawMode::Lines);
     }
 }
 
@@ -72,119 +111,76 @@ void Flux::Debug::run(float delta)
 
     // ctx->runSystems(delta);
 
-    // Delete all the mesh data
+    // Empty the batches, but keep the memory for next frame
     for (int i = 0; i < 9; i++)
     {
-        if (solids_changed[i])
-        {
-            delete[] solids[i].getComponent<Renderer::MeshCom>()->mesh_resource->vertices;
-            delete[] solids[i].getComponent<Renderer::MeshCom>()->mesh_resource->indices;
-            solids[i].getComponent<Renderer::MeshCom>()->mesh_resource->vertices_length = 0;
-            solids[i].getComponent<Renderer::MeshCom>()->mesh_resource->vertices = nullptr;
-            solids[i].getComponent<Renderer::MeshCom>()->mesh_resource->indices_length = 0;
-            solids[i].getComponent<Renderer::MeshCom>()->mesh_resource->indices = nullptr;
-            solids_changed[i] = false;
-        }
-
-        if (wireframes_changed[i])
+        for (auto batch : {&solids[i], &wireframes[i]})
         {
-            delete[] wireframes[i].getComponent<Renderer::MeshCom>()->mesh_resource->vertices;
-            delete[] wireframes[i].getComponent<Renderer::MeshCom>()->mesh_resource->indices;
-            wireframes[i].getComponent<Renderer::MeshCom>()->mesh_resource->vertices_length = 0;
-            wireframes[i].getComponent<Renderer::MeshCom>()->mesh_resource->vertices = nullptr;
-            wireframes[i].getComponent<Renderer::MeshCom>()->mesh_resource->indices_length = 0;
-            wireframes[i].getComponent<Renderer::MeshCom>()->mesh_resource->indices = nullptr;
-            wireframes_changed[i] = false;
+            if (batch->mesh_res->vertices_length != 0 || batch->mesh_res->indices_length != 0)
+            {
+                batch->mesh_res->vertices_length = 0;
+                batch->mesh_res->indices_length = 0;
+                batch->mesh_res->changed = true;
+            }
         }
     }
 }
 
-void Flux::Debug::drawMesh(std::vector<Renderer::Vertex> vertices, std::vector<uint32_t> indices, Colors color, bool wireframe)
+void Flux::Debug::drawMesh(const std::vector<Renderer::Vertex>& vertices, const std::vector<uint32_t>& indices, Colors color, bool wireframe)
 {
-    if (wireframe)
-    {
-        // We're about to shake up all the indices
-        std::vector<uint32_t> new_indices;
-        new_indices.resize(indices.size() * 2);
-
-        for (int i = 0, ni = 0; i < indices.size(); i += 3, ni += 6)
-        {
-            new_indices[ni] = indices[i];
-            new_indices[ni+1] = indices[i+1];
-            new_indices[ni+2] = indices[i+1];
-            new_indices[ni+3] = indices[i+2];
-            new_indices[ni+4] = indices[i+2];
-            new_indices[ni+5] = indices[i+3];
-        }
-
-        indices = new_indices;
-    }
-    
-    Flux::Renderer::MeshRes* mesh_res;
+    if (!enabled) return;
 
-    if (wireframe)
-    {
-        mesh_res = wireframes[color].getComponent<Renderer::MeshCom>()->mesh_resource.getPtr();
-    }
-    else
-    {
-        mesh_res = solids[color].getComponent<Renderer::MeshCom>()->mesh_resource.getPtr();
-    }
+    auto& batch = wireframe ? wireframes[color] : solids[color];
+    auto mesh_res = batch.mesh_res;
 
-    // Update the indices' values
-    auto old_vlength = mesh_res->vertices_length;
-    auto old_ilength = mesh_res->indices_length;
+    // Each triangle turns into 3 lines in wireframe mode
+    uint32_t index_count = wireframe ? indices.size() * 2 : indices.size();
+    auto base = reserveBatch(batch, vertices.size(), index_count);
 
-    for (auto i : indices)
-    {
-        i += old_vlength;
-    }
-
-    // Add to the arrays
+    std::memcpy(mesh_res->vertices + base, vertices.data(), sizeof(Renderer::Vertex) * vertices.size());
     mesh_res->vertices_length += vertices.size();
-    auto new_vertices = new Renderer::Vertex[mesh_res->vertices_length];
-
-    mesh_res->indices_length += indices.size();
-    auto new_indices = new uint32_t[mesh_res->indices_length];
-
-    // Copy over the memories
-    std::memcpy(new_vertices, mesh_res->vertices, sizeof(Renderer::Vertex) * old_vlength);
-    std::memcpy(new_vertices + old_vlength, &vertices[0], sizeof(Renderer::Vertex) * vertices.size());
-
-    std::memcpy(new_indices, mesh_res->indices, sizeof(uint32_t) * old_ilength);
-    std::memcpy(new_indices + old_ilength, &indices[0], sizeof(uint32_t) * indices.size());
 
-    // Free the old one
-    delete[] mesh_res->vertices;
-    delete[] mesh_res->indices;
-
-    // Replace it
-    mesh_res->vertices = new_vertices;
-    mesh_res->indices = new_indices;
-
-    // TODO: Make a better way of doing this
+    // The indices have to point at where the vertices ended up
+    auto out = mesh_res->indices + mesh_res->indices_length;
     if (wireframe)
     {
-        wireframes[color].removeComponent<GLRenderer::GLEntityCom>();
-        wireframes[color].getComponent<Renderer::MeshCom>()->mesh_resource.getBaseEntity().removeComponent<GLRenderer::GLMeshCom>();
-        wireframes_changed[color] = true;
+        for (int i = 0; i + 2 < indices.size(); i += 3)
+        {
+            *(out++) = indices[i] + base;
+            *(out++) = indices[i+1] + base;
+            *(out++) = indices[i+1] + base;
+            *(out++) = indices[i+2] + base;
+            *(out++) = indices[i+2] + base;
+            *(out++) = indices[i] + base;
+        }
     }
     else
     {
-        solids[color].removeComponent<GLRenderer::GLEntityCom>();
-        solids[color].getComponent<Renderer::MeshCom>()->mesh_resource.getBaseEntity().removeComponent<GLRenderer::GLMeshCom>();
-        solids_changed[color] = true;
+        for (auto i : indices)
+        {
+            *(out++) = i + base;
+        }
     }
+
+    mesh_res->indices_length = out - mesh_res->indices;
 }
 
 void Flux::Debug::drawLine(glm::vec3 start, glm::vec3 end, Colors color)
 {
-    std::vector<Renderer::Vertex> v {Renderer::Vertex {start.x, start.y, start.z}, Renderer::Vertex {end.x, end.y, end.z, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-                                     Renderer::Vertex {end.x, end.y, end.z, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}};
+    if (!enabled) return;
+
+    // Lines go straight in, there's no need to make a triangle out of them
+    auto& batch = wireframes[color];
+    auto mesh_res = batch.mesh_res;
+    auto base = reserveBatch(batch, 2, 2);
 
-    std::vector<uint32_t> i {0, 1, 2};
+    mesh_res->vertices[base] = Renderer::Vertex {start.x, start.y, start.z, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    mesh_res->vertices[base + 1] = Renderer::Vertex {end.x, end.y, end.z, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    mesh_res->vertices_length += 2;
 
-    drawMesh(v, i, color, true);
+    mesh_res->indices[mesh_res->indices_length] = base;
+    mesh_res->indices[mesh_res->indices_length + 1] = base + 1;
+    mesh_res->indices_length += 2;
 }
 
 void Flux::Debug::drawPoint(const glm::vec3 &pos, float radius, Colors color, bool wireframe)
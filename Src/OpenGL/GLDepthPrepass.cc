@@ -0,0 +1,115 @@
+#include "Flux/OpenGL/GLRenderer.hh"
+#include "Flux/Log.hh"
+#include "Flux/Renderer.hh"
+
+// STL includes
+#include <algorithm>
+
+#include "glm/gtc/type_ptr.hpp"
+
+using namespace Flux::GLRenderer;
+
+GLDepthPrepass Flux::GLRenderer::depth_prepass;
+
+#ifdef __EMSCRIPTEN__
+#define FLUX_DEPTH_PREPASS_GLSL_HEADER "#version 300 es\nprecision highp float;\n"
+#else
+#define FLUX_DEPTH_PREPASS_GLSL_HEADER "#version 330 core\n"
+#endif
+
+// The main pass tests for equal depth, so gl_Position has to come out exactly the same as the material's shader
+static const char* depth_vertex_source = FLUX_DEPTH_PREPASS_GLSL_HEADER R"(
+layout (location = 0) in vec3 position;
+
+uniform mat4 model_view_projection;
+
+invariant gl_Position;
+
+void main()
+{
+    gl_Position = model_view_projection * vec4(position, 1.0);
+}
+)";
+
+// Nothing is written, but GLSL ES still wants an output
+static const char* depth_fragment_source = FLUX_DEPTH_PREPASS_GLSL_HEADER R"(
+out vec4 frag_color;
+
+void main()
+{
+    frag_color = vec4(0.0);
+}
+)";
+
+GLDepthPrepass::GLDepthPrepass():
+enabled(true), initialized(false), program(0), mvp_location(-1)
+{
+
+}
+
+void GLDepthPrepass::init()
+{
+    // Goes through the shader cache like any other shader, so the binary gets saved
+    Renderer::ShaderRes shader;
+    shader.vert_src = depth_vertex_source;
+    shader.frag_src = depth_fragment_source;
+    shader.source_hash = Renderer::hashBytes(shader.vert_src.c_str(), shader.vert_src.size() + 1);
+    shader.source_hash = Renderer::hashBytes(shader.frag_src.c_str(), shader.frag_src.size(), shader.source_hash);
+
+    program = shader_cache.acquire(&shader);
+    mvp_location = glGetUniformLocation(program, "model_view_projection");
+
+    initialized = true;
+}
+
+void GLDepthPrepass::setEnabled(bool new_enabled)
+{
+    enabled = new_enabled;
+}
+
+void GLDepthPrepass::draw(GLCommandList* list)
+{
+    bool any = false;
+    for (auto& command : list->draws)
+    {
+        if (command.depth_prepass)
+        {
+            any = true;
+            break;
+        }
+    }
+
+    if (!any)
+    {
+        return;
+    }
+
+    if (!initialized)
+    {
+        init();
+    }
+
+    gl_state.useProgram(program);
+    gl_state.enable(GL_DEPTH_TEST);
+    gl_state.depthFunc(GL_LESS);
+    gl_state.depthMask(true);
+    gl_state.colorMask(false);
+
+    for (auto& command : list->draws)
+    {
+        if (!command.depth_prepass)
+        {
+            continue;
+        }
+
+        glUniformMatrix4fv(mvp_location, 1, GL_FALSE, glm::value_ptr(command.model_view_projection));
+
+        gl_state.bindVertexArray(command.depth_vao);
+        list->drawElements(command);
+
+        render_stats.draw_calls += std::max(command.range_count, (uint32_t)1);
+        render_stats.prepass_draws ++;
+    }
+
+    gl_state.colorMask(true);
+}
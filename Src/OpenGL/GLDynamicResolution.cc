@@ -0,0 +1,235 @@
+#include "Flux/OpenGL/GLRenderer.hh"
+#include "Flux/Log.hh"
+#include "Flux/Renderer.hh"
+
+// STL includes
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// From EXT_disjoint_timer_query, which glad wasn't made with
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+
+using namespace Flux::GLRenderer;
+
+GLDynamicResolution Flux::GLRenderer::dynamic_resolution;
+
+GLDynamicResolution::GLDynamicResolution():
+enabled(true), scale(1), framebuffer(0), color_buffer(0), depth_buffer(0), buffer_width(0), buffer_height(0),
+offscreen(false), width(0), height(0), window_width(0), window_height(0),
+timer_supported(false), check_disjoint(false), has_queries(false), current_query(-1), frame(0), gpu_time(0)
+{
+
+}
+
+static bool hasExtension(const char* name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+
+    for (GLint i = 0; i < count; i++)
+    {
+        auto extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if (extension != nullptr && std::strcmp(extension, name) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void GLDynamicResolution::loadTimerQueries(GLADloadproc load)
+{
+    // Both kinds of context are loaded as ES, so glad never loads glGetQueryObjectui64v
+    auto version = (const char*)glGetString(GL_VERSION);
+    bool es = version != nullptr && std::strncmp(version, "OpenGL ES", 9) == 0;
+
+    if (!es)
+    {
+        // Part of desktop GL since 3.3
+        glad_glGetQueryObjectui64v = (PFNGLGETQUERYOBJECTUI64VPROC)load("glGetQueryObjectui64v");
+    }
+    else if (hasExtension("GL_EXT_disjoint_timer_query") || hasExtension("GL_EXT_disjoint_timer_query_webgl2"))
+    {
+        // Same function with a different name. ES 3 already has the rest, and takes GL_TIME_ELAPSED with the extension
+        glad_glGetQueryObjectui64v = (PFNGLGETQUERYOBJECTUI64VPROC)load("glGetQueryObjectui64vEXT");
+        check_disjoint = true;
+    }
+
+    timer_supported = glad_glGenQueries != nullptr && glad_glGetQueryObjectui64v != nullptr;
+    LOG_INFO(timer_supported ? "Timing the gpu for dynamic resolution" : "No gpu timer queries, so the resolution won't be scaled");
+}
+
+void GLDynamicResolution::setEnabled(bool new_enabled)
+{
+    render_thread.record([this, new_enabled]() {
+        enabled = new_enabled;
+        governor.reset();
+    });
+}
+
+void GLDynamicResolution::setTarget(float seconds)
+{
+    render_thread.record([this, seconds]() { governor.setTarget(seconds); });
+}
+
+void GLDynamicResolution::setLimits(float min_scale, float max_scale)
+{
+    render_thread.record([this, min_scale, max_scale]() { governor.setLimits(min_scale, max_scale); });
+}
+
+void GLDynamicResolution::resize(int new_width, int new_height)
+{
+    if (framebuffer == 0)
+    {
+        glGenFramebuffers(1, &framebuffer);
+        glGenRenderbuffers(1, &color_buffer);
+        glGenRenderbuffers(1, &depth_buffer);
+    }
+
+    // It's always the size of the window, and only part of it is used
+    // That way, changing the scale doesn't mean making new buffers
+    glBindRenderbuffer(GL_RENDERBUFFER, color_buffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, new_width, new_height);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth_buffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, new_width, new_height);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_buffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth_buffer);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        LOG_ERROR("Could not create the framebuffer for dynamic resolution");
+        enabled = false;
+    }
+
+    buffer_width = new_width;
+    buffer_height = new_height;
+}
+
+void GLDynamicResolution::beginFrame(int new_window_width, int new_window_height)
+{
+    window_width = std::max(new_window_width, 1);
+    window_height = std::max(new_window_height, 1);
+
+    if (!has_queries)
+    {
+        if (timer_supported)
+        {
+            glGenQueries(FLUX_GPU_TIMER_QUERIES, queries);
+        }
+
+        for (int i = 0; i < FLUX_GPU_TIMER_QUERIES; i++)
+        {
+            query_busy[i] = false;
+        }
+
+        has_queries = true;
+    }
+
+    // Time the frame, unless the query from a few frames ago still hasn't come back
+    current_query = -1;
+    if (timer_supported && !query_busy[frame % FLUX_GPU_TIMER_QUERIES])
+    {
+        current_query = frame % FLUX_GPU_TIMER_QUERIES;
+        glBeginQuery(GL_TIME_ELAPSED, queries[current_query]);
+    }
+
+    offscreen = enabled && scale < 1;
+    if (offscreen)
+    {
+        if (buffer_width != window_width || buffer_height != window_height)
+        {
+            resize(window_width, window_height);
+        }
+
+        width = std::max((int)std::round(window_width * scale), 1);
+        height = std::max((int)std::round(window_height * scale), 1);
+    }
+    else
+    {
+        width = window_width;
+        height = window_height;
+    }
+
+    // resize() can turn it off if the framebuffer doesn't work
+    offscreen = offscreen && enabled;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, offscreen ? framebuffer : 0);
+    glViewport(0, 0, width, height);
+}
+
+void GLDynamicResolution::endFrame()
+{
+    if (offscreen)
+    {
+        // Stretch it over the whole window
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, window_width, window_height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    if (current_query != -1)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        query_busy[current_query] = true;
+    }
+}
+
+float GLDynamicResolution::update(float cpu_time)
+{
+    frame ++;
+
+    if (timer_supported)
+    {
+        // Reading this also clears it, so it has to be read before the results
+        GLint disjoint = 0;
+        if (check_disjoint)
+        {
+            glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+        }
+
+        // Go from oldest to newest, so the newest result is the one that's kept
+        for (int i = 0; i < FLUX_GPU_TIMER_QUERIES; i++)
+        {
+            int query = (frame + i) % FLUX_GPU_TIMER_QUERIES;
+            if (!query_busy[query])
+            {
+                continue;
+            }
+
+            GLint available = 0;
+            glGetQueryObjectiv(queries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+            {
+                continue;
+            }
+
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(queries[query], GL_QUERY_RESULT, &nanoseconds);
+            query_busy[query] = false;
+
+            // The result can't be trusted, so the last good one is kept
+            if (!disjoint)
+            {
+                gpu_time = nanoseconds / 1e9;
+            }
+        }
+    }
+
+    if (enabled)
+    {
+        scale = governor.update(cpu_time, gpu_time);
+    }
+    else
+    {
+        scale = 1;
+    }
+
+    return gpu_time;
+}
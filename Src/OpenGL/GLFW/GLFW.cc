@@ -37,7 +37,7 @@ void onFramebufferSizeChanged(GLFWwindow* w, int width, int height)
     current_window->height = height;
     current_window->width = width;
 
-    glViewport(0, 0, width, height);
+    // The viewport is set every frame, see GLDynamicResolution
 }
 
 static float scroll_offset = 0;
@@ -130,9 +130,7 @@ void Flux::GLRenderer::createWindow(const int &width, const int &height, const s
 
     current_window = gctx;
 
-    _startGL();
-
-    glfwMakeContextCurrent(w->window);
+    _startGL((GLADloadproc)glfwGetProcAddress);
 
     // Setup callbacks
     glfwSetFramebufferSizeCallback(w->window, onFramebufferSizeChanged);
@@ -147,6 +145,9 @@ void Flux::GLRenderer::createWindow(const int &width, const int &height, const s
 #ifdef EMSCRIPTEN
     glfwSwapInterval(1);
 #endif
+
+    // Everything's set up, so the render thread can have the context
+    render_thread.start();
 }
 
 static glm::vec2 old_position = glm::vec2(0);
@@ -224,6 +225,9 @@ void Flux::runMainloop()
         func();
     }
 
+    // Everything after this is on the main thread again
+    render_thread.stop();
+
     end();
 
     // Destroy resources before windows so opengl resource cleanup
@@ -243,41 +247,20 @@ bool Flux::GLRenderer::_windowStartFrame()
     return sc;
 }
 
-void showFPS(GLFWwindow* window)
+void Flux::GLRenderer::_windowEndFrame()
 {
-    static double previousSeconds = 0.0;
-    static int frameCount = 0;
-    double elapsedSeconds;
-    double currentSeconds = glfwGetTime(); // Time since start (s)
-
-    elapsedSeconds = currentSeconds - previousSeconds;
-
-    // Limit text update to 4/second
-    if (elapsedSeconds > 0.25) {
-        previousSeconds = currentSeconds;
-        double fps = (double)frameCount / elapsedSeconds;
-        double msPerFrame = 1000.0 / fps;
-
-        std::ostringstream outs;
-        outs.precision(3); // Set precision of numbers
-
-        outs << std::fixed << "FluxTest" << " - " << "FPS: " << fps << " Frame time: " << msPerFrame << "ms";
-
-        glfwSetWindowTitle(w->window, outs.str().c_str());
-
-        // Reset frame count
-        frameCount = 0;
-    }
+    // For the frame rate, see Renderer::getRenderStats
+    glfwSwapBuffers(w->window);
+}
 
-    frameCount ++;
+void Flux::GLRenderer::_windowAcquireContext()
+{
+    glfwMakeContextCurrent(w->window);
 }
 
-void Flux::GLRenderer::_windowEndFrame()
+void Flux::GLRenderer::_windowReleaseContext()
 {
-#ifndef EMSCRIPTEN
-    showFPS(w->window);
-#endif
-    glfwSwapBuffers(w->window);
+    glfwMakeContextCurrent(NULL);
 }
 
 void Flux::GLRenderer::destroyWindow()
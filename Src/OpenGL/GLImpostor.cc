@@ -0,0 +1,185 @@
+#include "Flux/OpenGL/GLRenderer.hh"
+#include "Flux/Log.hh"
+#include "Flux/Renderer.hh"
+
+// STL includes
+#include <algorithm>
+#include <vector>
+
+#include "glm/gtc/type_ptr.hpp"
+
+using namespace Flux::GLRenderer;
+
+GLImpostorRenderer Flux::GLRenderer::impostor_renderer;
+
+// Floats per instance: position, rotation, radius, half height
+#define FLUX_IMPOSTOR_INSTANCE_FLOATS 6
+
+#ifdef __EMSCRIPTEN__
+#define FLUX_IMPOSTOR_GLSL_HEADER "#version 300 es\nprecision highp float;\n"
+#else
+#define FLUX_IMPOSTOR_GLSL_HEADER "#version 330 core\n"
+#endif
+
+// The views have to be picked the same way bakeImpostor made them
+static const char* impostor_vertex_source = FLUX_IMPOSTOR_GLSL_HEADER R"(
+layout (location = 0) in vec4 instance_position;
+layout (location = 1) in vec2 instance_size;
+
+uniform mat4 view_projection;
+uniform vec3 camera_position;
+uniform float views;
+
+out vec2 uv;
+
+void main()
+{
+    // Triangle strip, from the bottom left
+    vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));
+
+    // Only turn around the up axis, so tall things don't lean over
+    vec3 to_camera = camera_position - instance_position.xyz;
+    to_camera.y = 0.0;
+    vec3 forward = length(to_camera) > 0.0001 ? normalize(to_camera) : vec3(0.0, 0.0, 1.0);
+    vec3 right = vec3(forward.z, 0.0, -forward.x);
+
+    // Which angle the object is being seen from, in its own space
+    float angle = atan(forward.x, forward.z) - instance_position.w;
+    float view = mod(floor(angle / 6.2831853 * views + 0.5), views);
+
+    vec3 position = instance_position.xyz
+        + right * (corner.x * 2.0 - 1.0) * instance_size.x
+        + vec3(0.0, (corner.y * 2.0 - 1.0) * instance_size.y, 0.0);
+
+    uv = vec2((view + corner.x) / views, corner.y);
+    gl_Position = view_projection * vec4(position, 1.0);
+}
+)";
+
+static const char* impostor_fragment_source = FLUX_IMPOSTOR_GLSL_HEADER R"(
+in vec2 uv;
+
+uniform sampler2D atlas;
+
+out vec4 frag_color;
+
+void main()
+{
+    vec4 color = texture(atlas, uv);
+    if (color.a < 0.5)
+    {
+        discard;
+    }
+
+    frag_color = vec4(color.rgb, 1.0);
+}
+)";
+
+GLImpostorRenderer::GLImpostorRenderer():
+initialized(false), program(0), vao(0), instance_buffer(0),
+view_projection_location(-1), camera_position_location(-1), views_location(-1), atlas_location(-1)
+{
+
+}
+
+void GLImpostorRenderer::init()
+{
+    // Goes through the shader cache like any other shader, so the binary gets saved
+    Renderer::ShaderRes shader;
+    shader.vert_src = impostor_vertex_source;
+    shader.frag_src = impostor_fragment_source;
+    shader.source_hash = Renderer::hashBytes(shader.vert_src.c_str(), shader.vert_src.size() + 1);
+    shader.source_hash = Renderer::hashBytes(shader.frag_src.c_str(), shader.frag_src.size(), shader.source_hash);
+
+    program = shader_cache.acquire(&shader);
+
+    view_projection_location = glGetUniformLocation(program, "view_projection");
+    camera_position_location = glGetUniformLocation(program, "camera_position");
+    views_location = glGetUniformLocation(program, "views");
+    atlas_location = glGetUniformLocation(program, "atlas");
+
+    // There's no vertex data, the corners come from gl_VertexID
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &instance_buffer);
+    render_stats.buffer_creations ++;
+
+    gl_state.bindVertexArray(vao);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(0, 1);
+    glVertexAttribDivisor(1, 1);
+
+    initialized = true;
+}
+
+void GLImpostorRenderer::draw(GLCommandList* list)
+{
+    auto& instances = list->impostors;
+    if (instances.empty())
+    {
+        return;
+    }
+
+    if (!initialized)
+    {
+        init();
+    }
+
+    // Each atlas is one draw
+    std::sort(instances.begin(), instances.end(), [](const GLImpostorInstance& a, const GLImpostorInstance& b) {
+        return a.atlas < b.atlas;
+    });
+
+    std::vector<float> data(instances.size() * FLUX_IMPOSTOR_INSTANCE_FLOATS);
+    for (size_t i = 0; i < instances.size(); i++)
+    {
+        auto& instance = instances[i];
+        float* out = &data[i * FLUX_IMPOSTOR_INSTANCE_FLOATS];
+        out[0] = instance.position.x;
+        out[1] = instance.position.y;
+        out[2] = instance.position.z;
+        out[3] = instance.rotation;
+        out[4] = instance.radius;
+        out[5] = instance.half_height;
+    }
+
+    gl_state.bindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+    glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(float), data.data(), GL_STREAM_DRAW);
+
+    gl_state.useProgram(program);
+    glUniformMatrix4fv(view_projection_location, 1, GL_FALSE, glm::value_ptr(list->view_projection));
+    glUniform3f(camera_position_location, list->camera_position.x, list->camera_position.y, list->camera_position.z);
+
+    gl_state.enable(GL_DEPTH_TEST);
+    gl_state.bindVertexArray(vao);
+
+    const GLsizei stride = FLUX_IMPOSTOR_INSTANCE_FLOATS * sizeof(float);
+
+    size_t start = 0;
+    while (start < instances.size())
+    {
+        size_t end = start + 1;
+        while (end < instances.size() && instances[end].atlas == instances[start].atlas)
+        {
+            end++;
+        }
+
+        gl_state.bindTexture(0, instances[start].atlas);
+        gl_state.setSampler(atlas_location, 0);
+        glUniform1f(views_location, (float)instances[start].views);
+
+        // ES 3.0 has no base instance, so the attributes are pointed at this atlas's part of the buffer instead
+        uintptr_t offset = start * stride;
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, stride, (void*)offset);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*)(offset + 4 * sizeof(float)));
+
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, end - start);
+
+        render_stats.draw_calls ++;
+        render_stats.triangles += 2 * (end - start);
+
+        start = end;
+    }
+
+    render_stats.impostors += instances.size();
+}
@@ -0,0 +1,199 @@
+#include "Flux/OpenGL/GLRenderer.hh"
+#include "Flux/Log.hh"
+#include "Flux/Particles.hh"
+
+// STL includes
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "glm/gtc/type_ptr.hpp"
+
+using namespace Flux::GLRenderer;
+
+GLParticleRenderer Flux::GLRenderer::particle_renderer;
+
+#ifdef __EMSCRIPTEN__
+#define FLUX_PARTICLE_GLSL_HEADER "#version 300 es\nprecision highp float;\n"
+#else
+#define FLUX_PARTICLE_GLSL_HEADER "#version 330 core\n"
+#endif
+
+static const char* particle_vertex_source = FLUX_PARTICLE_GLSL_HEADER R"(
+layout (location = 0) in vec4 instance_position;
+layout (location = 1) in vec4 instance_color;
+
+uniform mat4 view_projection;
+uniform vec3 camera_right;
+uniform vec3 camera_up;
+
+out vec2 uv;
+out vec4 color;
+
+void main()
+{
+    // Triangle strip, from the bottom left
+    vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));
+    vec2 offset = (corner * 2.0 - 1.0) * 0.5 * instance_position.w;
+
+    vec3 position = instance_position.xyz + camera_right * offset.x + camera_up * offset.y;
+
+    uv = corner;
+    color = instance_color;
+    gl_Position = view_projection * vec4(position, 1.0);
+}
+)";
+
+static const char* particle_fragment_source = FLUX_PARTICLE_GLSL_HEADER R"(
+in vec2 uv;
+in vec4 color;
+
+uniform sampler2D particle_texture;
+uniform int textured;
+
+out vec4 frag_color;
+
+void main()
+{
+    vec4 shape;
+    if (textured != 0)
+    {
+        shape = texture(particle_texture, uv);
+    }
+    else
+    {
+        // A soft dot
+        shape = vec4(1.0, 1.0, 1.0, clamp(1.0 - length(uv * 2.0 - 1.0), 0.0, 1.0));
+    }
+
+    frag_color = color * shape;
+}
+)";
+
+GLParticleRenderer::GLParticleRenderer():
+initialized(false), program(0), vao(0), instance_buffer(0),
+view_projection_location(-1), camera_right_location(-1), camera_up_location(-1), textured_location(-1), texture_location(-1)
+{
+
+}
+
+void GLParticleRenderer::init()
+{
+    // Goes through the shader cache like any other shader, so the binary gets saved
+    Renderer::ShaderRes shader;
+    shader.vert_src = particle_vertex_source;
+    shader.frag_src = particle_fragment_source;
+    shader.source_hash = Renderer::hashBytes(shader.vert_src.c_str(), shader.vert_src.size() + 1);
+    shader.source_hash = Renderer::hashBytes(shader.frag_src.c_str(), shader.frag_src.size(), shader.source_hash);
+
+    program = shader_cache.acquire(&shader);
+
+    view_projection_location = glGetUniformLocation(program, "view_projection");
+    camera_right_location = glGetUniformLocation(program, "camera_right");
+    camera_up_location = glGetUniformLocation(program, "camera_up");
+    textured_location = glGetUniformLocation(program, "textured");
+    texture_location = glGetUniformLocation(program, "particle_texture");
+
+    // There's no vertex data, the corners come from gl_VertexID
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &instance_buffer);
+    render_stats.buffer_creations ++;
+
+    gl_state.bindVertexArray(vao);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(0, 1);
+    glVertexAttribDivisor(1, 1);
+
+    initialized = true;
+}
+
+void GLParticleRenderer::draw(GLCommandList* list)
+{
+    auto& batches = list->particle_batches;
+    if (batches.empty())
+    {
+        return;
+    }
+
+    if (!initialized)
+    {
+        init();
+    }
+
+    // Emitters that look the same end up next to each other, so they can be drawn together
+    std::sort(batches.begin(), batches.end(), [](const GLParticleBatch& a, const GLParticleBatch& b) {
+        if (a.additive != b.additive)
+        {
+            return a.additive < b.additive;
+        }
+
+        return a.texture < b.texture;
+    });
+
+    data.resize(list->particles.size());
+    uint32_t written = 0;
+    for (auto& batch : batches)
+    {
+        std::memcpy(&data[written], &list->particles[batch.first], batch.count * sizeof(Particles::ParticleInstance));
+        batch.first = written;
+        written += batch.count;
+    }
+
+    gl_state.bindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+    glBufferData(GL_ARRAY_BUFFER, written * sizeof(Particles::ParticleInstance), data.data(), GL_STREAM_DRAW);
+
+    gl_state.useProgram(program);
+    glUniformMatrix4fv(view_projection_location, 1, GL_FALSE, glm::value_ptr(list->view_projection));
+    glUniform3f(camera_right_location, list->camera_right.x, list->camera_right.y, list->camera_right.z);
+    glUniform3f(camera_up_location, list->camera_up.x, list->camera_up.y, list->camera_up.z);
+
+    // Tested against everything else, but they don't hide each other
+    gl_state.enable(GL_DEPTH_TEST);
+    gl_state.depthFunc(GL_LESS);
+    gl_state.depthMask(false);
+    gl_state.enable(GL_BLEND);
+    gl_state.bindVertexArray(vao);
+
+    const GLsizei stride = sizeof(Particles::ParticleInstance);
+
+    size_t start = 0;
+    while (start < batches.size())
+    {
+        size_t end = start + 1;
+        uint32_t count = batches[start].count;
+        while (end < batches.size() && batches[end].additive == batches[start].additive && batches[end].texture == batches[start].texture)
+        {
+            count += batches[end].count;
+            end++;
+        }
+
+        auto& batch = batches[start];
+        gl_state.blendFunc(GL_SRC_ALPHA, batch.additive ? GL_ONE : GL_ONE_MINUS_SRC_ALPHA);
+
+        glUniform1i(textured_location, batch.texture != 0);
+        if (batch.texture != 0)
+        {
+            gl_state.bindTexture(0, batch.texture);
+            gl_state.setSampler(texture_location, 0);
+        }
+
+        // ES 3.0 has no base instance, so the attributes are pointed at this group's part of the buffer instead
+        uintptr_t offset = batch.first * stride;
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, stride, (void*)offset);
+        glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)(offset + 4 * sizeof(float)));
+
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+
+        render_stats.draw_calls ++;
+        render_stats.triangles += 2 * count;
+
+        start = end;
+    }
+
+    // Everything else is drawn without blending, and next frame's clear needs depth writes
+    gl_state.disable(GL_BLEND);
+    gl_state.depthMask(true);
+
+    render_stats.particles += list->particles.size();
+}
@@ -0,0 +1,353 @@
+#include "Flux/OpenGL/GLRenderer.hh"
+#include "Flux/Log.hh"
+#include "Flux/Renderer.hh"
+
+// STL includes
+#include <algorithm>
+
+#include "glm/gtc/type_ptr.hpp"
+
+using namespace Flux::GLRenderer;
+
+GLRenderThread Flux::GLRenderer::render_thread;
+
+void GLCommandList::clear()
+{
+    commands.clear();
+    draws.clear();
+    meshlet_ranges.clear();
+    bone_matrices.clear();
+    impostors.clear();
+    particles.clear();
+    particle_batches.clear();
+    deletions.clear();
+    light_count = 0;
+    directional_light_count = 0;
+    stats = Renderer::RenderStats();
+}
+
+uint32_t GLCommandList::drawElements(const GLDrawCommand& command) const
+{
+    if (command.range_count == 0)
+    {
+        glDrawElements(command.draw_type, command.count, command.index_type, (void*)command.offset);
+        return command.count;
+    }
+
+    // ES 3.0 doesn't have glMultiDrawElements, but neighbouring meshlets were already merged into one range
+    uint32_t index_size = command.index_type == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+    uint32_t drawn = 0;
+    for (uint32_t i = command.range_start; i < command.range_start + command.range_count; i++)
+    {
+        auto& range = meshlet_ranges[i];
+        glDrawElements(command.draw_type, range.y, command.index_type, (void*)(command.offset + (uintptr_t)range.x * index_size));
+        drawn += range.y;
+    }
+
+    return drawn;
+}
+
+GLRenderThread::GLRenderThread():
+recording(&lists[0]), started(false), threaded(false), last_frame_end(0), pending(nullptr), pending_call(nullptr), running(false)
+{
+
+}
+
+GLRenderThread::~GLRenderThread()
+{
+    if (thread.joinable())
+    {
+        // The program is ending without runMainloop finishing, so just let the thread go
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        condition.notify_all();
+        thread.join();
+    }
+}
+
+void GLRenderThread::start()
+{
+    if (started)
+    {
+        return;
+    }
+
+    started = true;
+    last_frame_end = Renderer::getTime();
+
+#ifdef FLUX_RENDER_THREAD
+    // The context can only be current on one thread
+    _windowReleaseContext();
+
+    threaded = true;
+    running = true;
+    thread = std::thread(&GLRenderThread::threadMain, this);
+#endif
+}
+
+void GLRenderThread::stop()
+{
+    if (!started)
+    {
+        return;
+    }
+
+    if (threaded)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this]() { return pending == nullptr; });
+            running = false;
+        }
+        condition.notify_all();
+        thread.join();
+
+        threaded = false;
+        _windowAcquireContext();
+    }
+
+    // Anything that was recorded won't be drawn, but it still has to be cleaned up
+    for (auto& command : recording->deletions)
+    {
+        command();
+    }
+    recording->clear();
+
+    started = false;
+}
+
+void GLRenderThread::record(std::function<void()> command)
+{
+    recording->commands.push_back(command);
+}
+
+void GLRenderThread::deleteLater(std::function<void()> command)
+{
+    if (!started)
+    {
+        // Nothing is going to be drawn, so it might as well happen now
+        command();
+        return;
+    }
+
+    recording->deletions.push_back(command);
+}
+
+void GLRenderThread::call(const std::function<void()>& function)
+{
+    if (!threaded || std::this_thread::get_id() == thread.get_id())
+    {
+        function();
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    pending_call = &function;
+    condition.notify_all();
+    condition.wait(lock, [this]() { return pending_call == nullptr; });
+}
+
+void GLRenderThread::submit()
+{
+    GLCommandList* list = recording;
+
+    if (!threaded)
+    {
+        execute(list);
+        list->clear();
+        return;
+    }
+
+    {
+        // The other list is the one that's being drawn, so wait for it before recording into it
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this]() { return pending == nullptr; });
+
+        pending = list;
+        recording = list == &lists[0] ? &lists[1] : &lists[0];
+        recording->clear();
+    }
+    condition.notify_all();
+}
+
+void GLRenderThread::finish()
+{
+    if (!threaded)
+    {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this]() { return pending == nullptr; });
+}
+
+Flux::Renderer::RenderStats GLRenderThread::getFinishedStats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return finished_stats;
+}
+
+void GLRenderThread::threadMain()
+{
+    _windowAcquireContext();
+
+    // Whatever the main thread did, it wasn't through this thread's context
+    gl_state.invalidate();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        condition.wait(lock, [this]() { return pending != nullptr || pending_call != nullptr || !running; });
+
+        if (pending_call != nullptr)
+        {
+            // Calls only happen between frames, so they never see half a frame's state
+            (*pending_call)();
+            pending_call = nullptr;
+            condition.notify_all();
+            continue;
+        }
+
+        if (pending != nullptr)
+        {
+            auto list = pending;
+
+            lock.unlock();
+            execute(list);
+            lock.lock();
+
+            pending = nullptr;
+            condition.notify_all();
+            continue;
+        }
+
+        // Only stop once there's nothing left to do
+        break;
+    }
+    lock.unlock();
+
+    _windowReleaseContext();
+}
+
+// Draws one thing
+static void draw(const GLDrawCommand& command, const GLCommandList* list, const glm::vec4& cluster_params)
+{
+    gl_state.useProgram(command.program);
+
+    glUniformMatrix4fv(command.mvp_location, 1, GL_FALSE, glm::value_ptr(command.model_view_projection));
+    glUniformMatrix4fv(command.mv_location, 1, GL_FALSE, glm::value_ptr(command.model_view));
+    glUniformMatrix4fv(command.m_location, 1, GL_FALSE, glm::value_ptr(command.model));
+    glUniform1i(command.vertex_format_location, command.vertex_format_flags);
+    glUniform3f(command.cam_pos_location, list->camera_position.x, list->camera_position.y, list->camera_position.z);
+
+    // Anything that's already bound from the last draw with this material is skipped by the state cache
+    for (int i = 0; i < command.texture_count; i++)
+    {
+        gl_state.bindTexture(i, command.textures[i], command.texture_targets[i]);
+        gl_state.setSampler(command.texture_locations[i], i);
+    }
+
+    gl_state.bindBufferBase(GL_UNIFORM_BUFFER, 0, command.uniform_buffer);
+    skinning.bind(command);
+
+    if (command.has_lights)
+    {
+        glUniform1iv(command.light_indexes_location, FLUX_MAX_OBJECT_LIGHTS, command.light_indexes);
+    }
+
+    // Everything the shader needs to find its cluster
+    glUniform1i(command.light_count_location, list->light_count);
+    glUniform1i(command.directional_light_count_location, list->directional_light_count);
+    glUniform4f(command.cluster_params_location, cluster_params.x, cluster_params.y, cluster_params.z, cluster_params.w);
+
+    // Depth from the pre-pass is already there, so only the front-most pixels get shaded
+    if (command.depth_prepass)
+    {
+        gl_state.depthFunc(GL_EQUAL);
+        gl_state.depthMask(false);
+    }
+    else
+    {
+        gl_state.depthFunc(GL_LESS);
+        gl_state.depthMask(true);
+    }
+
+    // The VAO is left bound afterwards, so drawing the same mesh twice doesn't need to rebind it
+    gl_state.enable(GL_DEPTH_TEST);
+    gl_state.bindVertexArray(command.vao);
+    uint32_t drawn = list->drawElements(command);
+
+    render_stats.draw_calls += std::max(command.range_count, (uint32_t)1);
+    if (command.draw_type == GL_TRIANGLES)
+    {
+        render_stats.triangles += drawn / 3;
+    }
+}
+
+void GLRenderThread::execute(GLCommandList* list)
+{
+    double start = Renderer::getTime();
+
+    dynamic_resolution.beginFrame(list->width, list->height);
+
+    for (auto& command : list->commands)
+    {
+        command();
+    }
+
+    // The shaders find their cluster from gl_FragCoord, so they need the size that's actually being drawn
+    glm::vec4 cluster_params = list->cluster_params;
+    cluster_params.x = dynamic_resolution.getWidth();
+    cluster_params.y = dynamic_resolution.getHeight();
+
+    skinning.upload(list);
+    depth_prepass.draw(list);
+
+    for (auto& command : list->draws)
+    {
+        draw(command, list, cluster_params);
+    }
+
+    // Impostors write depth, and next frame's clear needs it on too
+    gl_state.depthFunc(GL_LESS);
+    gl_state.depthMask(true);
+
+    impostor_renderer.draw(list);
+
+    // Particles don't write depth, so they have to go after everything they could be behind
+    particle_renderer.draw(list);
+
+    dynamic_resolution.endFrame();
+
+    for (auto& command : list->deletions)
+    {
+        command();
+    }
+
+    // Swapping waits for v-sync, so it isn't counted
+    // This is only used to tell if the cpu is holding things up, the scale goes by the gpu time
+    float cpu_time = std::max((float)(Renderer::getTime() - start), list->simulation_time);
+
+    _windowEndFrame();
+
+    render_stats.resolution_scale = dynamic_resolution.getScale();
+    render_stats.gpu_time = dynamic_resolution.update(cpu_time);
+
+    // Finish off the stats
+    render_stats.culled_objects += list->stats.culled_objects;
+    render_stats.culled_meshlets += list->stats.culled_meshlets;
+    render_stats.evictions += list->stats.evictions;
+    render_stats.gpu_memory = list->stats.gpu_memory;
+
+    double now = Renderer::getTime();
+    render_stats.frame_time = now - last_frame_end;
+    last_frame_end = now;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished_stats = render_stats;
+    }
+    render_stats = Renderer::RenderStats();
+}
@@ -1,6 +1,8 @@
 #include "Flux/OpenGL/GLRenderer.hh"
+#include "Flux/Animation.hh"
 #include "Flux/ECS.hh"
 #include "Flux/Log.hh"
+#include "Flux/Particles.hh"
 #include "Flux/Physics.hh"
 #include "Flux/Renderer.hh"
 #include "Flux/Input.hh"
@@ -8,6 +10,9 @@
 #include "Flux/Resources.hh"
 // #include "GLFW/glfw3.h"
 // #include <bits/stdint-uintn.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
@@ -25,46 +30,111 @@ using namespace Flux::GLRenderer;
 // We need this for callbacks
 // static GLCtx* current_window = nullptr;
 
+Flux::Renderer::RenderStats Flux::GLRenderer::render_stats;
+static Flux::Renderer::RenderStats last_render_stats;
+static double frame_start = 0;
+
 // Destructors
+// The frame being recorded might still draw with these, so the GL objects are deleted after it
 GLMeshCom::~GLMeshCom()
 {
-    // TODO: Figure out why this line was breaking everything
-    // glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
-    glDeleteBuffers(1, &IBO);
+    residency.forget(this);
+
+    if (!resident)
+    {
+        // The render thread still has the GL objects, so it hands them back to be deleted
+        upload_queue.cancel(upload_job);
+        return;
+    }
+
+    // Evicted meshes get a new component when they come back, so everything has to go
+    uint32_t vbo = VBO, ibo = IBO, vao = VAO, position_vao = position_VAO;
+    render_thread.deleteLater([vbo, ibo, vao, position_vao]() {
+        glDeleteVertexArrays(1, &vao);
+        gl_state.forgetVertexArray(vao);
+
+        // Only meshes with a position stream have one
+        if (position_vao != 0)
+        {
+            glDeleteVertexArrays(1, &position_vao);
+            gl_state.forgetVertexArray(position_vao);
+        }
+
+        glDeleteBuffers(1, &vbo);
+        glDeleteBuffers(1, &ibo);
+        gl_state.forgetBuffer(vbo);
+        gl_state.forgetBuffer(ibo);
+    });
+}
+
+GLTextureCom::~GLTextureCom()
+{
+    residency.forget(this);
+
+    if (!resident)
+    {
+        upload_queue.cancel(upload_job);
+        return;
+    }
+
+    uint32_t texture = handle;
+    render_thread.deleteLater([texture]() {
+        glDeleteTextures(1, &texture);
+        gl_state.forgetTexture(texture);
+    });
 }
 
 GLShaderCom::~GLShaderCom()
 {
-
-    glDeleteProgram(shader_program);
+    // Other shaders might be using the same program
+    uint32_t program = shader_program;
+    render_thread.deleteLater([program]() { shader_cache.release(program); });
 }
 
-void Flux::GLRenderer::_startGL()
+void Flux::GLRenderer::_startGL(GLADloadproc load)
 {
     LOG_SUCCESS(std::string("OpenGL Version ") + (char*)glGetString(GL_VERSION) + " on " + (char*)glGetString(GL_VENDOR) + " " + (char*)glGetString(GL_RENDERER));
 
+    dynamic_resolution.loadTimerQueries(load);
+
     // Create viewport
     glViewport(0, 0, current_window->width, current_window->height);
-    glEnable(GL_DEPTH_TEST);
+    gl_state.enable(GL_DEPTH_TEST);
 }
 
 bool Flux::GLRenderer::startFrame()
 {
     auto sc = _windowStartFrame();
+    frame_start = Renderer::getTime();
 
-    glClearColor(0.0, 0.74, 1.0, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    auto& list = render_thread.getList();
+    list.width = current_window->width;
+    list.height = current_window->height;
 
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
+    render_thread.record([]() {
+        glClearColor(0.0, 0.74, 1.0, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        gl_state.enable(GL_CULL_FACE);
+        gl_state.cullFace(GL_BACK);
+    });
 
     return !sc;
 }
 
 void Flux::GLRenderer::endFrame()
 {
-    _windowEndFrame();
+    render_thread.getList().simulation_time = Renderer::getTime() - frame_start;
+
+    // The render thread draws it, and swaps the buffers
+    render_thread.submit();
+
+    last_render_stats = render_thread.getFinishedStats();
+}
+
+const Flux::Renderer::RenderStats& Flux::Renderer::getRenderStats()
+{
+    return last_render_stats;
 }
 
 // static glm::mat4 projection;
@@ -73,32 +143,22 @@ void processTexture(Flux::Resources::ResourceRef<Flux::Renderer::TextureRes> tex
 {
     if (!texture.getBaseEntity().hasComponent<GLTextureCom>())
     {
-        // Create GL texture
-        auto txcom = new GLTextureCom;
-
-        glGenTextures(1, &txcom->handle);
-        glBindTexture(GL_TEXTURE_2D, txcom->handle);
-
-        // Set the texture wrapping/filtering options (on the currently bound texture object)
-        // Also, thanks learnopengl.com
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texture->width, texture->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, texture->image_data);
-        LOG_ASSERT_MESSAGE(glGetError() == GL_INVALID_VALUE, "Texture "+ texture->filename + " failed");
-        glGenerateMipmap(GL_TEXTURE_2D);
+        // If it was evicted, its data has to be loaded again
+        if (!residency.restoreTexture(texture.getBaseEntity()))
+        {
+            LOG_WARN("Texture " + texture->filename + " has no data to upload");
+        }
 
-        // Free the texture
-        texture->destroy();
+        // The GL texture is made, and the image uploaded, by the upload queue
+        GLTextureCom* txcom = upload_queue.addTexture(texture.getPtr());
 
         texture.getBaseEntity().addComponent(txcom);
+        residency.track(texture.getBaseEntity(), txcom);
     }
 }
 
 GLRendererSystem::GLRendererSystem():
-lights(new Renderer::LightSystem)
+lights(new Renderer::LightSystem), occlusion(new Renderer::OcclusionSystem)
 {
     
 }
@@ -113,394 +173,361 @@ void GLRendererSystem::onSystemAdded(ECSCtx *ctx)
     ctx->addSystemFront(new Flux::Physics::BroadPhaseSystem);
     ctx->addSystemFront(new Flux::Physics::RigidSystem);
     ctx->addSystemFront(new Flux::Physics::NarrowPhaseSystem);
+    ctx->addSystemFront(occlusion);
     ctx->addSystemFront(lights);
     ctx->addSystemFront(new Flux::Physics::BroadPhaseSystem);
     ctx->addSystemBack(new Flux::Transform::EndFrameSystem);
 }
 
-void GLRendererSystem::dealWithLights()
+// Creates a texture that's only used for looking up data in shaders
+static uint32_t createDataTexture(GLint internal, int width, int height, GLenum format, GLenum type)
 {
-    if (!setup_lighting)
+    uint32_t handle;
+    glGenTextures(1, &handle);
+    gl_state.editTexture(handle);
+
+    // Data textures must never be filtered
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glTexImage2D(GL_TEXTURE_2D, 0, internal, width, height, 0, format, type, NULL);
+    return handle;
+}
+
+// Rows of the light data texture, copied out for the render thread
+typedef std::vector<std::pair<int, std::array<glm::vec4, 4>>> LightRows;
+
+// The Lights block's buffer. Only the render thread touches it, so it's made the first time it's needed
+static uint32_t legacy_light_buffer = 0;
+
+// Puts the lights in the Lights block as well, for shaders that still use it. Only for the render thread
+static void uploadLegacyLights(const LightRows& rows)
+{
+    constexpr int array_size = sizeof(glm::vec4) * FLUX_LEGACY_MAX_LIGHTS;
+    if (legacy_light_buffer == 0)
     {
-        // Create initial light data
-        glGenBuffers(1, &light_buffer);
-
-        // This is all in layout std140
-        // Which means:
-        //  - Vec3s and Vec4s are _both_ 4 floats long
-        //  - Arrays are mostly normal, except all arrays must be a multiple
-        //    of the size of a vec4
-        constexpr int vec4_size = sizeof(float) * 4;
-        // 128 floats is already a multiple of vec4_size, so we don't need to worry about that
-        // constexpr int total_size = (128 * vec4_size * 2) + (128 * sizeof(float));
-        constexpr int total_size = (128 * vec4_size * 4); // + (128 * sizeof(float));
-
-        glBindBuffer(GL_UNIFORM_BUFFER, light_buffer);
-        glBufferData(GL_UNIFORM_BUFFER, total_size, NULL, GL_DYNAMIC_DRAW);
-        glBindBufferRange(GL_UNIFORM_BUFFER, 1, light_buffer, 0, total_size);
-        glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-        // Fill with zeros for now
-        // Buffer of zeros:
-        char zeros[total_size];
-        for (int i = 0; i < total_size; i++)
+        glGenBuffers(1, &legacy_light_buffer);
+        render_stats.buffer_creations ++;
+
+        // Lights that haven't been set yet are all zeros
+        std::vector<char> zeros(array_size * 4, 0);
+        gl_state.bindBuffer(GL_UNIFORM_BUFFER, legacy_light_buffer);
+        glBufferData(GL_UNIFORM_BUFFER, zeros.size(), zeros.data(), GL_DYNAMIC_DRAW);
+        gl_state.bindBufferBase(GL_UNIFORM_BUFFER, FLUX_LIGHTS_BINDING, legacy_light_buffer);
+    }
+
+    gl_state.bindBuffer(GL_UNIFORM_BUFFER, legacy_light_buffer);
+    for (auto& row : rows)
+    {
+        if (row.first >= FLUX_LEGACY_MAX_LIGHTS)
         {
-            zeros[i] = 0;
+            continue;
         }
 
-        glBindBuffer(GL_UNIFORM_BUFFER, light_buffer);
-        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(zeros), &zeros);
-        glBindBuffer(GL_UNIFORM_BUFFER, 0);
-        setup_lighting = true;
+        auto& r = row.second;
+        glm::vec4 info = glm::vec4(r[1].w, r[0].w, r[2].w, 0);
 
-        const GLenum err = glGetError();
-        if (GL_NO_ERROR != err)
-        {
-            LOG_ERROR("OpenGL Error");
-        }
+        glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::vec4) * row.first, sizeof(glm::vec4), &r[0]);
+        glBufferSubData(GL_UNIFORM_BUFFER, array_size + sizeof(glm::vec4) * row.first, sizeof(glm::vec4), &r[1]);
+        glBufferSubData(GL_UNIFORM_BUFFER, array_size * 2 + sizeof(glm::vec4) * row.first, sizeof(glm::vec4), &r[2]);
+        glBufferSubData(GL_UNIFORM_BUFFER, array_size * 3 + sizeof(glm::vec4) * row.first, sizeof(glm::vec4), &info);
     }
+}
 
-    // Add all the changed lights to the buffer
-    glBindBuffer(GL_UNIFORM_BUFFER, light_buffer);
-    for (auto i : lights->lights_that_changed)
+// Copies out lights in the light data texture's layout
+static LightRows getLightRows(Flux::Renderer::LightSystem* lights, bool all)
+{
+    LightRows rows;
+    auto add_light = [&](int i) {
+        auto& ld = lights->light_data[i];
+        rows.push_back(std::make_pair(i, std::array<glm::vec4, 4> {
+            glm::vec4(ld.position, ld.radius),
+            glm::vec4(ld.direction, (float)ld.type),
+            glm::vec4(ld.color, glm::cos(ld.cutoff)),
+            glm::vec4(0)
+        }));
+    };
+
+    if (all)
     {
-        auto light = lights->lights[i];
-        auto tc = light.getComponent<Transform::TransformCom>();
-        auto pos = glm::vec3(tc->model * glm::vec4(0,0,0,1));
-
-        auto lc = light.getComponent<Renderer::LightCom>();
-
-        if (lc->type == Renderer::LightType::Spot)
+        for (int i = 0; i < lights->light_data.size(); i++)
         {
-            // Calculate direction from transform
-            lc->direction = -glm::vec3(tc->model * glm::vec4(0, 0, 1, 0));
+            add_light(i);
         }
-
-        // Add to buffer
-        glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::vec4) * i, sizeof(glm::vec3), &pos);
-        glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::vec4) * 128 + (sizeof(glm::vec4) * i), sizeof(glm::vec3), &lc->direction);
-        glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::vec4) * 128 * 2 + (sizeof(glm::vec4) * i), sizeof(glm::vec3), &lc->color);
-        auto infos = glm::vec3((float)lc->type, lc->radius, glm::cos(lc->cutoff));
-        glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::vec4) * 128 * 3 + (sizeof(glm::vec4) * i), sizeof(glm::vec3), &infos);
     }
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-    const GLenum err = glGetError();
-    if (GL_NO_ERROR != err)
+    else
     {
-        LOG_ERROR("OpenGL Error");
+        for (auto i : lights->lights_that_changed)
+        {
+            add_light(i);
+        }
     }
+
+    return rows;
 }
 
-void GLRendererSystem::dealWithUniforms(Flux::Renderer::MeshCom* mesh, Flux::Renderer::MaterialRes* mat_res, GLShaderCom* shader_res)
+void GLRendererSystem::dealWithLights()
 {
-    bool create = false;
-    if (!mesh->mat_resource.getBaseEntity().hasComponent<GLUniformCom>())
+    if (!setup_lighting)
     {
-        // Create the uniform buffer
-        create = true;
+        // Each light is one row of 4 texels:
+        //  - position.xyz, radius
+        //  - direction.xyz, type
+        //  - color.rgb, cos(cutoff)
+        //  - unused
+        light_capacity = 128;
+        light_index_capacity = FLUX_LIGHT_INDEX_TEXTURE_WIDTH;
+
+        render_thread.call([this]() {
+            light_data_texture = createDataTexture(GL_RGBA32F, 4, light_capacity, GL_RGBA, GL_FLOAT);
+
+            // (offset, count) for each cluster
+            light_cluster_texture = createDataTexture(GL_RG32UI, FLUX_CLUSTERS_X * FLUX_CLUSTERS_Y, FLUX_CLUSTERS_Z, GL_RG_INTEGER, GL_UNSIGNED_INT);
+
+            // The compacted list of light indices that the clusters point into
+            light_index_texture = createDataTexture(GL_R32UI, FLUX_LIGHT_INDEX_TEXTURE_WIDTH, 1, GL_RED_INTEGER, GL_UNSIGNED_INT);
+
+            const GLenum err = glGetError();
+            if (GL_NO_ERROR != err)
+            {
+                LOG_ERROR("OpenGL Error");
+            }
+        });
+
+        setup_lighting = true;
     }
 
-    if (create || mat_res->changed)
+    // Make sure there's room for all the lights
+    bool upload_all = false;
+    int new_light_capacity = 0;
+    if (lights->light_data.size() > light_capacity)
     {
-        // We have to re-upload the uniform data to the gpu
-        GLUniformCom* uni;
-        if (create)
+        while (light_capacity < lights->light_data.size())
         {
-            uni = new GLUniformCom;
+            light_capacity *= 2;
+        }
 
-            uni->block_size = glGetUniformBlockIndex(shader_res->shader_program, "Material");
-            glUniformBlockBinding(shader_res->shader_program, uni->block_size, 0);
-            mesh->mat_resource.getBaseEntity().addComponent(uni);
+        new_light_capacity = light_capacity;
+        upload_all = true;
+    }
 
-            int block_size;
-            glGetActiveUniformBlockiv(shader_res->shader_program, uni->block_size, GL_UNIFORM_BLOCK_DATA_SIZE, &block_size);
-            std::cout << "Block size: " << block_size << "\n";
+    // Copy out all the changed lights, since the render thread uploads them later
+    LightRows rows = getLightRows(lights, upload_all);
+    bool legacy = legacy_lights;
 
-            // Put data in buffer
-            glGenBuffers(1, &uni->handle);
-            glBindBuffer(GL_UNIFORM_BUFFER, uni->handle);
+    // Clusters depend on the camera, so they have to be rebuilt every frame
+    lights->buildClusters(Transform::camera_view, projection, FLUX_NEAR_PLANE, FLUX_FAR_PLANE);
+    auto& grid = lights->clusters;
 
-            int size = mat_res->uniforms.size();
-            
-            std::vector<const char*> uniformNames;
+    // The index texture is a fixed width, so pad the list to fill the last row
+    int index_rows = (grid.light_indices.size() + FLUX_LIGHT_INDEX_TEXTURE_WIDTH - 1) / FLUX_LIGHT_INDEX_TEXTURE_WIDTH;
+    grid.light_indices.resize(std::max(index_rows, 1) * FLUX_LIGHT_INDEX_TEXTURE_WIDTH, 0);
 
-            // uniform_names_nice.resize(mat_res->uniforms.size());
-            int count = 0;
-            Renderer::UniformType last_type;
-            for (auto item : mat_res->uniforms)
-            {
-                // TODO: "Material." + name
-                if (item.second.type != Renderer::UniformType::Texture)
-                {
-                    char* x = new char[item.first.length()];
-                    auto length = item.first.copy(x, item.first.length(), 0);
-                    x[length] = '\0';
-                    uniformNames.push_back(x);
-                    last_type = item.second.type;
-                }
-                else
-                {
-                    // Make the size smaller so we don't tell OpenGL we're sending uniforms that don't exist
-                    size--;
-                }
-
-                count++;
-            }
+    int new_index_capacity = 0;
+    if (grid.light_indices.size() > light_index_capacity)
+    {
+        light_index_capacity = grid.light_indices.size();
+        new_index_capacity = light_index_capacity;
+    }
 
-            // Just a safety check
-            size = uniformNames.size();
-
-            // For MSVC
-            const int array_size = size;
-
-            GLuint uniformIndex[array_size];
-            glGetUniformIndices(shader_res->shader_program, size, &uniformNames[0], uniformIndex);
-            LOG_ASSERT_MESSAGE(glGetError() == GL_INVALID_OPERATION, "GL_INVALID_OPERATION");
-
-            GLint offsets[array_size];
-            glGetActiveUniformsiv(shader_res->shader_program, size, uniformIndex, GL_UNIFORM_OFFSET, offsets);
-            LOG_ASSERT_MESSAGE(glGetError() == GL_INVALID_VALUE, " uniformCount is greater than or equal to the value of GL_ACTIVE_UNIFORMS for program.");
-
-            int uniform_count;
-            glGetProgramiv(shader_res->shader_program, GL_ACTIVE_UNIFORM_BLOCKS, &uniform_count);
-            std::cout << "Uniform Count: " << uniform_count << "\n";
-
-            int total_size;
-
-            switch(last_type) {
-                case (Flux::Renderer::UniformType::Int):
-                    total_size = sizeof(int);
-                    break;
-                case (Flux::Renderer::UniformType::Float):
-                    total_size = sizeof(float);
-                    break;
-                case (Flux::Renderer::UniformType::Bool):
-                    total_size = sizeof(int);
-                    break;
-                case (Flux::Renderer::UniformType::Vector2):
-                    total_size = sizeof(float) * 2;
-                    break;
-                case (Flux::Renderer::UniformType::Vector3):
-                    total_size = sizeof(glm::vec3);
-                    break;
-                // case (Flux::Renderer::UniformType::Vector3): total_size += sizeof(float) * 4; break;
-                case (Flux::Renderer::UniformType::Vector4):
-                    total_size = sizeof(float) * 4;
-                    break;
-                case (Flux::Renderer::UniformType::Mat4):
-                    total_size = sizeof(glm::mat4);
-                    break;
-                case (Flux::Renderer::UniformType::Texture): break;
-            }
+    auto& list = render_thread.getList();
+    list.light_count = lights->light_data.size();
+    list.directional_light_count = grid.directional_count;
+    list.cluster_params = glm::vec4(current_window->width, current_window->height, grid.depth_scale, grid.depth_bias);
 
-            // glBindVertexArray(mc->VAO);
-            glBindBuffer(GL_UNIFORM_BUFFER, uni->handle);
-            glBufferData(GL_UNIFORM_BUFFER, block_size, NULL, GL_DYNAMIC_DRAW);
-            glBindBufferBase(GL_UNIFORM_BUFFER, 0, uni->handle);
-            // glBindVertexArray(0);
+    // The grid is built again next frame, while this one is still being drawn
+    auto clusters = grid.clusters;
+    auto light_indices = grid.light_indices;
 
-            // Add offsets to vector
-            uni->offset.resize(size);
-            for (int i = 0; i < size; i++)
-            {
-                uni->offset[i] = offsets[i];
-            }
+    uint32_t data_texture = light_data_texture, cluster_texture = light_cluster_texture, index_texture = light_index_texture;
+    render_thread.record([=]() {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
-            const GLenum err = glGetError();
-            if (GL_NO_ERROR != err)
-            {
-                // LOG_ERROR("OpenGL Error");
-                switch (err)
-                {
-                case GL_NO_ERROR:          LOG_ERROR("No error");
-                case GL_INVALID_ENUM:      LOG_ERROR("Invalid enum");
-                case GL_INVALID_VALUE:     LOG_ERROR("Invalid value");
-                case GL_INVALID_OPERATION: LOG_ERROR("Invalid operation");
-                // case GL_STACK_OVERFLOW:    return "Stack overflow";
-                // case GL_STACK_UNDERFLOW:   return "Stack underflow";
-                case GL_OUT_OF_MEMORY:     LOG_ERROR("Out of memory");
-                default:                   LOG_ERROR("Unknown error");
-                }
-            }
+        gl_state.editTexture(data_texture);
+        if (new_light_capacity != 0)
+        {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, 4, new_light_capacity, 0, GL_RGBA, GL_FLOAT, NULL);
+        }
 
-            // Deallocate memory
-            for (auto i : uniformNames)
-            {
-                delete[] i;
-            }
+        // Add all the changed lights to the texture
+        for (auto& row : rows)
+        {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, row.first, 4, 1, GL_RGBA, GL_FLOAT, row.second.data());
+        }
 
+        gl_state.editTexture(cluster_texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, FLUX_CLUSTERS_X * FLUX_CLUSTERS_Y, FLUX_CLUSTERS_Z, GL_RG_INTEGER, GL_UNSIGNED_INT, clusters.data());
+
+        gl_state.editTexture(index_texture);
+        if (new_index_capacity != 0)
+        {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, FLUX_LIGHT_INDEX_TEXTURE_WIDTH, new_index_capacity / FLUX_LIGHT_INDEX_TEXTURE_WIDTH, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, light_indices.data());
         }
         else
         {
-            // uni = (GLUniformCom*)Flux::getComponent(Flux::Resources::rctx, mesh->mat_resource, GLUniformComponentID);
-            uni = mesh->mat_resource.getBaseEntity().getComponent<GLUniformCom>();
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, FLUX_LIGHT_INDEX_TEXTURE_WIDTH, light_indices.size() / FLUX_LIGHT_INDEX_TEXTURE_WIDTH, GL_RED_INTEGER, GL_UNSIGNED_INT, light_indices.data());
         }
 
-        // Create buffer for data
-        // unsigned char* block_buffer;
-        // block_buffer = (unsigned char*) std::malloc(uni->block_size);
-        glBindBuffer(GL_UNIFORM_BUFFER, uni->handle);
-
-        // Chuck data in the buffer
-        int index = 0;
-        int tex_id = 0;
-        uni->textures = std::vector<GLTextureStore>();
-        int count = 0;
-        for (auto item: mat_res->uniforms)
+        // Bind them all, and leave them bound
+        // Material textures only use the units below FLUX_LIGHT_TEXTURE_UNIT
+        gl_state.bindTexture(FLUX_LIGHT_DATA_UNIT, data_texture);
+        gl_state.bindTexture(FLUX_LIGHT_CLUSTERS_UNIT, cluster_texture);
+        gl_state.bindTexture(FLUX_LIGHT_CLUSTER_INDICES_UNIT, index_texture);
+
+        if (legacy)
         {
-            switch (item.second.type)
-            {
-                case (Flux::Renderer::UniformType::Int):
-                {
-                    glBufferSubData(GL_UNIFORM_BUFFER, uni->offset[count-tex_id], sizeof(int), item.second.value);
-                    index += sizeof(int);
-                    LOG_ASSERT_MESSAGE(glGetError() == GL_INVALID_VALUE, "Something broke");
-                    // memcpy(block_buffer + uni->offset[index], item.second.value, sizeof(int));
-                    break;
-                }
-                case (Flux::Renderer::UniformType::Float):
-                {
-                    glBufferSubData(GL_UNIFORM_BUFFER, uni->offset[count-tex_id], sizeof(float), item.second.value);
-                    index += sizeof(float);
-                    LOG_ASSERT_MESSAGE_FATAL(glGetError() == GL_INVALID_VALUE, "Something broke");
-                    // memcpy(block_buffer + uni->offset[index], item.second.value, sizeof(float));
-                    break;
-                }
-                case (Flux::Renderer::UniformType::Bool):
-                {
-                    int res = ((bool*)item.second.value ? 1: 0);
-                    glBufferSubData(GL_UNIFORM_BUFFER, uni->offset[count-tex_id], sizeof(int), &res);
-                    index += sizeof(int);
-                    LOG_ASSERT_MESSAGE(glGetError() == GL_INVALID_VALUE, "Something broke");
-                    // memcpy(block_buffer + uni->offset[index], &res, sizeof(int));
-                    break;
-                }
-                case (Flux::Renderer::UniformType::Vector2):
-                {
-                    // I'm hoping glm's vectors are just a struct of floats...
-                    // memcpy(block_buffer + uni->offset[index], item.second.value, sizeof(float) * 2);
-                    glBufferSubData(GL_UNIFORM_BUFFER, uni->offset[count-tex_id], sizeof(float) * 2, glm::value_ptr(*(glm::vec2*)item.second.value));
-                    index += sizeof(float)*2;
-                    LOG_ASSERT_MESSAGE(glGetError() == GL_INVALID_VALUE, "Something broke");
-                    break;
-                }
-                case (Flux::Renderer::UniformType::Vector3):
-                {
-                    // I'm hoping glm's vectors are just a struct of floats...
-                    // memcpy(block_buffer + uni->offset[index], item.second.value, sizeof(float) * 3);
-                    glBufferSubData(GL_UNIFORM_BUFFER, uni->offset[count-tex_id], sizeof(float) * 3, glm::value_ptr(*(glm::vec3*)item.second.value));
-                    index += sizeof(float)*4;
-                    // index += sizeof(float)*3;
-                    LOG_ASSERT_MESSAGE(glGetError() != GL_NO_ERROR, "Something broke");
-                    break;
-                }
-                case (Flux::Renderer::UniformType::Vector4):
-                {
-                    // I'm hoping glm's vectors are just a struct of floats...
-                    // memcpy(block_buffer + uni->offset[index], item.second.value, sizeof(float) * 4);
-                    glBufferSubData(GL_UNIFORM_BUFFER, uni->offset[count-tex_id], sizeof(float) * 4, glm::value_ptr(*(glm::vec4*)item.second.value));
-                    index += sizeof(float)*4;
-                    LOG_ASSERT_MESSAGE(glGetError() == GL_INVALID_VALUE, "Something broke");
-                    break;
-                }
-                case (Flux::Renderer::UniformType::Mat4):
-                {
-                    // memcpy(block_buffer + uni->offset[index], glm::value_ptr(*(glm::mat4*)item.second.value), sizeof(float) * 16);
-                    glBufferSubData(GL_UNIFORM_BUFFER, uni->offset[count-tex_id], sizeof(float) * 16, item.second.value);
-                    index += sizeof(float)*16;
-                    LOG_ASSERT_MESSAGE(glGetError() == GL_INVALID_VALUE, "Something broke");
-                    break;
-                }
-                case (Flux::Renderer::UniformType::Texture):
-                {
-                    // For some very stupid reason, textures can't be in uniform buffers
-                    auto res = (Resources::ResourceRef<Renderer::TextureRes>*)item.second.value;
-
-                    if (!res->getBaseEntity().hasComponent<GLTextureCom>())
-                    {
-                        processTexture(Resources::ResourceRef<Renderer::TextureRes>(res->getBaseEntity()));
-                    }
-
-                    // memcpy(block_buffer + uni->offset[index], &tex_id, sizeof(int32_t));
-                    tex_id ++;
-                    uni->textures.push_back(GLTextureStore {glGetUniformLocation(shader_res->shader_program, item.first.c_str()), res->getBaseEntity()});
-                    LOG_ASSERT_MESSAGE(glGetError() == GL_INVALID_OPERATION, "Could not get texture's uniform location");
-
-                    break;
-                }
-            }
-            count ++;
+            uploadLegacyLights(rows);
         }
 
-        glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-        // std::cout << uni->textures.size() << "\n";
-
         const GLenum err = glGetError();
         if (GL_NO_ERROR != err)
         {
-            switch (err)
-            {
-            case GL_NO_ERROR:          LOG_ERROR("No error"); break;
-            case GL_INVALID_ENUM:      LOG_ERROR("Invalid enum"); break;
-            case GL_INVALID_VALUE:     LOG_ERROR("Invalid value"); break;
-            case GL_INVALID_OPERATION: LOG_ERROR("Invalid operation"); break;
-            // case GL_STACK_OVERFLOW:    return "Stack overflow";
-            // case GL_STACK_UNDERFLOW:   return "Stack underflow";
-            case GL_OUT_OF_MEMORY:     LOG_ERROR("Out of memory"); break;
-            default:                   LOG_ERROR("Unknown error"); break;
-            }
+            LOG_ERROR("OpenGL Error");
+        }
+    });
+}
+
+// Finds where everything in the shader's Material block goes
+static void findMaterialOffsets(GLShaderCom* shader_com)
+{
+    auto program = shader_com->shader_program;
+    shader_com->material_block_size = 0;
+    shader_com->material_offsets.clear();
+
+    uint32_t block_index = glGetUniformBlockIndex(program, "Material");
+    if (block_index == GL_INVALID_INDEX)
+    {
+        // The shader doesn't have any material uniforms
+        return;
+    }
+
+    glUniformBlockBinding(program, block_index, 0);
+    glGetActiveUniformBlockiv(program, block_index, GL_UNIFORM_BLOCK_DATA_SIZE, &shader_com->material_block_size);
+
+    int count;
+    glGetActiveUniformBlockiv(program, block_index, GL_UNIFORM_BLOCK_ACTIVE_UNIFORMS, &count);
+    if (count < 1)
+    {
+        return;
+    }
+
+    std::vector<int> indices(count);
+    glGetActiveUniformBlockiv(program, block_index, GL_UNIFORM_BLOCK_ACTIVE_UNIFORM_INDICES, indices.data());
+
+    std::vector<int> offsets(count);
+    glGetActiveUniformsiv(program, count, (GLuint*)indices.data(), GL_UNIFORM_OFFSET, offsets.data());
+
+    for (int i = 0; i < count; i++)
+    {
+        char name[256];
+        int length, size;
+        GLenum type;
+        glGetActiveUniform(program, indices[i], 256, &length, &size, &type, name);
+
+        // Blocks with an instance name give us "Material.name"
+        std::string nice_name(name, length);
+        auto dot = nice_name.rfind('.');
+        if (dot != std::string::npos)
+        {
+            nice_name = nice_name.substr(dot + 1);
         }
-        // glBufferData(GL_UNIFORM_BUFFER, uni->block_size, block_buffer, GL_DYNAMIC_DRAW);
-        // glBindBufferBase(GL_UNIFORM_BUFFER, 0, uni->handle);
 
-        // delete block_buffer;
+        shader_com->material_offsets[nice_name] = offsets[i];
+    }
+
+    const GLenum err = glGetError();
+    if (GL_NO_ERROR != err)
+    {
+        LOG_ERROR("OpenGL Error while finding the material block");
+    }
+}
+
+GLUniformCom::~GLUniformCom()
+{
+    uint32_t buffer = handle;
+    render_thread.deleteLater([buffer]() {
+        glDeleteBuffers(1, &buffer);
+        gl_state.forgetBuffer(buffer);
+    });
+}
+
+GLUniformCom* GLRendererSystem::dealWithUniforms(Flux::Renderer::MeshCom* mesh, Flux::Renderer::MaterialRes* mat_res, GLShaderCom* shader_res)
+{
+    auto mat_res_en = mesh->mat_resource.getBaseEntity();
+
+    GLUniformCom* uni;
+    if (!mat_res_en.hasComponent<GLUniformCom>())
+    {
+        // Create the uniform buffer
+        uni = new GLUniformCom;
+        uni->block_size = shader_res->material_block_size;
 
-        mat_res->changed = false;
+        render_thread.call([uni]() {
+            glGenBuffers(1, &uni->handle);
+            render_stats.buffer_creations ++;
+            gl_state.bindBuffer(GL_UNIFORM_BUFFER, uni->handle);
+            glBufferData(GL_UNIFORM_BUFFER, uni->block_size, NULL, GL_DYNAMIC_DRAW);
+        });
 
-        // Textures
-        // if (mat_res->has_texture)
-        // {
-        //     processTexture(mat_res->diffuse_texture);
-        // }
+        mat_res_en.addComponent(uni);
 
-        glBindBuffer(GL_UNIFORM_BUFFER, uni->handle);
-        glBindBufferBase(GL_UNIFORM_BUFFER, 0, uni->handle);
+        // The material has never been matched to this shader
+        mat_res->layout_changed = true;
     }
     else
     {
-        // Hasn't changed, but we still have to bind it
-        auto uni = mesh->mat_resource.getBaseEntity().getComponent<GLUniformCom>();
+        uni = mat_res_en.getComponent<GLUniformCom>();
+    }
 
-        // Textures
-        for (int i = 0; i < uni->textures.size(); i++)
+    if (mat_res->layout_changed)
+    {
+        // Move everything to where the shader expects it
+        // This only happens when uniforms are added, not when they change
+        std::vector<uint32_t> offsets;
+        for (auto& param : mat_res->params)
         {
-            // Why must I do this
-            int tx;
-            switch (i)
-            {
-                case (0): tx = GL_TEXTURE0; break;
-                case (1): tx = GL_TEXTURE1; break;
-                case (2): tx = GL_TEXTURE2; break;
-                case (3): tx = GL_TEXTURE3; break;
-                case (4): tx = GL_TEXTURE4; break;
-                case (5): tx = GL_TEXTURE5; break;
-                case (6): tx = GL_TEXTURE6; break;
-                case (7): tx = GL_TEXTURE7; break;
-                case (8): tx = GL_TEXTURE8; break;
-                default: LOG_WARN("Too many textures!"); tx = 0; break;
-            }
+            auto it = shader_res->material_offsets.find(param.name);
+            offsets.push_back(it != shader_res->material_offsets.end() ? it->second : FLUX_UNUSED_UNIFORM);
+        }
+
+        mat_res->relayout(offsets, uni->block_size);
 
-            glActiveTexture(tx);
-            glBindTexture(GL_TEXTURE_2D, uni->textures[i].resource.getBaseEntity().getComponent<GLTextureCom>()->handle);
-            glUniform1i(uni->textures[i].location, i);
+        // For some very stupid reason, textures can't be in uniform buffers
+        uni->textures.clear();
+        for (auto& tex : mat_res->textures)
+        {
+            processTexture(tex.texture);
+
+            int location;
+            render_thread.call([&]() {
+                location = glGetUniformLocation(shader_res->shader_program, tex.name.c_str());
+                LOG_ASSERT_MESSAGE(glGetError() == GL_INVALID_OPERATION, "Could not get texture's uniform location");
+            });
+
+            uni->textures.push_back(GLTextureStore {location, tex.texture});
         }
-        
-        glBindBuffer(GL_UNIFORM_BUFFER, uni->handle);
-        glBindBufferBase(GL_UNIFORM_BUFFER, 0, uni->handle);
-        // glBindBuffer(GL_UNIFORM_BUFFER, uni->handle);
     }
+
+    if (mat_res->changed && uni->block_size > 0)
+    {
+        // The block is already laid out, so it's just one upload
+        // It's copied, since the material can change again before it's drawn
+        auto size = std::min(uni->block_size, (int)mat_res->block.size());
+        std::vector<unsigned char> block(mat_res->block.begin(), mat_res->block.begin() + size);
+        uint32_t buffer = uni->handle;
+
+        render_thread.record([buffer, block]() {
+            gl_state.bindBuffer(GL_UNIFORM_BUFFER, buffer);
+            glBufferSubData(GL_UNIFORM_BUFFER, 0, block.size(), block.data());
+            render_stats.uniform_bytes += block.size();
+            LOG_ASSERT_MESSAGE(glGetError() == GL_INVALID_VALUE, "Something broke");
+        });
+    }
+    mat_res->changed = false;
+
+    return uni;
 }
 
 void GLRendererSystem::initGLMaterial(Flux::Renderer::MeshCom* mesh)
@@ -520,77 +547,59 @@ void GLRendererSystem::initGLMaterial(Flux::Renderer::MeshCom* mesh)
         // Create new component
         auto shader_com = new GLShaderCom;
 
-        // Create shaders
-        uint32_t vertex_shader, fragment_shader;
-        vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-        fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-
-        // std::cout << shaders_src->vert_src << "\n" << shaders_src->frag_src << "\n";
-
-        const char* vsrc = shader_res->vert_src.c_str();
-        const char* fsrc = shader_res->frag_src.c_str();
-
-        // std::cout << vsrc << "\n" << fsrc << "\n";
-
-        // Compile shaders
-        glShaderSource(vertex_shader, 1, &vsrc, NULL);
-        glShaderSource(fragment_shader, 1, &fsrc, NULL);
-
-        glCompileShader(vertex_shader);
-        glCompileShader(fragment_shader);
-
-        // Check for errors
-        int success;
-        char infoLog[512];
-        glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &success);
-        if(!success)
-        {
-            glGetShaderInfoLog(vertex_shader, 512, NULL, infoLog);
-            std::cout << "Vertex shader compilation failed:\n" << infoLog << std::endl;
-        }
-
-        success = 0;
-        char infoLog2[512];
-        glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &success);
-        if(!success)
-        {
-            glGetShaderInfoLog(fragment_shader, 512, NULL, infoLog2);
-            std::cout << "Fragment shader compilation failed:\n" << infoLog2 << std::endl;
-        }
-
-        // Link shaders
-        shader_com->shader_program = glCreateProgram();
-
-        glAttachShader(shader_com->shader_program, vertex_shader);
-        glAttachShader(shader_com->shader_program, fragment_shader);
-        glLinkProgram(shader_com->shader_program);
-
-        // Check for linking errors
-        success = 0;
-        char infoLog3[512];
-        glGetProgramiv(shader_com->shader_program, GL_LINK_STATUS, &success);
-        if(!success)
-        {
-            glGetProgramInfoLog(shader_com->shader_program, 512, NULL, infoLog3);
-            std::cout << "Shader linking failed:\n" << infoLog3 << std::endl;
-        }
-
-        shader_com->mvp_location = glGetUniformLocation(shader_com->shader_program, "model_view_projection");
-        shader_com->mv_location = glGetUniformLocation(shader_com->shader_program, "model_view");
-        shader_com->m_location = glGetUniformLocation(shader_com->shader_program, "model");
-        shader_com->cam_pos_location = glGetUniformLocation(shader_com->shader_program, "cam_pos");
-        shader_com->light_indexes_location = glGetUniformLocation(shader_com->shader_program, "light_indexes");
+        render_thread.call([&]() {
+            // Get the program
+            // Shaders with the same source share one, and it might not even need compiling
+            shader_com->shader_program = shader_cache.acquire(shader_res.getPtr());
+
+            shader_com->mvp_location = glGetUniformLocation(shader_com->shader_program, "model_view_projection");
+            shader_com->mv_location = glGetUniformLocation(shader_com->shader_program, "model_view");
+            shader_com->m_location = glGetUniformLocation(shader_com->shader_program, "model");
+            shader_com->cam_pos_location = glGetUniformLocation(shader_com->shader_program, "cam_pos");
+            shader_com->light_indexes_location = glGetUniformLocation(shader_com->shader_program, FLUX_LIGHT_INDEXES_UNIFORM);
+            shader_com->light_count_location = glGetUniformLocation(shader_com->shader_program, FLUX_LIGHT_COUNT_UNIFORM);
+            shader_com->directional_light_count_location = glGetUniformLocation(shader_com->shader_program, FLUX_DIRECTIONAL_LIGHT_COUNT_UNIFORM);
+            shader_com->vertex_format_location = glGetUniformLocation(shader_com->shader_program, "vertex_format");
+            shader_com->cluster_params_location = glGetUniformLocation(shader_com->shader_program, FLUX_CLUSTER_PARAMS_UNIFORM);
+
+            findMaterialOffsets(shader_com);
+
+            // Skinned shaders read their bones from here. See GLSkinning
+            uint32_t bones_index = glGetUniformBlockIndex(shader_com->shader_program, "FluxBones");
+            if (bones_index != GL_INVALID_INDEX)
+            {
+                glUniformBlockBinding(shader_com->shader_program, bones_index, FLUX_BONES_BINDING);
+            }
 
-        // Cleanup
-        glDeleteShader(vertex_shader);
-        glDeleteShader(fragment_shader);
+            // Link lights
+            // The light textures always stay on the same units, so this only has to be done once
+            int data_location = glGetUniformLocation(shader_com->shader_program, FLUX_LIGHT_DATA_UNIFORM);
+            gl_state.useProgram(shader_com->shader_program);
+            gl_state.setSampler(data_location, FLUX_LIGHT_DATA_UNIT);
+            gl_state.setSampler(glGetUniformLocation(shader_com->shader_program, FLUX_LIGHT_CLUSTERS_UNIFORM), FLUX_LIGHT_CLUSTERS_UNIT);
+            gl_state.setSampler(glGetUniformLocation(shader_com->shader_program, FLUX_LIGHT_CLUSTER_INDICES_UNIFORM), FLUX_LIGHT_CLUSTER_INDICES_UNIT);
+            glUniform3i(glGetUniformLocation(shader_com->shader_program, FLUX_CLUSTER_SIZE_UNIFORM), FLUX_CLUSTERS_X, FLUX_CLUSTERS_Y, FLUX_CLUSTERS_Z);
+
+            // Older shaders have a Lights block instead
+            uint32_t lights_index = glGetUniformBlockIndex(shader_com->shader_program, FLUX_LIGHTS_BLOCK);
+            if (lights_index != GL_INVALID_INDEX)
+            {
+                glUniformBlockBinding(shader_com->shader_program, lights_index, FLUX_LIGHTS_BINDING);
+                shader_com->legacy_lights = true;
+            }
+            else if ((int)shader_com->light_indexes_location != -1 && data_location == -1)
+            {
+                // It wants lights, but it won't find them anywhere
+                LOG_ERROR("Shader " + shader_res->frag_fname + " uses " FLUX_LIGHT_INDEXES_UNIFORM " without " FLUX_LIGHT_DATA_UNIFORM " or a " FLUX_LIGHTS_BLOCK " block, so it won't get any lights");
+            }
+        });
 
-        // Link lights
-        // It should stay linked, since I'm not re-binding that binding point
-        auto bs = glGetUniformBlockIndex(shader_com->shader_program, "Lights");
-        if (bs != GL_INVALID_INDEX)
+        if (shader_com->legacy_lights && !legacy_lights)
         {
-            glUniformBlockBinding(shader_com->shader_program, bs, 1);
+            // The Lights block hasn't been kept up to date until now, so it needs everything
+            legacy_lights = true;
+            LightRows rows = getLightRows(lights, true);
+            render_thread.record([rows]() { uploadLegacyLights(rows); });
         }
 
         // Add to resource entity
@@ -603,10 +612,7 @@ void GLRendererSystem::initGLMaterial(Flux::Renderer::MeshCom* mesh)
     // Don't know if we need this if statement
     if (!mat_res_en.hasComponent<GLUniformCom>())
     {
-        // Make shaders active
         GLShaderCom* shader_com = mat_res->shaders.getBaseEntity().getComponent<GLShaderCom>();
-        glUseProgram(shader_com->shader_program);
-
         dealWithUniforms(mesh, mat_res, shader_com);
     }
 }
@@ -614,10 +620,120 @@ void GLRendererSystem::initGLMaterial(Flux::Renderer::MeshCom* mesh)
 void GLRendererSystem::onSystemStart()
 {
     // TODO: Customisable FOV
-    projection = glm::perspective(1.570796f, (float)current_window->width/current_window->height, 0.01f, 100.0f);
+    projection = glm::perspective(1.570796f, (float)current_window->width/current_window->height, FLUX_NEAR_PLANE, FLUX_FAR_PLANE);
 
     // Make sure the lights are in the correct positions
     dealWithLights();
+
+    // Occluders have to be drawn before anything can be tested against them
+    occlusion->buildBuffer(Transform::camera_view, projection);
+
+    // Anything the render thread finished uploading last frame can be drawn now
+    upload_queue.finishJobs();
+
+    // Make room for anything new
+    residency.startFrame();
+
+    render_thread.getList().camera_position = Transform::camera_position;
+    render_thread.getList().view_projection = projection * Transform::camera_view;
+
+    // The rows of the view matrix are the camera's axes in world space
+    auto& view = Transform::camera_view;
+    render_thread.getList().camera_right = glm::vec3(view[0][0], view[1][0], view[2][0]);
+    render_thread.getList().camera_up = glm::vec3(view[0][1], view[1][1], view[2][1]);
+
+    // Upload whatever fits in the budget. Anything added last frame has its GL objects by now, since they were made in the last list
+    render_thread.record([]() {
+        upload_queue.startFrame();
+        upload_queue.process();
+    });
+}
+
+bool GLRendererSystem::drawImpostor(Flux::EntityRef entity, Flux::Transform::TransformCom* trans_com)
+{
+    auto impostor = entity.getComponent<Renderer::ImpostorCom>();
+    auto mesh = entity.getComponent<Renderer::MeshCom>();
+    auto& model = trans_com->model;
+
+    glm::vec3 position = glm::vec3(model * glm::vec4(impostor->center, 1));
+    float distance = glm::length(position - Transform::camera_position);
+    float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+
+    if (!Renderer::selectImpostor(impostor, mesh->mesh_resource.getPtr(), distance, scale, projection[1][1], current_window->height))
+    {
+        return false;
+    }
+
+    // The mesh is drawn until the atlas is on the gpu
+    if (!impostor->atlas.getBaseEntity().hasComponent<GLTextureCom>())
+    {
+        processTexture(impostor->atlas);
+        return false;
+    }
+
+    auto txcom = impostor->atlas.getBaseEntity().getComponent<GLTextureCom>();
+    if (!txcom->resident)
+    {
+        return false;
+    }
+
+    residency.touch(txcom);
+
+    GLImpostorInstance instance;
+    instance.atlas = txcom->handle;
+    instance.views = impostor->views;
+    instance.position = position;
+    instance.rotation = std::atan2(model[2].x, model[2].z);
+    instance.radius = impostor->radius * std::max(glm::length(glm::vec3(model[0])), glm::length(glm::vec3(model[2])));
+    instance.half_height = impostor->half_height * glm::length(glm::vec3(model[1]));
+
+    render_thread.getList().impostors.push_back(instance);
+    return true;
+}
+
+void GLRendererSystem::drawParticles(Flux::EntityRef entity)
+{
+    auto emitter = entity.getComponent<Particles::ParticleEmitterCom>();
+    if (emitter->particles.count == 0)
+    {
+        return;
+    }
+
+    if (entity.hasComponent<Transform::TransformCom>() && !entity.getComponent<Transform::TransformCom>()->global_visibility)
+    {
+        return;
+    }
+
+    GLParticleBatch batch;
+    batch.texture = 0;
+    batch.additive = emitter->additive;
+
+    // The particles aren't drawn until their texture is on the gpu
+    if (emitter->texture.getBaseEntity().getEntityID() != -1)
+    {
+        if (!emitter->texture.getBaseEntity().hasComponent<GLTextureCom>())
+        {
+            processTexture(emitter->texture);
+            return;
+        }
+
+        auto txcom = emitter->texture.getBaseEntity().getComponent<GLTextureCom>();
+        if (!txcom->resident)
+        {
+            return;
+        }
+
+        residency.touch(txcom);
+        batch.texture = txcom->handle;
+    }
+
+    auto& list = render_thread.getList();
+    batch.first = list.particles.size();
+    batch.count = emitter->particles.count;
+
+    list.particles.resize(batch.first + batch.count);
+    Particles::packParticles(emitter, &list.particles[batch.first]);
+    list.particle_batches.push_back(batch);
 }
 
 void GLRendererSystem::runSystem(Flux::EntityRef entity, float delta)
@@ -627,133 +743,245 @@ void GLRendererSystem::runSystem(Flux::EntityRef entity, float delta)
     //     entity.getComponent<Flux::Transform::TransformCom>()->has_changed = false;
     // }
 
+    if (entity.hasComponent<Particles::ParticleEmitterCom>())
+    {
+        drawParticles(entity);
+    }
+
     if (!entity.hasComponent<Flux::Renderer::MeshCom>())
     {
         // Doesn't have a mesh - we don't care
         return;
     }
 
+    if (entity.hasComponent<Renderer::StaticCom>() && entity.getComponent<Renderer::StaticCom>()->batched)
+    {
+        // Its batch draws it
+        return;
+    }
+
     Flux::Transform::TransformCom* trans_com = entity.getComponent<Flux::Transform::TransformCom>();
 
     if (!trans_com->global_visibility)
     {
         // Don't actually render
         // LOG_INFO("Not rendering");
+        render_thread.getList().stats.culled_objects ++;
         return;
     }
 
-    // Get the mesh
-    Flux::Renderer::MeshCom* mesh = entity.getComponent<Flux::Renderer::MeshCom>();
+    if (!occlusion->isVisible(entity))
+    {
+        // Hidden behind an occluder
+        render_thread.getList().stats.culled_objects ++;
+        return;
+    }
 
-    if (!entity.hasComponent<GLEntityCom>())
+    // Far away things can be drawn as impostors, which don't need the mesh at all
+    if (entity.hasComponent<Renderer::ImpostorCom>() && drawImpostor(entity, trans_com))
     {
-        // It hasn't been initialized yet
-        // Make sure they don't already exist
-        if (!mesh->mesh_resource.getBaseEntity().hasComponent<GLMeshCom>())
-        {
-            // Get the resource
-            auto mesh_res = mesh->mesh_resource;
+        return;
+    }
 
-            // Create new component
-            GLMeshCom* mesh_com = new GLMeshCom;
+    // Get the mesh
+    Flux::Renderer::MeshCom* mesh = entity.getComponent<Flux::Renderer::MeshCom>();
 
-            // Create buffer
-            glGenBuffers(1, &mesh_com->VBO);
-            glGenBuffers(1, &mesh_com->IBO);
+    // Cpu skinned characters draw their own skinned copy of the mesh instead
+    Animation::AnimatorCom* animator = entity.hasComponent<Animation::AnimatorCom>() ? entity.getComponent<Animation::AnimatorCom>() : nullptr;
+    bool cpu_skinned = animator != nullptr && animator->mode == Animation::SkinningMode::CPU && animator->skinned_mesh.getBaseEntity().getEntityID() != -1;
+    auto& mesh_resource = cpu_skinned ? animator->skinned_mesh : mesh->mesh_resource;
 
-            // Create Vertex Array
-            glGenVertexArrays(1, &mesh_com->VAO);
+    // Make sure they don't already exist
+    // This is also how evicted meshes come back
+    if (!mesh_resource.getBaseEntity().hasComponent<GLMeshCom>())
+    {
+        // The pre-pass only needs positions, so they get their own stream
+        if (mesh->mat_resource->depth_prepass)
+        {
+            mesh_resource->position_stream = true;
+        }
 
-            // Bind vertex array
-            glBindVertexArray(mesh_com->VAO);
+        // The buffers are made, and the data uploaded, by the upload queue
+        GLMeshCom* mesh_com = upload_queue.addMesh(mesh_resource.getPtr());
 
-            // Fill up buffer
-            glBindBuffer(GL_ARRAY_BUFFER, mesh_com->VBO);
-            glBufferData(GL_ARRAY_BUFFER, sizeof(Flux::Renderer::Vertex) * mesh_res->vertices_length, mesh_res->vertices, GL_STATIC_DRAW);
+        // Add to resource entity
+        // Flux::addComponent(Flux::Resources::rctx, mesh->mesh_resource, GLMeshComponentID, mesh_com);
+        mesh_resource.getBaseEntity().addComponent(mesh_com);
+        residency.track(mesh_resource.getBaseEntity(), mesh_com);
+    }
 
-            // Fill up buffer for indices
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh_com->IBO);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * mesh_res->indices_length, mesh_res->indices, GL_STATIC_DRAW);
+    if (!entity.hasComponent<GLEntityCom>())
+    {
+        // It hasn't been initialized yet
+        initGLMaterial(mesh);
 
-            // Tell OpenGL what our data means
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 14, (void*)0);
-            glEnableVertexAttribArray(0);
+        entity.addComponent(new GLEntityCom);
+    }
 
-            // Normal
-            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 14, (void*)(sizeof(float) * 3));
-            glEnableVertexAttribArray(1);
+    auto mat_res = mesh->mat_resource.getPtr();
 
-            // Texture
-            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 14, (void*)(sizeof(float) * 6));
-            glEnableVertexAttribArray(2);
+    // Actually render
+    GLMeshCom* mesh_com = mesh_resource.getBaseEntity().getComponent<GLMeshCom>();
 
-            // Tangents
-            glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 14, (void*)(sizeof(float) * 8));
-            glEnableVertexAttribArray(3);
+    if (mesh_resource->dynamic && mesh_resource->changed)
+    {
+        upload_queue.streamMesh(mesh_resource.getPtr(), mesh_com);
+    }
 
-            // Bitangents
-            glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 14, (void*)(sizeof(float) * 11));
-            glEnableVertexAttribArray(4);
+    if (mesh_com->num_indices == 0)
+    {
+        // Nevermind
+        return;
+    }
 
-            mesh_com->num_vertices = mesh_res->vertices_length;
-            mesh_com->num_indices = mesh_res->indices_length;
+    // Don't draw anything until all of its data is on the gpu
+    if (!mesh_com->resident)
+    {
+        return;
+    }
 
-            // Set draw mode
-            if (mesh_res->draw_mode == Renderer::DrawMode::Triangles)
+    if (mesh->mat_resource.getBaseEntity().hasComponent<GLUniformCom>())
+    {
+        for (auto& tex : mesh->mat_resource.getBaseEntity().getComponent<GLUniformCom>()->textures)
+        {
+            if (!tex.resource.getBaseEntity().hasComponent<GLTextureCom>())
             {
-                mesh_com->draw_type = GL_TRIANGLES;
+                // It was evicted
+                processTexture(tex.resource);
+                return;
             }
-            else
+
+            auto txcom = tex.resource.getBaseEntity().getComponent<GLTextureCom>();
+            if (!txcom->resident)
             {
-                mesh_com->draw_type = GL_LINES;
+                return;
             }
 
-            // Add to resource entity
-            // Flux::addComponent(Flux::Resources::rctx, mesh->mesh_resource, GLMeshComponentID, mesh_com);
-            mesh->mesh_resource.getBaseEntity().addComponent(mesh_com);
+            residency.touch(txcom);
         }
-
-        initGLMaterial(mesh);
-
-        entity.addComponent(new GLEntityCom);
     }
 
-    auto mat_res = mesh->mat_resource.getPtr();
+    residency.touch(mesh_com);
 
-    // Actually render
-    GLMeshCom* mesh_com = mesh->mesh_resource.getBaseEntity().getComponent<GLMeshCom>();
-    if (mesh_com->num_indices == 0)
+    GLShaderCom* shader_com = mat_res->shaders.getBaseEntity().getComponent<GLShaderCom>();
+    GLUniformCom* uni = dealWithUniforms(mesh, mat_res, shader_com);
+
+    // Everything is copied into the draw command, since it's drawn while the next frame is running
+    GLDrawCommand command;
+    command.program = shader_com->shader_program;
+    command.uniform_buffer = uni->handle;
+
+    command.mvp_location = shader_com->mvp_location;
+    command.mv_location = shader_com->mv_location;
+    command.m_location = shader_com->m_location;
+    command.cam_pos_location = shader_com->cam_pos_location;
+    command.vertex_format_location = shader_com->vertex_format_location;
+    command.light_indexes_location = shader_com->light_indexes_location;
+    command.light_count_location = shader_com->light_count_location;
+    command.directional_light_count_location = shader_com->directional_light_count_location;
+    command.cluster_params_location = shader_com->cluster_params_location;
+
+    // Skinned meshes get the position transform folded into their bones instead, since it has to happen before skinning
+    bool gpu_skinned = animator != nullptr && animator->mode == Animation::SkinningMode::GPU && animator->skin_valid && !animator->skin_matrices.empty()
+        && (mesh_com->vertex_format_flags & Renderer::VertexFormatFlags::Skinned);
+
+    // int loc = glGetUniformLocation(shader_com->shader_program, "model_view");
+    if (mesh_com->has_position_transform && !gpu_skinned)
     {
-        // Nevermind
-        return;
+        // Fold the position dequantization into the matrices
+        command.model = trans_com->model * mesh_com->position_transform;
+        command.model_view = trans_com->model_view * mesh_com->position_transform;
     }
+    else
+    {
+        command.model = trans_com->model;
+        command.model_view = trans_com->model_view;
+    }
+    command.model_view_projection = projection * command.model_view;
+    command.vertex_format_flags = mesh_com->vertex_format_flags;
 
-    GLShaderCom* shader_com = mat_res->shaders.getBaseEntity().getComponent<GLShaderCom>();
-
-    glUseProgram(shader_com->shader_program);
+    if (gpu_skinned)
+    {
+        command.bone_offset = GLSkinning::addPalette(render_thread.getList(), animator->skin_matrices,
+            mesh_com->has_position_transform ? mesh_com->position_transform : glm::mat4());
+    }
+    else
+    {
+        // Nothing is bound to FluxBones, so the shader mustn't try to skin it
+        command.vertex_format_flags &= ~Renderer::VertexFormatFlags::Skinned;
+    }
 
-    // int loc = glGetUniformLocation(shader_com->shader_program, "model_view");
-    auto mvp = projection * trans_com->model_view;
-    glUniformMatrix4fv(shader_com->mvp_location, 1, GL_FALSE, glm::value_ptr(mvp));
-    glUniformMatrix4fv(shader_com->mv_location, 1, GL_FALSE, glm::value_ptr(trans_com->model_view));
-    glUniformMatrix4fv(shader_com->m_location, 1, GL_FALSE, glm::value_ptr(trans_com->model));
-    glUniform3f(shader_com->cam_pos_location, Transform::camera_position.x,
-                                                Transform::camera_position.y,
-                                                Transform::camera_position.z);
+    // Textures
+    for (int i = 0; i < uni->textures.size(); i++)
+    {
+        if (i >= FLUX_LIGHT_TEXTURE_UNIT)
+        {
+            LOG_WARN("Too many textures!");
+            break;
+        }
 
-    dealWithUniforms(mesh, mat_res, shader_com);
+        auto txcom = uni->textures[i].resource.getBaseEntity().getComponent<GLTextureCom>();
+        command.textures[i] = txcom->handle;
+        command.texture_targets[i] = txcom->target;
+        command.texture_locations[i] = uni->textures[i].location;
+        command.texture_count ++;
+    }
 
     // Deal with lights
     if (entity.hasComponent<Renderer::LightInfoCom>())
     {
         auto lic = entity.getComponent<Renderer::LightInfoCom>();
-        glUniform1iv(shader_com->light_indexes_location, 8, lic->effected_lights);
+        command.has_lights = true;
+        std::memcpy(command.light_indexes, lic->effected_lights, sizeof(command.light_indexes));
+    }
+
+    // Pick the level of detail
+    int lod = 0;
+    if (mesh_com->lod_counts.size() > 1)
+    {
+        auto glentity = entity.getComponent<GLEntityCom>();
+        auto& model = trans_com->model;
+
+        float distance = glm::length(glm::vec3(model[3]) - Transform::camera_position);
+        float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+
+        glentity->current_lod = Renderer::selectLOD(mesh_resource.getPtr(), glentity->current_lod, distance, scale, projection[1][1], current_window->height);
+        lod = glentity->current_lod;
     }
 
-    glEnable(GL_DEPTH_TEST);
-    glBindVertexArray(mesh_com->VAO);
-    glDrawElements(mesh_com->draw_type, mesh_com->num_indices, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+    command.vao = mesh_com->VAO;
+    command.draw_type = mesh_com->draw_type;
+    command.index_type = mesh_com->index_type;
+    command.count = mesh_com->lod_counts[lod];
+    command.offset = mesh_com->lod_offsets[lod] * mesh_com->index_size;
+
+    // Big meshes only draw the meshlets that could be seen. Only the full mesh has them
+    auto mesh_res = mesh_resource.getPtr();
+    if (lod == 0 && !mesh_res->meshlets.empty() && !mesh_res->dynamic && !gpu_skinned)
+    {
+        auto& list = render_thread.getList();
+
+        // The meshlets are in the mesh's real space, so the position transform isn't wanted
+        auto model_camera = glm::vec3(glm::inverse(trans_com->model) * glm::vec4(Transform::camera_position, 1));
+
+        command.range_start = list.meshlet_ranges.size();
+        list.stats.culled_meshlets += Renderer::cullMeshlets(mesh_res, projection * trans_com->model_view, model_camera, list.meshlet_ranges);
+        command.range_count = list.meshlet_ranges.size() - command.range_start;
+
+        if (command.range_count == 0)
+        {
+            // All of it was culled
+            list.stats.culled_objects ++;
+            return;
+        }
+    }
+
+    // Meshes without a position stream can still go in the pre-pass, they just fetch whole vertices.
+    // The pre-pass shader doesn't know about bones, so gpu skinned meshes can't
+    command.depth_prepass = mat_res->depth_prepass && depth_prepass.isEnabled() && command.draw_type == GL_TRIANGLES && !gpu_skinned;
+    command.depth_vao = mesh_com->position_VAO != 0 ? mesh_com->position_VAO : mesh_com->VAO;
+
+    render_thread.getList().draws.push_back(command);
 
     // trans_com->has_changed = false;
 
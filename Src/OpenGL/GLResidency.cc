@@ -0,0 +1,184 @@
+#include "Flux/OpenGL/GLRenderer.hh"
+#include "Flux/Log.hh"
+#include "Flux/Renderer.hh"
+#include "Flux/Resources.hh"
+
+// STL includes
+#include <algorithm>
+
+using namespace Flux::GLRenderer;
+
+GLResidency Flux::GLRenderer::residency;
+
+GLResidency::GLResidency():
+budget(FLUX_GPU_MEMORY_BUDGET), bytes_used(0), frame(1)
+{
+
+}
+
+void GLResidency::track(EntityRef resource, GLMeshCom* mesh)
+{
+    Entry e;
+    e.resource = resource;
+    e.mesh = mesh;
+    mesh->last_used = frame;
+    entries.push_back(e);
+}
+
+void GLResidency::track(EntityRef resource, GLTextureCom* texture)
+{
+    Entry e;
+    e.resource = resource;
+    e.texture = texture;
+    texture->last_used = frame;
+    entries.push_back(e);
+}
+
+void GLResidency::forget(Component* com)
+{
+    for (auto it = entries.begin(); it != entries.end(); it++)
+    {
+        if (it->mesh == com || it->texture == com)
+        {
+            bytes_used -= it->mesh != nullptr ? it->mesh->gpu_bytes : it->texture->gpu_bytes;
+
+            // Order doesn't matter
+            *it = entries.back();
+            entries.pop_back();
+            return;
+        }
+    }
+}
+
+void GLResidency::setBudget(uint64_t bytes)
+{
+    budget = bytes;
+}
+
+void GLResidency::startFrame()
+{
+    frame ++;
+
+    // Dynamic meshes and decompressed textures change size, so it's easier to just add it all up again
+    bytes_used = 0;
+    for (auto& e : entries)
+    {
+        bytes_used += e.mesh != nullptr ? e.mesh->gpu_bytes : e.texture->gpu_bytes;
+    }
+
+    render_thread.getList().stats.gpu_memory = bytes_used;
+
+    if (bytes_used <= budget)
+    {
+        return;
+    }
+
+    // Anything that was drawn last frame will probably be drawn again, so leave it alone
+    // Half uploaded things are left alone too, since they're probably about to be drawn
+    std::vector<Entry> candidates;
+    for (auto& e : entries)
+    {
+        if (e.mesh != nullptr && e.mesh->resident && e.mesh->last_used + 1 < frame)
+        {
+            candidates.push_back(e);
+        }
+        else if (e.texture != nullptr && e.texture->resident && e.texture->last_used + 1 < frame && canRestore(e.resource))
+        {
+            candidates.push_back(e);
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const Entry& a, const Entry& b) {
+        auto a_used = a.mesh != nullptr ? a.mesh->last_used : a.texture->last_used;
+        auto b_used = b.mesh != nullptr ? b.mesh->last_used : b.texture->last_used;
+        return a_used < b_used;
+    });
+
+    for (auto& e : candidates)
+    {
+        if (bytes_used <= budget)
+        {
+            break;
+        }
+
+        // Removing the component destroys the GL objects, and calls forget()
+        if (e.mesh != nullptr)
+        {
+            e.resource.removeComponent<GLMeshCom>();
+        }
+        else
+        {
+            e.resource.removeComponent<GLTextureCom>();
+        }
+
+        render_thread.getList().stats.evictions ++;
+    }
+
+    render_thread.getList().stats.gpu_memory = bytes_used;
+}
+
+bool GLResidency::canRestore(EntityRef texture)
+{
+    auto tex = (Renderer::TextureRes*)texture.getComponent<Resources::Resource>();
+
+    if (!tex->processed)
+    {
+        // It still has its data
+        return true;
+    }
+
+    if (texture.hasComponent<Resources::SerializeCom>())
+    {
+        return true;
+    }
+
+    if (!tex->internal && !tex->filename.empty())
+    {
+        return true;
+    }
+
+#ifdef FLUX_NO_CPU_FREE
+    return tex->image_data != nullptr;
+#else
+    return false;
+#endif
+}
+
+bool GLResidency::restoreTexture(EntityRef texture)
+{
+    auto tex = (Renderer::TextureRes*)texture.getComponent<Resources::Resource>();
+
+    if (!tex->processed)
+    {
+        return true;
+    }
+
+    if (texture.hasComponent<Resources::SerializeCom>())
+    {
+        // Cooked textures get their mips back from the archive
+        tex->mip_sizes.clear();
+        if (!texture.getComponent<Resources::SerializeCom>()->parent_file->reloadResource(texture))
+        {
+            LOG_WARN("Could not reload evicted texture " + tex->filename);
+            return false;
+        }
+    }
+    else if (!tex->internal && !tex->filename.empty())
+    {
+        tex->loadImage(tex->filename);
+    }
+#ifdef FLUX_NO_CPU_FREE
+    else if (tex->image_data == nullptr)
+    {
+        return false;
+    }
+#else
+    else
+    {
+        return false;
+    }
+#endif
+
+    tex->processed = false;
+    return true;
+}
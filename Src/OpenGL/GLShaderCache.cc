@@ -0,0 +1,294 @@
+#include "Flux/OpenGL/GLRenderer.hh"
+#include "Flux/Log.hh"
+#include "Flux/Renderer.hh"
+
+// STL includes
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace Flux::GLRenderer;
+
+GLShaderCache Flux::GLRenderer::shader_cache;
+
+// "FXSC"
+#define FLUX_SHADER_CACHE_MAGIC 0x46585343
+
+// Changes whenever compile changes the sources, so binaries from before don't get used
+#define FLUX_SHADER_CACHE_VERSION 1
+
+uint32_t GLShaderCache::acquire(Renderer::ShaderRes* shader)
+{
+    auto it = programs.find(shader->source_hash);
+    if (it != programs.end())
+    {
+        // Somebody already has this one
+        it->second.references ++;
+        return it->second.handle;
+    }
+
+    uint32_t program = loadBinary(shader->source_hash);
+    if (program == 0)
+    {
+        program = compile(shader);
+        saveBinary(shader->source_hash, program);
+    }
+
+    programs[shader->source_hash] = Program {program, 1};
+    return program;
+}
+
+void GLShaderCache::release(uint32_t program)
+{
+    for (auto it = programs.begin(); it != programs.end(); it++)
+    {
+        if (it->second.handle == program)
+        {
+            it->second.references --;
+            if (it->second.references < 1)
+            {
+                glDeleteProgram(program);
+                gl_state.forgetProgram(program);
+                programs.erase(it);
+            }
+            return;
+        }
+    }
+}
+
+void GLShaderCache::setDirectory(const std::string& dir)
+{
+    directory = dir;
+}
+
+/**
+Declares gl_Position invariant, so it comes out exactly the same as the depth pre-pass's, which the main pass tests
+for equality against. It has to go after the #version and #extension lines
+*/
+static std::string makeInvariant(const std::string& src)
+{
+    if (src.find("invariant gl_Position") != std::string::npos)
+    {
+        return src;
+    }
+
+    size_t pos = 0;
+    while (pos < src.size())
+    {
+        size_t start = src.find_first_not_of(" \t\r\n", pos);
+        if (start == std::string::npos || (src.compare(start, 8, "#version") != 0 && src.compare(start, 10, "#extension") != 0))
+        {
+            break;
+        }
+
+        size_t end = src.find('\n', start);
+        pos = end == std::string::npos ? src.size() : end + 1;
+    }
+
+    std::string output = src;
+    output.insert(pos, "invariant gl_Position;\n");
+    return output;
+}
+
+uint32_t GLShaderCache::compile(Renderer::ShaderRes* shader_res)
+{
+    // Create shaders
+    uint32_t vertex_shader, fragment_shader;
+    vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+    fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+
+    std::string vert_src = makeInvariant(shader_res->vert_src);
+    const char* vsrc = vert_src.c_str();
+    const char* fsrc = shader_res->frag_src.c_str();
+
+    // Compile shaders
+    glShaderSource(vertex_shader, 1, &vsrc, NULL);
+    glShaderSource(fragment_shader, 1, &fsrc, NULL);
+
+    glCompileShader(vertex_shader);
+    glCompileShader(fragment_shader);
+
+    // Check for errors
+    int success;
+    char infoLog[512];
+    glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &success);
+    if(!success)
+    {
+        glGetShaderInfoLog(vertex_shader, 512, NULL, infoLog);
+        std::cout << "Vertex shader compilation failed:\n" << infoLog << std::endl;
+    }
+
+    success = 0;
+    char infoLog2[512];
+    glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &success);
+    if(!success)
+    {
+        glGetShaderInfoLog(fragment_shader, 512, NULL, infoLog2);
+        std::cout << "Fragment shader compilation failed:\n" << infoLog2 << std::endl;
+    }
+
+    // Link shaders
+    uint32_t program = glCreateProgram();
+
+    glAttachShader(program, vertex_shader);
+    glAttachShader(program, fragment_shader);
+
+    // Has to be set before linking, or some drivers won't give us the binary
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program);
+
+    // Check for linking errors
+    success = 0;
+    char infoLog3[512];
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if(!success)
+    {
+        glGetProgramInfoLog(program, 512, NULL, infoLog3);
+        std::cout << "Shader linking failed:\n" << infoLog3 << std::endl;
+    }
+
+    // Cleanup
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+
+    return program;
+}
+
+std::string GLShaderCache::getBinaryPath(uint64_t hash)
+{
+    std::stringstream ss;
+    ss << directory << "/" << std::hex << hash << ".bin";
+    return ss.str();
+}
+
+// Binary file layout:
+// magic, driver hash, binary format, length, then the binary itself
+
+uint32_t GLShaderCache::loadBinary(uint64_t hash)
+{
+#ifdef __EMSCRIPTEN__
+    // WebGL doesn't have program binaries
+    return 0;
+#else
+    if (directory.empty())
+    {
+        return 0;
+    }
+
+    if (driver_hash == 0)
+    {
+        // Binaries only work on the exact driver that made them, and the version of compile that made them
+        std::string driver = std::string((char*)glGetString(GL_VENDOR)) + (char*)glGetString(GL_RENDERER) + (char*)glGetString(GL_VERSION)
+            + std::to_string(FLUX_SHADER_CACHE_VERSION);
+        driver_hash = Renderer::hashBytes(driver.c_str(), driver.size());
+    }
+
+    std::ifstream file(getBinaryPath(hash), std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+    {
+        return 0;
+    }
+
+    uint64_t file_size = (uint64_t)file.tellg();
+    file.seekg(0);
+
+    uint32_t magic, format, length;
+    uint64_t file_driver_hash;
+    file.read((char*)&magic, sizeof(uint32_t));
+    file.read((char*)&file_driver_hash, sizeof(uint64_t));
+    file.read((char*)&format, sizeof(uint32_t));
+    file.read((char*)&length, sizeof(uint32_t));
+
+    if (!file || magic != FLUX_SHADER_CACHE_MAGIC || file_driver_hash != driver_hash)
+    {
+        return 0;
+    }
+
+    // A truncated or corrupt file could ask for any length
+    uint64_t header_size = sizeof(uint32_t) * 3 + sizeof(uint64_t);
+    if (length == 0 || length > file_size - header_size)
+    {
+        LOG_WARN("Shader cache file " + getBinaryPath(hash) + " is corrupt, so it's been ignored");
+        return 0;
+    }
+
+    std::vector<char> binary(length);
+    file.read(binary.data(), length);
+    if (!file)
+    {
+        return 0;
+    }
+
+    uint32_t program = glCreateProgram();
+    glProgramBinary(program, format, binary.data(), length);
+
+    // The driver is allowed to reject it, for example after an update
+    int success = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    while (glGetError() != GL_NO_ERROR) {}
+
+    if (!success)
+    {
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+#endif
+}
+
+void GLShaderCache::saveBinary(uint64_t hash, uint32_t program)
+{
+#ifndef __EMSCRIPTEN__
+    if (directory.empty())
+    {
+        return;
+    }
+
+    int success = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+
+    int formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+
+    int length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+
+    if (!success || formats < 1 || length < 1)
+    {
+        // Nothing worth saving
+        return;
+    }
+
+    std::vector<char> binary(length);
+    GLenum format;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+
+    if (glGetError() != GL_NO_ERROR)
+    {
+        return;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+
+    std::ofstream file(getBinaryPath(hash), std::ios::binary);
+    if (!file.is_open())
+    {
+        LOG_WARN("Could not write to the shader cache in " + directory);
+        return;
+    }
+
+    uint32_t magic = FLUX_SHADER_CACHE_MAGIC;
+    uint32_t format32 = format;
+    uint32_t length32 = length;
+    file.write((char*)&magic, sizeof(uint32_t));
+    file.write((char*)&driver_hash, sizeof(uint64_t));
+    file.write((char*)&format32, sizeof(uint32_t));
+    file.write((char*)&length32, sizeof(uint32_t));
+    file.write(binary.data(), length);
+#endif
+}
@@ -0,0 +1,77 @@
+#include "Flux/OpenGL/GLRenderer.hh"
+#include "Flux/Log.hh"
+#include "Flux/Renderer.hh"
+
+// STL includes
+#include <algorithm>
+
+using namespace Flux::GLRenderer;
+
+GLSkinning Flux::GLRenderer::skinning;
+
+// How many matrices each palette is rounded up to
+#define FLUX_PALETTE_MATRICES (FLUX_BONE_PALETTE_ALIGNMENT / sizeof(glm::mat4))
+
+// The block is always bound at full size, even for small skeletons, since that's what the shader says it is
+#define FLUX_BONES_BLOCK_SIZE (FLUX_MAX_BONES * sizeof(glm::mat4))
+
+GLSkinning::GLSkinning():
+buffer(0), capacity(0)
+{
+
+}
+
+int GLSkinning::addPalette(GLCommandList& list, const std::vector<glm::mat4>& matrices, const glm::mat4& position_transform)
+{
+    int offset = list.bone_matrices.size();
+    auto count = std::min(matrices.size(), (size_t)FLUX_MAX_BONES);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        list.bone_matrices.push_back(matrices[i] * position_transform);
+    }
+
+    // So the next one starts on the alignment
+    auto padded = (list.bone_matrices.size() + FLUX_PALETTE_MATRICES - 1) / FLUX_PALETTE_MATRICES * FLUX_PALETTE_MATRICES;
+    list.bone_matrices.resize(padded);
+
+    return offset;
+}
+
+void GLSkinning::upload(GLCommandList* list)
+{
+    if (list->bone_matrices.empty())
+    {
+        return;
+    }
+
+    if (buffer == 0)
+    {
+        glGenBuffers(1, &buffer);
+        render_stats.buffer_creations ++;
+    }
+
+    // The last palette gets bound at full size too, so there has to be room after it
+    uint32_t size = list->bone_matrices.size() * sizeof(glm::mat4) + FLUX_BONES_BLOCK_SIZE;
+
+    gl_state.bindBuffer(GL_UNIFORM_BUFFER, buffer);
+    if (size > capacity)
+    {
+        // Grows in big steps, so it isn't reallocated every time another character shows up
+        capacity = std::max(size, capacity * 2);
+    }
+
+    // Orphaning it means the gpu can keep using last frame's matrices while these go in
+    glBufferData(GL_UNIFORM_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, list->bone_matrices.size() * sizeof(glm::mat4), list->bone_matrices.data());
+}
+
+void GLSkinning::bind(const GLDrawCommand& command)
+{
+    if (command.bone_offset < 0)
+    {
+        return;
+    }
+
+    gl_state.bindBufferRange(GL_UNIFORM_BUFFER, FLUX_BONES_BINDING, buffer, command.bone_offset * sizeof(glm::mat4), FLUX_BONES_BLOCK_SIZE);
+}
@@ -0,0 +1,318 @@
+#include "Flux/OpenGL/GLRenderer.hh"
+#include "Flux/Log.hh"
+#include "Flux/Renderer.hh"
+
+using namespace Flux::GLRenderer;
+
+GLStateCache Flux::GLRenderer::gl_state;
+
+// Nothing is ever bound to this, so it means "we don't know"
+#define FLUX_UNKNOWN_STATE 0xFFFFFFFF
+
+GLStateCache::GLStateCache()
+{
+    invalidate();
+}
+
+void GLStateCache::useProgram(uint32_t new_program)
+{
+    if (program == new_program)
+    {
+        render_stats.redundant_calls ++;
+        return;
+    }
+
+    glUseProgram(new_program);
+    program = new_program;
+    render_stats.program_switches ++;
+}
+
+void GLStateCache::bindVertexArray(uint32_t new_vao)
+{
+    if (vao == new_vao)
+    {
+        render_stats.redundant_calls ++;
+        return;
+    }
+
+    glBindVertexArray(new_vao);
+    vao = new_vao;
+}
+
+void GLStateCache::bindBuffer(GLenum target, uint32_t buffer)
+{
+    if (target == GL_ELEMENT_ARRAY_BUFFER)
+    {
+        // This changes with the VAO, so we can't know what it is
+        glBindBuffer(target, buffer);
+        return;
+    }
+
+    auto it = buffers.find(target);
+    if (it != buffers.end() && it->second == buffer)
+    {
+        render_stats.redundant_calls ++;
+        return;
+    }
+
+    glBindBuffer(target, buffer);
+    buffers[target] = buffer;
+}
+
+void GLStateCache::bindBufferBase(GLenum target, uint32_t index, uint32_t buffer)
+{
+    // Only uniform buffers have binding points we care about
+    auto it = uniform_buffers.find(index);
+    if (target == GL_UNIFORM_BUFFER && it != uniform_buffers.end() && it->second == buffer)
+    {
+        render_stats.redundant_calls ++;
+        return;
+    }
+
+    glBindBufferBase(target, index, buffer);
+
+    // This also binds it to the generic binding point
+    buffers[target] = buffer;
+    if (target == GL_UNIFORM_BUFFER)
+    {
+        uniform_buffers[index] = buffer;
+    }
+}
+
+void GLStateCache::bindBufferRange(GLenum target, uint32_t index, uint32_t buffer, uintptr_t offset, uintptr_t size)
+{
+    // Ranges move every draw, so there's no point remembering them
+    glBindBufferRange(target, index, buffer, offset, size);
+
+    buffers[target] = buffer;
+    if (target == GL_UNIFORM_BUFFER)
+    {
+        // A bindBufferBase of the same buffer still has to go through
+        uniform_buffers[index] = FLUX_UNKNOWN_STATE;
+    }
+}
+
+void GLStateCache::bindTexture(uint32_t unit, uint32_t texture, GLenum target)
+{
+    LOG_ASSERT_MESSAGE(unit >= FLUX_MAX_TEXTURE_UNITS, "Texture unit is larger than FLUX_MAX_TEXTURE_UNITS");
+
+    auto it = textures[unit].find(target);
+    if (it != textures[unit].end() && it->second == texture)
+    {
+        render_stats.redundant_calls ++;
+        return;
+    }
+
+    activeTexture(unit);
+    glBindTexture(target, texture);
+    textures[unit][target] = texture;
+    render_stats.texture_binds ++;
+}
+
+void GLStateCache::editTexture(uint32_t texture, GLenum target)
+{
+    // Even if it's already bound, the unit might not be active
+    activeTexture(FLUX_EDIT_TEXTURE_UNIT);
+    bindTexture(FLUX_EDIT_TEXTURE_UNIT, texture, target);
+}
+
+void GLStateCache::activeTexture(uint32_t unit)
+{
+    if (active_unit == unit)
+    {
+        return;
+    }
+
+    glActiveTexture(GL_TEXTURE0 + unit);
+    active_unit = unit;
+}
+
+void GLStateCache::setSampler(int location, int unit)
+{
+    if (location < 0)
+    {
+        // Not in the shader
+        return;
+    }
+
+    if (program == FLUX_UNKNOWN_STATE)
+    {
+        glUniform1i(location, unit);
+        return;
+    }
+
+    uint64_t key = ((uint64_t)program << 32) | (uint32_t)location;
+    auto it = samplers.find(key);
+    if (it != samplers.end() && it->second == unit)
+    {
+        render_stats.redundant_calls ++;
+        return;
+    }
+
+    glUniform1i(location, unit);
+    samplers[key] = unit;
+}
+
+void GLStateCache::enable(GLenum cap)
+{
+    auto it = caps.find(cap);
+    if (it != caps.end() && it->second)
+    {
+        render_stats.redundant_calls ++;
+        return;
+    }
+
+    glEnable(cap);
+    caps[cap] = true;
+}
+
+void GLStateCache::disable(GLenum cap)
+{
+    auto it = caps.find(cap);
+    if (it != caps.end() && !it->second)
+    {
+        render_stats.redundant_calls ++;
+        return;
+    }
+
+    glDisable(cap);
+    caps[cap] = false;
+}
+
+void GLStateCache::cullFace(GLenum mode)
+{
+    if (cull_mode == mode)
+    {
+        render_stats.redundant_calls ++;
+        return;
+    }
+
+    glCullFace(mode);
+    cull_mode = mode;
+}
+
+void GLStateCache::depthFunc(GLenum func)
+{
+    if (depth_func == func)
+    {
+        render_stats.redundant_calls ++;
+        return;
+    }
+
+    glDepthFunc(func);
+    depth_func = func;
+}
+
+void GLStateCache::depthMask(bool write)
+{
+    if (depth_mask == (uint32_t)write)
+    {
+        render_stats.redundant_calls ++;
+        return;
+    }
+
+    glDepthMask(write ? GL_TRUE : GL_FALSE);
+    depth_mask = write;
+}
+
+void GLStateCache::colorMask(bool write)
+{
+    if (color_mask == (uint32_t)write)
+    {
+        render_stats.redundant_calls ++;
+        return;
+    }
+
+    GLboolean value = write ? GL_TRUE : GL_FALSE;
+    glColorMask(value, value, value, value);
+    color_mask = write;
+}
+
+void GLStateCache::blendFunc(GLenum source, GLenum dest)
+{
+    if (blend_source == source && blend_dest == dest)
+    {
+        render_stats.redundant_calls ++;
+        return;
+    }
+
+    glBlendFunc(source, dest);
+    blend_source = source;
+    blend_dest = dest;
+}
+
+void GLStateCache::forgetBuffer(uint32_t buffer)
+{
+    // GL unbinds deleted buffers, but just forgetting them is safer
+    for (auto it = buffers.begin(); it != buffers.end();)
+    {
+        if (it->second == buffer) it = buffers.erase(it);
+        else it++;
+    }
+
+    for (auto it = uniform_buffers.begin(); it != uniform_buffers.end();)
+    {
+        if (it->second == buffer) it = uniform_buffers.erase(it);
+        else it++;
+    }
+}
+
+void GLStateCache::forgetTexture(uint32_t texture)
+{
+    for (int i = 0; i < FLUX_MAX_TEXTURE_UNITS; i++)
+    {
+        for (auto& binding : textures[i])
+        {
+            if (binding.second == texture)
+            {
+                binding.second = FLUX_UNKNOWN_STATE;
+            }
+        }
+    }
+}
+
+void GLStateCache::forgetProgram(uint32_t old_program)
+{
+    if (program == old_program)
+    {
+        program = FLUX_UNKNOWN_STATE;
+    }
+
+    for (auto it = samplers.begin(); it != samplers.end();)
+    {
+        if ((it->first >> 32) == old_program) it = samplers.erase(it);
+        else it++;
+    }
+}
+
+void GLStateCache::forgetVertexArray(uint32_t old_vao)
+{
+    // Deleting the bound VAO binds 0, so whatever's bound next has to go through
+    if (vao == old_vao)
+    {
+        vao = FLUX_UNKNOWN_STATE;
+    }
+}
+
+void GLStateCache::invalidate()
+{
+    program = FLUX_UNKNOWN_STATE;
+    vao = FLUX_UNKNOWN_STATE;
+    active_unit = FLUX_UNKNOWN_STATE;
+    cull_mode = FLUX_UNKNOWN_STATE;
+    depth_func = FLUX_UNKNOWN_STATE;
+    depth_mask = FLUX_UNKNOWN_STATE;
+    color_mask = FLUX_UNKNOWN_STATE;
+    blend_source = FLUX_UNKNOWN_STATE;
+    blend_dest = FLUX_UNKNOWN_STATE;
+
+    for (int i = 0; i < FLUX_MAX_TEXTURE_UNITS; i++)
+    {
+        textures[i].clear();
+    }
+
+    buffers.clear();
+    uniform_buffers.clear();
+    caps.clear();
+    samplers.clear();
+}
@@ -0,0 +1,695 @@
+#include "Flux/OpenGL/GLRenderer.hh"
+#include "Flux/Log.hh"
+#include "Flux/Renderer.hh"
+
+// STL includes
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+
+#include "glm/gtc/matrix_transform.hpp"
+
+using namespace Flux::GLRenderer;
+
+GLUploadQueue Flux::GLRenderer::upload_queue;
+
+// Sets up attribute 0 of the currently bound VAO
+static void setupPositionAttribute(Flux::Renderer::PositionFormat format, uint32_t stride, uintptr_t offset)
+{
+    using namespace Flux::Renderer;
+
+    switch (format)
+    {
+        case PositionFormat::Float:
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offset);
+            break;
+        case PositionFormat::Half:
+            glVertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offset);
+            break;
+        case PositionFormat::SNorm16:
+            glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, stride, (void*)offset);
+            break;
+    }
+    glEnableVertexAttribArray(0);
+}
+
+// Sets up the attribute pointers of the currently bound VAO
+static void setupVertexAttributes(const Flux::Renderer::VertexFormat& format)
+{
+    using namespace Flux::Renderer;
+    auto stride = format.getStride();
+
+    // Position
+    setupPositionAttribute(format.position, stride, format.getOffset(0));
+
+    // Normal
+    if (format.normal == DirectionFormat::Float)
+    {
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(uintptr_t)format.getOffset(1));
+        glEnableVertexAttribArray(1);
+    }
+    else if (format.normal == DirectionFormat::Octahedral)
+    {
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride, (void*)(uintptr_t)format.getOffset(1));
+        glEnableVertexAttribArray(1);
+    }
+
+    // Texture
+    if (format.uv == UVFormat::Float)
+    {
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(uintptr_t)format.getOffset(2));
+        glEnableVertexAttribArray(2);
+    }
+    else if (format.uv == UVFormat::Half)
+    {
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)(uintptr_t)format.getOffset(2));
+        glEnableVertexAttribArray(2);
+    }
+
+    // Tangents
+    // If there's a bitangent sign, it's in the w component
+    int tangent_size = format.bitangent == BitangentFormat::Sign ? 4 : 3;
+    if (format.tangent == DirectionFormat::Float)
+    {
+        glVertexAttribPointer(3, tangent_size, GL_FLOAT, GL_FALSE, stride, (void*)(uintptr_t)format.getOffset(3));
+        glEnableVertexAttribArray(3);
+    }
+    else if (format.tangent == DirectionFormat::Octahedral)
+    {
+        glVertexAttribPointer(3, tangent_size == 4 ? 4 : 2, GL_SHORT, GL_TRUE, stride, (void*)(uintptr_t)format.getOffset(3));
+        glEnableVertexAttribArray(3);
+    }
+
+    // Bitangents
+    if (format.bitangent == BitangentFormat::Float)
+    {
+        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, stride, (void*)(uintptr_t)format.getOffset(4));
+        glEnableVertexAttribArray(4);
+    }
+}
+
+GLUploadQueue::GLUploadQueue():
+pbo(0), has_pbo(false), byte_budget(FLUX_UPLOAD_BYTES_PER_FRAME), ms_budget(FLUX_UPLOAD_MS_PER_FRAME),
+bytes_this_frame(0), ms_this_frame(0), next_id(1), queued(0)
+{
+
+}
+
+GLMeshCom* GLUploadQueue::addMesh(Renderer::MeshRes* mesh_res)
+{
+    // Create new component
+    GLMeshCom* mesh_com = new GLMeshCom;
+
+    // The job is handed to the render thread, so it can't touch the mesh
+    auto job = std::make_shared<Job>();
+    job->id = next_id++;
+    job->mesh_com = mesh_com;
+    mesh_com->upload_job = job->id;
+    queued ++;
+
+    mesh_com->draw_type = mesh_res->draw_mode == Renderer::DrawMode::Triangles ? GL_TRIANGLES : GL_LINES;
+
+    if (mesh_res->dynamic)
+    {
+        // Dynamic meshes change too often to be queued up, so they're streamed once they have their buffers
+        job->dynamic = true;
+        mesh_com->vertex_format_flags = 0;
+        mesh_com->has_position_transform = false;
+        mesh_com->num_vertices = 0;
+        mesh_com->num_indices = 0;
+        mesh_res->changed = true;
+
+        render_thread.record([this, job]() { createMesh(*job); });
+        return mesh_com;
+    }
+
+    // Packed vertices are uploaded as-is
+    // Meshes that haven't been packed yet are packed into the job, since the mesh isn't ours to change
+    glm::vec3 position_offset = mesh_res->position_offset;
+    float position_scale = mesh_res->position_scale;
+    bool packed = mesh_res->packed_vertices != nullptr || !mesh_res->vertex_format.isDefault();
+
+    if (mesh_res->packed_vertices != nullptr)
+    {
+        job->vertex_data.assign(mesh_res->packed_vertices, mesh_res->packed_vertices + mesh_res->packed_size);
+    }
+    else if (packed)
+    {
+        job->vertex_data = mesh_res->getPackedVertices(mesh_res->vertex_format, position_offset, position_scale);
+    }
+    else
+    {
+        auto vertices = (const char*)mesh_res->vertices;
+        job->vertex_data.assign(vertices, vertices + sizeof(Flux::Renderer::Vertex) * mesh_res->vertices_length);
+    }
+    uint32_t vertex_size = job->vertex_data.size();
+    job->vertex_format = packed ? mesh_res->vertex_format : Renderer::VertexFormat();
+
+    // All the levels of detail go in the same buffer, one after the other
+    mesh_com->lod_offsets = {0};
+    mesh_com->lod_counts = {mesh_res->indices_length};
+
+    uint32_t lod_offset = mesh_res->indices_length;
+    for (auto& lod : mesh_res->lods)
+    {
+        mesh_com->lod_offsets.push_back(lod_offset);
+        mesh_com->lod_counts.push_back(lod.indices_length);
+        lod_offset += lod.indices_length;
+    }
+
+    // The indices are staged too, so the mesh can change while we're uploading
+    // Small meshes have 16 bit indices, which is half the bandwidth. Loaded meshes already are
+    uint8_t index_size;
+    job->index_data = mesh_res->getPackedIndices(index_size);
+    mesh_com->index_size = index_size;
+    mesh_com->index_type = index_size == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+    // The positions are copied out now for the same reason
+    if (mesh_res->position_stream)
+    {
+        if (packed && mesh_res->packed_vertices == nullptr)
+        {
+            // Positions are always first, so they can be copied out of the vertices we just packed
+            auto stride = job->vertex_format.getStride();
+            auto size = job->vertex_format.getOffset(1);
+
+            job->position_data.resize(size * mesh_res->vertices_length);
+            for (int i = 0; i < mesh_res->vertices_length; i++)
+            {
+                std::memcpy(job->position_data.data() + i * size, job->vertex_data.data() + i * stride, size);
+            }
+        }
+        else
+        {
+            job->position_data = mesh_res->getPositionStream();
+        }
+    }
+
+    // Bone indices and weights go after that, so meshes without them don't pay for them
+    if (!mesh_res->skin.empty())
+    {
+        auto skin = (const char*)mesh_res->skin.data();
+        job->skin_data.assign(skin, skin + mesh_res->skin.size() * sizeof(Renderer::VertexSkin));
+    }
+
+    // Quantized positions have to be scaled back up
+    mesh_com->vertex_format_flags = job->vertex_format.getShaderFlags();
+    if (!job->skin_data.empty())
+    {
+        mesh_com->vertex_format_flags |= Renderer::VertexFormatFlags::Skinned;
+    }
+    mesh_com->has_position_transform = job->vertex_format.position == Renderer::PositionFormat::SNorm16;
+    mesh_com->position_transform = glm::scale(glm::translate(glm::mat4(), position_offset), glm::vec3(position_scale));
+
+    mesh_com->num_vertices = mesh_res->vertices_length;
+    mesh_com->num_indices = mesh_res->indices_length;
+
+    mesh_com->gpu_bytes = vertex_size + job->position_data.size() + job->skin_data.size() + job->index_data.size();
+
+    render_thread.record([this, job]() { createMesh(*job); });
+    return mesh_com;
+}
+
+void GLUploadQueue::createMesh(Job& job)
+{
+    // Create buffer
+    glGenBuffers(1, &job.vbo);
+    glGenBuffers(1, &job.ibo);
+    render_stats.buffer_creations += 2;
+
+    // Create Vertex Array
+    glGenVertexArrays(1, &job.vao);
+
+    // Bind vertex array
+    gl_state.bindVertexArray(job.vao);
+
+    if (job.dynamic)
+    {
+        gl_state.bindBuffer(GL_ARRAY_BUFFER, job.vbo);
+        gl_state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, job.ibo);
+        setupVertexAttributes(Renderer::VertexFormat());
+        gl_state.bindVertexArray(0);
+
+        finishJob(job);
+        return;
+    }
+
+    // Allocate the buffers. They get filled in later
+    uint32_t vertex_size = job.vertex_data.size();
+    gl_state.bindBuffer(GL_ARRAY_BUFFER, job.vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertex_size + job.position_data.size() + job.skin_data.size(), NULL, GL_STATIC_DRAW);
+
+    gl_state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, job.ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, job.index_data.size(), NULL, GL_STATIC_DRAW);
+
+    // Tell OpenGL what our data means
+    setupVertexAttributes(job.vertex_format);
+
+    if (!job.skin_data.empty())
+    {
+        // The indices stay as integers, the weights are turned into 0-1
+        uintptr_t skin_offset = vertex_size + job.position_data.size();
+        glVertexAttribIPointer(5, 4, GL_UNSIGNED_BYTE, sizeof(Renderer::VertexSkin), (void*)skin_offset);
+        glEnableVertexAttribArray(5);
+        glVertexAttribPointer(6, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Renderer::VertexSkin), (void*)(skin_offset + 4));
+        glEnableVertexAttribArray(6);
+    }
+
+    if (!job.position_data.empty())
+    {
+        // Same buffers, but only the positions, with nothing in between them
+        glGenVertexArrays(1, &job.position_vao);
+        gl_state.bindVertexArray(job.position_vao);
+        gl_state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, job.ibo);
+        setupPositionAttribute(job.vertex_format.position, job.vertex_format.getOffset(1), vertex_size);
+    }
+    gl_state.bindVertexArray(0);
+
+    jobs.push_back(std::move(job));
+}
+
+// How much memory a texture will take up once it's on the gpu
+static uint32_t getTextureSize(Flux::Renderer::TextureRes* texture)
+{
+    if (!texture->mip_sizes.empty())
+    {
+        // Cooked textures are stored exactly how the gpu has them
+        return texture->image_data_size;
+    }
+
+    // glGenerateMipmap adds another third
+    return texture->width * texture->height * texture->layers * 4 * 4 / 3;
+}
+
+GLTextureCom* GLUploadQueue::addTexture(Renderer::TextureRes* texture)
+{
+    auto txcom = new GLTextureCom;
+    txcom->target = texture->layers > 1 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+    txcom->gpu_bytes = getTextureSize(texture);
+
+    // The mips are copied, since the simulation can read or destroy the texture while the render thread is uploading it
+    auto job = std::make_shared<Job>();
+    job->id = next_id++;
+    job->texture = texture;
+    job->texture_com = txcom;
+    job->target = txcom->target;
+    job->gpu_bytes = txcom->gpu_bytes;
+    if (texture->image_data != nullptr)
+    {
+        job->texture_data.assign(texture->image_data, texture->image_data + texture->image_data_size);
+    }
+    job->mip_sizes = texture->mip_sizes;
+    job->width = texture->width;
+    job->height = texture->height;
+    job->layers = texture->layers;
+    job->format = texture->format;
+    job->filename = texture->filename;
+
+    txcom->upload_job = job->id;
+    queued ++;
+
+    render_thread.record([this, job]() { createTexture(*job); });
+    return txcom;
+}
+
+void GLUploadQueue::createTexture(Job& job)
+{
+    // Create GL texture
+    glGenTextures(1, &job.handle);
+    gl_state.editTexture(job.handle, job.target);
+
+    // Set the texture wrapping/filtering options (on the currently bound texture object)
+    // Also, thanks learnopengl.com
+    glTexParameteri(job.target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(job.target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(job.target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(job.target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    if (!job.mip_sizes.empty())
+    {
+        // Cooked textures already have their mips
+        glTexParameteri(job.target, GL_TEXTURE_MIN_FILTER, job.mip_sizes.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(job.target, GL_TEXTURE_MAX_LEVEL, job.mip_sizes.size() - 1);
+    }
+
+    jobs.push_back(std::move(job));
+}
+
+void GLUploadQueue::streamMesh(Renderer::MeshRes* mesh_res, GLMeshCom* mesh_com)
+{
+    if (!mesh_com->resident)
+    {
+        // It doesn't have its buffers yet. It's still changed, so it'll be streamed once it does
+        return;
+    }
+
+    mesh_com->num_vertices = mesh_res->vertices_length;
+    mesh_com->num_indices = mesh_res->indices_length;
+    mesh_com->lod_offsets = {0};
+    mesh_com->lod_counts = {mesh_res->indices_length};
+
+    // The mesh will have changed again by the time the render thread gets to it, so it's copied
+    std::vector<char> vertices((char*)mesh_res->vertices, (char*)(mesh_res->vertices + mesh_res->vertices_length));
+
+    // These are usually tiny, so they can be changed to 16 bit on the fly
+    std::vector<char> indices;
+    mesh_com->index_size = mesh_res->getIndexSize();
+    if (mesh_com->index_size == sizeof(uint16_t))
+    {
+        indices.resize(sizeof(uint16_t) * mesh_res->indices_length);
+        auto short_indices = (uint16_t*)indices.data();
+        for (int i = 0; i < mesh_res->indices_length; i++)
+        {
+            short_indices[i] = mesh_res->indices[i];
+        }
+        mesh_com->index_type = GL_UNSIGNED_SHORT;
+    }
+    else
+    {
+        indices.assign((char*)mesh_res->indices, (char*)(mesh_res->indices + mesh_res->indices_length));
+        mesh_com->index_type = GL_UNSIGNED_INT;
+    }
+
+    uint32_t vbo = mesh_com->VBO, ibo = mesh_com->IBO;
+    render_thread.record([vbo, ibo, vertices, indices]() {
+        // Passing the data to glBufferData orphans the old storage
+        // GL_COPY_WRITE_BUFFER is used so we don't mess with any VAO's index buffer
+        gl_state.bindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+        glBufferData(GL_COPY_WRITE_BUFFER, vertices.size(), vertices.data(), GL_STREAM_DRAW);
+
+        gl_state.bindBuffer(GL_COPY_WRITE_BUFFER, ibo);
+        glBufferData(GL_COPY_WRITE_BUFFER, indices.size(), indices.data(), GL_STREAM_DRAW);
+    });
+
+    mesh_com->gpu_bytes = vertices.size() + indices.size();
+    mesh_res->changed = false;
+}
+
+void GLUploadQueue::cancel(uint32_t job)
+{
+    // The component is going, so whatever comes back has to be deleted
+    cancelled.insert(job);
+    render_thread.record([this, job]() { dropJob(job); });
+}
+
+void GLUploadQueue::dropJob(uint32_t id)
+{
+    for (auto it = jobs.begin(); it != jobs.end(); it++)
+    {
+        if (it->id == id)
+        {
+            finishJob(*it);
+            jobs.erase(it);
+            return;
+        }
+    }
+}
+
+void GLUploadQueue::finishJob(Job& job)
+{
+    // The data isn't needed any more, so it doesn't hang around until finishJobs
+    job.texture_data = std::vector<unsigned char>();
+    job.vertex_data = std::vector<char>();
+    job.index_data = std::vector<char>();
+    job.position_data = std::vector<char>();
+    job.skin_data = std::vector<char>();
+
+    std::lock_guard<std::mutex> lock(finished_mutex);
+    finished.push_back(std::move(job));
+}
+
+void GLUploadQueue::finishJobs()
+{
+    std::vector<Job> done;
+    {
+        std::lock_guard<std::mutex> lock(finished_mutex);
+        done.swap(finished);
+    }
+
+    for (auto& job : done)
+    {
+        queued --;
+
+        if (cancelled.erase(job.id) != 0)
+        {
+            // Nothing is going to draw with them
+            uint32_t vbo = job.vbo, ibo = job.ibo, vao = job.vao, position_vao = job.position_vao, texture = job.handle;
+            render_thread.deleteLater([vbo, ibo, vao, position_vao, texture]() {
+                if (vao != 0)
+                {
+                    glDeleteVertexArrays(1, &vao);
+                    gl_state.forgetVertexArray(vao);
+                }
+
+                if (position_vao != 0)
+                {
+                    glDeleteVertexArrays(1, &position_vao);
+                    gl_state.forgetVertexArray(position_vao);
+                }
+
+                if (vbo != 0)
+                {
+                    glDeleteBuffers(1, &vbo);
+                    glDeleteBuffers(1, &ibo);
+                    gl_state.forgetBuffer(vbo);
+                    gl_state.forgetBuffer(ibo);
+                }
+
+                if (texture != 0)
+                {
+                    glDeleteTextures(1, &texture);
+                    gl_state.forgetTexture(texture);
+                }
+            });
+            continue;
+        }
+
+        if (job.mesh_com != nullptr)
+        {
+            job.mesh_com->VBO = job.vbo;
+            job.mesh_com->IBO = job.ibo;
+            job.mesh_com->VAO = job.vao;
+            job.mesh_com->position_VAO = job.position_vao;
+            job.mesh_com->upload_job = 0;
+            job.mesh_com->resident = true;
+            continue;
+        }
+
+        job.texture_com->handle = job.handle;
+        job.texture_com->gpu_bytes = job.gpu_bytes;
+        job.texture_com->upload_job = 0;
+        job.texture_com->resident = true;
+
+        // Free the texture
+        job.texture->destroy();
+    }
+}
+
+void GLUploadQueue::startFrame()
+{
+    bytes_this_frame = 0;
+    ms_this_frame = 0;
+}
+
+void GLUploadQueue::setBudget(uint32_t bytes_per_frame, float ms_per_frame)
+{
+    byte_budget = bytes_per_frame;
+    ms_budget = ms_per_frame;
+}
+
+bool GLUploadQueue::processMesh(Job& job, uint32_t max_bytes)
+{
+    // Vertices first, then the position stream, then the skin, then indices
+    // GL_COPY_WRITE_BUFFER is used so we don't mess with any VAO's index buffer
+    uint32_t vertex_size = job.vertex_data.size();
+    uint32_t skin_start = vertex_size + job.position_data.size();
+    uint32_t vbo_size = skin_start + job.skin_data.size();
+    uint32_t total = vbo_size + job.index_data.size();
+    uint32_t size = std::min(max_bytes, total - job.progress);
+
+    if (job.progress < vertex_size)
+    {
+        size = std::min(size, vertex_size - job.progress);
+
+        gl_state.bindBuffer(GL_COPY_WRITE_BUFFER, job.vbo);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, job.progress, size, job.vertex_data.data() + job.progress);
+    }
+    else if (job.progress < skin_start)
+    {
+        size = std::min(size, skin_start - job.progress);
+        uint32_t offset = job.progress - vertex_size;
+
+        gl_state.bindBuffer(GL_COPY_WRITE_BUFFER, job.vbo);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, job.progress, size, job.position_data.data() + offset);
+    }
+    else if (job.progress < vbo_size)
+    {
+        size = std::min(size, vbo_size - job.progress);
+        uint32_t offset = job.progress - skin_start;
+
+        gl_state.bindBuffer(GL_COPY_WRITE_BUFFER, job.vbo);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, job.progress, size, job.skin_data.data() + offset);
+    }
+    else if (size > 0)
+    {
+        uint32_t offset = job.progress - vbo_size;
+
+        gl_state.bindBuffer(GL_COPY_WRITE_BUFFER, job.ibo);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, job.index_data.data() + offset);
+    }
+    job.progress += size;
+    bytes_this_frame += size;
+
+    if (job.progress >= total)
+    {
+        return true;
+    }
+
+    return false;
+}
+
+bool GLUploadQueue::processTexture(Job& job, uint32_t max_bytes)
+{
+    if (!has_pbo)
+    {
+        glGenBuffers(1, &pbo);
+        has_pbo = true;
+    }
+
+    // Uncooked textures only have one level, and generate the rest on the gpu
+    bool cooked = !job.mip_sizes.empty();
+    int level_count = cooked ? job.mip_sizes.size() : 1;
+
+    uint32_t level_offset = 0;
+    for (int i = 0; i < job.level; i++)
+    {
+        level_offset += job.mip_sizes[i];
+    }
+
+    auto width = cooked ? std::max(job.width >> job.level, (uint32_t)1) : job.width;
+    auto height = cooked ? std::max(job.height >> job.level, (uint32_t)1) : job.height;
+    auto data = job.texture_data.data() + level_offset;
+
+    // Orphan the old contents of the pbo, so we don't have to wait for the gpu to finish with them
+    gl_state.bindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    auto target = job.target;
+    bool array = target == GL_TEXTURE_2D_ARRAY;
+    gl_state.editTexture(job.handle, target);
+
+    // Clear any old errors
+    while (glGetError() != GL_NO_ERROR) {}
+
+    bool level_done = true;
+    if (job.format == Renderer::TextureFormat::RGBA8)
+    {
+        // Uncompressed levels can be done a few rows at a time
+        // For arrays, progress counts the rows of every layer, but a piece never crosses into the next layer
+        uint32_t row_size = width * 4;
+        uint32_t layer = job.progress / height, row = job.progress % height;
+        uint32_t rows = std::max(max_bytes / row_size, (uint32_t)1);
+        rows = std::min(rows, height - row);
+
+        if (job.progress == 0)
+        {
+            if (array) glTexImage3D(target, job.level, GL_RGBA, width, height, job.layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            else glTexImage2D(target, job.level, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        }
+
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, rows * row_size, data + job.progress * row_size, GL_STREAM_DRAW);
+        if (array) glTexSubImage3D(target, job.level, 0, row, layer, width, rows, 1, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+        else glTexSubImage2D(target, job.level, 0, row, width, rows, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+
+        job.progress += rows;
+        bytes_this_frame += rows * row_size;
+        level_done = job.progress >= height * job.layers;
+
+        LOG_ASSERT_MESSAGE(glGetError() == GL_INVALID_VALUE, "Texture "+ job.filename + " failed");
+    }
+    else
+    {
+        // Compressed levels go all at once
+        GLenum internal = job.format == Renderer::TextureFormat::ETC2_RGB8 ? GL_COMPRESSED_RGB8_ETC2 : GL_COMPRESSED_RGBA8_ETC2_EAC;
+        auto size = job.mip_sizes[job.level];
+
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, data, GL_STREAM_DRAW);
+        if (array) glCompressedTexImage3D(target, job.level, internal, width, height, job.layers, 0, size, (void*)0);
+        else glCompressedTexImage2D(target, job.level, internal, width, height, 0, size, (void*)0);
+        bytes_this_frame += size;
+
+        if (glGetError() != GL_NO_ERROR)
+        {
+            // The gpu doesn't like the format, so do it the slow way
+            // Only the copy is decompressed, so the texture itself is left alone
+            LOG_WARN("Compressed texture " + job.filename + " isn't supported, decompressing it");
+            std::vector<unsigned char> decoded;
+            if (!Renderer::decompressMips(job.texture_data.data(), job.mip_sizes, job.width, job.height, job.layers, job.format, decoded))
+            {
+                LOG_WARN("Texture " + job.filename + " uses ETC2 modes that can't be decompressed");
+            }
+
+            job.texture_data.swap(decoded);
+            job.format = Renderer::TextureFormat::RGBA8;
+            job.gpu_bytes = job.texture_data.size();
+            job.level = 0;
+            job.progress = 0;
+            level_done = false;
+        }
+    }
+
+    // Other textures are still uploaded straight from memory
+    gl_state.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (level_done)
+    {
+        job.level ++;
+        job.progress = 0;
+    }
+
+    if (job.level < level_count)
+    {
+        return false;
+    }
+
+    if (!cooked)
+    {
+        glGenerateMipmap(target);
+    }
+
+    return true;
+}
+
+void GLUploadQueue::process()
+{
+    if (jobs.empty())
+    {
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&]() {
+        return ms_this_frame + std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    // Always do at least one piece per frame, or a tiny budget would stop everything
+    while (!jobs.empty() && (bytes_this_frame == 0 || (bytes_this_frame < byte_budget && elapsed() < ms_budget)))
+    {
+        uint32_t max_bytes = FLUX_UPLOAD_CHUNK_SIZE;
+        if (bytes_this_frame != 0)
+        {
+            max_bytes = std::min(max_bytes, byte_budget - bytes_this_frame);
+        }
+
+        auto& job = jobs.front();
+        bool done = job.mesh_com != nullptr ? processMesh(job, max_bytes) : processTexture(job, max_bytes);
+
+        if (done)
+        {
+            // The simulation marks it as resident, see finishJobs
+            finishJob(job);
+            jobs.pop_front();
+        }
+    }
+
+    ms_this_frame = elapsed();
+}
@@ -0,0 +1,664 @@
+/**
+This file is the windowing backend for headless builds.
+Instead of a window and a real OpenGL driver, it gives glad a set of functions that just count what they're asked to do
+*/
+
+#include "Flux/Log.hh"
+#include "Flux/OpenGL/GLRenderer.hh"
+#include "Flux/OpenGL/NullGL.hh"
+#include "Flux/Input.hh"
+#include "Flux/Flux.hh"
+#include "Flux/Renderer.hh"
+
+// STL
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <string>
+
+#include <glm/glm.hpp>
+
+using namespace Flux::GLRenderer;
+using namespace Flux::GLRenderer::Null;
+
+GLCtx* Flux::GLRenderer::current_window = nullptr;
+
+static NullStats frame_stats;
+static NullStats last_frame_stats;
+static NullStats total_stats;
+
+static bool trace_enabled = false;
+static std::vector<NullCommand> trace;
+
+static uint32_t frame_limit = 0;
+static uint32_t frame_count = 0;
+// Set on the render thread when the frame limit is hit
+static std::atomic<bool> should_close {false};
+
+static std::chrono::steady_clock::time_point start_time;
+
+// Every GL object gets a unique name, no matter what kind it is
+static uint32_t next_name = 1;
+
+// The buffer bound to GL_PIXEL_UNPACK_BUFFER, so texture data that comes from it isn't counted twice
+static uint32_t unpack_buffer = 0;
+
+static void record(const char* name, uint64_t a = 0, uint64_t b = 0, uint64_t c = 0)
+{
+    frame_stats.commands ++;
+
+    if (trace_enabled)
+    {
+        trace.push_back(NullCommand {name, {a, b, c}});
+    }
+}
+
+static uint32_t createNames(GLsizei n, GLuint* names)
+{
+    for (int i = 0; i < n; i++)
+    {
+        names[i] = next_name++;
+    }
+
+    frame_stats.objects_created += n;
+    return n;
+}
+
+static uint64_t getPixelSize(GLenum format, GLenum type)
+{
+    uint64_t components = 4;
+    switch (format)
+    {
+        case GL_RED: case GL_RED_INTEGER: components = 1; break;
+        case GL_RG: case GL_RG_INTEGER: components = 2; break;
+        case GL_RGB: case GL_RGB_INTEGER: components = 3; break;
+        default: components = 4; break;
+    }
+
+    switch (type)
+    {
+        case GL_UNSIGNED_BYTE: case GL_BYTE: return components;
+        case GL_UNSIGNED_SHORT: case GL_SHORT: case GL_HALF_FLOAT: return components * 2;
+        default: return components * 4;
+    }
+}
+
+// =========================================================
+// Fake GL functions
+// =========================================================
+
+// State
+static void APIENTRY nullEnable(GLenum cap) { record("glEnable", cap); frame_stats.state_changes ++; }
+static void APIENTRY nullDisable(GLenum cap) { record("glDisable", cap); frame_stats.state_changes ++; }
+static void APIENTRY nullCullFace(GLenum mode) { record("glCullFace", mode); frame_stats.state_changes ++; }
+static void APIENTRY nullDepthFunc(GLenum func) { record("glDepthFunc", func); frame_stats.state_changes ++; }
+static void APIENTRY nullDepthMask(GLboolean flag) { record("glDepthMask", flag); frame_stats.state_changes ++; }
+static void APIENTRY nullColorMask(GLboolean r, GLboolean g, GLboolean b, GLboolean a) { record("glColorMask", r, g, b); frame_stats.state_changes ++; }
+static void APIENTRY nullBlendFunc(GLenum s, GLenum d) { record("glBlendFunc", s, d); frame_stats.state_changes ++; }
+static void APIENTRY nullViewport(GLint x, GLint y, GLsizei w, GLsizei h) { record("glViewport", w, h); frame_stats.state_changes ++; }
+static void APIENTRY nullPixelStorei(GLenum pname, GLint param) { record("glPixelStorei", pname, param); frame_stats.state_changes ++; }
+static void APIENTRY nullClearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a) { record("glClearColor"); frame_stats.state_changes ++; }
+static void APIENTRY nullClear(GLbitfield mask) { record("glClear", mask); }
+static void APIENTRY nullActiveTexture(GLenum texture) { record("glActiveTexture", texture); frame_stats.state_changes ++; }
+static void APIENTRY nullUseProgram(GLuint program) { record("glUseProgram", program); frame_stats.state_changes ++; }
+
+// Queries
+static GLenum APIENTRY nullGetError() { record("glGetError"); return GL_NO_ERROR; }
+
+static const GLubyte* APIENTRY nullGetString(GLenum name)
+{
+    record("glGetString", name);
+    switch (name)
+    {
+        case GL_VENDOR: return (const GLubyte*)"Flux";
+        case GL_RENDERER: return (const GLubyte*)"Null Renderer";
+        // glad reads this to work out what to load
+        case GL_VERSION: return (const GLubyte*)"OpenGL ES 3.0 Flux Null";
+        case GL_SHADING_LANGUAGE_VERSION: return (const GLubyte*)"OpenGL ES GLSL ES 3.00";
+        default: return (const GLubyte*)"";
+    }
+}
+
+static const GLubyte* APIENTRY nullGetStringi(GLenum name, GLuint index)
+{
+    record("glGetStringi", name, index);
+    return (const GLubyte*)(index == 0 ? "GL_FLUX_null_renderer" : "GL_EXT_disjoint_timer_query");
+}
+
+static void APIENTRY nullGetIntegerv(GLenum pname, GLint* data)
+{
+    record("glGetIntegerv", pname);
+
+    // glad gives up if there are no extensions at all
+    *data = pname == GL_NUM_EXTENSIONS ? 2 : 0;
+}
+
+// Buffers
+static void APIENTRY nullGenBuffers(GLsizei n, GLuint* buffers) { record("glGenBuffers", createNames(n, buffers)); }
+static void APIENTRY nullDeleteBuffers(GLsizei n, const GLuint* buffers) { record("glDeleteBuffers", n); frame_stats.objects_deleted += n; }
+
+static void APIENTRY nullBindBuffer(GLenum target, GLuint buffer)
+{
+    record("glBindBuffer", target, buffer);
+    frame_stats.state_changes ++;
+
+    if (target == GL_PIXEL_UNPACK_BUFFER)
+    {
+        unpack_buffer = buffer;
+    }
+}
+
+static void APIENTRY nullBindBufferBase(GLenum target, GLuint index, GLuint buffer) { record("glBindBufferBase", target, index, buffer); frame_stats.state_changes ++; }
+static void APIENTRY nullBindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) { record("glBindBufferRange", index, buffer, offset); frame_stats.state_changes ++; }
+
+static void APIENTRY nullBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+{
+    record("glBufferData", target, size, data != nullptr);
+    if (data != nullptr)
+    {
+        frame_stats.buffer_bytes += size;
+    }
+}
+
+static void APIENTRY nullBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data)
+{
+    record("glBufferSubData", target, offset, size);
+    frame_stats.buffer_bytes += size;
+}
+
+// Vertex arrays
+static void APIENTRY nullGenVertexArrays(GLsizei n, GLuint* arrays) { record("glGenVertexArrays", createNames(n, arrays)); }
+static void APIENTRY nullDeleteVertexArrays(GLsizei n, const GLuint* arrays) { record("glDeleteVertexArrays", n); frame_stats.objects_deleted += n; }
+static void APIENTRY nullBindVertexArray(GLuint array) { record("glBindVertexArray", array); frame_stats.state_changes ++; }
+static void APIENTRY nullVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer) { record("glVertexAttribPointer", index, size, stride); }
+static void APIENTRY nullVertexAttribIPointer(GLuint index, GLint size, GLenum type, GLsizei stride, const void* pointer) { record("glVertexAttribIPointer", index, size, stride); }
+static void APIENTRY nullEnableVertexAttribArray(GLuint index) { record("glEnableVertexAttribArray", index); }
+static void APIENTRY nullVertexAttribDivisor(GLuint index, GLuint divisor) { record("glVertexAttribDivisor", index, divisor); }
+
+// Drawing
+static void APIENTRY nullDrawElements(GLenum mode, GLsizei count, GLenum type, const void* indices)
+{
+    record("glDrawElements", mode, count, (uintptr_t)indices);
+    frame_stats.draw_calls ++;
+    frame_stats.indices_drawn += count;
+}
+
+static void APIENTRY nullDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instances)
+{
+    record("glDrawElementsInstanced", mode, count, instances);
+    frame_stats.draw_calls ++;
+    frame_stats.indices_drawn += (uint64_t)count * instances;
+}
+
+static void APIENTRY nullDrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances)
+{
+    record("glDrawArraysInstanced", mode, count, instances);
+    frame_stats.draw_calls ++;
+    frame_stats.indices_drawn += (uint64_t)count * instances;
+}
+
+static void APIENTRY nullDrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+    record("glDrawArrays", mode, first, count);
+    frame_stats.draw_calls ++;
+    frame_stats.indices_drawn += count;
+}
+
+// Textures
+static void APIENTRY nullGenTextures(GLsizei n, GLuint* textures) { record("glGenTextures", createNames(n, textures)); }
+static void APIENTRY nullDeleteTextures(GLsizei n, const GLuint* textures) { record("glDeleteTextures", n); frame_stats.objects_deleted += n; }
+static void APIENTRY nullBindTexture(GLenum target, GLuint texture) { record("glBindTexture", target, texture); frame_stats.state_changes ++; }
+static void APIENTRY nullTexParameteri(GLenum target, GLenum pname, GLint param) { record("glTexParameteri", pname, param); frame_stats.state_changes ++; }
+static void APIENTRY nullGenerateMipmap(GLenum target) { record("glGenerateMipmap", target); }
+
+static void APIENTRY nullTexImage2D(GLenum target, GLint level, GLint internal, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels)
+{
+    record("glTexImage2D", level, width, height);
+    if (pixels != nullptr && unpack_buffer == 0)
+    {
+        frame_stats.texture_bytes += width * height * getPixelSize(format, type);
+    }
+}
+
+static void APIENTRY nullTexSubImage2D(GLenum target, GLint level, GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, const void* pixels)
+{
+    record("glTexSubImage2D", level, width, height);
+    if (unpack_buffer == 0)
+    {
+        frame_stats.texture_bytes += width * height * getPixelSize(format, type);
+    }
+}
+
+static void APIENTRY nullCompressedTexImage2D(GLenum target, GLint level, GLenum internal, GLsizei width, GLsizei height, GLint border, GLsizei size, const void* data)
+{
+    record("glCompressedTexImage2D", level, width, height);
+    if (unpack_buffer == 0)
+    {
+        frame_stats.texture_bytes += size;
+    }
+}
+
+static void APIENTRY nullTexImage3D(GLenum target, GLint level, GLint internal, GLsizei width, GLsizei height, GLsizei depth, GLint border, GLenum format, GLenum type, const void* pixels)
+{
+    record("glTexImage3D", level, width, height);
+    if (pixels != nullptr && unpack_buffer == 0)
+    {
+        frame_stats.texture_bytes += width * height * depth * getPixelSize(format, type);
+    }
+}
+
+static void APIENTRY nullTexSubImage3D(GLenum target, GLint level, GLint x, GLint y, GLint z, GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, const void* pixels)
+{
+    record("glTexSubImage3D", level, width, height);
+    if (unpack_buffer == 0)
+    {
+        frame_stats.texture_bytes += width * height * depth * getPixelSize(format, type);
+    }
+}
+
+static void APIENTRY nullCompressedTexImage3D(GLenum target, GLint level, GLenum internal, GLsizei width, GLsizei height, GLsizei depth, GLint border, GLsizei size, const void* data)
+{
+    record("glCompressedTexImage3D", level, width, height);
+    if (unpack_buffer == 0)
+    {
+        frame_stats.texture_bytes += size;
+    }
+}
+
+// Shaders
+static GLuint APIENTRY nullCreateShader(GLenum type) { GLuint name; record("glCreateShader", createNames(1, &name)); return name; }
+static GLuint APIENTRY nullCreateProgram() { GLuint name; record("glCreateProgram", createNames(1, &name)); return name; }
+static void APIENTRY nullDeleteShader(GLuint shader) { record("glDeleteShader", shader); frame_stats.objects_deleted ++; }
+static void APIENTRY nullDeleteProgram(GLuint program) { record("glDeleteProgram", program); frame_stats.objects_deleted ++; }
+static void APIENTRY nullShaderSource(GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length) { record("glShaderSource", shader); }
+static void APIENTRY nullCompileShader(GLuint shader) { record("glCompileShader", shader); }
+static void APIENTRY nullAttachShader(GLuint program, GLuint shader) { record("glAttachShader", program, shader); }
+static void APIENTRY nullLinkProgram(GLuint program) { record("glLinkProgram", program); }
+static void APIENTRY nullProgramParameteri(GLuint program, GLenum pname, GLint value) { record("glProgramParameteri", program, pname); }
+static void APIENTRY nullProgramBinary(GLuint program, GLenum format, const void* binary, GLsizei length) { record("glProgramBinary", program, length); }
+static void APIENTRY nullGetProgramBinary(GLuint program, GLsizei size, GLsizei* length, GLenum* format, void* binary) { record("glGetProgramBinary", program); *length = 0; *format = 0; }
+
+static void APIENTRY nullGetShaderiv(GLuint shader, GLenum pname, GLint* params)
+{
+    record("glGetShaderiv", shader, pname);
+
+    // Everything always compiles
+    *params = pname == GL_COMPILE_STATUS ? 1 : 0;
+}
+
+static void APIENTRY nullGetProgramiv(GLuint program, GLenum pname, GLint* params)
+{
+    record("glGetProgramiv", program, pname);
+    *params = pname == GL_LINK_STATUS ? 1 : 0;
+}
+
+static void APIENTRY nullGetShaderInfoLog(GLuint shader, GLsizei size, GLsizei* length, GLchar* log) { record("glGetShaderInfoLog"); if (length) *length = 0; if (size > 0) log[0] = '\0'; }
+static void APIENTRY nullGetProgramInfoLog(GLuint program, GLsizei size, GLsizei* length, GLchar* log) { record("glGetProgramInfoLog"); if (length) *length = 0; if (size > 0) log[0] = '\0'; }
+
+// Uniforms
+// There's no real shader to look at, so every uniform gets a new location, and there are no uniform blocks
+static GLint APIENTRY nullGetUniformLocation(GLuint program, const GLchar* name) { record("glGetUniformLocation", program); return next_name++; }
+static GLuint APIENTRY nullGetUniformBlockIndex(GLuint program, const GLchar* name) { record("glGetUniformBlockIndex", program); return GL_INVALID_INDEX; }
+static void APIENTRY nullUniformBlockBinding(GLuint program, GLuint index, GLuint binding) { record("glUniformBlockBinding", program, index, binding); }
+static void APIENTRY nullGetActiveUniformBlockiv(GLuint program, GLuint index, GLenum pname, GLint* params) { record("glGetActiveUniformBlockiv", program, pname); *params = 0; }
+static void APIENTRY nullGetActiveUniformsiv(GLuint program, GLsizei count, const GLuint* indices, GLenum pname, GLint* params) { record("glGetActiveUniformsiv", program, count); std::memset(params, 0, sizeof(GLint) * count); }
+
+static void APIENTRY nullGetActiveUniform(GLuint program, GLuint index, GLsizei size, GLsizei* length, GLint* usize, GLenum* type, GLchar* name)
+{
+    record("glGetActiveUniform", program, index);
+    *length = 0;
+    *usize = 0;
+    *type = 0;
+    if (size > 0) name[0] = '\0';
+}
+
+static void APIENTRY nullUniform1i(GLint location, GLint v0) { record("glUniform1i", location); frame_stats.uniform_updates ++; }
+static void APIENTRY nullUniform1iv(GLint location, GLsizei count, const GLint* value) { record("glUniform1iv", location, count); frame_stats.uniform_updates ++; }
+static void APIENTRY nullUniform1f(GLint location, GLfloat v0) { record("glUniform1f", location); frame_stats.uniform_updates ++; }
+static void APIENTRY nullUniform2f(GLint location, GLfloat v0, GLfloat v1) { record("glUniform2f", location); frame_stats.uniform_updates ++; }
+static void APIENTRY nullUniform3i(GLint location, GLint v0, GLint v1, GLint v2) { record("glUniform3i", location); frame_stats.uniform_updates ++; }
+static void APIENTRY nullUniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2) { record("glUniform3f", location); frame_stats.uniform_updates ++; }
+static void APIENTRY nullUniform4f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3) { record("glUniform4f", location); frame_stats.uniform_updates ++; }
+static void APIENTRY nullUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value) { record("glUniformMatrix4fv", location, count); frame_stats.uniform_updates ++; }
+
+// Framebuffers
+static void APIENTRY nullGenFramebuffers(GLsizei n, GLuint* framebuffers) { record("glGenFramebuffers", createNames(n, framebuffers)); }
+static void APIENTRY nullDeleteFramebuffers(GLsizei n, const GLuint* framebuffers) { record("glDeleteFramebuffers", n); frame_stats.objects_deleted += n; }
+static void APIENTRY nullBindFramebuffer(GLenum target, GLuint framebuffer) { record("glBindFramebuffer", target, framebuffer); frame_stats.state_changes ++; }
+static void APIENTRY nullGenRenderbuffers(GLsizei n, GLuint* renderbuffers) { record("glGenRenderbuffers", createNames(n, renderbuffers)); }
+static void APIENTRY nullDeleteRenderbuffers(GLsizei n, const GLuint* renderbuffers) { record("glDeleteRenderbuffers", n); frame_stats.objects_deleted += n; }
+static void APIENTRY nullBindRenderbuffer(GLenum target, GLuint renderbuffer) { record("glBindRenderbuffer", target, renderbuffer); frame_stats.state_changes ++; }
+static void APIENTRY nullRenderbufferStorage(GLenum target, GLenum format, GLsizei width, GLsizei height) { record("glRenderbufferStorage", format, width, height); }
+static void APIENTRY nullFramebufferRenderbuffer(GLenum target, GLenum attachment, GLenum rb_target, GLuint renderbuffer) { record("glFramebufferRenderbuffer", attachment, renderbuffer); }
+static GLenum APIENTRY nullCheckFramebufferStatus(GLenum target) { record("glCheckFramebufferStatus", target); return GL_FRAMEBUFFER_COMPLETE; }
+
+static void APIENTRY nullBlitFramebuffer(GLint sx0, GLint sy0, GLint sx1, GLint sy1, GLint dx0, GLint dy0, GLint dx1, GLint dy1, GLbitfield mask, GLenum filter)
+{
+    record("glBlitFramebuffer", sx1 - sx0, sy1 - sy0, mask);
+}
+
+// Timer queries
+// Nothing takes any time, so they're always ready, and always 0
+static void APIENTRY nullGenQueries(GLsizei n, GLuint* ids) { record("glGenQueries", createNames(n, ids)); }
+static void APIENTRY nullDeleteQueries(GLsizei n, const GLuint* ids) { record("glDeleteQueries", n); frame_stats.objects_deleted += n; }
+static void APIENTRY nullBeginQuery(GLenum target, GLuint id) { record("glBeginQuery", target, id); }
+static void APIENTRY nullEndQuery(GLenum target) { record("glEndQuery", target); }
+static void APIENTRY nullGetQueryObjectiv(GLuint id, GLenum pname, GLint* params) { record("glGetQueryObjectiv", id, pname); *params = pname == GL_QUERY_RESULT_AVAILABLE ? 1 : 0; }
+static void APIENTRY nullGetQueryObjectui64v(GLuint id, GLenum pname, GLuint64* params) { record("glGetQueryObjectui64v", id, pname); *params = 0; }
+
+// Anything we don't know about does nothing
+// This only works for functions that don't return anything, so any new functions the renderer uses should be added above
+static void APIENTRY nullUnknown() { record("unknown"); }
+
+static void* nullGetProcAddress(const char* name)
+{
+    static std::map<std::string, void*> functions = {
+        {"glEnable", (void*)nullEnable},
+        {"glDisable", (void*)nullDisable},
+        {"glCullFace", (void*)nullCullFace},
+        {"glDepthFunc", (void*)nullDepthFunc},
+        {"glDepthMask", (void*)nullDepthMask},
+        {"glColorMask", (void*)nullColorMask},
+        {"glBlendFunc", (void*)nullBlendFunc},
+        {"glViewport", (void*)nullViewport},
+        {"glPixelStorei", (void*)nullPixelStorei},
+        {"glClearColor", (void*)nullClearColor},
+        {"glClear", (void*)nullClear},
+        {"glActiveTexture", (void*)nullActiveTexture},
+        {"glUseProgram", (void*)nullUseProgram},
+
+        {"glGetError", (void*)nullGetError},
+        {"glGetString", (void*)nullGetString},
+        {"glGetStringi", (void*)nullGetStringi},
+        {"glGetIntegerv", (void*)nullGetIntegerv},
+
+        {"glGenBuffers", (void*)nullGenBuffers},
+        {"glDeleteBuffers", (void*)nullDeleteBuffers},
+        {"glBindBuffer", (void*)nullBindBuffer},
+        {"glBindBufferBase", (void*)nullBindBufferBase},
+        {"glBindBufferRange", (void*)nullBindBufferRange},
+        {"glBufferData", (void*)nullBufferData},
+        {"glBufferSubData", (void*)nullBufferSubData},
+
+        {"glGenVertexArrays", (void*)nullGenVertexArrays},
+        {"glDeleteVertexArrays", (void*)nullDeleteVertexArrays},
+        {"glBindVertexArray", (void*)nullBindVertexArray},
+        {"glVertexAttribPointer", (void*)nullVertexAttribPointer},
+        {"glVertexAttribIPointer", (void*)nullVertexAttribIPointer},
+        {"glEnableVertexAttribArray", (void*)nullEnableVertexAttribArray},
+        {"glVertexAttribDivisor", (void*)nullVertexAttribDivisor},
+
+        {"glDrawElements", (void*)nullDrawElements},
+        {"glDrawElementsInstanced", (void*)nullDrawElementsInstanced},
+        {"glDrawArrays", (void*)nullDrawArrays},
+        {"glDrawArraysInstanced", (void*)nullDrawArraysInstanced},
+
+        {"glGenTextures", (void*)nullGenTextures},
+        {"glDeleteTextures", (void*)nullDeleteTextures},
+        {"glBindTexture", (void*)nullBindTexture},
+        {"glTexParameteri", (void*)nullTexParameteri},
+        {"glGenerateMipmap", (void*)nullGenerateMipmap},
+        {"glTexImage2D", (void*)nullTexImage2D},
+        {"glTexSubImage2D", (void*)nullTexSubImage2D},
+        {"glCompressedTexImage2D", (void*)nullCompressedTexImage2D},
+        {"glTexImage3D", (void*)nullTexImage3D},
+        {"glTexSubImage3D", (void*)nullTexSubImage3D},
+        {"glCompressedTexImage3D", (void*)nullCompressedTexImage3D},
+
+        {"glCreateShader", (void*)nullCreateShader},
+        {"glCreateProgram", (void*)nullCreateProgram},
+        {"glDeleteShader", (void*)nullDeleteShader},
+        {"glDeleteProgram", (void*)nullDeleteProgram},
+        {"glShaderSource", (void*)nullShaderSource},
+        {"glCompileShader", (void*)nullCompileShader},
+        {"glAttachShader", (void*)nullAttachShader},
+        {"glLinkProgram", (void*)nullLinkProgram},
+        {"glProgramParameteri", (void*)nullProgramParameteri},
+        {"glProgramBinary", (void*)nullProgramBinary},
+        {"glGetProgramBinary", (void*)nullGetProgramBinary},
+        {"glGetShaderiv", (void*)nullGetShaderiv},
+        {"glGetProgramiv", (void*)nullGetProgramiv},
+        {"glGetShaderInfoLog", (void*)nullGetShaderInfoLog},
+        {"glGetProgramInfoLog", (void*)nullGetProgramInfoLog},
+
+        {"glGetUniformLocation", (void*)nullGetUniformLocation},
+        {"glGetUniformBlockIndex", (void*)nullGetUniformBlockIndex},
+        {"glUniformBlockBinding", (void*)nullUniformBlockBinding},
+        {"glGetActiveUniformBlockiv", (void*)nullGetActiveUniformBlockiv},
+        {"glGetActiveUniformsiv", (void*)nullGetActiveUniformsiv},
+        {"glGetActiveUniform", (void*)nullGetActiveUniform},
+        {"glUniform1i", (void*)nullUniform1i},
+        {"glUniform1iv", (void*)nullUniform1iv},
+        {"glUniform1f", (void*)nullUniform1f},
+        {"glUniform2f", (void*)nullUniform2f},
+        {"glUniform3i", (void*)nullUniform3i},
+        {"glUniform3f", (void*)nullUniform3f},
+        {"glUniform4f", (void*)nullUniform4f},
+        {"glUniformMatrix4fv", (void*)nullUniformMatrix4fv},
+
+        {"glGenFramebuffers", (void*)nullGenFramebuffers},
+        {"glDeleteFramebuffers", (void*)nullDeleteFramebuffers},
+        {"glBindFramebuffer", (void*)nullBindFramebuffer},
+        {"glGenRenderbuffers", (void*)nullGenRenderbuffers},
+        {"glDeleteRenderbuffers", (void*)nullDeleteRenderbuffers},
+        {"glBindRenderbuffer", (void*)nullBindRenderbuffer},
+        {"glRenderbufferStorage", (void*)nullRenderbufferStorage},
+        {"glFramebufferRenderbuffer", (void*)nullFramebufferRenderbuffer},
+        {"glCheckFramebufferStatus", (void*)nullCheckFramebufferStatus},
+        {"glBlitFramebuffer", (void*)nullBlitFramebuffer},
+
+        {"glGenQueries", (void*)nullGenQueries},
+        {"glDeleteQueries", (void*)nullDeleteQueries},
+        {"glBeginQuery", (void*)nullBeginQuery},
+        {"glEndQuery", (void*)nullEndQuery},
+        {"glGetQueryObjectiv", (void*)nullGetQueryObjectiv},
+        {"glGetQueryObjectui64v", (void*)nullGetQueryObjectui64v},
+        {"glGetQueryObjectui64vEXT", (void*)nullGetQueryObjectui64v},
+    };
+
+    auto it = functions.find(name);
+    if (it != functions.end())
+    {
+        return it->second;
+    }
+
+    return (void*)nullUnknown;
+}
+
+// =========================================================
+// Stats
+// =========================================================
+
+const NullStats& Flux::GLRenderer::Null::getLastFrameStats()
+{
+    return last_frame_stats;
+}
+
+const NullStats& Flux::GLRenderer::Null::getTotalStats()
+{
+    return total_stats;
+}
+
+void Flux::GLRenderer::Null::setTraceEnabled(bool enabled)
+{
+    trace_enabled = enabled;
+}
+
+const std::vector<NullCommand>& Flux::GLRenderer::Null::getTrace()
+{
+    return trace;
+}
+
+void Flux::GLRenderer::Null::clearTrace()
+{
+    trace.clear();
+}
+
+void Flux::GLRenderer::Null::setFrameLimit(uint32_t frames)
+{
+    frame_limit = frames;
+}
+
+void Flux::GLRenderer::Null::closeWindow()
+{
+    should_close = true;
+}
+
+// Adds the current frame's stats to the totals
+static void finishFrame()
+{
+    total_stats.commands += frame_stats.commands;
+    total_stats.draw_calls += frame_stats.draw_calls;
+    total_stats.indices_drawn += frame_stats.indices_drawn;
+    total_stats.state_changes += frame_stats.state_changes;
+    total_stats.uniform_updates += frame_stats.uniform_updates;
+    total_stats.buffer_bytes += frame_stats.buffer_bytes;
+    total_stats.texture_bytes += frame_stats.texture_bytes;
+    total_stats.objects_created += frame_stats.objects_created;
+    total_stats.objects_deleted += frame_stats.objects_deleted;
+
+    last_frame_stats = frame_stats;
+    frame_stats = NullStats();
+}
+
+// =========================================================
+// Window
+// =========================================================
+
+void (*func)();
+
+void Flux::setMainLoopFunction(void (*fun)())
+{
+    func = fun;
+}
+
+void Flux::GLRenderer::createWindow(const int &width, const int &height, const std::string &title)
+{
+    if (current_window != nullptr)
+    {
+        LOG_ERROR("There can only be one window open at once!");
+        return;
+    }
+
+    GLCtx* gctx = new GLCtx;
+    current_window = gctx;
+
+    gctx->width = width;
+    gctx->height = height;
+    gctx->title = title;
+    gctx->mouse_mode = Input::MouseMode::Free;
+    gctx->offset = glm::vec2();
+    gctx->mouse_pos = glm::vec2();
+
+    start_time = std::chrono::steady_clock::now();
+    should_close = false;
+    frame_count = 0;
+
+    // Initialize our pretend OpenGL
+    if (!gladLoadGLES2Loader((GLADloadproc)nullGetProcAddress))
+    {
+        LOG_ERROR("Could not initialize the null renderer");
+        return;
+    }
+
+    _startGL((GLADloadproc)nullGetProcAddress);
+
+    // Creating the window isn't part of any frame
+    finishFrame();
+
+    render_thread.start();
+}
+
+void Flux::runMainloop()
+{
+    while (!should_close)
+    {
+        func();
+    }
+
+    // Everything after this is on the main thread again
+    render_thread.stop();
+
+    end();
+
+    Flux::GLRenderer::destroyWindow();
+}
+
+bool Flux::GLRenderer::_windowStartFrame()
+{
+    return should_close;
+}
+
+void Flux::GLRenderer::_windowEndFrame()
+{
+    finishFrame();
+
+    frame_count ++;
+    if (frame_limit != 0 && frame_count >= frame_limit)
+    {
+        should_close = true;
+    }
+}
+
+// There's no context, so any thread can draw
+void Flux::GLRenderer::_windowAcquireContext()
+{
+
+}
+
+void Flux::GLRenderer::_windowReleaseContext()
+{
+
+}
+
+void Flux::GLRenderer::destroyWindow()
+{
+    delete current_window;
+    current_window = nullptr;
+}
+
+double Flux::Renderer::getTime()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+// =========================================================
+// Input
+// There's nobody to press anything
+// =========================================================
+
+bool Flux::Input::isKeyPressed(int key)
+{
+    return false;
+}
+
+bool Flux::Input::isMouseButtonPressed(int button)
+{
+    return false;
+}
+
+void Flux::Input::setCursorMode(Input::CursorMode mode)
+{
+
+}
+
+void Flux::Input::setMouseMode(Input::MouseMode mode)
+{
+    current_window->mouse_mode = mode;
+}
+
+glm::vec2& Flux::Input::getMouseOffset()
+{
+    return current_window->offset;
+}
+
+glm::vec2& Flux::Input::getMousePosition()
+{
+    return current_window->mouse_pos;
+}
+
+float Flux::Input::getScrollWheelOffset()
+{
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include "Flux/Particles.hh"
+#include "Flux/ECS.hh"
+#include "Flux/Log.hh"
+#include "Flux/Renderer.hh"
+#include "Flux/Threads.hh"
+
+#include <glm/glm.hpp>
+
+// STL includes
+#include <algorithm>
+#include <vector>
+
+using namespace Flux;
+
+// Big emitters are split between these
+static Threads::WorkerPool workers(FLUX_PARTICLE_THREADS);
+
+// =========================================================
+// Emitters
+// =========================================================
+
+Particles::ParticleEmitterCom* Particles::addParticleEmitter(EntityRef entity, uint32_t max_particles)
+{
+    if (entity.hasComponent<ParticleEmitterCom>())
+    {
+        LOG_WARN("Entity already has a particle emitter");
+        return entity.getComponent<ParticleEmitterCom>();
+    }
+
+    auto emitter = new ParticleEmitterCom;
+    emitter->max_particles = max_particles;
+
+    // Otherwise every emitter would spawn the same pattern
+    emitter->random_state ^= (uint32_t)entity.getEntityID() * 0x85EBCA6B;
+    if (emitter->random_state == 0)
+    {
+        emitter->random_state = 1;
+    }
+
+    emitter->particles.resize(max_particles);
+
+    entity.addComponent(emitter);
+    return emitter;
+}
+
+// =========================================================
+// Systems
+// =========================================================
+
+void Particles::ParticleSystem::runSystem(EntityRef entity, float delta)
+{
+    if (!entity.hasComponent<ParticleEmitterCom>())
+    {
+        return;
+    }
+
+    auto emitter = entity.getComponent<ParticleEmitterCom>();
+    auto& pool = emitter->particles;
+
+    // max_particles might have been changed
+    if (pool.capacity() != ((emitter->max_particles + 3) & ~3u))
+    {
+        pool.resize(emitter->max_particles);
+    }
+
+    // The arrays are a multiple of 4 long, so the last group can be done whole. The extra ones are dead anyway
+    uint32_t end = (pool.count + 3) & ~3u;
+    auto acceleration = emitter->acceleration;
+    float drag = emitter->drag;
+
+    if (FLUX_PARTICLE_THREADS > 0 && pool.count >= FLUX_PARTICLE_THREADING_THRESHOLD)
+    {
+        // The parts have to be whole groups of 4 for simulateParticles
+        workers.run(end, [&](uint32_t start, uint32_t part_end) {
+            simulateParticles(pool, start, part_end, acceleration, drag, delta);
+        }, 4);
+    }
+    else
+    {
+        simulateParticles(pool, 0, end, acceleration, drag, delta);
+    }
+
+    removeDeadParticles(pool);
+
+    if (!emitter->emitting)
+    {
+        emitter->spawn_accumulator = 0;
+        return;
+    }
+
+    glm::vec3 origin = glm::vec3(0);
+    if (entity.hasComponent<Transform::TransformCom>())
+    {
+        origin = glm::vec3(entity.getComponent<Transform::TransformCom>()->model[3]);
+    }
+
+    emitter->spawn_accumulator += emitter->rate * delta;
+    uint32_t spawning = (uint32_t)emitter->spawn_accumulator;
+    emitter->spawn_accumulator -= spawning;
+
+    spawnParticles(emitter, origin, spawning);
+}
+
+void Particles::addParticleSystems(ECSCtx* ctx)
+{
+    // It starts its own threads for big emitters
+    ctx->addSystemFront(new ParticleSystem, false);
+}
@@ -0,0 +1,206 @@
+#include "Flux/Particles.hh"
+
+#include <glm/glm.hpp>
+
+// STL includes
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace Flux;
+
+// =========================================================
+// Pools
+// =========================================================
+
+void Particles::ParticlePool::resize(uint32_t max_particles)
+{
+    uint32_t capacity = (max_particles + 3) & ~3u;
+
+    std::vector<float>* arrays[] = {&position_x, &position_y, &position_z, &velocity_x, &velocity_y, &velocity_z, &life, &life_rate};
+    for (auto array : arrays)
+    {
+        array->resize(capacity, 0);
+    }
+
+    count = std::min(count, max_particles);
+}
+
+void Particles::ParticlePool::kill(uint32_t i)
+{
+    count--;
+
+    position_x[i] = position_x[count];
+    position_y[i] = position_y[count];
+    position_z[i] = position_z[count];
+    velocity_x[i] = velocity_x[count];
+    velocity_y[i] = velocity_y[count];
+    velocity_z[i] = velocity_z[count];
+    life[i] = life[count];
+    life_rate[i] = life_rate[count];
+}
+
+// =========================================================
+// Simulation
+// =========================================================
+
+#ifdef __SSE2__
+
+void Particles::simulateParticles(ParticlePool& pool, uint32_t start, uint32_t end, glm::vec3 acceleration, float drag, float delta)
+{
+    // Drag is the same for every particle, so the exp only happens once
+    __m128 damping = _mm_set1_ps(std::exp(-drag * delta));
+    __m128 dt = _mm_set1_ps(delta);
+    __m128 dv_x = _mm_set1_ps(acceleration.x * delta);
+    __m128 dv_y = _mm_set1_ps(acceleration.y * delta);
+    __m128 dv_z = _mm_set1_ps(acceleration.z * delta);
+
+    float* px = pool.position_x.data();
+    float* py = pool.position_y.data();
+    float* pz = pool.position_z.data();
+    float* vx = pool.velocity_x.data();
+    float* vy = pool.velocity_y.data();
+    float* vz = pool.velocity_z.data();
+    float* life = pool.life.data();
+    const float* life_rate = pool.life_rate.data();
+
+    for (uint32_t i = start; i < end; i += 4)
+    {
+        __m128 x = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(vx + i), dv_x), damping);
+        __m128 y = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(vy + i), dv_y), damping);
+        __m128 z = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(vz + i), dv_z), damping);
+
+        _mm_storeu_ps(vx + i, x);
+        _mm_storeu_ps(vy + i, y);
+        _mm_storeu_ps(vz + i, z);
+
+        _mm_storeu_ps(px + i, _mm_add_ps(_mm_loadu_ps(px + i), _mm_mul_ps(x, dt)));
+        _mm_storeu_ps(py + i, _mm_add_ps(_mm_loadu_ps(py + i), _mm_mul_ps(y, dt)));
+        _mm_storeu_ps(pz + i, _mm_add_ps(_mm_loadu_ps(pz + i), _mm_mul_ps(z, dt)));
+
+        _mm_storeu_ps(life + i, _mm_add_ps(_mm_loadu_ps(life + i), _mm_mul_ps(_mm_loadu_ps(life_rate + i), dt)));
+    }
+}
+
+#else
+
+void Particles::simulateParticles(ParticlePool& pool, uint32_t start, uint32_t end, glm::vec3 acceleration, float drag, float delta)
+{
+    float damping = std::exp(-drag * delta);
+    glm::vec3 dv = acceleration * delta;
+
+    for (uint32_t i = start; i < end; i++)
+    {
+        float x = (pool.velocity_x[i] + dv.x) * damping;
+        float y = (pool.velocity_y[i] + dv.y) * damping;
+        float z = (pool.velocity_z[i] + dv.z) * damping;
+
+        pool.velocity_x[i] = x;
+        pool.velocity_y[i] = y;
+        pool.velocity_z[i] = z;
+
+        pool.position_x[i] += x * delta;
+        pool.position_y[i] += y * delta;
+        pool.position_z[i] += z * delta;
+
+        pool.life[i] += pool.life_rate[i] * delta;
+    }
+}
+
+#endif
+
+void Particles::removeDeadParticles(ParticlePool& pool)
+{
+    uint32_t i = 0;
+    while (i < pool.count)
+    {
+        if (pool.life[i] >= 1)
+        {
+            // Something else is moved into this spot, so it has to be checked too
+            pool.kill(i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+// Xorshift, from 0 to 1
+static float randomFloat(uint32_t& state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+
+    return (state >> 8) * (1.0f / 16777216.0f);
+}
+
+// From -1 to 1 on each axis
+static glm::vec3 randomVector(uint32_t& state)
+{
+    float x = randomFloat(state);
+    float y = randomFloat(state);
+    float z = randomFloat(state);
+
+    return glm::vec3(x, y, z) * 2.0f - 1.0f;
+}
+
+void Particles::spawnParticles(ParticleEmitterCom* emitter, glm::vec3 origin, uint32_t count)
+{
+    auto& pool = emitter->particles;
+    uint32_t room = std::min(emitter->max_particles, pool.capacity());
+    count = pool.count < room ? std::min(count, room - pool.count) : 0;
+
+    for (uint32_t n = 0; n < count; n++)
+    {
+        uint32_t i = pool.count;
+        pool.count++;
+
+        glm::vec3 position = origin + randomVector(emitter->random_state) * emitter->position_spread;
+        glm::vec3 velocity = emitter->velocity + randomVector(emitter->random_state) * emitter->velocity_spread;
+        float lifetime = glm::mix(emitter->min_lifetime, emitter->max_lifetime, randomFloat(emitter->random_state));
+
+        pool.position_x[i] = position.x;
+        pool.position_y[i] = position.y;
+        pool.position_z[i] = position.z;
+        pool.velocity_x[i] = velocity.x;
+        pool.velocity_y[i] = velocity.y;
+        pool.velocity_z[i] = velocity.z;
+        pool.life[i] = 0;
+        pool.life_rate[i] = lifetime > 0 ? 1 / lifetime : 1e6f;
+    }
+}
+
+// =========================================================
+// Drawing
+// =========================================================
+
+void Particles::packParticles(const ParticleEmitterCom* emitter, ParticleInstance* out)
+{
+    auto& pool = emitter->particles;
+
+    float size_change = emitter->end_size - emitter->start_size;
+    glm::vec4 start_color = emitter->start_color * 255.0f;
+    glm::vec4 color_change = emitter->end_color * 255.0f - start_color;
+
+    for (uint32_t i = 0; i < pool.count; i++)
+    {
+        float t = std::min(pool.life[i], 1.0f);
+        auto& instance = out[i];
+
+        instance.x = pool.position_x[i];
+        instance.y = pool.position_y[i];
+        instance.z = pool.position_z[i];
+        instance.size = emitter->start_size + size_change * t;
+
+        glm::vec4 color = start_color + color_change * t;
+        for (int c = 0; c < 4; c++)
+        {
+            instance.color[c] = (uint8_t)(glm::clamp(color[c], 0.0f, 255.0f) + 0.5f);
+        }
+    }
+}
@@ -503,15 +503,142 @@ std::vector<BoundingBox*> DS::SegmentedIntervalList::getCollidingBoxes(BoundingB
 //     }
 // }
 
+// ==================================================
+// Pair Cache
+// ==================================================
+
+bool DS::PairCache::add(BoundingBox* a, BoundingBox* b)
+{
+    if (b < a)
+    {
+        std::swap(a, b);
+    }
+
+    auto key = std::make_pair(a, b);
+    if (indices.find(key) != indices.end())
+    {
+        return false;
+    }
+
+    BoxPair pair = {a, b, CollisionData {glm::vec3(), glm::vec3(), 0, false}, false};
+    indices[key] = pairs.size();
+    pairs.push_back(pair);
+    added.push_back(pair);
+
+    a->overlapping.push_back(b);
+    b->overlapping.push_back(a);
+
+    return true;
+}
+
+// Order doesn't matter, and the boxes don't overlap much, so this is quick enough
+static void removeOverlap(BoundingBox* box, BoundingBox* other)
+{
+    auto it = std::find(box->overlapping.begin(), box->overlapping.end(), other);
+    if (it != box->overlapping.end())
+    {
+        *it = box->overlapping.back();
+        box->overlapping.pop_back();
+    }
+}
+
+bool DS::PairCache::remove(BoundingBox* a, BoundingBox* b)
+{
+    if (b < a)
+    {
+        std::swap(a, b);
+    }
+
+    auto it = indices.find(std::make_pair(a, b));
+    if (it == indices.end())
+    {
+        return false;
+    }
+
+    // Swap the last pair into its place
+    uint32_t index = it->second;
+    indices.erase(it);
+
+    removed.push_back(pairs[index]);
+    if (index != pairs.size() - 1)
+    {
+        pairs[index] = pairs.back();
+        indices[std::make_pair(pairs[index].a, pairs[index].b)] = index;
+    }
+    pairs.pop_back();
+
+    removeOverlap(a, b);
+    removeOverlap(b, a);
+
+    return true;
+}
+
+void DS::PairCache::removeBox(BoundingBox* box)
+{
+    // Removing the pairs changes the list, so it has to be copied
+    auto others = box->overlapping;
+    for (auto other : others)
+    {
+        if (remove(box, other))
+        {
+            // The other box still has to hear about it, but this one's going
+            auto& pair = removed.back();
+            (pair.a == box ? pair.a : pair.b) = nullptr;
+        }
+    }
+
+    // Pairs that only just started can't be reported any more
+    added.erase(std::remove_if(added.begin(), added.end(), [box](const BoxPair& pair) {
+        return pair.a == box || pair.b == box;
+    }), added.end());
+}
+
+void DS::PairCache::clearEvents()
+{
+    added.clear();
+    removed.clear();
+}
+
 // ==================================================
 // Sorted Extrema List
 // ==================================================
-DS::SortedExtremaList::SortedExtremaList(const int index):
-index(index)
+DS::SortedExtremaList::SortedExtremaList(const int index, PairCache* pairs):
+index(index),
+pairs(pairs)
 {
 
 }
 
+static bool overlaps(const BoundingBox* a, const BoundingBox* b)
+{
+    return a->min_pos.x < b->max_pos.x && b->min_pos.x < a->max_pos.x
+        && a->min_pos.y < b->max_pos.y && b->min_pos.y < a->max_pos.y
+        && a->min_pos.z < b->max_pos.z && b->min_pos.z < a->max_pos.z;
+}
+
+void DS::SortedExtremaList::swapped(const Extrema& moving, const Extrema& passed)
+{
+    if (pairs == nullptr || moving.box == passed.box)
+    {
+        return;
+    }
+
+    if (moving.type == Minima && passed.type == Maxima)
+    {
+        // They've just started overlapping on this axis, so they might overlap on all of them now.
+        // The boxes are already where they're going to end up, so the other axes don't need to be sorted first
+        if (overlaps(moving.box, passed.box))
+        {
+            pairs->add(moving.box, passed.box);
+        }
+    }
+    else if (moving.type == Maxima && passed.type == Minima)
+    {
+        // They've stopped overlapping on this axis, so they can't overlap at all
+        pairs->remove(moving.box, passed.box);
+    }
+}
+
 void DS::SortedExtremaList::addBoundingBox(BoundingBox* box, float minima, float maxima)
 {
     // Add the 2 extrema in the right place
@@ -520,9 +647,10 @@ void DS::SortedExtremaList::addBoundingBox(BoundingBox* box, float minima, float
         return value < info.pos;
     });
 
-    auto mit = extrema.insert(minima_it, Extrema {Minima, box, minima});
+    // The second insert can reallocate, so the index is taken before the iterator goes bad
+    int minima_index = extrema.insert(minima_it, Extrema {Minima, box, minima}) - extrema.begin();
 
-    auto maxima_it = std::upper_bound(extrema.begin(), extrema.end(), maxima, 
+    auto maxima_it = std::upper_bound(extrema.begin(), extrema.end(), maxima,
                 [](const float& value, Extrema& info) {
         return value < info.pos;
     });
@@ -530,7 +658,7 @@ void DS::SortedExtremaList::addBoundingBox(BoundingBox* box, float minima, float
     auto mat = extrema.insert(maxima_it, Extrema {Maxima, box, maxima});
 
     // The insertion of the Maxima after the minima shouldn't effect the minima's index
-    box->storage[index].minima_chunk_index = mit - extrema.begin();
+    box->storage[index].minima_chunk_index = minima_index;
     box->storage[index].maxima_chunk_index = mat - extrema.begin();
 
     // Sort to update indexes
@@ -554,13 +682,16 @@ void DS::SortedExtremaList::sort()
         Extrema key = extrema[i];
 
         // Make key up to date
+        // Inserting and erasing moves everything after it along, so the indexes are fixed here too
         if (key.type == Minima)
         {
             key.pos = key.box->min_pos[index];
+            key.box->storage[index].minima_chunk_index = i;
         }
         else
         {
             key.pos = key.box->max_pos[index];
+            key.box->storage[index].maxima_chunk_index = i;
         }
 
         extrema[i] = key;
@@ -575,6 +706,7 @@ void DS::SortedExtremaList::sort()
         j = i;
         while (j > 0 && extrema[j-1].pos > key.pos)
         {
+            swapped(key, extrema[j-1]);
             extrema[j] = extrema[j-1];
 
             // Update index
@@ -923,9 +1055,11 @@ void BoundingBox::updateDisplay()
 // ==================================================
 
 BoundingWorld::BoundingWorld():
-x_axis(0),
-y_axis(1),
-z_axis(2)
+narrow_phase_frame(0),
+pairs(),
+x_axis(0, &pairs),
+y_axis(1, &pairs),
+z_axis(2, &pairs)
 {
 
 }
@@ -936,10 +1070,21 @@ void BoundingWorld::addBoundingBox(BoundingBox *box)
     x_axis.addBoundingBox(box, box->min_pos.x, box->max_pos.x);
     y_axis.addBoundingBox(box, box->min_pos.y, box->max_pos.y);
     z_axis.addBoundingBox(box, box->min_pos.z, box->max_pos.z);
+
+    // It was put straight into the right place, so it never got swapped past the boxes it's already in
+    for (auto other : getColliding(box))
+    {
+        if (other != box && overlaps(box, other))
+        {
+            pairs.add(box, other);
+        }
+    }
 }
 
 void BoundingWorld::removeBoundingBox(BoundingBox *box)
 {
+    pairs.removeBox(box);
+
     // Remove it from the SILs
     x_axis.removeBoundingBox(box, box->min_pos.x, box->max_pos.x);
     y_axis.removeBoundingBox(box, box->min_pos.y, box->max_pos.y);
@@ -1023,6 +1168,9 @@ void Flux::Physics::giveBoundingBox(EntityRef entity)
     // Add a bounding box made from the entities mesh
     auto com = new BoundingCom;
     
+    // Packed meshes don't keep their vertices around
+    entity.getComponent<Renderer::MeshCom>()->mesh_resource->unpack();
+
     auto mesh = entity.getComponent<Renderer::MeshCom>()->mesh_resource->vertices;
     auto mesh_size = entity.getComponent<Renderer::MeshCom>()->mesh_resource->vertices_length;
 
@@ -1030,7 +1178,6 @@ void Flux::Physics::giveBoundingBox(EntityRef entity)
     com->box->entity = entity;
 
     com->setup = false;
-    com->collisions = std::vector<BoundingBox* >();
     entity.addComponent(com);
 }
 
@@ -1052,7 +1199,6 @@ void Flux::Physics::giveBoundingBox(EntityRef entity, glm::vec3 min_pos, glm::ve
     com->box->entity = entity;
 
     com->setup = false;
-    com->collisions = std::vector<BoundingBox* >();
     entity.addComponent(com);
 }
 
@@ -1100,8 +1246,6 @@ void BroadPhaseSystem::runSystem(EntityRef entity, float delta)
             // LOG_INFO("=== Add");
             // world.addBoundingBox(bc->box);
         }
-
-        // bc->collisions = world.getColliding(bc->box);
     }
 }
 
@@ -1120,14 +1264,8 @@ std::vector<BoundingBox*> Flux::Physics::getBoundingBoxCollisions(EntityRef enti
             return std::vector<BoundingBox*>();
         }
 
-        if (bc->frame != frames)
-        {
-            // LOG_INFO("Redoing BB");
-            bc->collisions = bc->world->getColliding(bc->box);
-            bc->frame = frames;
-        }
-
-        return bc->collisions;
+        // The pair cache already knows
+        return bc->box->overlapping;
     }
 
     // LOG_INFO("No Bounding Com");
@@ -1743,6 +1881,9 @@ void Flux::Physics::giveConvexCollider(Flux::EntityRef entity)
     std::vector<glm::vec3> points;
     // points.resize(mc->mesh_resource->vertices_length);
 
+    // Packed meshes don't keep their vertices around
+    mc->mesh_resource->unpack();
+
     for (auto i = 0 ; i < mc->mesh_resource->vertices_length; i++)
     {
         auto new_point = glm::vec3(mc->mesh_resource->vertices[i].x, mc->mesh_resource->vertices[i].y, mc->mesh_resource->vertices[i].z);
@@ -1761,105 +1902,131 @@ void Flux::Physics::giveConvexCollider(Flux::EntityRef entity)
     entity.addComponent(cc);
 }
 
-// TODO: Move collision detection out of a system,
-// only run it on object that specifically ask for it
-// because it's expensive af
-void NarrowPhaseSystem::runSystem(EntityRef entity, float delta)
+// Empties an entity's collisions the first time it's seen this frame
+static void resetCollisions(BoundingBox* box)
 {
-    
+    // Boxes that were destroyed are left out of the removed events
+    if (box == nullptr)
+    {
+        return;
+    }
+
+    if (box->entity.getEntityID() == -1 || !box->entity.hasComponent<ColliderCom>())
+    {
+        return;
+    }
+
+    auto cc = box->entity.getComponent<ColliderCom>();
+    if (cc->frame != frames)
+    {
+        cc->collisions.clear();
+        cc->frame = frames;
+    }
 }
 
-std::vector<Collision> Flux::Physics::getCollisions(EntityRef entity)
+/**
+Runs GJK on every pair the broad phase found, once a frame.
+Each pair is only tested once, and the result goes to both entities
+*/
+static void runNarrowPhase(BoundingWorld* world)
 {
-    if (!entity.hasComponent<BoundingCom>() || !entity.hasComponent<ColliderCom>())
+    if (world->narrow_phase_frame == frames)
     {
-        return std::vector<Collision>();
+        return;
     }
+    world->narrow_phase_frame = frames;
 
-    auto bc = entity.getComponent<BoundingCom>();
-    auto tc = entity.getComponent<Transform::TransformCom>();
+    auto& cache = world->getPairs();
 
-    bc->collisions = getBoundingBoxCollisions(entity);
-
-    if (bc->collisions.size() < 1 && !tc->has_changed)
+    // Entities that stopped touching something have to lose that collision too
+    for (auto& pair : cache.removed)
     {
-        // No collisions
-        // LOG_INFO("No collisions");
-        
-        return std::vector<Collision>();
+        resetCollisions(pair.a);
+        resetCollisions(pair.b);
     }
 
-    auto cc = entity.getComponent<ColliderCom>();
-
-    if (cc->frame == frames)
+    for (auto& pair : cache.pairs)
     {
-        return cc->collisions;
+        resetCollisions(pair.a);
+        resetCollisions(pair.b);
     }
 
-    bool recalculate = tc->has_changed;
-    for (auto i : bc->collisions)
+    for (auto& pair : cache.pairs)
     {
-        if (i->entity.getEntityID() != -1)
+        auto entity_a = pair.a->entity;
+        auto entity_b = pair.b->entity;
+
+        if (entity_a.getEntityID() == -1 || entity_b.getEntityID() == -1
+            || !entity_a.hasComponent<ColliderCom>() || !entity_b.hasComponent<ColliderCom>())
         {
-            if (i->entity.hasComponent<ColliderCom>())
-            {
-                auto etc = i->entity.getComponent<Transform::TransformCom>();
-                if (etc->has_changed == true)
-                {
-                    recalculate = true;
-                    break;
-                }
-            }
+            continue;
         }
-    }
 
-    if (recalculate)
-    {
-        // Process all the collisions :(
-        auto collisions = std::vector<Collision>();
-        cc->collider->updateTransform(tc->model);
-        // std::cout << bc->collisions.size() << "\n";
+        auto cc_a = entity_a.getComponent<ColliderCom>();
+        auto cc_b = entity_b.getComponent<ColliderCom>();
+        auto tc_a = entity_a.getComponent<Flux::Transform::TransformCom>();
+        auto tc_b = entity_b.getComponent<Flux::Transform::TransformCom>();
 
-        int c = 0;
-        for (auto i : bc->collisions)
+        // Nothing's moved, so it's the same as last time
+        if (!pair.tested || tc_a->has_changed || tc_b->has_changed)
         {
-            if (i->entity.getEntityID() != -1)
-            {
-                if (!i->entity.hasComponent<ColliderCom>())
-                {
-                    // Don't add it
-                }
-                else
-                {
-                    // Actually calculate the collision
-                    // Step 1: update collider's transform
-                    auto ecc = i->entity.getComponent<ColliderCom>();
-                    auto etc = i->entity.getComponent<Transform::TransformCom>();
-                    ecc->collider->updateTransform(etc->model);
+            cc_a->collider->updateTransform(tc_a->model);
+            cc_b->collider->updateTransform(tc_b->model);
 
-                    // Step 2: GJK
-                    auto colliding = GJK::getColliding(cc->collider, ecc->collider);
+            pair.contact = GJK::getColliding(cc_a->collider, cc_b->collider);
+            pair.tested = true;
+        }
 
-                    // Step 3: Profit, or don't profit
-                    if (colliding.colliding)
-                    {
-                        // TODO: Currently offset is in local coordinates
-                        // Which means it doesn't take into account scale
-                        collisions.push_back({colliding.normal, colliding.offset, colliding.depth, colliding.colliding, i->entity});
-                    }
-                }
-            }
-            c++;
+        if (!pair.contact.colliding)
+        {
+            continue;
         }
 
-        cc->collisions = collisions;
-        cc->frame = frames;
-        return cc->collisions;
+        // TODO: Currently offset is in local coordinates
+        // Which means it doesn't take into account scale
+        auto& contact = pair.contact;
+        cc_a->collisions.push_back({contact.normal, contact.offset, contact.depth, true, entity_b});
+
+        // B is pushed the other way, and the offset is moved to be from its origin instead
+        glm::vec3 offset_b = contact.offset + glm::vec3(tc_a->model[3]) - glm::vec3(tc_b->model[3]);
+        cc_b->collisions.push_back({-contact.normal, offset_b, contact.depth, true, entity_a});
     }
-    else
+
+    // Only now that they've been used can the events go. Anything after this is picked up next time
+    cache.clearEvents();
+}
+
+void NarrowPhaseSystem::runSystem(EntityRef entity, float delta)
+{
+    if (!entity.hasComponent<BoundingCom>())
     {
-        return cc->collisions;
+        return;
     }
+
+    auto bc = entity.getComponent<BoundingCom>();
+    if (bc->setup)
+    {
+        runNarrowPhase(bc->world);
+    }
+}
+
+std::vector<Collision> Flux::Physics::getCollisions(EntityRef entity)
+{
+    if (!entity.hasComponent<BoundingCom>() || !entity.hasComponent<ColliderCom>())
+    {
+        return std::vector<Collision>();
+    }
+
+    auto bc = entity.getComponent<BoundingCom>();
+    if (!bc->setup)
+    {
+        return std::vector<Collision>();
+    }
+
+    runNarrowPhase(bc->world);
+
+    auto cc = entity.getComponent<ColliderCom>();
+    return cc->collisions;
 }
 
 std::vector<Collision> Flux::Physics::move(EntityRef entity, const glm::vec3 &position)
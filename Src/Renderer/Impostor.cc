@@ -0,0 +1,390 @@
+#include "Flux/ECS.hh"
+#include "Flux/Log.hh"
+#include "Flux/Renderer.hh"
+#include "Flux/Resources.hh"
+
+#include <glm/glm.hpp>
+
+// STL includes
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <utility>
+#include <vector>
+
+using namespace Flux;
+
+// Lighting baked into the views. It's in model space, so it turns with the object
+#define FLUX_IMPOSTOR_AMBIENT 0.4f
+#define FLUX_IMPOSTOR_LIGHT_DIRECTION glm::vec3(0.3f, 0.8f, 0.5f)
+
+namespace
+{
+    // The part of a texture that the bake reads from
+    struct BakeTexture
+    {
+        const unsigned char* pixels = nullptr;
+        uint32_t width = 0;
+        uint32_t height = 0;
+    };
+
+    // Everything interpolated across a triangle
+    struct BakeVertex
+    {
+        glm::vec2 pos;
+        float depth;
+        glm::vec2 uv;
+        glm::vec3 normal;
+    };
+}
+
+// Finds the pixels of the texture the material is coloured by, if they're still on the cpu
+static BakeTexture findTexture(Renderer::MaterialRes* material)
+{
+    BakeTexture out;
+
+    Resources::ResourceRef<Renderer::TextureRes> texture;
+    std::string name;
+    if (material->has_texture)
+    {
+        texture = material->diffuse_texture;
+    }
+    else if (!material->textures.empty())
+    {
+        texture = material->textures[0].texture;
+        name = material->textures[0].name;
+    }
+    else
+    {
+        return out;
+    }
+
+    auto tex = texture.getPtr();
+    if (tex->image_data == nullptr || tex->format != Renderer::TextureFormat::RGBA8)
+    {
+        // Either the renderer already has it, or it would have to be decompressed
+        return out;
+    }
+
+    uint32_t layer_size = tex->width * tex->height * 4;
+    uint32_t layer = 0;
+    if (tex->layers > 1 && !name.empty())
+    {
+        // Texture arrays say which layer is theirs in a uniform
+        int param = material->findParam(name + "_layer");
+        if (param >= 0 && material->params[param].offset != FLUX_UNUSED_UNIFORM)
+        {
+            int32_t value;
+            std::memcpy(&value, material->block.data() + material->params[param].offset, sizeof(value));
+            layer = std::min((uint32_t)std::max(value, 0), tex->layers - 1);
+        }
+    }
+
+    if ((uint64_t)layer_size * (layer + 1) > tex->image_data_size)
+    {
+        return out;
+    }
+
+    out.pixels = tex->image_data + layer_size * layer;
+    out.width = tex->width;
+    out.height = tex->height;
+    return out;
+}
+
+static glm::vec4 sampleTexture(const BakeTexture& texture, glm::vec2 uv)
+{
+    if (texture.pixels == nullptr)
+    {
+        return glm::vec4(1);
+    }
+
+    // Images are flipped when they're loaded, so the first row is v = 0
+    uv.x -= std::floor(uv.x);
+    uv.y -= std::floor(uv.y);
+    uint32_t x = std::min((uint32_t)(uv.x * texture.width), texture.width - 1);
+    uint32_t y = std::min((uint32_t)(uv.y * texture.height), texture.height - 1);
+
+    auto p = texture.pixels + (x + y * texture.width) * 4;
+    return glm::vec4(p[0], p[1], p[2], p[3]) / 255.0f;
+}
+
+// Draws one triangle into a view. Both sides are drawn, since the depth test sorts it out
+static void bakeTriangle(const BakeVertex* v, const BakeTexture& texture, uint32_t view_size, uint32_t view_x, uint32_t atlas_width, unsigned char* pixels, float* depth)
+{
+    float area = (v[1].pos.x - v[0].pos.x) * (v[2].pos.y - v[0].pos.y) - (v[1].pos.y - v[0].pos.y) * (v[2].pos.x - v[0].pos.x);
+    if (std::abs(area) < 1e-8f)
+    {
+        return;
+    }
+
+    int min_x = std::max((int)std::floor(std::min(v[0].pos.x, std::min(v[1].pos.x, v[2].pos.x))), 0);
+    int max_x = std::min((int)std::ceil(std::max(v[0].pos.x, std::max(v[1].pos.x, v[2].pos.x))), (int)view_size - 1);
+    int min_y = std::max((int)std::floor(std::min(v[0].pos.y, std::min(v[1].pos.y, v[2].pos.y))), 0);
+    int max_y = std::min((int)std::ceil(std::max(v[0].pos.y, std::max(v[1].pos.y, v[2].pos.y))), (int)view_size - 1);
+
+    glm::vec3 light = glm::normalize(FLUX_IMPOSTOR_LIGHT_DIRECTION);
+
+    for (int y = min_y; y <= max_y; y++)
+    {
+        for (int x = min_x; x <= max_x; x++)
+        {
+            // Sample at the middle of the pixel
+            glm::vec2 p = glm::vec2(x + 0.5f, y + 0.5f);
+
+            float w0 = ((v[1].pos.x - p.x) * (v[2].pos.y - p.y) - (v[1].pos.y - p.y) * (v[2].pos.x - p.x)) / area;
+            float w1 = ((v[2].pos.x - p.x) * (v[0].pos.y - p.y) - (v[2].pos.y - p.y) * (v[0].pos.x - p.x)) / area;
+            float w2 = 1 - w0 - w1;
+
+            if (w0 < 0 || w1 < 0 || w2 < 0)
+            {
+                continue;
+            }
+
+            // It's orthographic, so everything is linear
+            float d = w0 * v[0].depth + w1 * v[1].depth + w2 * v[2].depth;
+            uint32_t index = view_x + x + y * atlas_width;
+            if (d <= depth[index])
+            {
+                continue;
+            }
+            depth[index] = d;
+
+            glm::vec2 uv = w0 * v[0].uv + w1 * v[1].uv + w2 * v[2].uv;
+            glm::vec3 normal = w0 * v[0].normal + w1 * v[1].normal + w2 * v[2].normal;
+            float length = glm::length(normal);
+            float lighting = 1;
+            if (length > 0)
+            {
+                lighting = FLUX_IMPOSTOR_AMBIENT + (1 - FLUX_IMPOSTOR_AMBIENT) * std::max(glm::dot(normal / length, light), 0.0f);
+            }
+
+            glm::vec3 color = glm::vec3(sampleTexture(texture, uv)) * lighting;
+
+            auto out = pixels + index * 4;
+            out[0] = (unsigned char)(glm::clamp(color.x, 0.0f, 1.0f) * 255);
+            out[1] = (unsigned char)(glm::clamp(color.y, 0.0f, 1.0f) * 255);
+            out[2] = (unsigned char)(glm::clamp(color.z, 0.0f, 1.0f) * 255);
+            out[3] = 255;
+        }
+    }
+}
+
+// Gives the empty pixels around the edges the colour of their neighbours, so filtering doesn't pull in black
+static void dilateView(unsigned char* pixels, uint32_t view_size, uint32_t view_x, uint32_t atlas_width)
+{
+    std::vector<unsigned char> source(pixels, pixels + atlas_width * view_size * 4);
+
+    for (int y = 0; y < (int)view_size; y++)
+    {
+        for (int x = 0; x < (int)view_size; x++)
+        {
+            uint32_t index = (view_x + x + y * atlas_width) * 4;
+            if (source[index + 3] != 0)
+            {
+                continue;
+            }
+
+            glm::vec3 total = glm::vec3(0);
+            int count = 0;
+            for (int dy = -1; dy <= 1; dy++)
+            {
+                for (int dx = -1; dx <= 1; dx++)
+                {
+                    int nx = x + dx, ny = y + dy;
+
+                    // Don't take colours from the view next door
+                    if (nx < 0 || ny < 0 || nx >= (int)view_size || ny >= (int)view_size)
+                    {
+                        continue;
+                    }
+
+                    uint32_t n = (view_x + nx + ny * atlas_width) * 4;
+                    if (source[n + 3] != 0)
+                    {
+                        total += glm::vec3(source[n], source[n + 1], source[n + 2]);
+                        count ++;
+                    }
+                }
+            }
+
+            if (count > 0)
+            {
+                pixels[index] = (unsigned char)(total.x / count);
+                pixels[index + 1] = (unsigned char)(total.y / count);
+                pixels[index + 2] = (unsigned char)(total.z / count);
+            }
+        }
+    }
+}
+
+bool Renderer::bakeImpostor(ImpostorCom* impostor, MeshRes* mesh, MaterialRes* material, uint32_t views, uint32_t view_size)
+{
+    if (mesh->draw_mode != DrawMode::Triangles || views == 0 || view_size == 0)
+    {
+        return false;
+    }
+
+    if (mesh->vertices == nullptr)
+    {
+        // The bake needs the positions on the cpu
+        mesh->unpack();
+    }
+
+    if (mesh->vertices_length == 0)
+    {
+        return false;
+    }
+
+    // A cylinder around the up axis, so the quad is the same size from every angle
+    glm::vec3 min_pos = glm::vec3(INFINITY);
+    glm::vec3 max_pos = glm::vec3(-INFINITY);
+    for (uint32_t i = 0; i < mesh->vertices_length; i++)
+    {
+        auto& v = mesh->vertices[i];
+        min_pos = glm::min(min_pos, glm::vec3(v.x, v.y, v.z));
+        max_pos = glm::max(max_pos, glm::vec3(v.x, v.y, v.z));
+    }
+
+    glm::vec3 center = (min_pos + max_pos) * 0.5f;
+    float radius = 0;
+    for (uint32_t i = 0; i < mesh->vertices_length; i++)
+    {
+        auto& v = mesh->vertices[i];
+        radius = std::max(radius, glm::length(glm::vec2(v.x - center.x, v.z - center.z)));
+    }
+    float half_height = (max_pos.y - min_pos.y) * 0.5f;
+
+    if (radius <= 0 || half_height <= 0)
+    {
+        // Flat things would be invisible from some angles anyway
+        return false;
+    }
+
+    BakeTexture texture = findTexture(material);
+
+    uint32_t atlas_width = views * view_size;
+    auto atlas = new TextureRes;
+    atlas->internal = true;
+    atlas->width = atlas_width;
+    atlas->height = view_size;
+    atlas->image_data_size = atlas_width * view_size * 4;
+    atlas->image_data = new unsigned char[atlas->image_data_size];
+    std::memset(atlas->image_data, 0, atlas->image_data_size);
+
+    std::vector<float> depth(atlas_width * view_size, -INFINITY);
+    std::vector<BakeVertex> projected(mesh->vertices_length);
+
+    for (uint32_t view = 0; view < views; view++)
+    {
+        // The camera looks at the middle from this direction. It has to match the impostor shader
+        float angle = 6.2831853f * view / views;
+        glm::vec3 forward = glm::vec3(std::sin(angle), 0, std::cos(angle));
+        glm::vec3 right = glm::vec3(std::cos(angle), 0, -std::sin(angle));
+
+        for (uint32_t i = 0; i < mesh->vertices_length; i++)
+        {
+            auto& v = mesh->vertices[i];
+            glm::vec3 offset = glm::vec3(v.x, v.y, v.z) - center;
+
+            auto& p = projected[i];
+            p.pos.x = (glm::dot(offset, right) / radius * 0.5f + 0.5f) * view_size;
+            p.pos.y = (offset.y / half_height * 0.5f + 0.5f) * view_size;
+            p.depth = glm::dot(offset, forward);
+            p.uv = glm::vec2(v.tx, v.ty);
+            p.normal = glm::vec3(v.nx, v.ny, v.nz);
+        }
+
+        for (uint32_t i = 0; i + 2 < mesh->indices_length; i += 3)
+        {
+            BakeVertex triangle[3] = {projected[mesh->indices[i]], projected[mesh->indices[i + 1]], projected[mesh->indices[i + 2]]};
+            bakeTriangle(triangle, texture, view_size, view * view_size, atlas_width, atlas->image_data, depth.data());
+        }
+
+        dilateView(atlas->image_data, view_size, view * view_size, atlas_width);
+    }
+
+    impostor->atlas = Resources::createResource(atlas);
+    impostor->views = views;
+    impostor->center = center;
+    impostor->radius = radius;
+    impostor->half_height = half_height;
+    impostor->showing = false;
+
+    return true;
+}
+
+void Renderer::buildImpostors(const std::vector<EntityRef>& entities)
+{
+    // Mesh, then material
+    std::map<std::pair<int, int>, ImpostorCom*> baked;
+    int count = 0;
+
+    for (auto entity : entities)
+    {
+        if (!entity.hasComponent<ImpostorCom>() || !entity.hasComponent<MeshCom>())
+        {
+            continue;
+        }
+
+        auto impostor = entity.getComponent<ImpostorCom>();
+        if (impostor->views != 0)
+        {
+            // Already done
+            continue;
+        }
+
+        auto mc = entity.getComponent<MeshCom>();
+        auto key = std::make_pair(mc->mesh_resource.getBaseEntity().getEntityID(), mc->mat_resource.getBaseEntity().getEntityID());
+
+        auto it = baked.find(key);
+        if (it != baked.end())
+        {
+            // Same picture, so it can share the atlas
+            impostor->atlas = it->second->atlas;
+            impostor->views = it->second->views;
+            impostor->center = it->second->center;
+            impostor->radius = it->second->radius;
+            impostor->half_height = it->second->half_height;
+            continue;
+        }
+
+        if (!bakeImpostor(impostor, mc->mesh_resource.getPtr(), mc->mat_resource.getPtr()))
+        {
+            LOG_WARN("Could not bake impostor");
+            continue;
+        }
+
+        baked[key] = impostor;
+        count ++;
+    }
+
+    if (count > 0)
+    {
+        LOG_INFO("Baked " + std::to_string(count) + " impostors");
+    }
+}
+
+bool Renderer::selectImpostor(ImpostorCom* impostor, MeshRes* mesh, float distance, float scale, float projection_scale, float screen_height)
+{
+    if (impostor->views == 0)
+    {
+        return false;
+    }
+
+    // The least detailed level has to be good enough first
+    int last_lod = mesh->lods.size();
+    if (last_lod > 0 && selectLOD(mesh, last_lod, distance, scale, projection_scale, screen_height) != last_lod)
+    {
+        impostor->showing = false;
+        return false;
+    }
+
+    float pixels = impostor->half_height * 2 * scale * projection_scale * screen_height * 0.5f / std::max(distance, 0.0001f);
+
+    // Once it's showing, it has to get a bit bigger before going back
+    float limit = impostor->showing ? FLUX_IMPOSTOR_PIXELS : FLUX_IMPOSTOR_PIXELS * (1 - FLUX_LOD_HYSTERESIS);
+    impostor->showing = pixels < limit;
+
+    return impostor->showing;
+}
@@ -0,0 +1,643 @@
+#include "Flux/Log.hh"
+#include "Flux/Renderer.hh"
+
+#include <glm/glm.hpp>
+
+// STL includes
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+using namespace Flux;
+
+/** Size of the simulated vertex cache used for optimizing */
+#ifndef FLUX_VERTEX_CACHE_SIZE
+#define FLUX_VERTEX_CACHE_SIZE 32
+#endif
+
+/** Size of the FIFO cache used to find cluster boundaries for overdraw optimization */
+#ifndef FLUX_OVERDRAW_CACHE_SIZE
+#define FLUX_OVERDRAW_CACHE_SIZE 16
+#endif
+
+// Most of the optimizations need the real vertices, and need to re-pack them after
+static bool prepareMesh(Renderer::MeshRes* mesh)
+{
+    if (mesh->draw_mode != Renderer::DrawMode::Triangles)
+    {
+        LOG_WARN("Only triangle meshes can be optimized");
+        return false;
+    }
+
+    mesh->unpack();
+    return mesh->vertices != nullptr;
+}
+
+static void finishMesh(Renderer::MeshRes* mesh)
+{
+    if (mesh->packed_vertices != nullptr)
+    {
+        mesh->pack(mesh->vertex_format);
+    }
+}
+
+// =========================================================
+// Welding
+// =========================================================
+
+/** Vertex that has been snapped to a grid, so it can be hashed. The last two are the skin, if there is one */
+struct WeldKey
+{
+    int64_t values[16];
+
+    bool operator==(const WeldKey& other) const
+    {
+        return std::memcmp(values, other.values, sizeof(values)) == 0;
+    }
+};
+
+struct WeldKeyHash
+{
+    size_t operator()(const WeldKey& key) const
+    {
+        // FNV-1a
+        uint64_t hash = 14695981039346656037ULL;
+        auto bytes = (const unsigned char*)key.values;
+        for (int i = 0; i < sizeof(key.values); i++)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+
+        return hash;
+    }
+};
+
+uint32_t Renderer::weldVertices(Resources::ResourceRef<MeshRes> mesh_ref, float epsilon)
+{
+    auto mesh = mesh_ref.getPtr();
+    mesh->unpack();
+    if (mesh->vertices == nullptr)
+    {
+        return 0;
+    }
+
+    std::unordered_map<WeldKey, uint32_t, WeldKeyHash> unique;
+    unique.reserve(mesh->vertices_length);
+
+    std::vector<uint32_t> remap(mesh->vertices_length);
+    std::vector<Vertex> new_vertices;
+    new_vertices.reserve(mesh->vertices_length);
+    std::vector<VertexSkin> new_skin;
+
+    for (int i = 0; i < mesh->vertices_length; i++)
+    {
+        // Vertex is just 14 floats
+        float values[14];
+        std::memcpy(values, &mesh->vertices[i], sizeof(values));
+
+        WeldKey key;
+        for (int j = 0; j < 14; j++)
+        {
+            if (epsilon > 0)
+            {
+                key.values[j] = (int64_t)std::round(values[j] / epsilon);
+            }
+            else
+            {
+                // -0 and 0 should still be the same
+                float v = values[j] == 0 ? 0.0f : values[j];
+                uint32_t bits;
+                std::memcpy(&bits, &v, sizeof(bits));
+                key.values[j] = bits;
+            }
+        }
+
+        // Vertices in the same place that follow different bones have to stay apart
+        key.values[14] = 0;
+        key.values[15] = 0;
+        if (!mesh->skin.empty())
+        {
+            uint32_t bones, weights;
+            std::memcpy(&bones, mesh->skin[i].bones, sizeof(bones));
+            std::memcpy(&weights, mesh->skin[i].weights, sizeof(weights));
+            key.values[14] = bones;
+            key.values[15] = weights;
+        }
+
+        auto it = unique.find(key);
+        if (it != unique.end())
+        {
+            remap[i] = it->second;
+        }
+        else
+        {
+            remap[i] = new_vertices.size();
+            unique[key] = new_vertices.size();
+            new_vertices.push_back(mesh->vertices[i]);
+
+            if (!mesh->skin.empty())
+            {
+                new_skin.push_back(mesh->skin[i]);
+            }
+        }
+    }
+
+    uint32_t removed = mesh->vertices_length - new_vertices.size();
+    if (removed == 0)
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < mesh->indices_length; i++)
+    {
+        mesh->indices[i] = remap[mesh->indices[i]];
+    }
+
+    for (auto& lod : mesh->lods)
+    {
+        for (auto& index : lod.indices)
+        {
+            index = remap[index];
+        }
+    }
+
+    delete[] mesh->vertices;
+    mesh->vertices_length = new_vertices.size();
+    mesh->vertices = new Vertex[mesh->vertices_length];
+    std::memcpy(mesh->vertices, new_vertices.data(), sizeof(Vertex) * mesh->vertices_length);
+
+    if (!mesh->skin.empty())
+    {
+        mesh->skin = std::move(new_skin);
+    }
+
+    finishMesh(mesh);
+    return removed;
+}
+
+// =========================================================
+// Vertex Cache
+// =========================================================
+
+// Scoring constants from Tom Forsyth's article
+static const float cache_decay_power = 1.5f;
+static const float last_triangle_score = 0.75f;
+static const float valence_boost_scale = 2.0f;
+static const float valence_boost_power = 0.5f;
+
+static float vertexScore(int cache_position, int remaining_triangles)
+{
+    if (remaining_triangles == 0)
+    {
+        // Not used anymore
+        return -1.0f;
+    }
+
+    float score = 0;
+    if (cache_position >= 0)
+    {
+        if (cache_position < 3)
+        {
+            // The vertices of the last triangle get a fixed score,
+            // so the next triangle doesn't just use the same edge
+            score = last_triangle_score;
+        }
+        else
+        {
+            float scaler = 1.0f / (FLUX_VERTEX_CACHE_SIZE - 3);
+            score = std::pow(1.0f - (cache_position - 3) * scaler, cache_decay_power);
+        }
+    }
+
+    // Boost vertices with only a few triangles left, to get rid of lone triangles
+    score += valence_boost_scale * std::pow((float)remaining_triangles, -valence_boost_power);
+    return score;
+}
+
+void Renderer::optimizeVertexCache(Resources::ResourceRef<MeshRes> mesh_ref)
+{
+    auto mesh = mesh_ref.getPtr();
+    if (!prepareMesh(mesh))
+    {
+        return;
+    }
+
+    // The triangles are about to move, so the meshlets won't match any more
+    mesh->meshlets.clear();
+    optimizeVertexCache(mesh->indices, mesh->indices_length, mesh->vertices_length);
+
+    for (auto& lod : mesh->lods)
+    {
+        optimizeVertexCache(lod.indices.data(), lod.indices.size(), mesh->vertices_length);
+    }
+}
+
+void Renderer::optimizeVertexCache(uint32_t* indices, uint32_t indices_length, uint32_t vertices_length)
+{
+    uint32_t triangle_count = indices_length / 3;
+    uint32_t vertex_count = vertices_length;
+    if (triangle_count == 0)
+    {
+        return;
+    }
+
+    // Build triangle adjacency for every vertex
+    std::vector<uint32_t> adjacency_offsets(vertex_count + 1, 0);
+    for (int i = 0; i < triangle_count * 3; i++)
+    {
+        adjacency_offsets[indices[i] + 1]++;
+    }
+
+    for (int i = 0; i < vertex_count; i++)
+    {
+        adjacency_offsets[i + 1] += adjacency_offsets[i];
+    }
+
+    std::vector<uint32_t> adjacency(triangle_count * 3);
+    std::vector<uint32_t> adjacency_fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+    for (int i = 0; i < triangle_count * 3; i++)
+    {
+        adjacency[adjacency_fill[indices[i]]++] = i / 3;
+    }
+
+    // Per-vertex state
+    std::vector<int> remaining(vertex_count);
+    std::vector<int> cache_position(vertex_count, -1);
+    std::vector<float> vertex_scores(vertex_count);
+
+    for (int i = 0; i < vertex_count; i++)
+    {
+        remaining[i] = adjacency_offsets[i + 1] - adjacency_offsets[i];
+        vertex_scores[i] = vertexScore(-1, remaining[i]);
+    }
+
+    // Per-triangle state
+    std::vector<float> triangle_scores(triangle_count);
+    std::vector<bool> emitted(triangle_count, false);
+
+    for (int i = 0; i < triangle_count; i++)
+    {
+        triangle_scores[i] = vertex_scores[indices[i * 3]] + vertex_scores[indices[i * 3 + 1]] + vertex_scores[indices[i * 3 + 2]];
+    }
+
+    // The cache has 3 extra slots for the vertices that get pushed out by the newest triangle
+    std::vector<uint32_t> cache;
+    cache.reserve(FLUX_VERTEX_CACHE_SIZE + 3);
+
+    std::vector<uint32_t> new_indices;
+    new_indices.reserve(triangle_count * 3);
+
+    int best_triangle = -1;
+    uint32_t scan_cursor = 0;
+
+    for (int t = 0; t < triangle_count; t++)
+    {
+        if (best_triangle == -1)
+        {
+            // Nothing in the cache is useful, so just find the best triangle left
+            float best_score = -1;
+            for (int i = scan_cursor; i < triangle_count; i++)
+            {
+                if (!emitted[i] && triangle_scores[i] > best_score)
+                {
+                    best_score = triangle_scores[i];
+                    best_triangle = i;
+                }
+            }
+
+            // Everything before this has been emitted
+            while (scan_cursor < triangle_count && emitted[scan_cursor])
+            {
+                scan_cursor++;
+            }
+        }
+
+        // Emit it
+        emitted[best_triangle] = true;
+        uint32_t* tri = &indices[best_triangle * 3];
+
+        for (int i = 0; i < 3; i++)
+        {
+            uint32_t v = tri[i];
+            new_indices.push_back(v);
+
+            // Remove this triangle from the vertex's adjacency
+            auto begin = adjacency.begin() + adjacency_offsets[v];
+            auto end = begin + remaining[v];
+            auto it = std::find(begin, end, best_triangle);
+            std::iter_swap(it, end - 1);
+            remaining[v]--;
+
+            // Move to the front of the cache
+            auto cached = std::find(cache.begin(), cache.end(), v);
+            if (cached != cache.end())
+            {
+                cache.erase(cached);
+            }
+            cache.insert(cache.begin(), v);
+        }
+
+        // Update scores of everything in the cache, including the vertices that just got kicked out
+        for (int i = 0; i < cache.size(); i++)
+        {
+            uint32_t v = cache[i];
+            cache_position[v] = i < FLUX_VERTEX_CACHE_SIZE ? i : -1;
+        }
+
+        best_triangle = -1;
+        float best_score = -1;
+
+        for (int i = 0; i < cache.size(); i++)
+        {
+            uint32_t v = cache[i];
+            float new_score = vertexScore(cache_position[v], remaining[v]);
+            float diff = new_score - vertex_scores[v];
+            vertex_scores[v] = new_score;
+
+            for (int j = 0; j < remaining[v]; j++)
+            {
+                uint32_t triangle = adjacency[adjacency_offsets[v] + j];
+                triangle_scores[triangle] += diff;
+
+                if (triangle_scores[triangle] > best_score)
+                {
+                    best_score = triangle_scores[triangle];
+                    best_triangle = triangle;
+                }
+            }
+        }
+
+        if (cache.size() > FLUX_VERTEX_CACHE_SIZE)
+        {
+            cache.resize(FLUX_VERTEX_CACHE_SIZE);
+        }
+    }
+
+    // Keep any leftover indices that don't make a full triangle
+    std::copy(new_indices.begin(), new_indices.end(), indices);
+}
+
+// =========================================================
+// Overdraw
+// =========================================================
+
+// Simulates a FIFO cache, and returns the number of misses for the given triangle
+static int simulateTriangle(std::vector<int>& cache_timestamps, int& timestamp, const uint32_t* tri)
+{
+    int misses = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        if (timestamp - cache_timestamps[tri[i]] > FLUX_OVERDRAW_CACHE_SIZE)
+        {
+            cache_timestamps[tri[i]] = timestamp++;
+            misses++;
+        }
+    }
+
+    return misses;
+}
+
+void Renderer::optimizeOverdraw(Resources::ResourceRef<MeshRes> mesh_ref, float threshold)
+{
+    // This is based on "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw" (Sander et al.)
+    auto mesh = mesh_ref.getPtr();
+    if (!prepareMesh(mesh))
+    {
+        return;
+    }
+
+    uint32_t triangle_count = mesh->indices_length / 3;
+    if (triangle_count == 0)
+    {
+        return;
+    }
+
+    // Same as optimizeVertexCache, the meshlets won't match once the triangles move
+    mesh->meshlets.clear();
+
+    // Hard boundaries: triangles where the cache starts again from scratch
+    std::vector<uint32_t> clusters;
+    {
+        std::vector<int> cache_timestamps(mesh->vertices_length, -FLUX_OVERDRAW_CACHE_SIZE - 1);
+        int timestamp = 0;
+
+        for (int i = 0; i < triangle_count; i++)
+        {
+            if (simulateTriangle(cache_timestamps, timestamp, &mesh->indices[i * 3]) == 3)
+            {
+                clusters.push_back(i);
+            }
+        }
+
+        if (clusters.empty() || clusters[0] != 0)
+        {
+            clusters.insert(clusters.begin(), 0);
+        }
+    }
+
+    // Soft boundaries: split clusters more, as long as the cache doesn't get too much worse
+    std::vector<uint32_t> soft_clusters;
+    {
+        std::vector<int> cache_timestamps(mesh->vertices_length, -FLUX_OVERDRAW_CACHE_SIZE - 1);
+        int timestamp = 0;
+
+        for (int c = 0; c < clusters.size(); c++)
+        {
+            uint32_t start = clusters[c];
+            uint32_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangle_count;
+
+            // How good the cache is for the entire cluster, starting from an empty cache
+            timestamp += FLUX_OVERDRAW_CACHE_SIZE + 1;
+            int cluster_misses = 0;
+            for (int i = start; i < end; i++)
+            {
+                cluster_misses += simulateTriangle(cache_timestamps, timestamp, &mesh->indices[i * 3]);
+            }
+            float cluster_acmr = (float)cluster_misses / (end - start);
+
+            // Start again, and split whenever we're doing well enough
+            timestamp += FLUX_OVERDRAW_CACHE_SIZE + 1;
+            soft_clusters.push_back(start);
+
+            int misses = 0;
+            uint32_t cluster_start = start;
+            for (int i = start; i < end; i++)
+            {
+                misses += simulateTriangle(cache_timestamps, timestamp, &mesh->indices[i * 3]);
+                float acmr = (float)misses / (i - cluster_start + 1);
+
+                if (i + 1 < end && acmr <= cluster_acmr * threshold)
+                {
+                    // Good spot to split
+                    soft_clusters.push_back(i + 1);
+                    cluster_start = i + 1;
+                    misses = 0;
+
+                    // Splitting means the cache gets flushed
+                    timestamp += FLUX_OVERDRAW_CACHE_SIZE + 1;
+                }
+            }
+        }
+    }
+
+    // Find the middle of the mesh
+    glm::vec3 mesh_centroid(0);
+    for (int i = 0; i < mesh->vertices_length; i++)
+    {
+        mesh_centroid = mesh_centroid + glm::vec3(mesh->vertices[i].x, mesh->vertices[i].y, mesh->vertices[i].z);
+    }
+    mesh_centroid = mesh_centroid / (float)std::max(mesh->vertices_length, (uint32_t)1);
+
+    // Sort clusters by how much they face outwards
+    std::vector<std::pair<float, uint32_t>> sort_data;
+    sort_data.reserve(soft_clusters.size());
+
+    for (int c = 0; c < soft_clusters.size(); c++)
+    {
+        uint32_t start = soft_clusters[c];
+        uint32_t end = c + 1 < soft_clusters.size() ? soft_clusters[c + 1] : triangle_count;
+
+        glm::vec3 centroid(0);
+        glm::vec3 normal(0);
+        float area = 0;
+
+        for (int i = start; i < end; i++)
+        {
+            auto& a = mesh->vertices[mesh->indices[i * 3]];
+            auto& b = mesh->vertices[mesh->indices[i * 3 + 1]];
+            auto& v = mesh->vertices[mesh->indices[i * 3 + 2]];
+
+            auto p0 = glm::vec3(a.x, a.y, a.z);
+            auto p1 = glm::vec3(b.x, b.y, b.z);
+            auto p2 = glm::vec3(v.x, v.y, v.z);
+
+            // Cross product is area weighted
+            auto n = glm::cross(p1 - p0, p2 - p0);
+            float tri_area = glm::length(n);
+
+            centroid = centroid + (p0 + p1 + p2) * (tri_area / 3.0f);
+            normal = normal + n;
+            area += tri_area;
+        }
+
+        if (area > 0)
+        {
+            centroid = centroid / area;
+        }
+
+        float normal_length = glm::length(normal);
+        if (normal_length > 0)
+        {
+            normal = normal / normal_length;
+        }
+
+        sort_data.push_back({glm::dot(centroid - mesh_centroid, normal), c});
+    }
+
+    std::stable_sort(sort_data.begin(), sort_data.end(), [](const std::pair<float, uint32_t>& a, const std::pair<float, uint32_t>& b) {
+        return a.first > b.first;
+    });
+
+    // Rebuild the index buffer in the new order
+    std::vector<uint32_t> new_indices;
+    new_indices.reserve(mesh->indices_length);
+
+    for (auto i : sort_data)
+    {
+        uint32_t c = i.second;
+        uint32_t start = soft_clusters[c];
+        uint32_t end = c + 1 < soft_clusters.size() ? soft_clusters[c + 1] : triangle_count;
+
+        new_indices.insert(new_indices.end(), mesh->indices + (start * 3), mesh->indices + (end * 3));
+    }
+
+    std::copy(new_indices.begin(), new_indices.end(), mesh->indices);
+}
+
+// =========================================================
+// Vertex Fetch
+// =========================================================
+
+void Renderer::optimizeVertexFetch(Resources::ResourceRef<MeshRes> mesh_ref)
+{
+    auto mesh = mesh_ref.getPtr();
+    mesh->unpack();
+    if (mesh->vertices == nullptr)
+    {
+        return;
+    }
+
+    std::vector<uint32_t> remap(mesh->vertices_length, UINT32_MAX);
+    auto new_vertices = new Vertex[mesh->vertices_length];
+    std::vector<VertexSkin> new_skin(mesh->skin.size());
+    uint32_t next_vertex = 0;
+
+    // Vertices go in the order they are first used
+    for (int i = 0; i < mesh->indices_length; i++)
+    {
+        uint32_t v = mesh->indices[i];
+        if (remap[v] == UINT32_MAX)
+        {
+            remap[v] = next_vertex;
+            new_vertices[next_vertex] = mesh->vertices[v];
+            if (!mesh->skin.empty())
+            {
+                new_skin[next_vertex] = mesh->skin[v];
+            }
+
+            next_vertex++;
+        }
+
+        mesh->indices[i] = remap[v];
+    }
+
+    // LODs only use vertices from the full mesh, so they've all been remapped already
+    for (auto& lod : mesh->lods)
+    {
+        for (auto& index : lod.indices)
+        {
+            index = remap[index];
+        }
+    }
+
+    // Unused vertices get dropped
+    delete[] mesh->vertices;
+    mesh->vertices = new_vertices;
+    mesh->vertices_length = next_vertex;
+
+    if (!mesh->skin.empty())
+    {
+        new_skin.resize(next_vertex);
+        mesh->skin = std::move(new_skin);
+    }
+
+    finishMesh(mesh);
+}
+
+void Renderer::optimizeMesh(Resources::ResourceRef<MeshRes> mesh)
+{
+    if (mesh->draw_mode != DrawMode::Triangles)
+    {
+        // Lines don't have much to optimize
+        return;
+    }
+
+    auto old_vertices = mesh->vertices_length;
+
+    weldVertices(mesh);
+    optimizeVertexCache(mesh);
+    optimizeOverdraw(mesh);
+    optimizeVertexFetch(mesh);
+
+    // Big meshes are split up, so the renderer doesn't have to draw all of it when only a corner is on screen.
+    // Skinned meshes move around, so their meshlet bounds would be wrong
+    if (mesh->skin.empty() && mesh->indices_length / 3 >= FLUX_MESHLET_MIN_TRIANGLES)
+    {
+        buildMeshlets(mesh);
+    }
+
+    LOG_INFO("Optimized mesh: " + std::to_string(old_vertices) + " -> " + std::to_string(mesh->vertices_length) + " vertices");
+}
@@ -0,0 +1,426 @@
+#include "Flux/Log.hh"
+#include "Flux/Renderer.hh"
+
+#include <glm/glm.hpp>
+
+// STL includes
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+using namespace Flux;
+
+/**
+Symmetric 4x4 matrix for quadric error metrics.
+See "Surface Simplification Using Quadric Error Metrics" (Garland and Heckbert)
+*/
+struct Quadric
+{
+    double a00, a01, a02, a03;
+    double a11, a12, a13;
+    double a22, a23;
+    double a33;
+
+    void add(const Quadric& other)
+    {
+        a00 += other.a00; a01 += other.a01; a02 += other.a02; a03 += other.a03;
+        a11 += other.a11; a12 += other.a12; a13 += other.a13;
+        a22 += other.a22; a23 += other.a23;
+        a33 += other.a33;
+    }
+
+    /** Sum of the squared distances from the point to all the planes */
+    double evaluate(const glm::vec3& p) const
+    {
+        double x = p.x, y = p.y, z = p.z;
+        return a00*x*x + 2*a01*x*y + 2*a02*x*z + 2*a03*x
+             + a11*y*y + 2*a12*y*z + 2*a13*y
+             + a22*z*z + 2*a23*z
+             + a33;
+    }
+};
+
+static Quadric planeQuadric(const glm::vec3& normal, float d)
+{
+    double a = normal.x, b = normal.y, c = normal.z;
+    return Quadric {
+        a*a, a*b, a*c, a*d,
+        b*b, b*c, b*d,
+        c*c, c*d,
+        (double)d*d
+    };
+}
+
+/** A possible collapse of vertex `from` into vertex `to` */
+struct Collapse
+{
+    uint32_t from;
+    uint32_t to;
+    double cost;
+};
+
+static uint64_t positionKey(const Renderer::Vertex& v, uint32_t* bits)
+{
+    std::memcpy(&bits[0], &v.x, sizeof(float));
+    std::memcpy(&bits[1], &v.y, sizeof(float));
+    std::memcpy(&bits[2], &v.z, sizeof(float));
+
+    // FNV-1a, just for the hash map
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < 3; i++)
+    {
+        hash ^= bits[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static glm::vec3 getPosition(const Renderer::Vertex* vertices, uint32_t index)
+{
+    return glm::vec3(vertices[index].x, vertices[index].y, vertices[index].z);
+}
+
+/**
+Simplifies the indices down to about target_triangles, without moving any vertices.
+Vertices on seams (where there's more than one vertex in the same place) and borders are never moved,
+so UVs and the outline of the mesh stay intact.
+Returns the biggest error of any collapse
+*/
+static float simplifyIndices(const Renderer::Vertex* vertices, uint32_t vertex_count, std::vector<uint32_t>& indices, uint32_t target_triangles, float max_error)
+{
+    // Find vertices that share a position
+    std::vector<uint32_t> group(vertex_count);
+    std::vector<uint32_t> group_size(vertex_count, 0);
+    {
+        std::unordered_multimap<uint64_t, uint32_t> positions;
+        positions.reserve(vertex_count);
+
+        for (uint32_t i = 0; i < vertex_count; i++)
+        {
+            uint32_t bits[3], other_bits[3];
+            auto key = positionKey(vertices[i], bits);
+
+            group[i] = i;
+            auto range = positions.equal_range(key);
+            for (auto it = range.first; it != range.second; it++)
+            {
+                positionKey(vertices[it->second], other_bits);
+                if (std::memcmp(bits, other_bits, sizeof(bits)) == 0)
+                {
+                    group[i] = it->second;
+                    break;
+                }
+            }
+
+            if (group[i] == i)
+            {
+                positions.insert({key, i});
+            }
+
+            group_size[group[i]]++;
+        }
+    }
+
+    // Lock the vertices on the border of the mesh
+    // A border edge is one that doesn't have a matching edge going the other way
+    std::vector<bool> locked(vertex_count, false);
+    {
+        std::unordered_map<uint64_t, int> edges;
+        edges.reserve(indices.size());
+
+        for (int i = 0; i < indices.size(); i++)
+        {
+            uint32_t a = group[indices[i]];
+            uint32_t b = group[indices[i - (i % 3) + ((i + 1) % 3)]];
+            edges[((uint64_t)a << 32) | b]++;
+        }
+
+        for (auto& edge : edges)
+        {
+            uint32_t a = edge.first >> 32;
+            uint32_t b = edge.first & 0xFFFFFFFF;
+
+            if (edges.find(((uint64_t)b << 32) | a) == edges.end())
+            {
+                locked[a] = true;
+                locked[b] = true;
+            }
+        }
+    }
+
+    // Build quadrics from all the triangle planes
+    std::vector<Quadric> quadrics(vertex_count, Quadric {0, 0, 0, 0, 0, 0, 0, 0, 0, 0});
+    for (int i = 0; i + 2 < indices.size(); i += 3)
+    {
+        auto p0 = getPosition(vertices, indices[i]);
+        auto p1 = getPosition(vertices, indices[i + 1]);
+        auto p2 = getPosition(vertices, indices[i + 2]);
+
+        auto normal = glm::cross(p1 - p0, p2 - p0);
+        float length = glm::length(normal);
+        if (length == 0)
+        {
+            continue;
+        }
+
+        normal = normal / length;
+        auto q = planeQuadric(normal, -glm::dot(normal, p0));
+
+        quadrics[group[indices[i]]].add(q);
+        quadrics[group[indices[i + 1]]].add(q);
+        quadrics[group[indices[i + 2]]].add(q);
+    }
+
+    auto can_collapse = [&](uint32_t v) {
+        return group_size[group[v]] == 1 && !locked[group[v]];
+    };
+
+    double max_cost = (double)max_error * max_error;
+    double worst_cost = 0;
+    uint32_t triangle_count = indices.size() / 3;
+
+    std::vector<uint32_t> adjacency_offsets, adjacency;
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> remap(vertex_count);
+    std::vector<bool> touched(vertex_count);
+
+    while (triangle_count > target_triangles)
+    {
+        // Which triangles use each vertex
+        adjacency_offsets.assign(vertex_count + 1, 0);
+        for (auto index : indices)
+        {
+            adjacency_offsets[index + 1]++;
+        }
+
+        for (int i = 0; i < vertex_count; i++)
+        {
+            adjacency_offsets[i + 1] += adjacency_offsets[i];
+        }
+
+        adjacency.resize(indices.size());
+        std::vector<uint32_t> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+        for (int i = 0; i < indices.size(); i++)
+        {
+            adjacency[fill[indices[i]]++] = i / 3;
+        }
+
+        // Find every possible collapse
+        collapses.clear();
+        for (int i = 0; i < indices.size(); i++)
+        {
+            uint32_t from = indices[i];
+            uint32_t to = indices[i - (i % 3) + ((i + 1) % 3)];
+
+            // Try both directions
+            for (int j = 0; j < 2; j++)
+            {
+                if (can_collapse(from))
+                {
+                    Quadric q = quadrics[group[from]];
+                    q.add(quadrics[group[to]]);
+                    collapses.push_back({from, to, q.evaluate(getPosition(vertices, to))});
+                }
+
+                std::swap(from, to);
+            }
+        }
+
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) {
+            return a.cost < b.cost;
+        });
+
+        // Do as many collapses as we can, without any of them overlapping
+        for (int i = 0; i < vertex_count; i++)
+        {
+            remap[i] = i;
+        }
+        std::fill(touched.begin(), touched.end(), false);
+
+        int collapsed = 0;
+        for (auto& collapse : collapses)
+        {
+            if (collapse.cost > max_cost || triangle_count <= target_triangles)
+            {
+                break;
+            }
+
+            if (touched[collapse.from] || touched[collapse.to])
+            {
+                continue;
+            }
+
+            // Make sure no triangles get flipped
+            bool flips = false;
+            uint32_t removed = 0;
+            auto to_pos = getPosition(vertices, collapse.to);
+
+            for (int j = adjacency_offsets[collapse.from]; j < adjacency_offsets[collapse.from + 1]; j++)
+            {
+                uint32_t* tri = &indices[adjacency[j] * 3];
+                if (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to)
+                {
+                    // This one just disappears
+                    removed++;
+                    continue;
+                }
+
+                glm::vec3 p[3], new_p[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    p[k] = getPosition(vertices, tri[k]);
+                    new_p[k] = tri[k] == collapse.from ? to_pos : p[k];
+                }
+
+                auto old_normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+                auto new_normal = glm::cross(new_p[1] - new_p[0], new_p[2] - new_p[0]);
+
+                if (glm::dot(old_normal, new_normal) <= 0)
+                {
+                    flips = true;
+                    break;
+                }
+            }
+
+            if (flips)
+            {
+                continue;
+            }
+
+            remap[collapse.from] = collapse.to;
+            quadrics[group[collapse.to]].add(quadrics[group[collapse.from]]);
+
+            // Everything around the collapse has changed, so leave it for the next pass
+            for (int j = adjacency_offsets[collapse.from]; j < adjacency_offsets[collapse.from + 1]; j++)
+            {
+                uint32_t* tri = &indices[adjacency[j] * 3];
+                touched[tri[0]] = true;
+                touched[tri[1]] = true;
+                touched[tri[2]] = true;
+            }
+
+            triangle_count -= removed;
+            worst_cost = std::max(worst_cost, collapse.cost);
+            collapsed++;
+        }
+
+        if (collapsed == 0)
+        {
+            // Can't go any further
+            break;
+        }
+
+        // Apply the collapses, and get rid of the triangles that don't exist anymore
+        uint32_t write = 0;
+        for (int i = 0; i + 2 < indices.size(); i += 3)
+        {
+            uint32_t a = remap[indices[i]];
+            uint32_t b = remap[indices[i + 1]];
+            uint32_t c = remap[indices[i + 2]];
+
+            if (group[a] == group[b] || group[b] == group[c] || group[a] == group[c])
+            {
+                continue;
+            }
+
+            indices[write++] = a;
+            indices[write++] = b;
+            indices[write++] = c;
+        }
+
+        indices.resize(write);
+        triangle_count = write / 3;
+    }
+
+    return std::sqrt(worst_cost);
+}
+
+void Renderer::generateLODs(Resources::ResourceRef<MeshRes> mesh_ref, int max_levels, float reduction, float max_error)
+{
+    auto mesh = mesh_ref.getPtr();
+    if (mesh->draw_mode != DrawMode::Triangles)
+    {
+        LOG_WARN("Only triangle meshes can have levels of detail");
+        return;
+    }
+
+    mesh->unpack();
+    if (mesh->vertices == nullptr || mesh->indices_length < 3)
+    {
+        return;
+    }
+
+    // Errors are relative to the size of the mesh
+    glm::vec3 min_pos = getPosition(mesh->vertices, 0);
+    glm::vec3 max_pos = min_pos;
+    for (int i = 1; i < mesh->vertices_length; i++)
+    {
+        min_pos = glm::min(min_pos, getPosition(mesh->vertices, i));
+        max_pos = glm::max(max_pos, getPosition(mesh->vertices, i));
+    }
+    float size = glm::length(max_pos - min_pos) * 0.5f;
+
+    mesh->lods.clear();
+
+    std::vector<uint32_t> current(mesh->indices, mesh->indices + mesh->indices_length - (mesh->indices_length % 3));
+    float total_error = 0;
+
+    for (int level = 0; level < max_levels; level++)
+    {
+        uint32_t current_triangles = current.size() / 3;
+        uint32_t target = current_triangles * reduction;
+
+        auto simplified = current;
+        float error = simplifyIndices(mesh->vertices, mesh->vertices_length, simplified, target, max_error * size);
+
+        if (simplified.size() / 3 > current_triangles * 0.9f)
+        {
+            // Not worth having another level
+            break;
+        }
+
+        // Each level is simplified from the one before it, so the errors add up
+        total_error += error;
+
+        optimizeVertexCache(simplified.data(), simplified.size(), mesh->vertices_length);
+        mesh->lods.push_back(MeshLOD {total_error, simplified, (uint32_t)simplified.size()});
+
+        current = simplified;
+    }
+
+    LOG_INFO("Generated " + std::to_string(mesh->lods.size()) + " levels of detail");
+}
+
+int Renderer::selectLOD(MeshRes* mesh, int current_lod, float distance, float scale, float projection_scale, float screen_height)
+{
+    if (mesh->lods.empty())
+    {
+        return 0;
+    }
+
+    current_lod = std::min(current_lod, (int)mesh->lods.size());
+
+    // How many pixels an error of 1 in model space covers
+    float pixels_per_unit = scale * projection_scale * screen_height * 0.5f / std::max(distance, 0.0001f);
+
+    auto pixel_error = [&](int lod) {
+        return lod == 0 ? 0.0f : mesh->lods[lod - 1].error * pixels_per_unit;
+    };
+
+    // Go more detailed straight away
+    while (current_lod > 0 && pixel_error(current_lod) > FLUX_LOD_PIXEL_ERROR)
+    {
+        current_lod--;
+    }
+
+    // But only go less detailed once it's definitely fine
+    while (current_lod < mesh->lods.size() && pixel_error(current_lod + 1) < FLUX_LOD_PIXEL_ERROR * (1 - FLUX_LOD_HYSTERESIS))
+    {
+        current_lod++;
+    }
+
+    return current_lod;
+}
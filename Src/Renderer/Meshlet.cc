@@ -0,0 +1,345 @@
+#include "Flux/Log.hh"
+#include "Flux/Renderer.hh"
+
+#include <glm/glm.hpp>
+
+// STL includes
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+using namespace Flux;
+
+/** When a meshlet runs out of connected triangles, this many of the next unused ones are checked for the closest */
+#define FLUX_MESHLET_SEARCH_WINDOW 64
+
+/** Normal cones wider than this (as the cosine of the half angle) are too wide to be worth testing */
+#define FLUX_MESHLET_MIN_CONE_DOT 0.1f
+
+// =========================================================
+// Building
+// =========================================================
+
+static glm::vec3 getPosition(const Renderer::Vertex* vertices, uint32_t index)
+{
+    return glm::vec3(vertices[index].x, vertices[index].y, vertices[index].z);
+}
+
+static Renderer::Meshlet finishMeshlet(const Renderer::MeshRes* mesh, const std::vector<uint32_t>& triangles, const std::vector<glm::vec3>& normals, uint32_t offset)
+{
+    Renderer::Meshlet meshlet;
+    meshlet.offset = offset;
+    meshlet.count = triangles.size() * 3;
+
+    // The sphere goes around the middle of the box, which is good enough
+    glm::vec3 min_pos = getPosition(mesh->vertices, mesh->indices[triangles[0] * 3]);
+    glm::vec3 max_pos = min_pos;
+    glm::vec3 normal_sum(0);
+
+    for (auto t : triangles)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            auto p = getPosition(mesh->vertices, mesh->indices[t * 3 + i]);
+            min_pos = glm::min(min_pos, p);
+            max_pos = glm::max(max_pos, p);
+        }
+
+        normal_sum += normals[t];
+    }
+
+    meshlet.center = (min_pos + max_pos) * 0.5f;
+    meshlet.radius = 0;
+    for (auto t : triangles)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            meshlet.radius = std::max(meshlet.radius, glm::length(getPosition(mesh->vertices, mesh->indices[t * 3 + i]) - meshlet.center));
+        }
+    }
+
+    // The cone has to hold every triangle's normal
+    meshlet.cone_axis = glm::vec3(0, 0, 1);
+    meshlet.cone_cutoff = 1;
+
+    float axis_length = glm::length(normal_sum);
+    if (axis_length < 0.0001f)
+    {
+        return meshlet;
+    }
+
+    meshlet.cone_axis = normal_sum / axis_length;
+
+    float min_dot = 1;
+    for (auto t : triangles)
+    {
+        // Degenerate triangles don't face anywhere
+        if (normals[t] != glm::vec3(0))
+        {
+            min_dot = std::min(min_dot, glm::dot(normals[t], meshlet.cone_axis));
+        }
+    }
+
+    if (min_dot > FLUX_MESHLET_MIN_CONE_DOT)
+    {
+        // The camera sees the backs of all of them from inside the flipped cone, widened by 90 degrees.
+        // cos(angle + 90) is -sin(angle), which is where the sine comes from
+        meshlet.cone_cutoff = std::sqrt(1 - min_dot * min_dot);
+    }
+
+    return meshlet;
+}
+
+void Renderer::buildMeshlets(Resources::ResourceRef<MeshRes> mesh_ref, uint32_t max_triangles)
+{
+    auto mesh = mesh_ref.getPtr();
+    if (mesh->draw_mode != DrawMode::Triangles)
+    {
+        LOG_WARN("Only triangle meshes can be split into meshlets");
+        return;
+    }
+
+    mesh->unpack();
+    mesh->meshlets.clear();
+    if (mesh->vertices == nullptr || mesh->indices_length < 3)
+    {
+        return;
+    }
+
+    max_triangles = std::max(max_triangles, (uint32_t)1);
+    uint32_t triangle_count = mesh->indices_length / 3;
+
+    // Middle and facing of each triangle
+    std::vector<glm::vec3> centroids(triangle_count);
+    std::vector<glm::vec3> normals(triangle_count);
+    for (int i = 0; i < triangle_count; i++)
+    {
+        auto a = getPosition(mesh->vertices, mesh->indices[i * 3]);
+        auto b = getPosition(mesh->vertices, mesh->indices[i * 3 + 1]);
+        auto c = getPosition(mesh->vertices, mesh->indices[i * 3 + 2]);
+
+        centroids[i] = (a + b + c) / 3.0f;
+
+        auto normal = glm::cross(b - a, c - a);
+        float length = glm::length(normal);
+        normals[i] = length > 0 ? normal / length : glm::vec3(0);
+    }
+
+    // Build triangle adjacency for every vertex
+    std::vector<uint32_t> adjacency_offsets(mesh->vertices_length + 1, 0);
+    for (int i = 0; i < triangle_count * 3; i++)
+    {
+        adjacency_offsets[mesh->indices[i] + 1]++;
+    }
+
+    for (int i = 0; i < mesh->vertices_length; i++)
+    {
+        adjacency_offsets[i + 1] += adjacency_offsets[i];
+    }
+
+    std::vector<uint32_t> adjacency(triangle_count * 3);
+    std::vector<uint32_t> adjacency_fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+    for (int i = 0; i < triangle_count * 3; i++)
+    {
+        adjacency[adjacency_fill[mesh->indices[i]]++] = i / 3;
+    }
+
+    std::vector<bool> used(triangle_count, false);
+    std::vector<uint32_t> new_indices;
+    new_indices.reserve(triangle_count * 3);
+
+    std::vector<uint32_t> triangles;
+    std::vector<uint32_t> candidates;
+    uint32_t scan_cursor = 0;
+
+    while (true)
+    {
+        // Everything before this is already in a meshlet
+        while (scan_cursor < triangle_count && used[scan_cursor])
+        {
+            scan_cursor++;
+        }
+
+        if (scan_cursor == triangle_count)
+        {
+            break;
+        }
+
+        triangles.clear();
+        candidates.clear();
+
+        glm::vec3 centroid_sum(0), normal_sum(0);
+        int next = scan_cursor;
+
+        while (next != -1)
+        {
+            used[next] = true;
+            triangles.push_back(next);
+            centroid_sum += centroids[next];
+            normal_sum += normals[next];
+
+            if (triangles.size() >= max_triangles)
+            {
+                break;
+            }
+
+            // Anything touching the new triangle could go next
+            for (int i = 0; i < 3; i++)
+            {
+                auto v = mesh->indices[next * 3 + i];
+                for (int j = adjacency_offsets[v]; j < adjacency_offsets[v + 1]; j++)
+                {
+                    if (!used[adjacency[j]])
+                    {
+                        candidates.push_back(adjacency[j]);
+                    }
+                }
+            }
+
+            // The closest one that faces the same way wins
+            glm::vec3 center = centroid_sum / (float)triangles.size();
+            float normal_length = glm::length(normal_sum);
+            glm::vec3 normal = normal_length > 0 ? normal_sum / normal_length : glm::vec3(0);
+
+            auto score = [&](uint32_t t) {
+                return glm::length(centroids[t] - center) * (2 - glm::dot(normals[t], normal));
+            };
+
+            next = -1;
+            float best_score = std::numeric_limits<float>::max();
+            for (size_t i = 0; i < candidates.size();)
+            {
+                auto t = candidates[i];
+                if (used[t])
+                {
+                    candidates[i] = candidates.back();
+                    candidates.pop_back();
+                    continue;
+                }
+
+                float s = score(t);
+                if (s < best_score)
+                {
+                    best_score = s;
+                    next = t;
+                }
+                i++;
+            }
+
+            if (next == -1)
+            {
+                // Nothing connected is left, so try the closest of the next few triangles
+                // They're usually nearby, since the indices have been optimized for the vertex cache
+                int checked = 0;
+                for (int t = scan_cursor; t < triangle_count && checked < FLUX_MESHLET_SEARCH_WINDOW; t++)
+                {
+                    if (used[t])
+                    {
+                        continue;
+                    }
+
+                    checked++;
+                    float s = score(t);
+                    if (s < best_score)
+                    {
+                        best_score = s;
+                        next = t;
+                    }
+                }
+            }
+        }
+
+        // Keep the original order inside the meshlet, so the vertex cache optimization still mostly works
+        std::sort(triangles.begin(), triangles.end());
+
+        mesh->meshlets.push_back(finishMeshlet(mesh, triangles, normals, new_indices.size()));
+        for (auto t : triangles)
+        {
+            new_indices.push_back(mesh->indices[t * 3]);
+            new_indices.push_back(mesh->indices[t * 3 + 1]);
+            new_indices.push_back(mesh->indices[t * 3 + 2]);
+        }
+    }
+
+    // Leftover indices that aren't a whole triangle are dropped
+    std::copy(new_indices.begin(), new_indices.end(), mesh->indices);
+    mesh->indices_length = new_indices.size();
+
+    LOG_INFO("Split mesh into " + std::to_string(mesh->meshlets.size()) + " meshlets");
+}
+
+// =========================================================
+// Culling
+// =========================================================
+
+void Renderer::getFrustumPlanes(const glm::mat4& matrix, glm::vec4 planes[6])
+{
+    // Gribb and Hartmann's method. Each plane is the last row plus or minus one of the others
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++)
+    {
+        rows[i] = glm::vec4(matrix[0][i], matrix[1][i], matrix[2][i], matrix[3][i]);
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        planes[i * 2] = rows[3] + rows[i];
+        planes[i * 2 + 1] = rows[3] - rows[i];
+    }
+
+    // Normalized, so distances to them are real distances
+    for (int i = 0; i < 6; i++)
+    {
+        float length = glm::length(glm::vec3(planes[i]));
+        if (length > 0)
+        {
+            planes[i] = planes[i] / length;
+        }
+    }
+}
+
+bool Renderer::isMeshletVisible(const Meshlet& meshlet, const glm::vec4 planes[6], const glm::vec3& camera_position)
+{
+    for (int i = 0; i < 6; i++)
+    {
+        if (glm::dot(glm::vec3(planes[i]), meshlet.center) + planes[i].w < -meshlet.radius)
+        {
+            return false;
+        }
+    }
+
+    // Facing away, as long as the camera is inside the flipped cone, from anywhere in the sphere
+    auto to_center = meshlet.center - camera_position;
+    return glm::dot(to_center, meshlet.cone_axis) < meshlet.cone_cutoff * glm::length(to_center) + meshlet.radius;
+}
+
+uint32_t Renderer::cullMeshlets(const MeshRes* mesh, const glm::mat4& model_view_projection, const glm::vec3& camera_position, std::vector<glm::uvec2>& ranges)
+{
+    glm::vec4 planes[6];
+    getFrustumPlanes(model_view_projection, planes);
+
+    // Only ranges from this mesh can be merged
+    size_t first_range = ranges.size();
+    uint32_t culled = 0;
+
+    for (auto& meshlet : mesh->meshlets)
+    {
+        if (!isMeshletVisible(meshlet, planes, camera_position))
+        {
+            culled++;
+            continue;
+        }
+
+        if (ranges.size() > first_range && ranges.back().x + ranges.back().y == meshlet.offset)
+        {
+            ranges.back().y += meshlet.count;
+        }
+        else
+        {
+            ranges.push_back(glm::uvec2(meshlet.offset, meshlet.count));
+        }
+    }
+
+    return culled;
+}
@@ -0,0 +1,369 @@
+#include "Flux/Log.hh"
+#include "Flux/Physics.hh"
+#include "Flux/Renderer.hh"
+
+#include <glm/glm.hpp>
+
+// STL includes
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace Flux;
+
+// Size of a tile in the occlusion buffer, in pixels
+#define FLUX_OCCLUSION_TILE 8
+
+// Anything closer to the camera than this is treated as crossing the near plane
+#define FLUX_OCCLUSION_MIN_W 0.0001f
+
+Renderer::OcclusionBuffer::OcclusionBuffer(int width, int height)
+{
+    // Tiles are 8x8, and the rasterizer does 4 pixels at a time
+    this->width = (width + FLUX_OCCLUSION_TILE - 1) / FLUX_OCCLUSION_TILE * FLUX_OCCLUSION_TILE;
+    this->height = (height + FLUX_OCCLUSION_TILE - 1) / FLUX_OCCLUSION_TILE * FLUX_OCCLUSION_TILE;
+    tiles_x = this->width / FLUX_OCCLUSION_TILE;
+    tiles_y = this->height / FLUX_OCCLUSION_TILE;
+
+    depth.resize(this->width * this->height, 1.0f);
+    tile_depth.resize(tiles_x * tiles_y, 1.0f);
+
+    view_projection = glm::mat4(1);
+    triangles_drawn = 0;
+}
+
+void Renderer::OcclusionBuffer::clear(const glm::mat4& view_projection)
+{
+    this->view_projection = view_projection;
+    std::fill(depth.begin(), depth.end(), 1.0f);
+    std::fill(tile_depth.begin(), tile_depth.end(), 1.0f);
+    triangles_drawn = 0;
+}
+
+void Renderer::OcclusionBuffer::drawTriangles(const glm::mat4& model, const Vertex* vertices, const uint32_t* indices, uint32_t index_count)
+{
+    auto mvp = view_projection * model;
+
+    for (uint32_t i = 0; i + 2 < index_count; i += 3)
+    {
+        auto& v0 = vertices[indices[i]];
+        auto& v1 = vertices[indices[i + 1]];
+        auto& v2 = vertices[indices[i + 2]];
+
+        drawTriangle(mvp * glm::vec4(v0.x, v0.y, v0.z, 1), mvp * glm::vec4(v1.x, v1.y, v1.z, 1), mvp * glm::vec4(v2.x, v2.y, v2.z, 1));
+    }
+}
+
+void Renderer::OcclusionBuffer::drawMesh(const glm::mat4& model, MeshRes* mesh)
+{
+    if (mesh->draw_mode != DrawMode::Triangles)
+    {
+        return;
+    }
+
+    if (mesh->vertices == nullptr)
+    {
+        // Occluders need their positions on the cpu
+        mesh->unpack();
+    }
+
+    if (!mesh->lods.empty())
+    {
+        // Occluders don't need to be detailed
+        auto& lod = mesh->lods.back();
+        drawTriangles(model, mesh->vertices, lod.indices.data(), lod.indices.size());
+    }
+    else
+    {
+        drawTriangles(model, mesh->vertices, mesh->indices, mesh->indices_length);
+    }
+}
+
+void Renderer::OcclusionBuffer::drawTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c)
+{
+    if (a.w < FLUX_OCCLUSION_MIN_W || b.w < FLUX_OCCLUSION_MIN_W || c.w < FLUX_OCCLUSION_MIN_W)
+    {
+        // Clipping would be more accurate, but leaving it out can only make less things hidden
+        return;
+    }
+
+    // To pixels. Y is kept pointing up, so counter-clockwise stays counter-clockwise
+    auto toScreen = [this](const glm::vec4& v) {
+        return glm::vec3((v.x / v.w * 0.5f + 0.5f) * width, (v.y / v.w * 0.5f + 0.5f) * height, v.z / v.w);
+    };
+
+    glm::vec3 p0 = toScreen(a);
+    glm::vec3 p1 = toScreen(b);
+    glm::vec3 p2 = toScreen(c);
+
+    float area = (p1.x - p0.x) * (p2.y - p0.y) - (p1.y - p0.y) * (p2.x - p0.x);
+    if (area <= 0)
+    {
+        // Back facing, or has no area
+        return;
+    }
+
+    // Bounding box, with the left edge lined up to 4 pixels
+    int min_x = std::max((int)std::floor(std::min(p0.x, std::min(p1.x, p2.x))), 0) & ~3;
+    int max_x = std::min((int)std::ceil(std::max(p0.x, std::max(p1.x, p2.x))), width - 1);
+    int min_y = std::max((int)std::floor(std::min(p0.y, std::min(p1.y, p2.y))), 0);
+    int max_y = std::min((int)std::ceil(std::max(p0.y, std::max(p1.y, p2.y))), height - 1);
+
+    if (min_x > max_x || min_y > max_y)
+    {
+        // Off screen
+        return;
+    }
+
+    triangles_drawn ++;
+
+    // Edge functions. Each one is positive on the inside of the edge opposite its vertex
+    // w = dx * x + dy * y + offset
+    float e0_dx = p1.y - p2.y, e0_dy = p2.x - p1.x, e0_c = p1.x * p2.y - p1.y * p2.x;
+    float e1_dx = p2.y - p0.y, e1_dy = p0.x - p2.x, e1_c = p2.x * p0.y - p2.y * p0.x;
+    float e2_dx = p0.y - p1.y, e2_dy = p1.x - p0.x, e2_c = p0.x * p1.y - p0.y * p1.x;
+
+    // Depth is linear in screen space, so it's a plane too
+    float inv_area = 1.0f / area;
+    float z_dx = (e0_dx * p0.z + e1_dx * p1.z + e2_dx * p2.z) * inv_area;
+    float z_dy = (e0_dy * p0.z + e1_dy * p1.z + e2_dy * p2.z) * inv_area;
+    float z_c = (e0_c * p0.z + e1_c * p1.z + e2_c * p2.z) * inv_area;
+
+    for (int y = min_y; y <= max_y; y++)
+    {
+        // Sample at the centre of the pixels
+        float py = y + 0.5f;
+        float px = min_x + 0.5f;
+
+        float w0 = e0_dx * px + e0_dy * py + e0_c;
+        float w1 = e1_dx * px + e1_dy * py + e1_c;
+        float w2 = e2_dx * px + e2_dy * py + e2_c;
+        float z = z_dx * px + z_dy * py + z_c;
+
+        float* row = depth.data() + y * width;
+
+#ifdef __SSE2__
+        __m128 steps = _mm_set_ps(3, 2, 1, 0);
+        __m128 vw0 = _mm_add_ps(_mm_set1_ps(w0), _mm_mul_ps(steps, _mm_set1_ps(e0_dx)));
+        __m128 vw1 = _mm_add_ps(_mm_set1_ps(w1), _mm_mul_ps(steps, _mm_set1_ps(e1_dx)));
+        __m128 vw2 = _mm_add_ps(_mm_set1_ps(w2), _mm_mul_ps(steps, _mm_set1_ps(e2_dx)));
+        __m128 vz = _mm_add_ps(_mm_set1_ps(z), _mm_mul_ps(steps, _mm_set1_ps(z_dx)));
+
+        __m128 w0_step = _mm_set1_ps(e0_dx * 4);
+        __m128 w1_step = _mm_set1_ps(e1_dx * 4);
+        __m128 w2_step = _mm_set1_ps(e2_dx * 4);
+        __m128 z_step = _mm_set1_ps(z_dx * 4);
+        __m128 zero = _mm_setzero_ps();
+
+        for (int x = min_x; x <= max_x; x += 4)
+        {
+            // Inside all 3 edges
+            __m128 mask = _mm_and_ps(_mm_cmpge_ps(vw0, zero), _mm_and_ps(_mm_cmpge_ps(vw1, zero), _mm_cmpge_ps(vw2, zero)));
+
+            if (_mm_movemask_ps(mask))
+            {
+                __m128 old = _mm_loadu_ps(row + x);
+                __m128 closer = _mm_min_ps(old, vz);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(mask, closer), _mm_andnot_ps(mask, old)));
+            }
+
+            vw0 = _mm_add_ps(vw0, w0_step);
+            vw1 = _mm_add_ps(vw1, w1_step);
+            vw2 = _mm_add_ps(vw2, w2_step);
+            vz = _mm_add_ps(vz, z_step);
+        }
+#else
+        for (int x = min_x; x <= max_x; x++)
+        {
+            if (w0 >= 0 && w1 >= 0 && w2 >= 0)
+            {
+                row[x] = std::min(row[x], z);
+            }
+
+            w0 += e0_dx;
+            w1 += e1_dx;
+            w2 += e2_dx;
+            z += z_dx;
+        }
+#endif
+    }
+}
+
+void Renderer::OcclusionBuffer::finish()
+{
+    for (int ty = 0; ty < tiles_y; ty++)
+    {
+        for (int tx = 0; tx < tiles_x; tx++)
+        {
+            float furthest = -1;
+            for (int y = ty * FLUX_OCCLUSION_TILE; y < (ty + 1) * FLUX_OCCLUSION_TILE; y++)
+            {
+                const float* row = depth.data() + y * width + tx * FLUX_OCCLUSION_TILE;
+                for (int x = 0; x < FLUX_OCCLUSION_TILE; x++)
+                {
+                    furthest = std::max(furthest, row[x]);
+                }
+            }
+
+            tile_depth[tx + ty * tiles_x] = furthest;
+        }
+    }
+}
+
+bool Renderer::OcclusionBuffer::isVisible(const glm::vec3& min_pos, const glm::vec3& max_pos) const
+{
+    // Project the corners, and find the box's closest point
+    glm::vec2 screen_min(INFINITY);
+    glm::vec2 screen_max(-INFINITY);
+    float nearest = INFINITY;
+
+    for (int i = 0; i < 8; i++)
+    {
+        glm::vec4 corner((i & 1) ? max_pos.x : min_pos.x, (i & 2) ? max_pos.y : min_pos.y, (i & 4) ? max_pos.z : min_pos.z, 1);
+        corner = view_projection * corner;
+
+        if (corner.w < FLUX_OCCLUSION_MIN_W)
+        {
+            // It's touching the camera
+            return true;
+        }
+
+        glm::vec2 screen((corner.x / corner.w * 0.5f + 0.5f) * width, (corner.y / corner.w * 0.5f + 0.5f) * height);
+        screen_min = glm::min(screen_min, screen);
+        screen_max = glm::max(screen_max, screen);
+        nearest = std::min(nearest, corner.z / corner.w);
+    }
+
+    if (screen_max.x < 0 || screen_max.y < 0 || screen_min.x >= width || screen_min.y >= height)
+    {
+        return false;
+    }
+
+    int min_x = std::max((int)std::floor(screen_min.x), 0);
+    int max_x = std::min((int)std::floor(screen_max.x), width - 1);
+    int min_y = std::max((int)std::floor(screen_min.y), 0);
+    int max_y = std::min((int)std::floor(screen_max.y), height - 1);
+
+    for (int ty = min_y / FLUX_OCCLUSION_TILE; ty <= max_y / FLUX_OCCLUSION_TILE; ty++)
+    {
+        for (int tx = min_x / FLUX_OCCLUSION_TILE; tx <= max_x / FLUX_OCCLUSION_TILE; tx++)
+        {
+            if (nearest > tile_depth[tx + ty * tiles_x])
+            {
+                // Everything in this tile is in front of the box
+                continue;
+            }
+
+            // Have to check the pixels
+            int start_x = std::max(min_x, tx * FLUX_OCCLUSION_TILE);
+            int end_x = std::min(max_x, (tx + 1) * FLUX_OCCLUSION_TILE - 1);
+            int start_y = std::max(min_y, ty * FLUX_OCCLUSION_TILE);
+            int end_y = std::min(max_y, (ty + 1) * FLUX_OCCLUSION_TILE - 1);
+
+            for (int y = start_y; y <= end_y; y++)
+            {
+                const float* row = depth.data() + y * width;
+                for (int x = start_x; x <= end_x; x++)
+                {
+                    if (nearest <= row[x])
+                    {
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+// =====================================================
+// Occlusion System
+// =====================================================
+
+void Renderer::OcclusionSystem::onSystemStart()
+{
+    occluders.clear();
+    has_buffer = false;
+}
+
+// This must run AFTER transform system
+void Renderer::OcclusionSystem::runSystem(EntityRef entity, float delta)
+{
+    if (!enabled || !entity.hasComponent<OccluderCom>() || !entity.hasComponent<MeshCom>() || !entity.hasComponent<Transform::TransformCom>())
+    {
+        return;
+    }
+
+    if (!entity.getComponent<Transform::TransformCom>()->global_visibility)
+    {
+        return;
+    }
+
+    occluders.push_back(entity);
+}
+
+void Renderer::OcclusionSystem::buildBuffer(const glm::mat4& view, const glm::mat4& projection)
+{
+    // The camera's cell picks what could be seen, before anything is drawn
+    auto pvs = getPVS();
+    pvs_cell = use_pvs && pvs != nullptr ? pvs->findCell(Transform::camera_position) : -1;
+
+    if (!enabled || occluders.empty())
+    {
+        // Nothing can be hidden
+        has_buffer = false;
+        return;
+    }
+
+    buffer.clear(projection * view);
+
+    for (auto& entity : occluders)
+    {
+        auto tc = entity.getComponent<Transform::TransformCom>();
+        auto mesh = entity.getComponent<MeshCom>()->mesh_resource.getPtr();
+
+        buffer.drawMesh(tc->model, mesh);
+    }
+
+    buffer.finish();
+    has_buffer = true;
+}
+
+bool Renderer::OcclusionSystem::isVisible(EntityRef entity)
+{
+    glm::vec3 min_pos, max_pos;
+    if (entity.hasComponent<StaticBatchCom>())
+    {
+        auto batch = entity.getComponent<StaticBatchCom>();
+        min_pos = batch->min_pos;
+        max_pos = batch->max_pos;
+    }
+    else if (entity.hasComponent<Physics::BoundingCom>())
+    {
+        auto box = entity.getComponent<Physics::BoundingCom>()->box;
+        min_pos = box->min_pos;
+        max_pos = box->max_pos;
+    }
+    else
+    {
+        return true;
+    }
+
+    // Cells that can't be seen from the camera's cell are skipped without testing anything else
+    auto pvs = getPVS();
+    if (pvs_cell >= 0 && pvs != nullptr && !pvs->isVisible(pvs_cell, min_pos, max_pos))
+    {
+        return false;
+    }
+
+    if (!has_buffer || entity.hasComponent<OccluderCom>())
+    {
+        return true;
+    }
+
+    return buffer.isVisible(min_pos, max_pos);
+}
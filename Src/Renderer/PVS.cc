@@ -0,0 +1,448 @@
+#include "Flux/ECS.hh"
+#include "Flux/Log.hh"
+#include "Flux/Renderer.hh"
+#include "Flux/Resources.hh"
+
+#include <glm/glm.hpp>
+#include "glm/gtc/matrix_transform.hpp"
+
+// STL includes
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace Flux;
+
+// Near plane of the views rendered while building. Small, so walls right next to the point still block things
+#define FLUX_PVS_NEAR_PLANE 0.01f
+
+// How far from the middle of a cell the corner samples are, as a fraction of the cell size
+#define FLUX_PVS_SAMPLE_SPREAD 0.45f
+
+static Renderer::PVS* current_pvs = nullptr;
+
+void Renderer::setPVS(PVS* pvs)
+{
+    current_pvs = pvs;
+}
+
+Renderer::PVS* Renderer::getPVS()
+{
+    return current_pvs;
+}
+
+// Zero bytes come in long runs, so each run is stored as a 0 and its length
+static std::vector<uint8_t> compressRow(const std::vector<uint8_t>& row)
+{
+    std::vector<uint8_t> out;
+    for (size_t i = 0; i < row.size();)
+    {
+        if (row[i] != 0)
+        {
+            out.push_back(row[i]);
+            i++;
+            continue;
+        }
+
+        uint8_t run = 0;
+        while (i < row.size() && row[i] == 0 && run < 255)
+        {
+            run++;
+            i++;
+        }
+
+        out.push_back(0);
+        out.push_back(run);
+    }
+
+    return out;
+}
+
+static bool decompressRow(const std::vector<uint8_t>& compressed, std::vector<uint8_t>& row, size_t row_bytes)
+{
+    row.clear();
+    for (size_t i = 0; i < compressed.size(); i++)
+    {
+        if (compressed[i] != 0)
+        {
+            row.push_back(compressed[i]);
+            continue;
+        }
+
+        if (i + 1 >= compressed.size())
+        {
+            return false;
+        }
+
+        row.insert(row.end(), compressed[i + 1], 0);
+        i++;
+    }
+
+    return row.size() == row_bytes;
+}
+
+// Returns false if a box is completely outside one of the 90 degree views.
+// The occlusion buffer says anything crossing the near plane is visible, which would include things behind the view
+static bool inView(const glm::vec3& eye, const glm::vec3& direction, const glm::vec3& up, const glm::vec3& min_pos, const glm::vec3& max_pos)
+{
+    glm::vec3 side = glm::cross(direction, up);
+    const glm::vec3 axes[2] = {up, side};
+
+    // The 4 side planes, then the one through the eye
+    for (int plane = 0; plane < 5; plane++)
+    {
+        bool inside = false;
+        for (int i = 0; i < 8 && !inside; i++)
+        {
+            glm::vec3 corner((i & 1) ? max_pos.x : min_pos.x, (i & 2) ? max_pos.y : min_pos.y, (i & 4) ? max_pos.z : min_pos.z);
+            glm::vec3 v = corner - eye;
+
+            float forward = glm::dot(v, direction);
+            if (plane == 4)
+            {
+                inside = forward >= 0;
+            }
+            else
+            {
+                float across = glm::dot(v, axes[plane / 2]);
+                inside = (plane % 2 == 0) ? forward - across >= 0 : forward + across >= 0;
+            }
+        }
+
+        if (!inside)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Renderer::PVS::build(const std::vector<EntityRef>& entities, float cell_size)
+{
+    struct Occluder
+    {
+        glm::mat4 model;
+        MeshRes* mesh;
+    };
+
+    // The grid covers everything with a mesh
+    std::vector<Occluder> occluders;
+    glm::vec3 min_pos = glm::vec3(INFINITY);
+    glm::vec3 max_pos = glm::vec3(-INFINITY);
+
+    for (auto entity : entities)
+    {
+        if (!entity.hasComponent<MeshCom>() || !entity.hasComponent<Transform::TransformCom>())
+        {
+            continue;
+        }
+
+        auto mesh = entity.getComponent<MeshCom>()->mesh_resource.getPtr();
+        if (mesh->vertices == nullptr)
+        {
+            mesh->unpack();
+        }
+
+        glm::mat4 model = Transform::getParentTransform(entity);
+        for (uint32_t i = 0; i < mesh->vertices_length; i++)
+        {
+            auto& v = mesh->vertices[i];
+            glm::vec3 world = glm::vec3(model * glm::vec4(v.x, v.y, v.z, 1));
+            min_pos = glm::min(min_pos, world);
+            max_pos = glm::max(max_pos, world);
+        }
+
+        if (entity.hasComponent<OccluderCom>() && mesh->draw_mode == DrawMode::Triangles)
+        {
+            occluders.push_back(Occluder {model, mesh});
+        }
+    }
+
+    if (min_pos.x > max_pos.x || cell_size <= 0)
+    {
+        LOG_WARN("Nothing to build a PVS from");
+        return false;
+    }
+
+    glm::vec3 extent = max_pos - min_pos;
+    int new_x = std::max((int)std::ceil(extent.x / cell_size), 1);
+    int new_y = std::max((int)std::ceil(extent.y / cell_size), 1);
+    int new_z = std::max((int)std::ceil(extent.z / cell_size), 1);
+
+    if ((int64_t)new_x * new_y * new_z > FLUX_PVS_MAX_CELLS)
+    {
+        LOG_WARN("PVS would need " + std::to_string((int64_t)new_x * new_y * new_z) + " cells, which is more than FLUX_PVS_MAX_CELLS. Try bigger cells");
+        return false;
+    }
+
+    origin = min_pos;
+    this->cell_size = cell_size;
+    size_x = new_x;
+    size_y = new_y;
+    size_z = new_z;
+    cached_row = -1;
+
+    int cells = getCellCount();
+    size_t row_bytes = (cells + 7) / 8;
+    std::vector<std::vector<uint8_t>> visible(cells, std::vector<uint8_t>(row_bytes, 0));
+
+    auto cellBounds = [&](int cell, glm::vec3& cell_min, glm::vec3& cell_max) {
+        int x = cell % size_x;
+        int y = (cell / size_x) % size_y;
+        int z = cell / (size_x * size_y);
+        cell_min = origin + glm::vec3(x, y, z) * cell_size;
+        cell_max = cell_min + glm::vec3(cell_size);
+    };
+
+    // 90 degrees each, so the 6 of them cover everything
+    glm::mat4 projection = glm::perspective(1.570796f, 1.0f, FLUX_PVS_NEAR_PLANE, glm::length(extent) + cell_size);
+    const glm::vec3 directions[6] = {glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1)};
+    const glm::vec3 ups[6] = {glm::vec3(0, 1, 0), glm::vec3(0, 1, 0), glm::vec3(0, 0, -1), glm::vec3(0, 0, 1), glm::vec3(0, 1, 0), glm::vec3(0, 1, 0)};
+
+    OcclusionBuffer buffer(FLUX_PVS_VIEW_SIZE, FLUX_PVS_VIEW_SIZE);
+
+    for (int cell = 0; cell < cells; cell++)
+    {
+        auto& set = visible[cell];
+        set[cell / 8] |= 1 << (cell % 8);
+
+        glm::vec3 cell_min, cell_max;
+        cellBounds(cell, cell_min, cell_max);
+        glm::vec3 center = (cell_min + cell_max) * 0.5f;
+
+        // The middle, then the corners
+        for (int sample = 0; sample < 9; sample++)
+        {
+            glm::vec3 point = center;
+            if (sample > 0)
+            {
+                int corner = sample - 1;
+                glm::vec3 offset = glm::vec3((corner & 1) ? 1 : -1, (corner & 2) ? 1 : -1, (corner & 4) ? 1 : -1);
+                point += offset * cell_size * FLUX_PVS_SAMPLE_SPREAD;
+            }
+
+            for (int face = 0; face < 6; face++)
+            {
+                buffer.clear(projection * glm::lookAt(point, point + directions[face], ups[face]));
+                for (auto& occluder : occluders)
+                {
+                    buffer.drawMesh(occluder.model, occluder.mesh);
+                }
+                buffer.finish();
+
+                for (int other = 0; other < cells; other++)
+                {
+                    if (set[other / 8] & (1 << (other % 8)))
+                    {
+                        // Already seen from somewhere else
+                        continue;
+                    }
+
+                    glm::vec3 other_min, other_max;
+                    cellBounds(other, other_min, other_max);
+                    if (inView(point, directions[face], ups[face], other_min, other_max) && buffer.isVisible(other_min, other_max))
+                    {
+                        set[other / 8] |= 1 << (other % 8);
+                    }
+                }
+            }
+        }
+    }
+
+    // If a can see b, then b can see a, even if none of b's samples caught it
+    for (int a = 0; a < cells; a++)
+    {
+        for (int b = a + 1; b < cells; b++)
+        {
+            bool ab = visible[a][b / 8] & (1 << (b % 8));
+            bool ba = visible[b][a / 8] & (1 << (a % 8));
+            if (ab || ba)
+            {
+                visible[a][b / 8] |= 1 << (b % 8);
+                visible[b][a / 8] |= 1 << (a % 8);
+            }
+        }
+    }
+
+    rows.resize(cells);
+    uint64_t total_visible = 0;
+    for (int cell = 0; cell < cells; cell++)
+    {
+        for (int other = 0; other < cells; other++)
+        {
+            total_visible += (visible[cell][other / 8] >> (other % 8)) & 1;
+        }
+
+        rows[cell] = compressRow(visible[cell]);
+    }
+
+    LOG_INFO("Built PVS with " + std::to_string(cells) + " cells. Each cell sees " + std::to_string(total_visible / cells) + " on average, and it takes " + std::to_string(getCompressedSize()) + " bytes");
+    return true;
+}
+
+int Renderer::PVS::findCell(const glm::vec3& position) const
+{
+    if (rows.empty())
+    {
+        return -1;
+    }
+
+    glm::vec3 p = (position - origin) / cell_size;
+    int x = (int)std::floor(p.x);
+    int y = (int)std::floor(p.y);
+    int z = (int)std::floor(p.z);
+
+    if (x < 0 || y < 0 || z < 0 || x >= size_x || y >= size_y || z >= size_z)
+    {
+        return -1;
+    }
+
+    return x + (y + z * size_y) * size_x;
+}
+
+const std::vector<uint8_t>& Renderer::PVS::getRow(int from)
+{
+    if (cached_row != from)
+    {
+        // load() already checked that it decompresses
+        decompressRow(rows[from], row, (getCellCount() + 7) / 8);
+        cached_row = from;
+    }
+
+    return row;
+}
+
+bool Renderer::PVS::isCellVisible(int from, int to)
+{
+    if (from < 0 || from >= (int)rows.size() || to < 0 || to >= (int)rows.size())
+    {
+        return true;
+    }
+
+    auto& set = getRow(from);
+    return (set[to / 8] >> (to % 8)) & 1;
+}
+
+bool Renderer::PVS::isVisible(int from, const glm::vec3& min_pos, const glm::vec3& max_pos)
+{
+    if (from < 0 || from >= (int)rows.size())
+    {
+        return true;
+    }
+
+    glm::vec3 lo = (min_pos - origin) / cell_size;
+    glm::vec3 hi = (max_pos - origin) / cell_size;
+
+    int min_x = (int)std::floor(lo.x), min_y = (int)std::floor(lo.y), min_z = (int)std::floor(lo.z);
+    int max_x = (int)std::floor(hi.x), max_y = (int)std::floor(hi.y), max_z = (int)std::floor(hi.z);
+
+    if (min_x < 0 || min_y < 0 || min_z < 0 || max_x >= size_x || max_y >= size_y || max_z >= size_z)
+    {
+        return true;
+    }
+
+    auto& set = getRow(from);
+    for (int z = min_z; z <= max_z; z++)
+    {
+        for (int y = min_y; y <= max_y; y++)
+        {
+            for (int x = min_x; x <= max_x; x++)
+            {
+                int cell = x + (y + z * size_y) * size_x;
+                if ((set[cell / 8] >> (cell % 8)) & 1)
+                {
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+size_t Renderer::PVS::getCompressedSize() const
+{
+    size_t size = 0;
+    for (auto& r : rows)
+    {
+        size += r.size();
+    }
+
+    return size;
+}
+
+// Layout: origin, cell size, grid size, then each cell's compressed set with its length first
+
+void Renderer::PVS::save(FluxArc::BinaryFile* file) const
+{
+    file->set(origin.x);
+    file->set(origin.y);
+    file->set(origin.z);
+    file->set(cell_size);
+
+    file->set((uint32_t)size_x);
+    file->set((uint32_t)size_y);
+    file->set((uint32_t)size_z);
+
+    for (auto& r : rows)
+    {
+        file->set((uint32_t)r.size());
+        file->set((char*)r.data(), r.size());
+    }
+}
+
+bool Renderer::PVS::load(FluxArc::BinaryFile* file)
+{
+    file->get(&origin.x);
+    file->get(&origin.y);
+    file->get(&origin.z);
+    file->get(&cell_size);
+
+    uint32_t x, y, z;
+    file->get(&x);
+    file->get(&y);
+    file->get(&z);
+
+    rows.clear();
+    cached_row = -1;
+
+    if ((uint64_t)x * y * z > FLUX_PVS_MAX_CELLS || cell_size <= 0)
+    {
+        size_x = size_y = size_z = 0;
+        return false;
+    }
+
+    size_x = x;
+    size_y = y;
+    size_z = z;
+
+    int cells = getCellCount();
+    size_t row_bytes = (cells + 7) / 8;
+
+    rows.resize(cells);
+    std::vector<uint8_t> check;
+    for (auto& r : rows)
+    {
+        uint32_t length;
+        file->get(&length);
+
+        // No cell's set can be bigger than 2 bytes per byte
+        if (length > row_bytes * 2)
+        {
+            rows.clear();
+            return false;
+        }
+
+        r.resize(length);
+        file->get((char*)r.data(), length);
+
+        if (!decompressRow(r, check, row_bytes))
+        {
+            rows.clear();
+            return false;
+        }
+    }
+
+    return true;
+}
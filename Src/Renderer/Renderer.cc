@@ -10,6 +10,8 @@
 #include <glm/glm.hpp>
 
 // STL includes
+#include <algorithm>
+#include <cmath>
 #include <fstream>
 
 // STB
@@ -53,20 +55,39 @@ Resources::ResourceRef<Flux::Renderer::ShaderRes> Flux::Renderer::createShaderRe
     // TODO: Change later
     auto sr = new ShaderRes;
 
-    sr->frag_src = temp_readFile(frag);
-    sr->vert_src = temp_readFile(vert);
-
     sr->vert_fname = vert;
     sr->frag_fname = frag;
+    sr->load();
 
     return Resources::createResource(sr);
 }
 
+uint64_t Flux::Renderer::hashBytes(const void* data, size_t size, uint64_t hash)
+{
+    auto bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+void Flux::Renderer::ShaderRes::load()
+{
+    vert_src = temp_readFile(vert_fname);
+    frag_src = temp_readFile(frag_fname);
+
+    // The null in between stops "ab" + "c" hashing the same as "a" + "bc"
+    source_hash = hashBytes(vert_src.c_str(), vert_src.size() + 1);
+    source_hash = hashBytes(frag_src.c_str(), frag_src.size(), source_hash);
+}
+
 Resources::ResourceRef<Flux::Renderer::MaterialRes> Renderer::createMaterialResource(Resources::ResourceRef<ShaderRes> shader_resource)
 {
     auto mr = new MaterialRes;
     mr->shaders = shader_resource;
-    mr->uniforms = std::map<std::string, Uniform>();
     mr->changed = true;
 
     return Resources::createResource(mr);
@@ -87,161 +108,163 @@ void Flux::Renderer::addMesh(EntityRef entity, Resources::ResourceRef<MeshRes> m
     Transform::giveTransform(entity);
 }
 
-void Flux::Renderer::setUniform(Resources::ResourceRef<MaterialRes> res, const std::string& name, const glm::vec2& v)
+uint32_t Flux::Renderer::getStd140Size(UniformType type)
 {
-    // auto mr = (MaterialRes*)Resources::getResource(res);
+    switch (type)
+    {
+        case (UniformType::Int): return sizeof(int32_t);
+        case (UniformType::Float): return sizeof(float);
+        case (UniformType::Bool): return sizeof(int32_t);
+        case (UniformType::Vector2): return sizeof(float) * 2;
+        case (UniformType::Vector3): return sizeof(float) * 3;
+        case (UniformType::Vector4): return sizeof(float) * 4;
+        case (UniformType::Mat4): return sizeof(float) * 16;
+        case (UniformType::Texture): return 0;
+    }
 
-    Uniform us;
-    us.location = -1;
-    us.type = UniformType::Vector2;
+    return 0;
+}
 
-    // Allocate enw memory, and copy value into it
-    // glm::vec2* value = (glm::vec2*)std::malloc(sizeof(v));
-    // std::memcpy(value, &v, sizeof(v));
-    glm::vec2* value = new glm::vec2(v);
+uint32_t Flux::Renderer::getStd140Alignment(UniformType type)
+{
+    switch (type)
+    {
+        case (UniformType::Vector2): return sizeof(float) * 2;
+        // vec3s are aligned like vec4s
+        case (UniformType::Vector3): return sizeof(float) * 4;
+        case (UniformType::Vector4): return sizeof(float) * 4;
+        case (UniformType::Mat4): return sizeof(float) * 4;
+        default: return sizeof(float);
+    }
+}
 
-    us.value = value;
+int Flux::Renderer::MaterialRes::findParam(const std::string& name) const
+{
+    for (int i = 0; i < params.size(); i++)
+    {
+        if (params[i].name == name)
+        {
+            return i;
+        }
+    }
 
-    res->uniforms[name] = us;
-    res->changed = true;
+    return -1;
 }
 
-void Flux::Renderer::setUniform(Resources::ResourceRef<MaterialRes> res, const std::string& name, const glm::vec3& v)
+void Flux::Renderer::MaterialRes::setParam(const std::string& name, UniformType type, const void* value)
 {
-    // auto mr = (MaterialRes*)Resources::getResource(res);
-
-    if (res->uniforms.find(name) != res->uniforms.end())
+    int index = findParam(name);
+    if (index == -1)
+    {
+        // Put it on the end, following the std140 rules
+        // The renderer moves it if the shader has a different layout
+        auto align = getStd140Alignment(type);
+        uint32_t offset = (block.size() + align - 1) / align * align;
+        block.resize(offset + getStd140Size(type), 0);
+
+        params.push_back(MaterialParam {name, type, offset});
+        index = params.size() - 1;
+        layout_changed = true;
+    }
+    else if (params[index].type != type)
     {
-        // Just change the value
-        LOG_ASSERT_MESSAGE(res->uniforms[name].type != UniformType::Vector3, "Wrong uniform type: Expected Vector3");
-        delete (glm::vec3*)res->uniforms[name].value;
-        res->uniforms[name].value = new glm::vec3(v);
-        res->changed = true;
+        LOG_WARN("Wrong uniform type for " + name);
         return;
     }
 
-    Uniform us;
-    us.location = -1;
-    us.type = UniformType::Vector3;
+    std::memcpy(block.data() + params[index].offset, value, getStd140Size(type));
+    changed = true;
+}
 
-    // Allocate enw memory, and copy value into it
-    // glm::vec3* value = (glm::vec3*)std::malloc(sizeof(v));
-    // std::memcpy(value, &v, sizeof(v));
-    glm::vec3* value = new glm::vec3(v);
+void Flux::Renderer::MaterialRes::setTexture(const std::string& name, Resources::ResourceRef<TextureRes> texture)
+{
+    // The renderer looks up the texture's location again either way
+    layout_changed = true;
+    changed = true;
 
-    us.value = value;
+    for (auto& tex : textures)
+    {
+        if (tex.name == name)
+        {
+            tex.texture = texture;
+            return;
+        }
+    }
 
-    res->uniforms[name] = us;
-    res->changed = true;
+    textures.push_back(MaterialTexture {name, texture});
 }
 
-void Flux::Renderer::setUniform(Resources::ResourceRef<MaterialRes> res, const std::string& name, const glm::vec4& v)
+void Flux::Renderer::MaterialRes::relayout(const std::vector<uint32_t>& offsets, uint32_t block_size)
 {
-    // auto mr = (MaterialRes*)Resources::getResource(res);
+    std::vector<unsigned char> new_block(block_size, 0);
+
+    for (int i = 0; i < params.size(); i++)
+    {
+        auto size = getStd140Size(params[i].type);
+        uint32_t offset = offsets[i];
 
-    Uniform us;
-    us.location = -1;
-    us.type = UniformType::Vector4;
+        if (offset == FLUX_UNUSED_UNIFORM)
+        {
+            // The shader doesn't use it, but we still have to keep it around
+            auto align = getStd140Alignment(params[i].type);
+            offset = (std::max((uint32_t)new_block.size(), block_size) + align - 1) / align * align;
+        }
 
-    // Allocate enw memory, and copy value into it
-    // glm::vec4* value = (glm::vec4*)std::malloc(sizeof(v));
-    // std::memcpy(value, &v, sizeof(v));
-    glm::vec4* value = new glm::vec4(v);
+        if (new_block.size() < offset + size)
+        {
+            new_block.resize(offset + size, 0);
+        }
 
-    us.value = value;
+        std::memcpy(new_block.data() + offset, block.data() + params[i].offset, size);
+        params[i].offset = offset;
+    }
 
-    res->uniforms[name] = us;
-    res->changed = true;
+    block.swap(new_block);
+    layout_changed = false;
+    changed = true;
 }
 
-void Flux::Renderer::setUniform(Resources::ResourceRef<MaterialRes> res, const std::string& name, const float& v)
+void Flux::Renderer::setUniform(Resources::ResourceRef<MaterialRes> res, const std::string& name, const glm::vec2& v)
 {
-    // auto mr = (MaterialRes*)Resources::getResource(res);
-
-    Uniform us;
-    us.location = -1;
-    us.type = UniformType::Float;
+    res->setParam(name, UniformType::Vector2, &v);
+}
 
-    // Allocate enw memory, and copy value into it
-    // float* value = (float*)std::malloc(sizeof(v));
-    // std::memcpy(value, &v, sizeof(v));
-    float* value = new float(v);
+void Flux::Renderer::setUniform(Resources::ResourceRef<MaterialRes> res, const std::string& name, const glm::vec3& v)
+{
+    res->setParam(name, UniformType::Vector3, &v);
+}
 
-    us.value = value;
+void Flux::Renderer::setUniform(Resources::ResourceRef<MaterialRes> res, const std::string& name, const glm::vec4& v)
+{
+    res->setParam(name, UniformType::Vector4, &v);
+}
 
-    res->uniforms[name] = us;
-    res->changed = true;
+void Flux::Renderer::setUniform(Resources::ResourceRef<MaterialRes> res, const std::string& name, const float& v)
+{
+    res->setParam(name, UniformType::Float, &v);
 }
 
 void Flux::Renderer::setUniform(Resources::ResourceRef<MaterialRes> res, const std::string& name, const int& v)
 {
-    // auto mr = (MaterialRes*)Resources::getResource(res);
-
-    Uniform us;
-    us.location = -1;
-    us.type = UniformType::Int;
-
-    // Allocate enw memory, and copy value into it
-    // int* value = (int*)std::malloc(sizeof(v));
-    int* value = new int(v);
-    // std::memcpy(value, &v, sizeof(v));
-
-    us.value = value;
-
-    res->uniforms[name] = us;
-    res->changed = true;
+    int32_t value = v;
+    res->setParam(name, UniformType::Int, &value);
 }
 
 void Flux::Renderer::setUniform(Resources::ResourceRef<MaterialRes> res, const std::string& name, const bool& v)
 {
-    // auto mr = (MaterialRes*)Resources::getResource(res);
-
-    Uniform us;
-    us.location = -1;
-    us.type = UniformType::Int;
-
-    // Allocate enw memory, and copy value into it
-    int32_t* value = new int32_t(v);
-    // int realv = v ? 1 : 0;
-    // value = realv;
-
-    us.value = value;
-
-    res->uniforms[name] = us;
-    res->changed = true;
+    // Bools are 4 bytes in std140
+    int32_t value = v ? 1 : 0;
+    res->setParam(name, UniformType::Bool, &value);
 }
 
 void Flux::Renderer::setUniform(Resources::ResourceRef<MaterialRes> res, const std::string& name, const glm::mat4& v)
 {
-    // auto mr = (MaterialRes*)Resources::getResource(res);
-
-    Uniform us;
-    us.location = -1;
-    us.type = UniformType::Mat4;
-
-    // Allocate enw memory, and copy value into it
-    glm::mat4* value = new glm::mat4(v);
-    // std::memcpy(value, &v, sizeof(v));
-
-    us.value = value;
-
-    res->uniforms[name] = us;
-    res->changed = true;
+    res->setParam(name, UniformType::Mat4, &v);
 }
 
 void Flux::Renderer::setUniform(Resources::ResourceRef<MaterialRes> res, const std::string& name, Resources::ResourceRef<TextureRes> v)
 {
-    Uniform us;
-    us.location = -1;
-    us.type = UniformType::Texture;
-
-    // Create pointer version of ResourceRef
-    auto value = new Resources::ResourceRef<TextureRes>(v.getBaseEntity());
-
-    us.value = value;
-
-    res->uniforms[name] = us;
-    res->changed = true;
+    res->setTexture(name, v);
 }
 
 // =========================================================
@@ -315,15 +338,36 @@ void Renderer::addSpotLight(EntityRef entity, float cutoff_radians, float radius
     Flux::Physics::giveBoundingBox(entity, glm::vec3(-radius/2, -radius/2, -radius/2), glm::vec3(radius/2, radius/2, radius/2));
 }
 
-Renderer::LightSystem::LightSystem()
+/** Lights that would be put into more grid cells than this are tested against everything instead */
+#define FLUX_MAX_LIGHT_CELLS 64
+
+// Packs a grid cell's coordinates into a single key
+static uint64_t packCell(int x, int y, int z)
 {
-    // Null all the lights
-    for (int i = 0; i < 128; i++)
-    {
-        lights[i] = EntityRef();
-    }
+    return ((uint64_t)(x & 0x1FFFFF) << 42) | ((uint64_t)(y & 0x1FFFFF) << 21) | (uint64_t)(z & 0x1FFFFF);
+}
+
+static float luminance(const glm::vec3& color)
+{
+    return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
 
-    return;
+/** A light that touches a cluster, and how important it is to that cluster */
+struct ClusterPair
+{
+    uint32_t cluster;
+    uint32_t light;
+    float score;
+};
+
+Renderer::LightSystem::LightSystem():
+current_stamp(0),
+grid_changed(true)
+{
+    clusters.near = 0;
+    clusters.far = 0;
+    clusters.depth_scale = 0;
+    clusters.depth_bias = 0;
 }
 
 void Renderer::LightSystem::onSystemStart()
@@ -331,273 +375,417 @@ void Renderer::LightSystem::onSystemStart()
     // Check all of our lights to see if they've changed
     lights_that_changed.clear();
 
-    // Add it to the lighting setup if it hasn't already been
+    // Give new lights a slot, re-using slots of removed lights
     for (auto entity : new_lights)
     {
-        for (int i = 0; i < 128; i++)
+        int slot = -1;
+        for (int i = 0; i < lights.size(); i++)
         {
             if (lights[i].getEntityID() == -1)
             {
-                lights[i] = entity;
-
-                // Force it to be on the lights_that_changed list
-                entity.getComponent<Transform::TransformCom>()->has_changed = true;
+                slot = i;
                 break;
             }
         }
 
+        if (slot == -1)
+        {
+            slot = lights.size();
+            lights.push_back(EntityRef());
+            light_data.push_back(LightData {glm::vec3(0), 0, glm::vec3(0), LightType::Point, glm::vec3(0), 0});
+        }
+
+        lights[slot] = entity;
+
+        // Force it to be on the lights_that_changed list
+        entity.getComponent<Transform::TransformCom>()->has_changed = true;
         entity.getComponent<LightCom>()->inducted = true;
     }
 
     new_lights.clear();
 
-    int c = 0;
-    for (auto i : lights)
+    for (int i = 0; i < lights.size(); i++)
     {
-        if (i.getEntityID() != -1)
+        if (lights[i].getEntityID() == -1)
         {
-            if (i.getComponent<Transform::TransformCom>()->has_changed)
+            continue;
+        }
+
+        // Free the slot of lights that have been destroyed
+        if (lights[i].getCtx()->getEntity(lights[i]) == nullptr || !lights[i].hasComponent<LightCom>())
+        {
+            lights[i] = EntityRef();
+            light_data[i] = LightData {glm::vec3(0), 0, glm::vec3(0), LightType::Point, glm::vec3(0), 0};
+            lights_that_changed.push_back(i);
+            continue;
+        }
+
+        auto tc = lights[i].getComponent<Transform::TransformCom>();
+        if (tc->has_changed)
+        {
+            // Oh well, I guess we're recalculating that light
+            auto lc = lights[i].getComponent<LightCom>();
+
+            if (lc->type == LightType::Spot)
             {
-                // Oh well, I guess we're recalculating that light
-                lights_that_changed.push_back(c);
-                // LOG_INFO("Light changed!");
+                // Calculate direction from transform
+                lc->direction = -glm::vec3(tc->model * glm::vec4(0, 0, 1, 0));
             }
+
+            light_data[i] = LightData {glm::vec3(tc->model * glm::vec4(0, 0, 0, 1)), lc->radius, lc->direction, lc->type, lc->color, lc->cutoff};
+            lights_that_changed.push_back(i);
         }
+    }
 
-        c++;
+    grid_changed = !lights_that_changed.empty();
+    if (grid_changed)
+    {
+        buildGrid();
     }
 }
 
-// This must run AFTER transform system
-void Renderer::LightSystem::runSystem(EntityRef entity, float delta)
+void Renderer::LightSystem::buildGrid()
 {
-    if (entity.hasComponent<LightCom>())
+    grid.clear();
+    global_lights.clear();
+    light_stamps.resize(lights.size(), 0);
+
+    for (int i = 0; i < lights.size(); i++)
     {
-        auto lc = entity.getComponent<LightCom>();
-        if (!lc->inducted)
+        if (lights[i].getEntityID() == -1)
         {
-            LOG_INFO("Adding new light");
-            new_lights.push_back(entity);
+            continue;
         }
-    }
 
-    if (!entity.hasComponent<MeshCom>() || !entity.hasComponent<Transform::TransformCom>())
-    {
-        return;
-    }
+        auto& light = light_data[i];
+        if (light.type == LightType::Directional)
+        {
+            // Directional lights effect everything
+            global_lights.push_back(i);
+            continue;
+        }
 
-    auto tc = entity.getComponent<Transform::TransformCom>();
-    glm::vec3 position = glm::vec3(tc->model * glm::vec4(0,0,0,1));
+        glm::vec3 min_cell = glm::floor((light.position - glm::vec3(light.radius)) / FLUX_LIGHT_GRID_CELL_SIZE);
+        glm::vec3 max_cell = glm::floor((light.position + glm::vec3(light.radius)) / FLUX_LIGHT_GRID_CELL_SIZE);
+        glm::vec3 cell_count = max_cell - min_cell + glm::vec3(1);
 
-    if (!entity.hasComponent<LightInfoCom>())
-    {
-        // Calculate initial lighting
-        int light_count = 0;
-        auto lightinfo = new LightInfoCom;
-        for (int i = 0; i < 128; i++)
+        if (cell_count.x * cell_count.y * cell_count.z > FLUX_MAX_LIGHT_CELLS)
+        {
+            // Too big to be worth putting in the grid
+            global_lights.push_back(i);
+            continue;
+        }
+
+        for (int x = min_cell.x; x <= max_cell.x; x++)
         {
-            if (lights[i].getEntityID() != -1)
+            for (int y = min_cell.y; y <= max_cell.y; y++)
             {
-                if (entity.hasComponent<Physics::BoundingCom>())
-                {
-                    // Use bounding box for collision
-                    auto box_en = entity.getComponent<Physics::BoundingCom>()->box;
-                    auto box_li = lights[i].getComponent<Physics::BoundingCom>()->box;
-                    if ((box_en->min_pos.x <= box_li->max_pos.x && box_en->max_pos.x >= box_li->min_pos.x)
-                        && (box_en->min_pos.y <= box_li->max_pos.y && box_en->max_pos.y >= box_li->min_pos.y)
-                        && (box_en->min_pos.z <= box_li->max_pos.z && box_en->max_pos.z >= box_li->min_pos.z))
-                    {
-                        lightinfo->effected_lights[light_count] = i;
-                        light_count ++;
-                        if (light_count == 8)
-                        {
-                            // We've reached max lights
-                            break;
-                        }
-                    }
-                }
-                else
+                for (int z = min_cell.z; z <= max_cell.z; z++)
                 {
-                    // Use the old, slow method
-                    // auto light_pos = glm::vec3(lights[i].getComponent<Transform::TransformCom>()->model * glm::vec4(0,0,0,1));
-                    // if (glm::distance(light_pos, position) <= lights[i].getComponent<LightCom>()->radius)
-                    // {
-                    //     lightinfo->effected_lights[light_count] = i;
-                    //     light_count ++;
-                    //     if (light_count == 8)
-                    //     {
-                    //         // We've reached max lights
-                    //         break;
-                    //     }
-                    // }
+                    grid[packCell(x, y, z)].push_back(i);
                 }
             }
         }
+    }
+}
+
+float Renderer::LightSystem::getContribution(int light, const glm::vec3& min_pos, const glm::vec3& max_pos) const
+{
+    if (lights[light].getEntityID() == -1)
+    {
+        return 0;
+    }
+
+    auto& ld = light_data[light];
+    float intensity = luminance(ld.color);
 
-        // Fill up the rest of the light com
-        for (int i = light_count; i < 8; i++)
+    if (ld.type == LightType::Directional)
+    {
+        return intensity;
+    }
+
+    // Distance from the light to the closest point of the box
+    glm::vec3 closest = glm::clamp(ld.position, min_pos, max_pos);
+    float dist = glm::distance(closest, ld.position);
+
+    if (dist >= ld.radius)
+    {
+        return 0;
+    }
+
+    float falloff = 1 - (dist / ld.radius);
+    return intensity * falloff * falloff;
+}
+
+void Renderer::LightSystem::assignLights(const glm::vec3& min_pos, const glm::vec3& max_pos, LightInfoCom* lightinfo)
+{
+    // Stamps make sure lights in multiple cells are only tested once
+    current_stamp++;
+    if (current_stamp == 0)
+    {
+        std::fill(light_stamps.begin(), light_stamps.end(), 0);
+        current_stamp = 1;
+    }
+
+    std::vector<std::pair<float, int>> candidates;
+    auto test_light = [&](int l) {
+        if (light_stamps[l] == current_stamp)
         {
-            lightinfo->effected_lights[i] = -1;
+            return;
         }
-        
-        entity.addComponent(lightinfo);
-        // No need to recalculate anything else
-        return;
+        light_stamps[l] = current_stamp;
+
+        float contribution = getContribution(l, min_pos, max_pos);
+        if (contribution > 0)
+        {
+            candidates.push_back({contribution, l});
+        }
+    };
+
+    for (auto l : global_lights)
+    {
+        test_light(l);
     }
 
-    auto lightinfo = entity.getComponent<LightInfoCom>();
+    glm::vec3 min_cell = glm::floor(min_pos / FLUX_LIGHT_GRID_CELL_SIZE);
+    glm::vec3 max_cell = glm::floor(max_pos / FLUX_LIGHT_GRID_CELL_SIZE);
+    glm::vec3 cell_count = max_cell - min_cell + glm::vec3(1);
 
-    if (tc->has_changed == true)
+    if (cell_count.x * cell_count.y * cell_count.z > FLUX_MAX_LIGHT_CELLS)
     {
-        // We have to do a full recalculation, anyways
-        // Calculate initial lighting
-        int light_count = 0;
-        for (int i = 0; i < 128; i++)
+        // Huge object, it's faster to just check every light
+        for (int l = 0; l < lights.size(); l++)
         {
-            if (lights[i].getEntityID() != -1)
+            test_light(l);
+        }
+    }
+    else
+    {
+        for (int x = min_cell.x; x <= max_cell.x; x++)
+        {
+            for (int y = min_cell.y; y <= max_cell.y; y++)
             {
-                if (entity.hasComponent<Physics::BoundingCom>())
+                for (int z = min_cell.z; z <= max_cell.z; z++)
                 {
-                    auto box_en = entity.getComponent<Physics::BoundingCom>()->box;
-                    auto box_li = lights[i].getComponent<Physics::BoundingCom>()->box;
-                    if ((box_en->min_pos.x <= box_li->max_pos.x && box_en->max_pos.x >= box_li->min_pos.x)
-                        && (box_en->min_pos.y <= box_li->max_pos.y && box_en->max_pos.y >= box_li->min_pos.y)
-                        && (box_en->min_pos.z <= box_li->max_pos.z && box_en->max_pos.z >= box_li->min_pos.z))
+                    auto cell = grid.find(packCell(x, y, z));
+                    if (cell == grid.end())
                     {
-                        lightinfo->effected_lights[light_count] = i;
-                        light_count ++;
-                        if (light_count == 8)
-                        {
-                            // We've reached max lights
-                            break;
-                        }
+                        continue;
+                    }
+
+                    for (auto l : cell->second)
+                    {
+                        test_light(l);
                     }
-                }
-                else
-                {
-                    // Old, bad method
-                    // auto light_pos = glm::vec3(lights[i].getComponent<Transform::TransformCom>()->model * glm::vec4(0,0,0,1));
-                    // auto lc = lights[i].getComponent<LightCom>();
-                    // if (lc == nullptr)
-                    // {
-                    //     LOG_WARN("How the hell did a non-light get into the lights array???");
-                    //     continue;
-                    // }
-                    
-                    // if (glm::distance(light_pos, position) <= lc->radius)
-                    // {
-                    //     lightinfo->effected_lights[light_count] = i;
-                    //     light_count ++;
-                    //     if (light_count == 8)
-                    //     {
-                    //         // We've reached max lights
-                    //         break;
-                    //     }
-                    // }
                 }
             }
         }
+    }
 
-        // Full up the rest of the light com
-        for (int i = light_count; i < 8; i++)
+    // Only keep the most important lights
+    int light_count = std::min((int)candidates.size(), FLUX_MAX_OBJECT_LIGHTS);
+    std::partial_sort(candidates.begin(), candidates.begin() + light_count, candidates.end(),
+                [](const std::pair<float, int>& a, const std::pair<float, int>& b) {
+        return a.first > b.first;
+    });
+
+    for (int i = 0; i < light_count; i++)
+    {
+        lightinfo->effected_lights[i] = candidates[i].second;
+    }
+
+    // Fill up the rest of the light com
+    for (int i = light_count; i < FLUX_MAX_OBJECT_LIGHTS; i++)
+    {
+        lightinfo->effected_lights[i] = -1;
+    }
+}
+
+// This must run AFTER transform system
+void Renderer::LightSystem::runSystem(EntityRef entity, float delta)
+{
+    if (entity.hasComponent<LightCom>())
+    {
+        auto lc = entity.getComponent<LightCom>();
+        if (!lc->inducted)
         {
-            lightinfo->effected_lights[i] = -1;
+            LOG_INFO("Adding new light");
+            new_lights.push_back(entity);
         }
-        
-        // No need to recalculate anything else
+    }
+
+    if (!entity.hasComponent<MeshCom>() || !entity.hasComponent<Transform::TransformCom>())
+    {
         return;
     }
+
+    auto tc = entity.getComponent<Transform::TransformCom>();
+
+    LightInfoCom* lightinfo;
+    if (!entity.hasComponent<LightInfoCom>())
+    {
+        lightinfo = new LightInfoCom;
+        entity.addComponent(lightinfo);
+    }
+    else
+    {
+        lightinfo = entity.getComponent<LightInfoCom>();
+        if (!tc->has_changed && !grid_changed)
+        {
+            // Nothing has moved, so nothing has changed
+            return;
+        }
+    }
+
+    if (entity.hasComponent<Physics::BoundingCom>())
+    {
+        // Use the bounding box, which is already in global space
+        auto box = entity.getComponent<Physics::BoundingCom>()->box;
+        assignLights(box->min_pos, box->max_pos, lightinfo);
+    }
+    else if (entity.hasComponent<StaticBatchCom>())
+    {
+        // Batches are already in world space
+        auto batch = entity.getComponent<StaticBatchCom>();
+        assignLights(batch->min_pos, batch->max_pos, lightinfo);
+    }
     else
     {
-        // Check if this entity is effected by any of the moved lights
-        for (auto l : lights_that_changed)
+        glm::vec3 position = glm::vec3(tc->model * glm::vec4(0, 0, 0, 1));
+        assignLights(position, position, lightinfo);
+    }
+}
+
+void Renderer::LightSystem::buildClusters(const glm::mat4& view, const glm::mat4& projection, float near, float far)
+{
+    constexpr int tile_count = FLUX_CLUSTERS_X * FLUX_CLUSTERS_Y;
+    constexpr int cluster_count = tile_count * FLUX_CLUSTERS_Z;
+
+    clusters.near = near;
+    clusters.far = far;
+    clusters.depth_scale = FLUX_CLUSTERS_Z / std::log(far / near);
+    clusters.depth_bias = -FLUX_CLUSTERS_Z * std::log(near) / std::log(far / near);
+
+    auto get_slice = [&](float depth) {
+        return glm::clamp((int)std::floor(std::log(depth) * clusters.depth_scale + clusters.depth_bias), 0, FLUX_CLUSTERS_Z - 1);
+    };
+
+    std::vector<ClusterPair> pairs;
+    std::vector<uint32_t> directional;
+
+    for (int i = 0; i < lights.size(); i++)
+    {
+        if (lights[i].getEntityID() == -1)
         {
-            bool is_current = false;
-            for (int i = 0; i < 8; i ++)
+            continue;
+        }
+
+        auto& light = light_data[i];
+        float intensity = luminance(light.color);
+
+        if (light.type == LightType::Directional)
+        {
+            // Lights every cluster, so it goes in the global list instead of taking up room in each one
+            directional.push_back(i);
+            continue;
+        }
+
+        glm::vec3 center = glm::vec3(view * glm::vec4(light.position, 1));
+        float depth = -center.z;
+        float radius = light.radius;
+
+        if (depth + radius < near || depth - radius > far)
+        {
+            // Can't be seen
+            continue;
+        }
+
+        int z_start = get_slice(std::max(depth - radius, near));
+        int z_end = get_slice(std::min(depth + radius, far));
+
+        // Screen space bounds
+        int x_start = 0, x_end = FLUX_CLUSTERS_X - 1;
+        int y_start = 0, y_end = FLUX_CLUSTERS_Y - 1;
+
+        if (depth - radius > near)
+        {
+            // Project the corners of the light's bounding box
+            // If the light crosses the near plane, it covers the entire screen anyways
+            glm::vec2 ndc_min(1, 1), ndc_max(-1, -1);
+            for (int corner = 0; corner < 8; corner++)
             {
-                if (l == lightinfo->effected_lights[i])
-                {
-                    if (entity.hasComponent<Physics::BoundingCom>())
-                    {
-                        auto box_en = entity.getComponent<Physics::BoundingCom>()->box;
-                        auto box_li = lights[l].getComponent<Physics::BoundingCom>()->box;
-                        if (!((box_en->min_pos.x <= box_li->max_pos.x && box_en->max_pos.x >= box_li->min_pos.x)
-                            && (box_en->min_pos.y <= box_li->max_pos.y && box_en->max_pos.y >= box_li->min_pos.y)
-                            && (box_en->min_pos.z <= box_li->max_pos.z && box_en->max_pos.z >= box_li->min_pos.z)))
-                        {
-                            // Remove that light from the list
-                            // Move every light after it forward
-                            for (int li = i; i < 7; i++)
-                            {
-                                lightinfo->effected_lights[li] = lightinfo->effected_lights[li + 1];
-                            }
-                            lightinfo->effected_lights[7] = -1;
-                            is_current = true;
-
-                            // LOG_INFO("Removing Light");
-                        }
-                    }
-                    else
-                    {
-                        // Re-calculate that light
-                        // auto light_pos = glm::vec3(lights[l].getComponent<Transform::TransformCom>()->model * glm::vec4(0,0,0,1));
-                        // if (glm::distance(light_pos, position) > lights[l].getComponent<LightCom>()->radius)
-                        // {
-                        //     // Remove that light from the list
-                        //     // Move every light after it forward
-                        //     for (int li = i; i < 7; i++)
-                        //     {
-                        //         lightinfo->effected_lights[li] = lightinfo->effected_lights[li + 1];
-                        //     }
-                        //     lightinfo->effected_lights[7] = -1;
-                        //     is_current = true;
-                        // }
-                    }
-                }
+                glm::vec3 offset((corner & 1) ? radius : -radius, (corner & 2) ? radius : -radius, (corner & 4) ? radius : -radius);
+                glm::vec4 clip = projection * glm::vec4(center + offset, 1);
+                glm::vec2 ndc = glm::vec2(clip.x, clip.y) / clip.w;
+
+                ndc_min = glm::min(ndc_min, ndc);
+                ndc_max = glm::max(ndc_max, ndc);
             }
 
-            if (!is_current)
+            if (ndc_min.x > 1 || ndc_min.y > 1 || ndc_max.x < -1 || ndc_max.y < -1)
             {
-                if (entity.hasComponent<Physics::BoundingCom>())
-                {
-                    auto box_en = entity.getComponent<Physics::BoundingCom>()->box;
-                    auto box_li = lights[l].getComponent<Physics::BoundingCom>()->box;
-                    if ((box_en->min_pos.x <= box_li->max_pos.x && box_en->max_pos.x >= box_li->min_pos.x)
-                        && (box_en->min_pos.y <= box_li->max_pos.y && box_en->max_pos.y >= box_li->min_pos.y)
-                        && (box_en->min_pos.z <= box_li->max_pos.z && box_en->max_pos.z >= box_li->min_pos.z))
-                    {
-                        // Add this light
-                        for (int i = 0; i < 8; i++)
-                        {
-                            if (lightinfo->effected_lights[i] == -1)
-                            {
-                                // Put it here
-                                lightinfo->effected_lights[i] = l;
-                                break;
-                            }
-                        }
-                    }
-                }
-                else
+                // Off screen
+                continue;
+            }
+
+            x_start = glm::clamp((int)std::floor((ndc_min.x * 0.5f + 0.5f) * FLUX_CLUSTERS_X), 0, FLUX_CLUSTERS_X - 1);
+            x_end = glm::clamp((int)std::floor((ndc_max.x * 0.5f + 0.5f) * FLUX_CLUSTERS_X), 0, FLUX_CLUSTERS_X - 1);
+            y_start = glm::clamp((int)std::floor((ndc_min.y * 0.5f + 0.5f) * FLUX_CLUSTERS_Y), 0, FLUX_CLUSTERS_Y - 1);
+            y_end = glm::clamp((int)std::floor((ndc_max.y * 0.5f + 0.5f) * FLUX_CLUSTERS_Y), 0, FLUX_CLUSTERS_Y - 1);
+        }
+
+        for (int z = z_start; z <= z_end; z++)
+        {
+            // Middle of the slice, in view space
+            float slice_depth = std::exp(((float)z + 0.5f - clusters.depth_bias) / clusters.depth_scale);
+
+            for (int y = y_start; y <= y_end; y++)
+            {
+                for (int x = x_start; x <= x_end; x++)
                 {
-                    // auto light_pos = glm::vec3(lights[l].getComponent<Transform::TransformCom>()->model * glm::vec4(0,0,0,1));
-                    // if (glm::distance(light_pos, position) <= lights[l].getComponent<LightCom>()->radius)
-                    // {
-                    //     // Add this light
-                    //     for (int i = 0; i < 8; i++)
-                    //     {
-                    //         if (lightinfo->effected_lights[i] == -1)
-                    //         {
-                    //             // Put it here
-                    //             lightinfo->effected_lights[i] = l;
-                    //             break;
-                    //         }
-                    //     }
-                    // }
+                    // Rank lights by how close they are to the middle of the cluster
+                    // This is only used for ordering, so it doesn't need to be exact
+                    glm::vec2 ndc(((float)x + 0.5f) / FLUX_CLUSTERS_X * 2 - 1, ((float)y + 0.5f) / FLUX_CLUSTERS_Y * 2 - 1);
+                    glm::vec3 cluster_center(ndc.x * slice_depth / projection[0][0], ndc.y * slice_depth / projection[1][1], -slice_depth);
+
+                    float falloff = std::max(1 - glm::distance(cluster_center, center) / radius, 0.01f);
+
+                    uint32_t cluster = x + (y * FLUX_CLUSTERS_X) + (z * tile_count);
+                    pairs.push_back({cluster, (uint32_t)i, intensity * falloff * falloff});
                 }
             }
         }
     }
+
+    // Group by cluster, most important lights first
+    std::sort(pairs.begin(), pairs.end(), [](const ClusterPair& a, const ClusterPair& b) {
+        if (a.cluster != b.cluster)
+        {
+            return a.cluster < b.cluster;
+        }
+        return a.score > b.score;
+    });
+
+    clusters.clusters.assign(cluster_count * 2, 0);
+    clusters.light_indices = directional;
+    clusters.light_indices.reserve(directional.size() + pairs.size());
+    clusters.directional_count = directional.size();
+
+    for (int i = 0; i < pairs.size(); i++)
+    {
+        auto cluster = pairs[i].cluster;
+        if (i == 0 || pairs[i - 1].cluster != cluster)
+        {
+            // Start of a new cluster
+            clusters.clusters[cluster * 2] = clusters.light_indices.size();
+        }
+
+        if (clusters.clusters[cluster * 2 + 1] < FLUX_MAX_CLUSTER_LIGHTS)
+        {
+            clusters.light_indices.push_back(pairs[i].light);
+            clusters.clusters[cluster * 2 + 1]++;
+        }
+    }
 }
 
 // =========================================================
@@ -635,6 +823,7 @@ void Flux::Renderer::TextureRes::destroy()
             // Since it's not only stored in the archive, I can still do this
             // Even when FLUX_NO_CPU_FREE is on
             stbi_image_free(image_data);
+            image_data = nullptr;
         }
 
         processed = true;
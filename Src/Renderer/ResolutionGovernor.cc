@@ -0,0 +1,102 @@
+#include "Flux/Log.hh"
+#include "Flux/Renderer.hh"
+
+// STL includes
+#include <algorithm>
+#include <cmath>
+
+using namespace Flux;
+
+/** How much of each new frame time goes into the smoothed time. Lower is smoother, but slower to react */
+#define FLUX_RESOLUTION_SMOOTHING 0.2f
+
+/** Frames have to be under this fraction of the target for the scale to go up */
+#define FLUX_RESOLUTION_HEADROOM 0.8f
+
+/** How much the scale goes up by each time */
+#define FLUX_RESOLUTION_RAISE_STEP 0.05f
+
+/** The scale never drops by more than this fraction in one frame, so one bad frame doesn't wreck the image */
+#define FLUX_RESOLUTION_MAX_DROP 0.25f
+
+Renderer::ResolutionGovernor::ResolutionGovernor(float target, float min_scale, float max_scale):
+target(target), min_scale(min_scale), max_scale(max_scale)
+{
+    reset();
+}
+
+void Renderer::ResolutionGovernor::reset()
+{
+    scale = max_scale;
+    smoothed_time = 0;
+    has_time = false;
+    frames_under = 0;
+}
+
+void Renderer::ResolutionGovernor::setLimits(float min, float max)
+{
+    min_scale = min;
+    max_scale = max;
+    setScale(std::min(std::max(scale, min_scale), max_scale));
+}
+
+void Renderer::ResolutionGovernor::setScale(float new_scale)
+{
+    // Time goes up with the number of pixels, which is the scale squared
+    float ratio = new_scale / scale;
+    smoothed_time *= ratio * ratio;
+    scale = new_scale;
+}
+
+float Renderer::ResolutionGovernor::update(float cpu_time, float gpu_time)
+{
+    // The cpu time doesn't change with the number of pixels, so it can't stand in for the gpu time.
+    // Until there is one, the scale stays where it is
+    if (gpu_time <= 0)
+    {
+        frames_under = 0;
+        return scale;
+    }
+
+    if (!has_time)
+    {
+        smoothed_time = gpu_time;
+        has_time = true;
+    }
+    else
+    {
+        smoothed_time += (gpu_time - smoothed_time) * FLUX_RESOLUTION_SMOOTHING;
+    }
+
+    if (smoothed_time > target)
+    {
+        frames_under = 0;
+
+        if (cpu_time > target && cpu_time > gpu_time)
+        {
+            // The cpu is holding things up, so fewer pixels won't make any difference
+            return scale;
+        }
+
+        // Go straight to the scale that should fit
+        float fit = scale * std::sqrt(target / smoothed_time);
+        float lowest = std::max(min_scale, scale * (1 - FLUX_RESOLUTION_MAX_DROP));
+        setScale(std::max(fit, lowest));
+    }
+    else if (smoothed_time < target * FLUX_RESOLUTION_HEADROOM && scale < max_scale)
+    {
+        // Going up is slower, so it doesn't flick back and forth
+        frames_under ++;
+        if (frames_under >= FLUX_RESOLUTION_RAISE_FRAMES)
+        {
+            setScale(std::min(scale + FLUX_RESOLUTION_RAISE_STEP, max_scale));
+            frames_under = 0;
+        }
+    }
+    else
+    {
+        frames_under = 0;
+    }
+
+    return scale;
+}
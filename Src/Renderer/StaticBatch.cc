@@ -0,0 +1,211 @@
+#include "Flux/Animation.hh"
+#include "Flux/ECS.hh"
+#include "Flux/Log.hh"
+#include "Flux/Renderer.hh"
+#include "Flux/Resources.hh"
+
+#include <glm/glm.hpp>
+
+// STL includes
+#include <cmath>
+#include <map>
+#include <tuple>
+#include <vector>
+
+using namespace Flux;
+
+namespace
+{
+    struct BatchSource
+    {
+        EntityRef entity;
+        glm::mat4 model;
+
+        /** Copies in the full vertex format, since the mesh itself can be packed and shared with other things */
+        std::vector<Renderer::Vertex> vertices;
+        std::vector<uint32_t> indices;
+    };
+
+    // Material, then cell
+    typedef std::tuple<int, int, int, int> BatchKey;
+}
+
+// Moves a direction into world space
+static void transformDirection(const glm::mat3& m, float& x, float& y, float& z)
+{
+    glm::vec3 v = m * glm::vec3(x, y, z);
+    float length = glm::length(v);
+    if (length > 0)
+    {
+        v /= length;
+    }
+
+    x = v.x;
+    y = v.y;
+    z = v.z;
+}
+
+// Merges sources[start] to sources[end - 1] into one batch entity
+static EntityRef createBatch(const std::vector<BatchSource>& sources, size_t start, size_t end, Resources::ResourceRef<Renderer::MaterialRes> material)
+{
+    uint32_t vertex_count = 0, index_count = 0;
+    for (size_t i = start; i < end; i++)
+    {
+        vertex_count += sources[i].vertices.size();
+        index_count += sources[i].indices.size();
+    }
+
+    auto mesh = new Renderer::MeshRes;
+    mesh->draw_mode = Renderer::DrawMode::Triangles;
+    mesh->vertices_length = vertex_count;
+    mesh->vertices = new Renderer::Vertex[vertex_count];
+    mesh->indices_length = index_count;
+    mesh->indices = new uint32_t[index_count];
+
+    auto batch_com = new Renderer::StaticBatchCom;
+    batch_com->min_pos = glm::vec3(INFINITY);
+    batch_com->max_pos = glm::vec3(-INFINITY);
+
+    uint32_t vertex_offset = 0, index_offset = 0;
+    for (size_t i = start; i < end; i++)
+    {
+        auto& src = sources[i];
+        glm::mat3 normal_matrix = glm::transpose(glm::inverse(glm::mat3(src.model)));
+
+        for (uint32_t v = 0; v < src.vertices.size(); v++)
+        {
+            auto vert = src.vertices[v];
+
+            glm::vec3 position = glm::vec3(src.model * glm::vec4(vert.x, vert.y, vert.z, 1));
+            vert.x = position.x;
+            vert.y = position.y;
+            vert.z = position.z;
+
+            transformDirection(normal_matrix, vert.nx, vert.ny, vert.nz);
+            transformDirection(glm::mat3(src.model), vert.tanx, vert.tany, vert.tanz);
+            transformDirection(glm::mat3(src.model), vert.btanx, vert.btany, vert.btanz);
+
+            batch_com->min_pos = glm::min(batch_com->min_pos, position);
+            batch_com->max_pos = glm::max(batch_com->max_pos, position);
+
+            mesh->vertices[vertex_offset + v] = vert;
+        }
+
+        // Mirrored meshes would end up inside out
+        bool flip = glm::determinant(glm::mat3(src.model)) < 0;
+
+        for (uint32_t j = 0; j < src.indices.size(); j += 3)
+        {
+            mesh->indices[index_offset + j] = src.indices[j] + vertex_offset;
+            mesh->indices[index_offset + j + 1] = src.indices[flip ? j + 2 : j + 1] + vertex_offset;
+            mesh->indices[index_offset + j + 2] = src.indices[flip ? j + 1 : j + 2] + vertex_offset;
+        }
+
+        vertex_offset += src.vertices.size();
+        index_offset += src.indices.size();
+
+        EntityRef entity = src.entity;
+        batch_com->sources.push_back(entity);
+        entity.getComponent<Renderer::StaticCom>()->batched = true;
+    }
+
+    auto batch = sources[start].entity.getCtx()->createEntity();
+    Renderer::addMesh(batch, Resources::createResource(mesh), material);
+    batch.addComponent(batch_com);
+
+    return batch;
+}
+
+std::vector<EntityRef> Renderer::batchStatic(const std::vector<EntityRef>& entities)
+{
+    std::map<BatchKey, std::vector<BatchSource>> groups;
+    std::map<int, Resources::ResourceRef<MaterialRes>> materials;
+
+    for (auto entity : entities)
+    {
+        if (!entity.hasComponent<StaticCom>() || !entity.hasComponent<MeshCom>() || !entity.hasComponent<Transform::TransformCom>())
+        {
+            continue;
+        }
+
+        if (entity.getComponent<StaticCom>()->batched)
+        {
+            continue;
+        }
+
+        if (entity.hasComponent<ImpostorCom>())
+        {
+            // It has to be drawn by itself to switch to its impostor
+            continue;
+        }
+
+        auto mc = entity.getComponent<MeshCom>();
+        auto mesh = mc->mesh_resource.getPtr();
+        if (mesh->draw_mode != DrawMode::Triangles || mesh->dynamic || mesh->indices_length % 3 != 0)
+        {
+            continue;
+        }
+
+        // Batches are in world space, so skinning wouldn't move them.
+        // They don't have levels of detail or meshlets either, so meshes that do are better off by themselves
+        if (!mesh->skin.empty() || entity.hasComponent<Animation::AnimatorCom>() || !mesh->lods.empty() || !mesh->meshlets.empty())
+        {
+            continue;
+        }
+
+        // Batches are always in the full vertex format, since quantized positions wouldn't survive world space
+        BatchSource src;
+        src.entity = entity;
+        src.model = Transform::getParentTransform(entity);
+        src.vertices = mesh->getUnpackedVertices();
+        src.indices = mesh->getUnpackedIndices();
+
+        glm::vec3 cell = glm::floor(glm::vec3(src.model[3]) / FLUX_STATIC_BATCH_CELL_SIZE);
+        int material = mc->mat_resource.getBaseEntity().getEntityID();
+
+        groups[BatchKey(material, (int)cell.x, (int)cell.y, (int)cell.z)].push_back(src);
+        materials[material] = mc->mat_resource;
+    }
+
+    std::vector<EntityRef> batches;
+    for (auto& group : groups)
+    {
+        auto& sources = group.second;
+        if (sources.size() < 2)
+        {
+            // Nothing to gain
+            continue;
+        }
+
+        // Split it up so each batch stays under the vertex limit
+        size_t start = 0;
+        uint32_t vertices = 0;
+        for (size_t i = 0; i < sources.size(); i++)
+        {
+            if (i > start && vertices + sources[i].vertices.size() > FLUX_STATIC_BATCH_MAX_VERTICES)
+            {
+                if (i - start > 1)
+                {
+                    batches.push_back(createBatch(sources, start, i, materials[std::get<0>(group.first)]));
+                }
+
+                start = i;
+                vertices = 0;
+            }
+
+            vertices += sources[i].vertices.size();
+        }
+
+        if (sources.size() - start > 1)
+        {
+            batches.push_back(createBatch(sources, start, sources.size(), materials[std::get<0>(group.first)]));
+        }
+    }
+
+    if (!batches.empty())
+    {
+        LOG_INFO("Merged static meshes into " + std::to_string(batches.size()) + " batches");
+    }
+
+    return batches;
+}
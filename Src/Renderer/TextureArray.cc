@@ -0,0 +1,226 @@
+#include "Flux/ECS.hh"
+#include "Flux/Log.hh"
+#include "Flux/Renderer.hh"
+#include "Flux/Resources.hh"
+
+// STL includes
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <map>
+#include <tuple>
+#include <vector>
+
+using namespace Flux;
+
+namespace
+{
+    // A place a texture is used
+    struct TextureUse
+    {
+        Resources::ResourceRef<Renderer::MaterialRes> material;
+        std::string name;
+    };
+
+    struct ArrayLayer
+    {
+        Resources::ResourceRef<Renderer::TextureRes> texture;
+        std::vector<TextureUse> uses;
+    };
+
+    // Width, height, format, then mip count
+    typedef std::tuple<uint32_t, uint32_t, uint8_t, uint32_t> ArrayKey;
+}
+
+// Whether some GLSL declares a sampler2DArray with that name
+static bool declaresArray(const std::string& src, const std::string& name)
+{
+    size_t pos = 0;
+    while ((pos = src.find("sampler2DArray", pos)) != std::string::npos)
+    {
+        pos += 14;
+
+        size_t start = src.find_first_not_of(" \t\r\n", pos);
+        if (start != std::string::npos && src.compare(start, name.size(), name) == 0)
+        {
+            size_t end = start + name.size();
+            if (end == src.size() || !(std::isalnum((unsigned char)src[end]) || src[end] == '_'))
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// Only shaders written for arrays can have their textures moved into one
+static bool supportsArray(Renderer::MaterialRes* material, const std::string& name)
+{
+    if (material->shaders.getBaseEntity().getEntityID() == -1)
+    {
+        return false;
+    }
+
+    auto shader = material->shaders.getPtr();
+    bool has_sampler = declaresArray(shader->frag_src, name) || declaresArray(shader->vert_src, name);
+    bool has_layer = shader->frag_src.find(name + "_layer") != std::string::npos || shader->vert_src.find(name + "_layer") != std::string::npos;
+
+    return has_sampler && has_layer;
+}
+
+// Size of one level of a texture, or the whole thing if it hasn't been cooked
+static uint32_t getLevelSize(Renderer::TextureRes* tex, int level)
+{
+    if (tex->mip_sizes.empty())
+    {
+        return tex->width * tex->height * 4;
+    }
+
+    return tex->mip_sizes[level];
+}
+
+// Makes one array out of layers[start] to layers[end - 1]
+static Resources::ResourceRef<Renderer::TextureRes> createArray(std::vector<ArrayLayer>& layers, size_t start, size_t end)
+{
+    auto first = layers[start].texture.getPtr();
+    uint32_t layer_count = end - start;
+
+    auto array = new Renderer::TextureRes;
+    array->internal = true;
+    array->width = first->width;
+    array->height = first->height;
+    array->format = first->format;
+    array->layers = layer_count;
+
+    // Uncooked textures only have the one level, and GL makes the rest
+    uint32_t levels = first->mip_sizes.empty() ? 1 : first->mip_sizes.size();
+
+    array->image_data_size = 0;
+    for (uint32_t level = 0; level < levels; level++)
+    {
+        array->image_data_size += getLevelSize(first, level) * layer_count;
+        if (!first->mip_sizes.empty())
+        {
+            array->mip_sizes.push_back(getLevelSize(first, level) * layer_count);
+        }
+    }
+
+    array->image_data = new unsigned char[array->image_data_size];
+
+    // Each level has every layer in it, so the layers are interleaved
+    uint32_t offset = 0;
+    std::vector<uint32_t> source_offsets(layer_count, 0);
+    for (uint32_t level = 0; level < levels; level++)
+    {
+        uint32_t size = getLevelSize(first, level);
+        for (uint32_t l = 0; l < layer_count; l++)
+        {
+            auto tex = layers[start + l].texture.getPtr();
+            std::memcpy(array->image_data + offset, tex->image_data + source_offsets[l], size);
+
+            source_offsets[l] += size;
+            offset += size;
+        }
+    }
+
+    auto array_res = Resources::createResource(array);
+
+    for (uint32_t l = 0; l < layer_count; l++)
+    {
+        for (auto& use : layers[start + l].uses)
+        {
+            use.material->setTexture(use.name, array_res);
+            Renderer::setUniform(use.material, use.name + "_layer", (int)l);
+        }
+    }
+
+    return array_res;
+}
+
+std::vector<Resources::ResourceRef<Renderer::TextureRes>> Renderer::buildTextureArrays(const std::vector<Resources::ResourceRef<MaterialRes>>& materials, uint32_t max_size)
+{
+    std::map<ArrayKey, std::vector<ArrayLayer>> groups;
+
+    // Where each texture went, so textures shared by materials only get one layer
+    std::map<int, std::pair<ArrayKey, size_t>> seen;
+
+    for (auto material : materials)
+    {
+        for (auto& mat_tex : material->textures)
+        {
+            if (!supportsArray(material.getPtr(), mat_tex.name))
+            {
+                LOG_WARN("Texture " + mat_tex.name + " isn't a sampler2DArray with a " + mat_tex.name
+                    + "_layer uniform in its material's shader, so it's been left out of the texture arrays");
+                continue;
+            }
+
+            int id = mat_tex.texture.getBaseEntity().getEntityID();
+
+            auto it = seen.find(id);
+            if (it != seen.end())
+            {
+                groups[it->second.first][it->second.second].uses.push_back(TextureUse {material, mat_tex.name});
+                continue;
+            }
+
+            auto tex = mat_tex.texture.getPtr();
+            if (tex->layers > 1 || tex->processed)
+            {
+                // Already an array, or the data is gone
+                continue;
+            }
+
+            if (tex->image_data == nullptr && !tex->filename.empty())
+            {
+                tex->loadImage(tex->filename);
+            }
+
+            if (tex->image_data == nullptr || tex->width > max_size || tex->height > max_size)
+            {
+                continue;
+            }
+
+            if (tex->mip_sizes.empty() && tex->format != TextureFormat::RGBA8)
+            {
+                continue;
+            }
+
+            ArrayKey key(tex->width, tex->height, (uint8_t)tex->format, tex->mip_sizes.size());
+
+            ArrayLayer layer;
+            layer.texture = mat_tex.texture;
+            layer.uses.push_back(TextureUse {material, mat_tex.name});
+
+            groups[key].push_back(layer);
+            seen[id] = std::make_pair(key, groups[key].size() - 1);
+        }
+    }
+
+    std::vector<Resources::ResourceRef<TextureRes>> arrays;
+    for (auto& group : groups)
+    {
+        auto& layers = group.second;
+
+        // Split it up so each array stays under the layer limit
+        for (size_t start = 0; start < layers.size(); start += FLUX_MAX_TEXTURE_ARRAY_LAYERS)
+        {
+            size_t end = std::min(start + FLUX_MAX_TEXTURE_ARRAY_LAYERS, layers.size());
+            if (end - start < 2)
+            {
+                // Nothing to gain
+                continue;
+            }
+
+            arrays.push_back(createArray(layers, start, end));
+        }
+    }
+
+    if (!arrays.empty())
+    {
+        LOG_INFO("Packed material textures into " + std::to_string(arrays.size()) + " texture arrays");
+    }
+
+    return arrays;
+}
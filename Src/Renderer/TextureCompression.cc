@@ -0,0 +1,649 @@
+#include "Flux/Log.hh"
+#include "Flux/Renderer.hh"
+
+// STL includes
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// STB
+#include "stb/stb_image.h"
+
+using namespace Flux;
+
+// =========================================================
+// Mips
+// =========================================================
+
+// Halves the size of an RGBA8 image with a box filter
+static std::vector<uint8_t> downsample(const std::vector<uint8_t>& src, uint32_t width, uint32_t height)
+{
+    uint32_t new_width = std::max(width / 2, (uint32_t)1);
+    uint32_t new_height = std::max(height / 2, (uint32_t)1);
+    std::vector<uint8_t> out(new_width * new_height * 4);
+
+    for (uint32_t y = 0; y < new_height; y++)
+    {
+        for (uint32_t x = 0; x < new_width; x++)
+        {
+            // Odd sizes just use the edge twice
+            uint32_t x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+            uint32_t y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+
+            for (int c = 0; c < 4; c++)
+            {
+                uint32_t sum = src[(y0 * width + x0) * 4 + c] + src[(y0 * width + x1) * 4 + c]
+                             + src[(y1 * width + x0) * 4 + c] + src[(y1 * width + x1) * 4 + c];
+                out[(y * new_width + x) * 4 + c] = (sum + 2) / 4;
+            }
+        }
+    }
+
+    return out;
+}
+
+// =========================================================
+// ETC2 / EAC
+// =========================================================
+
+// Only the ETC1 compatible modes (individual and differential) are used for encoding.
+// They are valid ETC2, and much simpler than the T, H and planar modes
+
+static const int etc_modifiers[8][2] = {
+    {2, 8}, {5, 17}, {9, 29}, {13, 42}, {18, 60}, {24, 80}, {33, 106}, {47, 183}
+};
+
+static const int eac_modifiers[16][8] = {
+    {-3, -6, -9, -15, 2, 5, 8, 14},
+    {-3, -7, -10, -13, 2, 6, 9, 12},
+    {-2, -5, -8, -13, 1, 4, 7, 12},
+    {-2, -4, -6, -13, 1, 3, 5, 12},
+    {-3, -6, -8, -12, 2, 5, 7, 11},
+    {-3, -7, -9, -11, 2, 6, 8, 10},
+    {-4, -7, -8, -11, 3, 6, 7, 10},
+    {-3, -5, -8, -11, 2, 4, 7, 10},
+    {-2, -6, -8, -10, 1, 5, 7, 9},
+    {-2, -5, -8, -10, 1, 4, 7, 9},
+    {-2, -4, -8, -10, 1, 3, 7, 9},
+    {-2, -5, -7, -10, 1, 4, 6, 9},
+    {-3, -4, -7, -10, 2, 3, 6, 9},
+    {-1, -2, -3, -10, 0, 1, 2, 9},
+    {-4, -6, -8, -9, 3, 5, 7, 8},
+    {-3, -5, -7, -9, 2, 4, 6, 8}
+};
+
+static int clamp255(int v)
+{
+    return std::min(std::max(v, 0), 255);
+}
+
+// Pixel index values are: +a, +b, -a, -b
+static int etcModifier(int table, int index)
+{
+    int m = etc_modifiers[table][index & 1];
+    return index & 2 ? -m : m;
+}
+
+/** A 4x4 block of RGBA8 pixels, indexed by y * 4 + x */
+typedef uint8_t Block[16][4];
+
+// Is the pixel part of the given subblock
+static bool inSubblock(int x, int y, bool flip, int subblock)
+{
+    return (flip ? y : x) / 2 == subblock;
+}
+
+// Finds the best table for a subblock. Returns the error
+static int fitSubblock(const Block& block, bool flip, int subblock, const int base[3], int& best_table, int* best_indices)
+{
+    int best_error = INT_MAX;
+
+    for (int t = 0; t < 8; t++)
+    {
+        int error = 0;
+        int indices[16];
+
+        for (int y = 0; y < 4 && error < best_error; y++)
+        {
+            for (int x = 0; x < 4; x++)
+            {
+                if (!inSubblock(x, y, flip, subblock))
+                {
+                    continue;
+                }
+
+                auto pixel = block[y * 4 + x];
+                int pixel_error = INT_MAX;
+
+                for (int i = 0; i < 4; i++)
+                {
+                    int m = etcModifier(t, i);
+                    int e = 0;
+                    for (int c = 0; c < 3; c++)
+                    {
+                        int d = clamp255(base[c] + m) - pixel[c];
+                        e += d * d;
+                    }
+
+                    if (e < pixel_error)
+                    {
+                        pixel_error = e;
+                        indices[y * 4 + x] = i;
+                    }
+                }
+
+                error += pixel_error;
+            }
+        }
+
+        if (error < best_error)
+        {
+            best_error = error;
+            best_table = t;
+            for (int y = 0; y < 4; y++)
+            {
+                for (int x = 0; x < 4; x++)
+                {
+                    if (inSubblock(x, y, flip, subblock))
+                    {
+                        best_indices[y * 4 + x] = indices[y * 4 + x];
+                    }
+                }
+            }
+        }
+    }
+
+    return best_error;
+}
+
+static void writeBigEndian(uint8_t* out, uint64_t bits, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        out[i] = (bits >> ((bytes - 1 - i) * 8)) & 0xFF;
+    }
+}
+
+static uint64_t readBigEndian(const uint8_t* in, int bytes)
+{
+    uint64_t bits = 0;
+    for (int i = 0; i < bytes; i++)
+    {
+        bits = (bits << 8) | in[i];
+    }
+
+    return bits;
+}
+
+static void encodeColorBlock(const Block& block, uint8_t* out)
+{
+    int best_error = INT_MAX;
+    uint64_t best_bits = 0;
+
+    for (int flip = 0; flip < 2; flip++)
+    {
+        // Average color of each subblock
+        float average[2][3] = {{0, 0, 0}, {0, 0, 0}};
+        for (int y = 0; y < 4; y++)
+        {
+            for (int x = 0; x < 4; x++)
+            {
+                int s = inSubblock(x, y, flip, 0) ? 0 : 1;
+                for (int c = 0; c < 3; c++)
+                {
+                    average[s][c] += block[y * 4 + x][c] / 8.0f;
+                }
+            }
+        }
+
+        // Try differential mode: 555 base color, and a 333 offset for the second one
+        int q5[2][3];
+        bool fits = true;
+        for (int s = 0; s < 2; s++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                q5[s][c] = (int)std::round(average[s][c] * 31.0f / 255.0f);
+            }
+        }
+
+        for (int c = 0; c < 3; c++)
+        {
+            int d = q5[1][c] - q5[0][c];
+            fits = fits && d >= -4 && d <= 3;
+        }
+
+        if (fits)
+        {
+            int tables[2], indices[16];
+            int error = 0;
+            for (int s = 0; s < 2; s++)
+            {
+                int base[3];
+                for (int c = 0; c < 3; c++)
+                {
+                    base[c] = (q5[s][c] << 3) | (q5[s][c] >> 2);
+                }
+                error += fitSubblock(block, flip, s, base, tables[s], indices);
+            }
+
+            if (error < best_error)
+            {
+                best_error = error;
+                best_bits = ((uint64_t)q5[0][0] << 59) | ((uint64_t)((q5[1][0] - q5[0][0]) & 7) << 56)
+                          | ((uint64_t)q5[0][1] << 51) | ((uint64_t)((q5[1][1] - q5[0][1]) & 7) << 48)
+                          | ((uint64_t)q5[0][2] << 43) | ((uint64_t)((q5[1][2] - q5[0][2]) & 7) << 40)
+                          | ((uint64_t)tables[0] << 37) | ((uint64_t)tables[1] << 34)
+                          | ((uint64_t)1 << 33) | ((uint64_t)flip << 32);
+
+                for (int y = 0; y < 4; y++)
+                {
+                    for (int x = 0; x < 4; x++)
+                    {
+                        int j = x * 4 + y;
+                        int index = indices[y * 4 + x];
+                        best_bits |= ((uint64_t)(index >> 1) << (16 + j)) | ((uint64_t)(index & 1) << j);
+                    }
+                }
+            }
+        }
+
+        // Try individual mode: two 444 colors
+        {
+            int q4[2][3];
+            int tables[2], indices[16];
+            int error = 0;
+            for (int s = 0; s < 2; s++)
+            {
+                int base[3];
+                for (int c = 0; c < 3; c++)
+                {
+                    q4[s][c] = (int)std::round(average[s][c] * 15.0f / 255.0f);
+                    base[c] = q4[s][c] * 17;
+                }
+                error += fitSubblock(block, flip, s, base, tables[s], indices);
+            }
+
+            if (error < best_error)
+            {
+                best_error = error;
+                best_bits = ((uint64_t)q4[0][0] << 60) | ((uint64_t)q4[1][0] << 56)
+                          | ((uint64_t)q4[0][1] << 52) | ((uint64_t)q4[1][1] << 48)
+                          | ((uint64_t)q4[0][2] << 44) | ((uint64_t)q4[1][2] << 40)
+                          | ((uint64_t)tables[0] << 37) | ((uint64_t)tables[1] << 34)
+                          | ((uint64_t)flip << 32);
+
+                for (int y = 0; y < 4; y++)
+                {
+                    for (int x = 0; x < 4; x++)
+                    {
+                        int j = x * 4 + y;
+                        int index = indices[y * 4 + x];
+                        best_bits |= ((uint64_t)(index >> 1) << (16 + j)) | ((uint64_t)(index & 1) << j);
+                    }
+                }
+            }
+        }
+    }
+
+    writeBigEndian(out, best_bits, 8);
+}
+
+static void encodeAlphaBlock(const Block& block, uint8_t* out)
+{
+    int min_alpha = 255, max_alpha = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        min_alpha = std::min(min_alpha, (int)block[i][3]);
+        max_alpha = std::max(max_alpha, (int)block[i][3]);
+    }
+
+    int best_error = INT_MAX;
+    int best_base = 0, best_multiplier = 1, best_table = 0;
+    int best_indices[16] = {0};
+
+    for (int t = 0; t < 16; t++)
+    {
+        int range = eac_modifiers[t][7] - eac_modifiers[t][3];
+        int guess = (int)std::round((float)(max_alpha - min_alpha) / range);
+
+        for (int m = std::max(guess - 1, 1); m <= std::min(guess + 1, 15); m++)
+        {
+            // Line the lowest modifier up with the lowest alpha
+            int base = clamp255(min_alpha - eac_modifiers[t][3] * m);
+
+            int error = 0;
+            int indices[16];
+            for (int i = 0; i < 16 && error < best_error; i++)
+            {
+                int pixel_error = INT_MAX;
+                for (int j = 0; j < 8; j++)
+                {
+                    int d = clamp255(base + eac_modifiers[t][j] * m) - block[i][3];
+                    if (d * d < pixel_error)
+                    {
+                        pixel_error = d * d;
+                        indices[i] = j;
+                    }
+                }
+                error += pixel_error;
+            }
+
+            if (error < best_error)
+            {
+                best_error = error;
+                best_base = base;
+                best_multiplier = m;
+                best_table = t;
+                std::memcpy(best_indices, indices, sizeof(indices));
+            }
+        }
+    }
+
+    out[0] = best_base;
+    out[1] = (best_multiplier << 4) | best_table;
+
+    uint64_t bits = 0;
+    for (int y = 0; y < 4; y++)
+    {
+        for (int x = 0; x < 4; x++)
+        {
+            int j = x * 4 + y;
+            bits |= (uint64_t)best_indices[y * 4 + x] << (45 - (j * 3));
+        }
+    }
+
+    writeBigEndian(out + 2, bits, 6);
+}
+
+static bool decodeColorBlock(const uint8_t* in, Block& block)
+{
+    uint64_t bits = readBigEndian(in, 8);
+    bool diff = (bits >> 33) & 1;
+    bool flip = (bits >> 32) & 1;
+
+    int base[2][3];
+    if (diff)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            int shift = 59 - (c * 8);
+            int c0 = (bits >> shift) & 31;
+            int d = (bits >> (shift - 3)) & 7;
+            int c1 = c0 + (d >= 4 ? d - 8 : d);
+
+            if (c1 < 0 || c1 > 31)
+            {
+                // T, H or planar mode, which we never write
+                return false;
+            }
+
+            base[0][c] = (c0 << 3) | (c0 >> 2);
+            base[1][c] = (c1 << 3) | (c1 >> 2);
+        }
+    }
+    else
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            int shift = 60 - (c * 8);
+            base[0][c] = ((bits >> shift) & 15) * 17;
+            base[1][c] = ((bits >> (shift - 4)) & 15) * 17;
+        }
+    }
+
+    int tables[2] = {(int)((bits >> 37) & 7), (int)((bits >> 34) & 7)};
+
+    for (int y = 0; y < 4; y++)
+    {
+        for (int x = 0; x < 4; x++)
+        {
+            int j = x * 4 + y;
+            int index = (((bits >> (16 + j)) & 1) << 1) | ((bits >> j) & 1);
+            int s = inSubblock(x, y, flip, 0) ? 0 : 1;
+            int m = etcModifier(tables[s], index);
+
+            for (int c = 0; c < 3; c++)
+            {
+                block[y * 4 + x][c] = clamp255(base[s][c] + m);
+            }
+        }
+    }
+
+    return true;
+}
+
+static void decodeAlphaBlock(const uint8_t* in, Block& block)
+{
+    int base = in[0];
+    int multiplier = in[1] >> 4;
+    int table = in[1] & 15;
+    uint64_t bits = readBigEndian(in + 2, 6);
+
+    for (int y = 0; y < 4; y++)
+    {
+        for (int x = 0; x < 4; x++)
+        {
+            int j = x * 4 + y;
+            int index = (bits >> (45 - (j * 3))) & 7;
+            block[y * 4 + x][3] = clamp255(base + eac_modifiers[table][index] * multiplier);
+        }
+    }
+}
+
+static uint32_t blockSize(Renderer::TextureFormat format)
+{
+    return format == Renderer::TextureFormat::ETC2_RGBA8 ? 16 : 8;
+}
+
+static void encodeImage(const std::vector<uint8_t>& image, uint32_t width, uint32_t height, Renderer::TextureFormat format, std::vector<uint8_t>& out)
+{
+    uint32_t blocks_x = (width + 3) / 4;
+    uint32_t blocks_y = (height + 3) / 4;
+    uint32_t block_size = blockSize(format);
+
+    size_t start = out.size();
+    out.resize(start + (blocks_x * blocks_y * block_size));
+
+    for (uint32_t by = 0; by < blocks_y; by++)
+    {
+        for (uint32_t bx = 0; bx < blocks_x; bx++)
+        {
+            // Blocks that hang over the edge just repeat the last pixel
+            Block block;
+            for (int y = 0; y < 4; y++)
+            {
+                for (int x = 0; x < 4; x++)
+                {
+                    uint32_t px = std::min(bx * 4 + x, width - 1);
+                    uint32_t py = std::min(by * 4 + y, height - 1);
+                    std::memcpy(block[y * 4 + x], &image[(py * width + px) * 4], 4);
+                }
+            }
+
+            uint8_t* dest = &out[start + ((by * blocks_x + bx) * block_size)];
+            if (format == Renderer::TextureFormat::ETC2_RGBA8)
+            {
+                // Alpha comes first
+                encodeAlphaBlock(block, dest);
+                dest += 8;
+            }
+
+            encodeColorBlock(block, dest);
+        }
+    }
+}
+
+static bool decodeImage(const uint8_t* data, uint32_t width, uint32_t height, Renderer::TextureFormat format, std::vector<uint8_t>& out)
+{
+    uint32_t blocks_x = (width + 3) / 4;
+    uint32_t blocks_y = (height + 3) / 4;
+    uint32_t block_size = blockSize(format);
+    bool success = true;
+
+    size_t start = out.size();
+    out.resize(start + (width * height * 4));
+
+    for (uint32_t by = 0; by < blocks_y; by++)
+    {
+        for (uint32_t bx = 0; bx < blocks_x; bx++)
+        {
+            const uint8_t* src = data + ((by * blocks_x + bx) * block_size);
+
+            Block block;
+            for (int i = 0; i < 16; i++)
+            {
+                block[i][3] = 255;
+            }
+
+            if (format == Renderer::TextureFormat::ETC2_RGBA8)
+            {
+                decodeAlphaBlock(src, block);
+                src += 8;
+            }
+
+            success = decodeColorBlock(src, block) && success;
+
+            for (int y = 0; y < 4; y++)
+            {
+                for (int x = 0; x < 4; x++)
+                {
+                    uint32_t px = bx * 4 + x;
+                    uint32_t py = by * 4 + y;
+                    if (px < width && py < height)
+                    {
+                        std::memcpy(&out[start + ((py * width + px) * 4)], block[y * 4 + x], 4);
+                    }
+                }
+            }
+        }
+    }
+
+    return success;
+}
+
+// =========================================================
+// Texture Resource
+// =========================================================
+
+void Renderer::TextureRes::cook(TextureFormat new_format, bool generate_mips)
+{
+    if (!mip_sizes.empty())
+    {
+        LOG_WARN("Texture " + filename + " has already been cooked");
+        return;
+    }
+
+    if (layers > 1)
+    {
+        // Arrays are built from their layers, so those should be cooked instead
+        LOG_WARN("Texture arrays can't be cooked");
+        return;
+    }
+
+    if (image_data == nullptr && !filename.empty())
+    {
+        loadImage(filename);
+    }
+
+    if (image_data == nullptr)
+    {
+        LOG_ERROR("Texture has no data to cook");
+        return;
+    }
+
+    // Build the mip chain
+    std::vector<uint8_t> level(image_data, image_data + (width * height * 4));
+    uint32_t level_width = width, level_height = height;
+
+    std::vector<uint8_t> cooked;
+    while (true)
+    {
+        size_t before = cooked.size();
+        if (new_format == TextureFormat::RGBA8)
+        {
+            cooked.insert(cooked.end(), level.begin(), level.end());
+        }
+        else
+        {
+            encodeImage(level, level_width, level_height, new_format, cooked);
+        }
+        mip_sizes.push_back(cooked.size() - before);
+
+        if (!generate_mips || (level_width == 1 && level_height == 1))
+        {
+            break;
+        }
+
+        level = downsample(level, level_width, level_height);
+        level_width = std::max(level_width / 2, (uint32_t)1);
+        level_height = std::max(level_height / 2, (uint32_t)1);
+    }
+
+    // Replace the old data
+    if (internal)
+    {
+        delete[] image_data;
+    }
+    else
+    {
+        stbi_image_free(image_data);
+    }
+
+    image_data_size = cooked.size();
+    image_data = new unsigned char[image_data_size];
+    std::memcpy(image_data, cooked.data(), image_data_size);
+
+    format = new_format;
+    internal = true;
+}
+
+bool Renderer::decompressMips(const unsigned char* data, std::vector<uint32_t>& mip_sizes, uint32_t width, uint32_t height, uint32_t layers, TextureFormat format, std::vector<unsigned char>& decoded)
+{
+    std::vector<uint32_t> new_sizes;
+    uint32_t offset = 0;
+    bool success = true;
+
+    for (int i = 0; i < mip_sizes.size(); i++)
+    {
+        size_t before = decoded.size();
+        uint32_t mip_width = std::max(width >> i, (uint32_t)1);
+        uint32_t mip_height = std::max(height >> i, (uint32_t)1);
+
+        // Every layer in a level is the same size
+        uint32_t layer_size = mip_sizes[i] / layers;
+        for (uint32_t l = 0; l < layers; l++)
+        {
+            success = decodeImage(data + offset + l * layer_size, mip_width, mip_height, format, decoded) && success;
+        }
+
+        new_sizes.push_back(decoded.size() - before);
+        offset += mip_sizes[i];
+    }
+
+    mip_sizes = new_sizes;
+    return success;
+}
+
+void Renderer::TextureRes::decompress()
+{
+    if (format == TextureFormat::RGBA8 || image_data == nullptr)
+    {
+        return;
+    }
+
+    std::vector<uint8_t> decoded;
+    if (!decompressMips(image_data, mip_sizes, width, height, layers, format, decoded))
+    {
+        LOG_WARN("Texture " + filename + " uses ETC2 modes that can't be decompressed");
+    }
+
+    delete[] image_data;
+    image_data_size = decoded.size();
+    image_data = new unsigned char[image_data_size];
+    std::memcpy(image_data, decoded.data(), image_data_size);
+
+    format = TextureFormat::RGBA8;
+}
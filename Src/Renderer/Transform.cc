@@ -18,6 +18,7 @@ using namespace Flux;
 static Flux::EntityRef camera;
 
 glm::vec3 Transform::camera_position = glm::vec3(0, 0, 0);
+glm::mat4 Transform::camera_view = glm::mat4();
 
 void Flux::Transform::setCamera(EntityRef entity)
 {
@@ -395,6 +396,7 @@ void Flux::Transform::CameraSystem::runSystem(EntityRef entity, float delta)
 
         camera = entity;
         camera_position = getGlobalTranslation(camera);
+        camera_view = cc->view_matrix;
     }
 }
 
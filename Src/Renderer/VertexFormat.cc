@@ -0,0 +1,605 @@
+#include "Flux/Log.hh"
+#include "Flux/Renderer.hh"
+
+#include <glm/glm.hpp>
+#include "glm/gtc/packing.hpp"
+
+// STL includes
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace Flux;
+
+// =========================================================
+// Vertex Format
+// =========================================================
+
+bool Renderer::VertexFormat::operator==(const VertexFormat& other) const
+{
+    return position == other.position && normal == other.normal && uv == other.uv
+        && tangent == other.tangent && bitangent == other.bitangent;
+}
+
+bool Renderer::VertexFormat::operator!=(const VertexFormat& other) const
+{
+    return !(*this == other);
+}
+
+bool Renderer::VertexFormat::isDefault() const
+{
+    return *this == VertexFormat();
+}
+
+static uint32_t positionSize(Renderer::PositionFormat format)
+{
+    // The 16 bit formats are padded to 4 bytes
+    return format == Renderer::PositionFormat::Float ? sizeof(float) * 3 : sizeof(int16_t) * 4;
+}
+
+static uint32_t directionSize(Renderer::DirectionFormat format)
+{
+    switch (format)
+    {
+        case Renderer::DirectionFormat::Float:
+            return sizeof(float) * 3;
+        case Renderer::DirectionFormat::Octahedral:
+            return sizeof(int16_t) * 2;
+        default:
+            return 0;
+    }
+}
+
+static uint32_t uvSize(Renderer::UVFormat format)
+{
+    switch (format)
+    {
+        case Renderer::UVFormat::Float:
+            return sizeof(float) * 2;
+        case Renderer::UVFormat::Half:
+            return sizeof(uint16_t) * 2;
+        default:
+            return 0;
+    }
+}
+
+static uint32_t tangentSize(Renderer::DirectionFormat format, Renderer::BitangentFormat bitangent)
+{
+    if (format == Renderer::DirectionFormat::None || bitangent != Renderer::BitangentFormat::Sign)
+    {
+        return directionSize(format);
+    }
+
+    // The bitangent's sign goes in the w component
+    return format == Renderer::DirectionFormat::Float ? sizeof(float) * 4 : sizeof(int16_t) * 4;
+}
+
+uint32_t Renderer::VertexFormat::getOffset(int attribute) const
+{
+    uint32_t sizes[5] = {
+        positionSize(position),
+        directionSize(normal),
+        uvSize(uv),
+        tangentSize(tangent, bitangent),
+        bitangent == BitangentFormat::Float ? (uint32_t)sizeof(float) * 3 : 0
+    };
+
+    uint32_t offset = 0;
+    for (int i = 0; i < attribute; i++)
+    {
+        offset += sizes[i];
+    }
+
+    return offset;
+}
+
+uint32_t Renderer::VertexFormat::getStride() const
+{
+    return getOffset(5);
+}
+
+int Renderer::VertexFormat::getShaderFlags() const
+{
+    int flags = 0;
+    if (normal == DirectionFormat::Octahedral)
+    {
+        flags |= VertexFormatFlags::OctahedralNormals;
+    }
+
+    if (tangent == DirectionFormat::Octahedral)
+    {
+        flags |= VertexFormatFlags::OctahedralTangents;
+    }
+
+    if (bitangent == BitangentFormat::Sign)
+    {
+        flags |= VertexFormatFlags::BitangentSign;
+    }
+
+    return flags;
+}
+
+// =========================================================
+// Encoding
+// =========================================================
+
+static float signNotZero(float v)
+{
+    return v >= 0 ? 1.0f : -1.0f;
+}
+
+/**
+Octahedral encoding: project onto an octahedron, then unfold the bottom half over the top.
+See "A Survey of Efficient Representations for Independent Unit Vectors" (Cigolle et al.)
+*/
+static glm::vec2 octEncode(glm::vec3 v)
+{
+    float length = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+    if (length == 0)
+    {
+        // Not a direction, so whatever
+        return glm::vec2(0, 0);
+    }
+
+    v = v / length;
+
+    if (v.z >= 0)
+    {
+        return glm::vec2(v.x, v.y);
+    }
+
+    return glm::vec2((1 - std::abs(v.y)) * signNotZero(v.x), (1 - std::abs(v.x)) * signNotZero(v.y));
+}
+
+static glm::vec3 octDecode(glm::vec2 e)
+{
+    glm::vec3 v(e.x, e.y, 1 - std::abs(e.x) - std::abs(e.y));
+
+    if (v.z < 0)
+    {
+        float x = v.x;
+        v.x = (1 - std::abs(v.y)) * signNotZero(x);
+        v.y = (1 - std::abs(x)) * signNotZero(v.y);
+    }
+
+    return glm::normalize(v);
+}
+
+static void writeSNorm(char* dest, const float* values, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        uint16_t packed = glm::packSnorm1x16(values[i]);
+        std::memcpy(dest + (i * sizeof(uint16_t)), &packed, sizeof(uint16_t));
+    }
+}
+
+static void readSNorm(const char* src, float* values, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        uint16_t packed;
+        std::memcpy(&packed, src + (i * sizeof(uint16_t)), sizeof(uint16_t));
+        values[i] = glm::unpackSnorm1x16(packed);
+    }
+}
+
+static void writeHalf(char* dest, const float* values, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        uint16_t packed = glm::packHalf1x16(values[i]);
+        std::memcpy(dest + (i * sizeof(uint16_t)), &packed, sizeof(uint16_t));
+    }
+}
+
+static void readHalf(const char* src, float* values, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        uint16_t packed;
+        std::memcpy(&packed, src + (i * sizeof(uint16_t)), sizeof(uint16_t));
+        values[i] = glm::unpackHalf1x16(packed);
+    }
+}
+
+static void writeDirection(char* dest, Renderer::DirectionFormat format, const glm::vec3& v)
+{
+    if (format == Renderer::DirectionFormat::Float)
+    {
+        float values[3] = {v.x, v.y, v.z};
+        std::memcpy(dest, values, sizeof(values));
+    }
+    else if (format == Renderer::DirectionFormat::Octahedral)
+    {
+        auto e = octEncode(v);
+        float values[2] = {e.x, e.y};
+        writeSNorm(dest, values, 2);
+    }
+}
+
+static glm::vec3 readDirection(const char* src, Renderer::DirectionFormat format)
+{
+    if (format == Renderer::DirectionFormat::Float)
+    {
+        float values[3];
+        std::memcpy(values, src, sizeof(values));
+        return glm::vec3(values[0], values[1], values[2]);
+    }
+    else if (format == Renderer::DirectionFormat::Octahedral)
+    {
+        float values[2];
+        readSNorm(src, values, 2);
+        return octDecode(glm::vec2(values[0], values[1]));
+    }
+
+    return glm::vec3(0);
+}
+
+void Renderer::MeshRes::pack(const VertexFormat& format)
+{
+    if (vertices == nullptr)
+    {
+        // Re-packing an already packed mesh needs the original vertices
+        unpack();
+    }
+
+    auto data = getPackedVertices(format, position_offset, position_scale);
+    vertex_format = format;
+
+    delete[] packed_vertices;
+    packed_size = data.size();
+    packed_vertices = new char[packed_size];
+    std::memcpy(packed_vertices, data.data(), packed_size);
+}
+
+std::vector<char> Renderer::MeshRes::getPackedVertices(const VertexFormat& format, glm::vec3& position_offset, float& position_scale) const
+{
+    if (format.position == PositionFormat::SNorm16)
+    {
+        // Positions are stored relative to the mesh's bounds
+        // The scale is the same on every axis so it can be folded into the model matrix
+        // without messing up the normals
+        glm::vec3 min_pos(0), max_pos(0);
+        if (vertices_length > 0)
+        {
+            min_pos = max_pos = glm::vec3(vertices[0].x, vertices[0].y, vertices[0].z);
+        }
+
+        for (int i = 1; i < vertices_length; i++)
+        {
+            auto p = glm::vec3(vertices[i].x, vertices[i].y, vertices[i].z);
+            min_pos = glm::min(min_pos, p);
+            max_pos = glm::max(max_pos, p);
+        }
+
+        auto extents = (max_pos - min_pos) * 0.5f;
+        position_offset = (min_pos + max_pos) * 0.5f;
+        position_scale = std::max(std::max(extents.x, extents.y), std::max(extents.z, 0.00001f));
+    }
+    else
+    {
+        position_offset = glm::vec3(0);
+        position_scale = 1;
+    }
+
+    auto stride = format.getStride();
+    uint32_t offsets[5];
+    for (int i = 0; i < 5; i++)
+    {
+        offsets[i] = format.getOffset(i);
+    }
+
+    // Padding should be 0, not garbage
+    std::vector<char> packed(stride * vertices_length, 0);
+
+    for (int i = 0; i < vertices_length; i++)
+    {
+        auto& v = vertices[i];
+        char* dest = packed.data() + (i * stride);
+
+        // Position
+        float position[3] = {v.x, v.y, v.z};
+        switch (format.position)
+        {
+            case PositionFormat::Float:
+                std::memcpy(dest + offsets[0], position, sizeof(position));
+                break;
+            case PositionFormat::Half:
+                writeHalf(dest + offsets[0], position, 3);
+                break;
+            case PositionFormat::SNorm16:
+                for (int j = 0; j < 3; j++)
+                {
+                    position[j] = (position[j] - position_offset[j]) / position_scale;
+                }
+                writeSNorm(dest + offsets[0], position, 3);
+                break;
+        }
+
+        // Normal
+        writeDirection(dest + offsets[1], format.normal, glm::vec3(v.nx, v.ny, v.nz));
+
+        // UVs
+        float uv[2] = {v.tx, v.ty};
+        if (format.uv == UVFormat::Float)
+        {
+            std::memcpy(dest + offsets[2], uv, sizeof(uv));
+        }
+        else if (format.uv == UVFormat::Half)
+        {
+            writeHalf(dest + offsets[2], uv, 2);
+        }
+
+        // Tangent
+        auto tangent = glm::vec3(v.tanx, v.tany, v.tanz);
+        writeDirection(dest + offsets[3], format.tangent, tangent);
+
+        // Bitangent
+        auto bitangent = glm::vec3(v.btanx, v.btany, v.btanz);
+        if (format.bitangent == BitangentFormat::Float)
+        {
+            float values[3] = {bitangent.x, bitangent.y, bitangent.z};
+            std::memcpy(dest + offsets[4], values, sizeof(values));
+        }
+        else if (format.bitangent == BitangentFormat::Sign && format.tangent != DirectionFormat::None)
+        {
+            // bitangent = cross(normal, tangent) * sign
+            float sign = signNotZero(glm::dot(glm::cross(glm::vec3(v.nx, v.ny, v.nz), tangent), bitangent));
+
+            if (format.tangent == DirectionFormat::Float)
+            {
+                std::memcpy(dest + offsets[3] + (sizeof(float) * 3), &sign, sizeof(float));
+            }
+            else
+            {
+                writeSNorm(dest + offsets[3] + (sizeof(int16_t) * 3), &sign, 1);
+            }
+        }
+    }
+
+    return packed;
+}
+
+// Reads count indices of the given size into dest
+static void readIndices(const char* src, uint8_t index_size, uint32_t* dest, uint32_t count)
+{
+    if (index_size == sizeof(uint16_t))
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint16_t index;
+            std::memcpy(&index, src + i * sizeof(uint16_t), sizeof(uint16_t));
+            dest[i] = index;
+        }
+    }
+    else
+    {
+        std::memcpy(dest, src, count * sizeof(uint32_t));
+    }
+}
+
+// Writes count indices in the given size to the end of dest
+static void writeIndices(const uint32_t* src, uint32_t count, uint8_t index_size, std::vector<char>& dest)
+{
+    auto start = dest.size();
+    dest.resize(start + count * index_size);
+
+    if (index_size == sizeof(uint16_t))
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint16_t index = src[i];
+            std::memcpy(dest.data() + start + i * sizeof(uint16_t), &index, sizeof(uint16_t));
+        }
+    }
+    else
+    {
+        std::memcpy(dest.data() + start, src, count * sizeof(uint32_t));
+    }
+}
+
+std::vector<char> Renderer::MeshRes::getPackedIndices(uint8_t& size) const
+{
+    size = getIndexSize();
+    if (indices == nullptr)
+    {
+        // Still how it was loaded
+        return packed_indices;
+    }
+
+    std::vector<char> packed;
+    writeIndices(indices, indices_length, size, packed);
+    for (auto& lod : lods)
+    {
+        writeIndices(lod.indices.data(), lod.indices.size(), size, packed);
+    }
+
+    return packed;
+}
+
+void Renderer::MeshRes::unpack()
+{
+    if (indices == nullptr && !packed_indices.empty())
+    {
+        // The indices are widened, so they can be changed
+        // The packed ones go, since they'd be out of date as soon as anything did
+        indices = new uint32_t[indices_length];
+        readIndices(packed_indices.data(), index_size, indices, indices_length);
+
+        auto offset = indices_length * index_size;
+        for (auto& lod : lods)
+        {
+            lod.indices.resize(lod.indices_length);
+            readIndices(packed_indices.data() + offset, index_size, lod.indices.data(), lod.indices_length);
+            offset += lod.indices_length * index_size;
+        }
+
+        packed_indices.clear();
+        packed_indices.shrink_to_fit();
+    }
+
+    if (vertices != nullptr || packed_vertices == nullptr)
+    {
+        // Nothing to do
+        return;
+    }
+
+    auto unpacked = getUnpackedVertices();
+    vertices = new Vertex[vertices_length];
+    std::copy(unpacked.begin(), unpacked.end(), vertices);
+}
+
+std::vector<Renderer::Vertex> Renderer::MeshRes::getUnpackedVertices() const
+{
+    if (vertices != nullptr)
+    {
+        return std::vector<Vertex>(vertices, vertices + vertices_length);
+    }
+
+    if (packed_vertices == nullptr)
+    {
+        return std::vector<Vertex>();
+    }
+
+    auto stride = vertex_format.getStride();
+    uint32_t offsets[5];
+    for (int i = 0; i < 5; i++)
+    {
+        offsets[i] = vertex_format.getOffset(i);
+    }
+
+    std::vector<Vertex> unpacked(vertices_length);
+
+    for (int i = 0; i < vertices_length; i++)
+    {
+        auto& v = unpacked[i];
+        const char* src = packed_vertices + (i * stride);
+
+        // Position
+        float position[3];
+        switch (vertex_format.position)
+        {
+            case PositionFormat::Float:
+                std::memcpy(position, src + offsets[0], sizeof(position));
+                break;
+            case PositionFormat::Half:
+                readHalf(src + offsets[0], position, 3);
+                break;
+            case PositionFormat::SNorm16:
+                readSNorm(src + offsets[0], position, 3);
+                for (int j = 0; j < 3; j++)
+                {
+                    position[j] = position[j] * position_scale + position_offset[j];
+                }
+                break;
+        }
+
+        v.x = position[0];
+        v.y = position[1];
+        v.z = position[2];
+
+        // Normal
+        auto normal = readDirection(src + offsets[1], vertex_format.normal);
+        v.nx = normal.x;
+        v.ny = normal.y;
+        v.nz = normal.z;
+
+        // UVs
+        float uv[2] = {0, 0};
+        if (vertex_format.uv == UVFormat::Float)
+        {
+            std::memcpy(uv, src + offsets[2], sizeof(uv));
+        }
+        else if (vertex_format.uv == UVFormat::Half)
+        {
+            readHalf(src + offsets[2], uv, 2);
+        }
+
+        v.tx = uv[0];
+        v.ty = uv[1];
+
+        // Tangent
+        auto tangent = readDirection(src + offsets[3], vertex_format.tangent);
+        v.tanx = tangent.x;
+        v.tany = tangent.y;
+        v.tanz = tangent.z;
+
+        // Bitangent
+        glm::vec3 bitangent(0);
+        if (vertex_format.bitangent == BitangentFormat::Float)
+        {
+            float values[3];
+            std::memcpy(values, src + offsets[4], sizeof(values));
+            bitangent = glm::vec3(values[0], values[1], values[2]);
+        }
+        else if (vertex_format.bitangent == BitangentFormat::Sign && vertex_format.tangent != DirectionFormat::None)
+        {
+            float sign;
+            if (vertex_format.tangent == DirectionFormat::Float)
+            {
+                std::memcpy(&sign, src + offsets[3] + (sizeof(float) * 3), sizeof(float));
+            }
+            else
+            {
+                readSNorm(src + offsets[3] + (sizeof(int16_t) * 3), &sign, 1);
+            }
+
+            bitangent = glm::cross(normal, tangent) * sign;
+        }
+
+        v.btanx = bitangent.x;
+        v.btany = bitangent.y;
+        v.btanz = bitangent.z;
+    }
+
+    return unpacked;
+}
+
+std::vector<uint32_t> Renderer::MeshRes::getUnpackedIndices() const
+{
+    if (indices != nullptr)
+    {
+        return std::vector<uint32_t>(indices, indices + indices_length);
+    }
+
+    std::vector<uint32_t> unpacked(indices_length);
+    if (!packed_indices.empty())
+    {
+        readIndices(packed_indices.data(), index_size, unpacked.data(), indices_length);
+    }
+
+    return unpacked;
+}
+
+std::vector<char> Renderer::MeshRes::getPositionStream() const
+{
+    std::vector<char> stream;
+
+    if (packed_vertices != nullptr)
+    {
+        // Positions are always first, so they just have to be copied out byte for byte
+        // That way they're exactly what the main pass sees
+        auto stride = vertex_format.getStride();
+        auto size = vertex_format.getOffset(1);
+
+        stream.resize(size * vertices_length);
+        for (int i = 0; i < vertices_length; i++)
+        {
+            std::memcpy(stream.data() + i * size, packed_vertices + i * stride, size);
+        }
+    }
+    else if (vertices != nullptr)
+    {
+        stream.resize(sizeof(float) * 3 * vertices_length);
+        auto positions = (float*)stream.data();
+        for (int i = 0; i < vertices_length; i++)
+        {
+            positions[i * 3] = vertices[i].x;
+            positions[i * 3 + 1] = vertices[i].y;
+            positions[i * 3 + 2] = vertices[i].z;
+        }
+    }
+
+    return stream;
+}
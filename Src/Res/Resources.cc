@@ -32,7 +32,7 @@ void Flux::Resources::createSceneLink(EntityRef entity, const std::string& scene
     instanciateSceneLink(entity);
 }
 
-void Flux::Resources::instanciateSceneLink(EntityRef entity)
+std::vector<Flux::EntityRef> Flux::Resources::instanciateSceneLink(EntityRef entity)
 {
     auto fname = entity.getComponent<SceneLinkCom>()->filename;
     
@@ -54,6 +54,11 @@ void Flux::Resources::instanciateSceneLink(EntityRef entity)
             }
         }
     }
+
+    auto& linked = scene->getLinkedEntities();
+    output.insert(output.end(), linked.begin(), linked.end());
+
+    return output;
 }
 
 // Flux::Resources::ResourceRef Flux::Resources::createResource(Resource *res)
@@ -1,5 +1,6 @@
 #include "Flux/ECS.hh"
 #include "Flux/Log.hh"
+#include "Flux/Renderer.hh"
 #include "Flux/Resources.hh"
 #include "FluxArc/FluxArc.hh"
 #include <algorithm>
@@ -189,6 +190,13 @@ void Serializer::save(FluxArc::Archive& arc, bool release = false)
     properties.set((uint32_t)resources.size());
 
     arc.setFile("--scene-properties--", properties);
+
+    if (pvs != nullptr)
+    {
+        FluxArc::BinaryFile pvs_file;
+        pvs->save(&pvs_file);
+        arc.setFile("--pvs--", pvs_file);
+    }
 }
 
 Deserializer* Flux::Resources::deserialize(const std::string& filename, bool reload)
@@ -218,6 +226,19 @@ Deserializer::Deserializer(const std::string& filename, bool unlinked_res)
     pbf.get<uint32_t>(&entity_count);
     pbf.get<uint32_t>(&resource_count);
 
+    // Levels can come with precomputed visibility
+    if (arc.hasFile("--pvs--"))
+    {
+        auto pvs_bf = arc.getBinaryFile("--pvs--");
+        pvs = new Renderer::PVS;
+        if (!pvs->load(&pvs_bf))
+        {
+            LOG_WARN("Invalid PVS in " + filename);
+            delete pvs;
+            pvs = nullptr;
+        }
+    }
+
     // Load IHID Table
     auto ihid_bf = arc.getBinaryFile("--ihid-table--");
 
@@ -280,6 +301,12 @@ Deserializer::Deserializer(const std::string& filename, bool unlinked_res)
 
 Deserializer::~Deserializer()
 {
+    if (Renderer::getPVS() == pvs)
+    {
+        Renderer::setPVS(nullptr);
+    }
+    delete pvs;
+
     for (auto i : entities)
     {
         for (auto j : i.component_data)
@@ -416,23 +443,88 @@ ResourceRef<Resource> Deserializer::getResource(uint32_t id)
     }
 }
 
+bool Deserializer::reloadResource(EntityRef resource)
+{
+    if (!resource.hasComponent<SerializeCom>() || resource.getComponent<SerializeCom>()->parent_file != this)
+    {
+        return false;
+    }
+
+    auto it = ihid_table.find(resource.getComponent<SerializeCom>()->inheritance_id);
+    if (it == ihid_table.end())
+    {
+        return false;
+    }
+
+    // The archive is closed once everything is loaded, so it has to be opened again
+    FluxArc::Archive reload_arc(fname.string());
+    if (!reload_arc.hasFile("Resource-" + std::to_string(it->second)))
+    {
+        LOG_WARN("Could not reload resource from " + fname.string());
+        return false;
+    }
+
+    auto bf = reload_arc.getBinaryFile("Resource-" + std::to_string(it->second));
+
+    bool lk;
+    bf.get(&lk);
+    if (lk)
+    {
+        // Linked resources belong to the other file
+        return false;
+    }
+
+    std::string name = bf.get();
+    uint32_t size;
+    bf.get(&size);
+
+    if (size == -1)
+    {
+        return false;
+    }
+
+    auto data = new char[size];
+    bf.get(data, size);
+    auto en = FluxArc::BinaryFile(data, size);
+    resource.getComponent<Resource>()->deserialize(this, &en);
+
+    return true;
+}
+
 ResourceRef<Resource> Deserializer::getResourceByIHID(uint32_t ihid)
 {
     return getResource(ihid_table[ihid]);
 }
 
-std::vector<Flux::EntityRef> Deserializer::addToECS(ECSCtx *ctx)
+std::vector<Flux::EntityRef> Deserializer::addToECS(ECSCtx *ctx, bool prepare_static)
 {
     entity_done = std::vector<bool>(entities.size(), false);
     entitys = {};
+    linked_entities = {};
     
     current_ctx = ctx;
     std::vector<EntityRef> output = {};
+
     for (auto i : entities)
     {
         output.push_back(getEntity(i.id));
     }
 
+    if (pvs != nullptr)
+    {
+        Renderer::setPVS(pvs);
+    }
+
+    if (prepare_static)
+    {
+        // Linked scenes have been parented by now, so everything is where it should be
+        std::vector<EntityRef> loaded = output;
+        loaded.insert(loaded.end(), linked_entities.begin(), linked_entities.end());
+
+        Renderer::buildImpostors(loaded);
+        Renderer::batchStatic(loaded);
+    }
+
     return output;
 }
 
@@ -462,7 +554,8 @@ Flux::EntityRef Deserializer::getEntity(int id)
     // Initialise scene links
     if (entity.hasComponent<SceneLinkCom>())
     {
-        instanciateSceneLink(entity);
+        auto linked = instanciateSceneLink(entity);
+        linked_entities.insert(linked_entities.end(), linked.begin(), linked.end());
     }
 
     entitys[id] = entity;
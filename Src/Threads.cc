@@ -1,3 +1,10 @@
+#include "Flux/Threads.hh"
+#include "Flux/Log.hh"
+
+#include <algorithm>
+
+using namespace Flux;
+
 // #include "Flux/Threads.hh"
 // #include "Flux/ECS.hh"
 // #include "Flux/Log.hh"
@@ -154,4 +161,118 @@
 //     {
 //         tctx->done[i] = false;
 //     }
-// }
\ No newline at end of file
+// }
+
+// =========================================================
+// Worker pools
+// =========================================================
+
+Threads::WorkerPool::WorkerPool(int thread_count):
+thread_count(thread_count)
+{
+
+}
+
+Threads::WorkerPool::~WorkerPool()
+{
+    if (threads.empty())
+    {
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        running = false;
+    }
+    condition.notify_all();
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+void Threads::WorkerPool::run(uint32_t count, const std::function<void(uint32_t, uint32_t)>& function, uint32_t grain)
+{
+    if (thread_count <= 0)
+    {
+        function(0, count);
+        return;
+    }
+
+    if (threads.empty())
+    {
+        start();
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        job = &function;
+        job_count = count;
+        job_grain = grain;
+        remaining = threads.size();
+        generation++;
+    }
+    condition.notify_all();
+
+    doPart(0, function, count, grain);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this]() { return remaining == 0; });
+    job = nullptr;
+}
+
+void Threads::WorkerPool::start()
+{
+    running = true;
+    for (int i = 0; i < thread_count; i++)
+    {
+        threads.push_back(std::thread(&WorkerPool::workerMain, this, i + 1));
+    }
+
+    LOG_INFO("Started " + std::to_string(threads.size()) + " worker threads");
+}
+
+void Threads::WorkerPool::doPart(int part, const std::function<void(uint32_t, uint32_t)>& function, uint32_t count, uint32_t grain)
+{
+    uint32_t parts = threads.size() + 1;
+    uint32_t groups_per_part = ((count + grain - 1) / grain + parts - 1) / parts;
+
+    uint32_t start = std::min(part * groups_per_part * grain, count);
+    uint32_t end = std::min(start + groups_per_part * grain, count);
+    if (start < end)
+    {
+        function(start, end);
+    }
+}
+
+void Threads::WorkerPool::workerMain(int part)
+{
+    uint64_t seen = 0;
+    while (true)
+    {
+        const std::function<void(uint32_t, uint32_t)>* function;
+        uint32_t count, grain;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [&]() { return !running || generation != seen; });
+            if (!running)
+            {
+                return;
+            }
+
+            seen = generation;
+            function = job;
+            count = job_count;
+            grain = job_grain;
+        }
+
+        doPart(part, *function, count, grain);
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            remaining--;
+        }
+        finished.notify_one();
+    }
+}